@@ -35,6 +35,7 @@ data class RecognizerConfig(
     var rule3MinUtteranceLength: Float = 30.0f,
     var hotwordsFile: String = "",
     var hotwordsScore: Float = 1.5f,
+    var stateStorage: String = "fp32", // fp32, fp16 or bf16
 )
 
 class SherpaNcnn(
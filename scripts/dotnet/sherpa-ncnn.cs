@@ -68,6 +68,10 @@ namespace SherpaNcnn
         public string HotwordsFile;
 
         public float HotwordsScore;
+
+        // fp32 (default), fp16 or bf16
+        [MarshalAs(UnmanagedType.LPStr)]
+        public string StateStorage;
     }
 
     // please see
@@ -87,6 +87,9 @@ type RecognizerConfig struct {
 
 	HotwordsFile  string
 	HotwordsScore float32
+
+	// Storage of the encoder states: fp32 (default), fp16 or bf16
+	StateStorage string
 }
 
 // It contains the recognition result for a online stream.
@@ -156,6 +159,9 @@ func NewRecognizer(config *RecognizerConfig) *Recognizer {
 
 	c.hotwords_score = C.float(config.HotwordsScore)
 
+	c.state_storage = C.CString(config.StateStorage)
+	defer C.free(unsafe.Pointer(c.state_storage))
+
 	recognizer := &Recognizer{}
 	recognizer.impl = C.CreateRecognizer(&c)
 
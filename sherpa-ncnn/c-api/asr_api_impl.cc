@@ -152,6 +152,8 @@ static void set_default_sherpa_ncnn_config(SherpaNcnnRecognizerConfig& config) {
 
     config.hotwords_file = nullptr;
     config.hotwords_score = 1.5f;
+
+    config.state_storage = nullptr;
 }
 
 int ASRRecognizer_Impl::Init(const ASR_Parameters& asr_config ) {
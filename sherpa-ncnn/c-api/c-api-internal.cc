@@ -84,6 +84,7 @@ SherpaNcnnRecognizer *CreateRecognizer(
   
   config.hotwords_file = SHERPA_NCNN_OR(in_config->hotwords_file, "");
   config.hotwords_score = SHERPA_NCNN_OR(in_config->hotwords_score, 1.5);
+  config.state_storage = SHERPA_NCNN_OR(in_config->state_storage, "fp32");
 
   config.enable_endpoint = in_config->enable_endpoint;
 
@@ -161,6 +162,7 @@ SherpaNcnnResult *GetResult(SherpaNcnnRecognizer *p, SherpaNcnnStream *s) {
   std::copy(text.begin(), text.end(), const_cast<char *>(r->text));
   const_cast<char *>(r->text)[text.size()] = 0;
   r->count = res.tokens.size();
+  r->degradation_level = res.degradation_level;
   if (r->count > 0) {
     // Each word ends with nullptr
     r->tokens = new char[text.size() + r->count];
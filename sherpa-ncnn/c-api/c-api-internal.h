@@ -131,6 +131,11 @@ SHERPA_NCNN_API typedef struct SherpaNcnnRecognizerConfig {
 
   /// scale of hotwords, used only when hotwords_file is not empty
   float hotwords_score;
+
+  /// Element type for keeping encoder states of a stream between chunks.
+  /// Valid values are: fp32, fp16, bf16. If it is NULL, fp32 is used.
+  /// fp16 and bf16 use about 1/4 of the state memory of fp32 per stream.
+  const char *state_storage;
 } SherpaNcnnRecognizerConfig;
 
 SHERPA_NCNN_API typedef struct SherpaNcnnResult {
@@ -147,6 +152,10 @@ SHERPA_NCNN_API typedef struct SherpaNcnnResult {
 
   // The number of tokens/timestamps in above pointer
   int32_t count;
+
+  // Quality level the stream was decoded with. 0 means the configured
+  // decoding method. Larger values are cheaper methods used under load.
+  int32_t degradation_level;
 } SherpaNcnnResult;
 
 SHERPA_NCNN_API typedef struct SherpaNcnnRecognizer SherpaNcnnRecognizer;
@@ -22,10 +22,13 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "sherpa-ncnn/csrc/display.h"
 #include "sherpa-ncnn/csrc/model.h"
 #include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/thread-allocator.h"
+#include "sherpa-ncnn/csrc/trace-recorder.h"
 
 struct SherpaNcnnRecognizer {
   std::unique_ptr<sherpa_ncnn::Recognizer> recognizer;
@@ -71,6 +74,7 @@ SherpaNcnnRecognizer *CreateRecognizer(
 
   config.hotwords_file = SHERPA_NCNN_OR(in_config->hotwords_file, "");
   config.hotwords_score = SHERPA_NCNN_OR(in_config->hotwords_score, 1.5);
+  config.state_storage = SHERPA_NCNN_OR(in_config->state_storage, "fp32");
 
   config.enable_endpoint = in_config->enable_endpoint;
 
@@ -148,6 +152,7 @@ SherpaNcnnResult *GetResult(SherpaNcnnRecognizer *p, SherpaNcnnStream *s) {
   std::copy(text.begin(), text.end(), const_cast<char *>(r->text));
   const_cast<char *>(r->text)[text.size()] = 0;
   r->count = res.tokens.size();
+  r->degradation_level = res.degradation_level;
   if (r->count > 0) {
     // Each word ends with nullptr
     r->tokens = new char[text.size() + r->count];
@@ -186,6 +191,106 @@ int32_t IsEndpoint(SherpaNcnnRecognizer *p, SherpaNcnnStream *s) {
   return p->recognizer->IsEndpoint(s->stream.get());
 }
 
+const SherpaNcnnStreamState *SaveStreamState(SherpaNcnnRecognizer *p,
+                                             SherpaNcnnStream *s) {
+  std::vector<uint8_t> state;
+  p->recognizer->SaveStreamState(s->stream.get(), &state);
+
+  auto ans = new SherpaNcnnStreamState;
+  auto data = new uint8_t[state.size()];
+  std::copy(state.begin(), state.end(), data);
+
+  ans->data = data;
+  ans->n = state.size();
+
+  return ans;
+}
+
+void DestroyStreamState(const SherpaNcnnStreamState *state) {
+  delete[] state->data;
+  delete state;
+}
+
+SherpaNcnnStream *RestoreStreamState(SherpaNcnnRecognizer *p,
+                                     const uint8_t *data, int32_t n) {
+  auto stream = p->recognizer->RestoreStreamState(data, n);
+  if (!stream) {
+    return nullptr;
+  }
+
+  auto ans = new SherpaNcnnStream;
+  ans->stream = std::move(stream);
+  return ans;
+}
+
+static void CopyCounters(const sherpa_ncnn::DecodeCounters &src,
+                         SherpaNcnnCounters *dst) {
+  using sherpa_ncnn::Stage;
+
+  auto copy = [&src](Stage stage, SherpaNcnnStageCounter *c) {
+    c->count = src[stage].count;
+    c->seconds = src[stage].seconds;
+    c->max_seconds = src[stage].max_seconds;
+  };
+
+  dst->num_chunks = src.num_chunks;
+  dst->num_frames = src.num_frames;
+  copy(Stage::kFbank, &dst->fbank);
+  copy(Stage::kEncoder, &dst->encoder);
+  copy(Stage::kDecoder, &dst->decoder);
+  copy(Stage::kJoiner, &dst->joiner);
+  copy(Stage::kSearch, &dst->search);
+  copy(Stage::kResult, &dst->result);
+}
+
+void GetRecognizerCounters(SherpaNcnnRecognizer *p,
+                           SherpaNcnnCounters *counters) {
+  CopyCounters(p->recognizer->GetCounters(), counters);
+}
+
+void ResetRecognizerCounters(SherpaNcnnRecognizer *p) {
+  p->recognizer->ResetCounters();
+}
+
+void GetStreamCounters(SherpaNcnnStream *s, SherpaNcnnCounters *counters) {
+  CopyCounters(s->stream->GetCounters(), counters);
+}
+
+void GetRecognizerMemoryUsage(SherpaNcnnRecognizer *p,
+                              SherpaNcnnRecognizerMemoryUsage *usage) {
+  sherpa_ncnn::RecognizerMemoryUsage u = p->recognizer->GetMemoryUsage();
+  usage->model_weights = u.model_weights;
+  usage->blob_bytes = u.blob_bytes;
+  usage->blob_peak_bytes = u.blob_peak_bytes;
+  usage->workspace_bytes = u.workspace_bytes;
+  usage->workspace_peak_bytes = u.workspace_peak_bytes;
+  usage->num_allocs = u.num_allocs;
+  usage->pooled_bytes = u.pooled_bytes;
+  usage->new_stream_bytes = u.new_stream_bytes;
+}
+
+int64_t TrimThreadAllocators() { return sherpa_ncnn::TrimThreadAllocators(); }
+
+void GetStreamMemoryUsage(SherpaNcnnStream *s,
+                          SherpaNcnnStreamMemoryUsage *usage) {
+  sherpa_ncnn::StreamMemoryUsage u = s->stream->GetMemoryUsage();
+  usage->features = u.features;
+  usage->encoder_states = u.encoder_states;
+  usage->decoder_result = u.decoder_result;
+  usage->context_graph = u.context_graph;
+  usage->total = u.Total();
+}
+
+void StartTracing(int32_t buffer_size) {
+  sherpa_ncnn::StartTracing(buffer_size);
+}
+
+void StopTracing() { sherpa_ncnn::StopTracing(); }
+
+int32_t WriteTrace(const char *filename) {
+  return sherpa_ncnn::WriteTrace(filename);
+}
+
 SherpaNcnnDisplay *CreateDisplay(int32_t max_word_per_line) {
   SherpaNcnnDisplay *ans = new SherpaNcnnDisplay;
   ans->impl = std::make_unique<sherpa_ncnn::Display>(max_word_per_line);
@@ -155,6 +155,11 @@ SHERPA_NCNN_API typedef struct SherpaNcnnRecognizerConfig {
 
   /// scale of hotwords, used only when hotwords_file is not empty
   float hotwords_score;
+
+  /// Element type for keeping encoder states of a stream between chunks.
+  /// Valid values are: fp32, fp16, bf16. If it is NULL, fp32 is used.
+  /// fp16 and bf16 use about 1/4 of the state memory of fp32 per stream.
+  const char *state_storage;
 } SherpaNcnnRecognizerConfig;
 
 SHERPA_NCNN_API typedef struct SherpaNcnnResult {
@@ -171,8 +176,85 @@ SHERPA_NCNN_API typedef struct SherpaNcnnResult {
 
   // The number of tokens/timestamps in above pointer
   int32_t count;
+
+  // Quality level the stream was decoded with. 0 means the configured
+  // decoding method. Larger values are cheaper methods used under load.
+  int32_t degradation_level;
 } SherpaNcnnResult;
 
+SHERPA_NCNN_API typedef struct SherpaNcnnStreamState {
+  // Serialized state of a stream. It uses the byte order of the host.
+  const uint8_t *data;
+
+  // Number of bytes in data
+  int32_t n;
+} SherpaNcnnStreamState;
+
+SHERPA_NCNN_API typedef struct SherpaNcnnStageCounter {
+  // Number of runs of the stage
+  int64_t count;
+
+  // Total and longest time of a run in seconds. It includes the stages
+  // run within it, e.g., search includes decoder and joiner.
+  double seconds;
+  double max_seconds;
+} SherpaNcnnStageCounter;
+
+SHERPA_NCNN_API typedef struct SherpaNcnnCounters {
+  // Number of decoded chunks
+  int64_t num_chunks;
+
+  // Number of feature frames consumed by the encoder
+  int64_t num_frames;
+
+  SherpaNcnnStageCounter fbank;
+  SherpaNcnnStageCounter encoder;
+  SherpaNcnnStageCounter decoder;
+  SherpaNcnnStageCounter joiner;
+  SherpaNcnnStageCounter search;
+  SherpaNcnnStageCounter result;
+} SherpaNcnnCounters;
+
+SHERPA_NCNN_API typedef struct SherpaNcnnStreamMemoryUsage {
+  // Bytes of the feature frames and samples kept by the stream
+  int64_t features;
+
+  // Bytes of the encoder states
+  int64_t encoder_states;
+
+  // Bytes of the decoded tokens and hypotheses
+  int64_t decoder_result;
+
+  // Bytes of the hotwords graph, if any
+  int64_t context_graph;
+
+  // Sum of the above
+  int64_t total;
+} SherpaNcnnStreamMemoryUsage;
+
+SHERPA_NCNN_API typedef struct SherpaNcnnRecognizerMemoryUsage {
+  // Bytes of the weights read from the model files
+  int64_t model_weights;
+
+  // Bytes of the ncnn blobs currently allocated and their peak
+  int64_t blob_bytes;
+  int64_t blob_peak_bytes;
+
+  // Bytes of the ncnn workspace currently allocated and their peak
+  int64_t workspace_bytes;
+  int64_t workspace_peak_bytes;
+
+  // Number of blobs and workspace buffers allocated so far
+  int64_t num_allocs;
+
+  // Bytes of the free blob and workspace buffers kept for reuse. See
+  // TrimThreadAllocators().
+  int64_t pooled_bytes;
+
+  // Total bytes of a newly created stream
+  int64_t new_stream_bytes;
+} SherpaNcnnRecognizerMemoryUsage;
+
 SHERPA_NCNN_API typedef struct SherpaNcnnRecognizer SherpaNcnnRecognizer;
 SHERPA_NCNN_API typedef struct SherpaNcnnStream SherpaNcnnStream;
 
@@ -268,6 +350,98 @@ SHERPA_NCNN_API void InputFinished(SherpaNcnnStream *s);
 SHERPA_NCNN_API int32_t IsEndpoint(SherpaNcnnRecognizer *p,
                                    SherpaNcnnStream *s);
 
+/// Serialize the state of a stream, e.g., for moving it to another process.
+///
+/// It includes encoder states, decoding results, audio that is not
+/// decoded yet and hotword positions.
+///
+/// @param p A pointer returned by CreateRecognizer()
+/// @param s A pointer returned by CreateStream(). It is not changed.
+/// @return A pointer containing the state. The user has to invoke
+///         DestroyStreamState() to free the returned pointer to avoid
+///         memory leak.
+SHERPA_NCNN_API const SherpaNcnnStreamState *SaveStreamState(
+    SherpaNcnnRecognizer *p, SherpaNcnnStream *s);
+
+/// Destroy the pointer returned by SaveStreamState().
+///
+/// @param state A pointer returned by SaveStreamState()
+SHERPA_NCNN_API void DestroyStreamState(const SherpaNcnnStreamState *state);
+
+/// Create a stream from a state returned by SaveStreamState().
+///
+/// The recognizer must be created with the same config (models,
+/// state_storage and hotwords) as the one that saved the state.
+///
+/// @param p A pointer returned by CreateRecognizer()
+/// @param data  Pointer to the serialized state.
+/// @param n  Number of bytes in data.
+/// @return Return a pointer to a stream, or NULL if the state is invalid.
+///         The caller MUST invoke DestroyStream at the end to avoid memory
+///         leak.
+SHERPA_NCNN_API SherpaNcnnStream *RestoreStreamState(SherpaNcnnRecognizer *p,
+                                                     const uint8_t *data,
+                                                     int32_t n);
+
+/// Get the counters of all streams created by a recognizer.
+///
+/// @param p A pointer returned by CreateRecognizer()
+/// @param counters On return, it contains the counters.
+SHERPA_NCNN_API void GetRecognizerCounters(SherpaNcnnRecognizer *p,
+                                           SherpaNcnnCounters *counters);
+
+/// Set the counters returned by GetRecognizerCounters() to 0.
+///
+/// @param p A pointer returned by CreateRecognizer()
+SHERPA_NCNN_API void ResetRecognizerCounters(SherpaNcnnRecognizer *p);
+
+/// Get the counters of a stream.
+///
+/// @param s A pointer returned by CreateStream()
+/// @param counters On return, it contains the counters.
+SHERPA_NCNN_API void GetStreamCounters(SherpaNcnnStream *s,
+                                       SherpaNcnnCounters *counters);
+
+/// Get the memory used by the model and the networks of a recognizer.
+///
+/// @param p A pointer returned by CreateRecognizer()
+/// @param usage On return, it contains the memory usage in bytes.
+SHERPA_NCNN_API void GetRecognizerMemoryUsage(
+    SherpaNcnnRecognizer *p, SherpaNcnnRecognizerMemoryUsage *usage);
+
+/// Release the free buffers kept by the pools of all threads, i.e.,
+/// SherpaNcnnRecognizerMemoryUsage::pooled_bytes of recognizers that use
+/// the pools of each thread, which is the default.
+///
+/// @return Return the number of bytes released.
+SHERPA_NCNN_API int64_t TrimThreadAllocators();
+
+/// Get the memory held by a stream. It must not be called while the
+/// stream is being decoded.
+///
+/// @param s A pointer returned by CreateStream()
+/// @param usage On return, it contains the memory usage in bytes.
+SHERPA_NCNN_API void GetStreamMemoryUsage(SherpaNcnnStream *s,
+                                          SherpaNcnnStreamMemoryUsage *usage);
+
+/// Start recording the decoding activity of all threads, e.g., spans of
+/// the encoder, the decoder and the joiner of each stream. Spans recorded
+/// before are dropped.
+///
+/// @param buffer_size  Number of spans kept per thread. Older spans of a
+///                     thread are overwritten.
+SHERPA_NCNN_API void StartTracing(int32_t buffer_size);
+
+SHERPA_NCNN_API void StopTracing();
+
+/// Write the recorded spans to a file in the Chrome trace event format.
+/// It can be opened in chrome://tracing or https://ui.perfetto.dev
+/// Call it after StopTracing() or while no stream is decoded.
+///
+/// @param filename  Path of the JSON file to write.
+/// @return Return 1 on success. Return 0 otherwise.
+SHERPA_NCNN_API int32_t WriteTrace(const char *filename);
+
 // for displaying results on Linux/macOS.
 SHERPA_NCNN_API typedef struct SherpaNcnnDisplay SherpaNcnnDisplay;
 
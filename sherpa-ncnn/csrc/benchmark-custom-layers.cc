@@ -0,0 +1,307 @@
+// sherpa-ncnn/csrc/benchmark-custom-layers.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Compare the custom Zipformer layers using the kernels for this CPU
+// with the scalar kernels. The shapes are those of a streaming Zipformer
+// with 384-dim layers, 8 heads and chunks of 16 frames.
+//
+// It also runs the layers on packed and fp16 inputs, as ncnn passes them
+// with use_packing_layout and use_fp16_storage, and compares the time
+// with the conversions ncnn used to insert around them, i.e., unpack and
+// cast the input to fp32, run the layer and convert the output back.
+//
+// It exits with a non-zero status if the outputs differ.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "mat.h"     // NOLINT
+#include "option.h"  // NOLINT
+#include "sherpa-ncnn/csrc/custom-layer-kernels.h"
+#include "sherpa-ncnn/csrc/poolingmodulenoproj.h"
+#include "sherpa-ncnn/csrc/random-mat.h"
+#include "sherpa-ncnn/csrc/simpleupsample.h"
+#include "sherpa-ncnn/csrc/tensorasstrided.h"
+
+// Return true if a and b have the same shape and their elements differ by
+// at most atol + rtol * max(|a|, |b|). A fused multiply-add changes the
+// last bit.
+static bool Equal(const ncnn::Mat &a, const ncnn::Mat &b, float rtol = 1e-5f,
+                  float atol = 0) {
+  if (a.w != b.w || a.h != b.h || a.c != b.c) return false;
+
+  for (int32_t q = 0; q != a.c; ++q) {
+    const float *pa = a.channel(q);
+    const float *pb = b.channel(q);
+    for (int32_t i = 0; i != a.w * a.h * a.d; ++i) {
+      float tol = atol + rtol * std::max(std::abs(pa[i]), std::abs(pb[i]));
+      if (std::abs(pa[i] - pb[i]) > tol) return false;
+    }
+  }
+
+  return true;
+}
+
+// Return the average time of f() in microseconds
+static float Time(const std::function<void()> &f, int32_t num_runs) {
+  f();  // warm up
+
+  auto start = std::chrono::steady_clock::now();
+  for (int32_t i = 0; i != num_runs; ++i) {
+    f();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<float, std::micro>(end - start).count() /
+         num_runs;
+}
+
+// Run forward() with the scalar kernels and the detected kernels.
+// Return false if the outputs differ.
+static bool Compare(const std::string &layer,
+                    const std::function<ncnn::Mat()> &forward,
+                    int32_t num_runs) {
+  sherpa_ncnn::SelectCustomLayerKernels("scalar");
+  ncnn::Mat expected = forward();
+  float scalar_us = Time(forward, num_runs);
+
+  sherpa_ncnn::SelectCustomLayerKernels("auto");
+  ncnn::Mat actual = forward();
+  float us = Time(forward, num_runs);
+
+  bool ok = Equal(expected, actual);
+
+  fprintf(stderr,
+          "%-20s scalar: %8.2f us  %-6s: %8.2f us  speedup: %.2f  %s\n",
+          layer.c_str(), scalar_us, sherpa_ncnn::GetCustomLayerKernels().name,
+          us, scalar_us / us, ok ? "OK" : "MISMATCH");
+
+  return ok;
+}
+
+// Convert m to the layout ncnn passes to a layer supporting it
+static ncnn::Mat ToLayout(const ncnn::Mat &m, int32_t elempack, bool fp16,
+                          const ncnn::Option &opt) {
+  ncnn::Mat packed;
+  ncnn::convert_packing(m, packed, elempack, opt);
+  if (!fp16) return packed;
+
+  ncnn::Mat ans;
+  ncnn::cast_float32_to_float16(packed, ans, opt);
+  return ans;
+}
+
+// Convert m to unpacked fp32, which is what the layers got before
+static ncnn::Mat ToFp32Unpacked(const ncnn::Mat &m, const ncnn::Option &opt) {
+  ncnn::Mat fp32 = m;
+  if (m.elemsize / m.elempack == 2) {
+    ncnn::cast_float16_to_float32(m, fp32, opt);
+  }
+
+  ncnn::Mat ans;
+  ncnn::convert_packing(fp32, ans, 1, opt);
+  return ans;
+}
+
+// Run forward() on the input converted to the given layout and compare
+// with the unpacked fp32 output. Return false if the outputs differ.
+static bool CompareLayout(
+    const std::string &layer,
+    const std::function<ncnn::Mat(const ncnn::Mat &)> &forward,
+    const ncnn::Mat &input, int32_t elempack, bool fp16, int32_t num_runs,
+    const ncnn::Option &opt) {
+  ncnn::Mat expected = forward(input);
+
+  ncnn::Mat x = ToLayout(input, elempack, fp16, opt);
+  ncnn::Mat actual = ToFp32Unpacked(forward(x), opt);
+
+  float convert_us = Time(
+      [&]() {
+        ncnn::Mat y = forward(ToFp32Unpacked(x, opt));
+        ToLayout(y, elempack, fp16, opt);
+      },
+      num_runs);
+
+  float us = Time([&]() { forward(x); }, num_runs);
+
+  // fp16 has 11 significant bits
+  bool ok = fp16 ? Equal(expected, actual, 1e-3f, 1e-3f)
+                 : Equal(expected, actual);
+
+  std::string name = layer + (fp16 ? " fp16" : "") + " pack" +
+                     std::to_string(elempack);
+
+  fprintf(stderr,
+          "%-29s convert: %8.2f us  native: %8.2f us  speedup: %.2f  %s\n",
+          name.c_str(), convert_us, us, convert_us / us,
+          ok ? "OK" : "MISMATCH");
+
+  return ok;
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  int32_t num_runs = 10000;
+  if (argc > 1) {
+    num_runs = atoi(argv[1]);
+  }
+
+  if (num_runs < 1) {
+    fprintf(stderr, "Usage: %s [num_runs]\n", argv[0]);
+    return -1;
+  }
+
+  ncnn::Option opt;
+  opt.num_threads = 1;
+
+  const int32_t dim = 384;
+  const int32_t num_frames = 16;
+  const int32_t num_heads = 8;
+  const int32_t left_context = 64;
+
+  bool ok = true;
+
+  {
+    sherpa_ncnn::PoolingModuleNoProj layer;
+
+    std::vector<ncnn::Mat> inputs(3);
+    inputs[0].create(dim, num_frames);
+    inputs[1].create(1);
+    inputs[2].create(dim, 1);
+    sherpa_ncnn::FillRandom(&inputs[0]);
+    sherpa_ncnn::FillRandom(&inputs[2]);
+    inputs[1][0] = 32;
+
+    ok &= Compare(
+        "PoolingModuleNoProj",
+        [&]() {
+          std::vector<ncnn::Mat> outputs(3);
+          layer.forward(inputs, outputs, opt);
+          return outputs[0];
+        },
+        num_runs);
+
+    // cached_len and cached_avg are never packed since they have one row
+    auto forward = [&](const ncnn::Mat &x) {
+      std::vector<ncnn::Mat> in = {x, inputs[1], inputs[2]};
+      std::vector<ncnn::Mat> outputs(3);
+      layer.forward(in, outputs, opt);
+      return outputs[0];
+    };
+
+    // fp16 storage is not supported. See its constructor.
+    for (int32_t elempack : {4, 8}) {
+      ok &= CompareLayout("PoolingModuleNoProj", forward, inputs[0], elempack,
+                          false, num_runs, opt);
+    }
+  }
+
+  {
+    sherpa_ncnn::SimpleUpsample layer;
+    layer.upsample = 2;
+    layer.num_channels = dim;
+    layer.bias.create(dim, layer.upsample);
+    sherpa_ncnn::FillRandom(&layer.bias);
+
+    ncnn::Mat input(dim, num_frames);
+    sherpa_ncnn::FillRandom(&input);
+
+    ok &= Compare(
+        "SimpleUpsample",
+        [&]() {
+          ncnn::Mat output;
+          layer.forward(input, output, opt);
+          return output;
+        },
+        num_runs);
+
+    auto forward = [&](const ncnn::Mat &x) {
+      ncnn::Mat output;
+      layer.forward(x, output, opt);
+      return output;
+    };
+
+    for (bool fp16 : {false, true}) {
+      for (int32_t elempack : {4, 8}) {
+        ok &= CompareLayout("SimpleUpsample", forward, input, elempack, fp16,
+                            num_runs, opt);
+      }
+    }
+  }
+
+  {
+    // Relative positional encoding: rows of the output are shifted,
+    // contiguous runs of the input
+    int32_t outw = num_frames + left_context;
+    int32_t inw = 2 * outw - 1;
+
+    sherpa_ncnn::TensorAsStrided layer;
+    layer.sizes.create(3, sizeof(int32_t));
+    layer.strides.create(3, sizeof(int32_t));
+    int32_t *sizes = layer.sizes;
+    int32_t *strides = layer.strides;
+    sizes[0] = num_heads;
+    sizes[1] = num_frames;
+    sizes[2] = outw;
+    strides[0] = num_frames * inw;
+    strides[1] = inw - 1;
+    strides[2] = 1;
+    layer.storage_offset = num_frames - 1;
+
+    ncnn::Mat input(inw, num_frames, num_heads);
+    sherpa_ncnn::FillRandom(&input);
+
+    // memcpy does not depend on the kernels, so compare with the
+    // element-wise copy of the previous implementation
+    ncnn::Mat expected(outw, num_frames, num_heads);
+    auto scalar = [&]() {
+      for (int32_t q = 0; q != num_heads; ++q) {
+        const float *in = input.channel(q);
+        in += layer.storage_offset;
+        for (int32_t y = 0; y != num_frames; ++y) {
+          float *out = expected.channel(q).row(y);
+          const float *in_ptr = in + y * strides[1];
+          for (int32_t x = 0; x != outw; ++x) {
+            out[x] = in_ptr[x * strides[2]];
+          }
+        }
+      }
+    };
+
+    ncnn::Mat output;
+    auto memcpy_version = [&]() { layer.forward(input, output, opt); };
+
+    float scalar_us = Time(scalar, num_runs);
+    float us = Time(memcpy_version, num_runs);
+
+    bool same = Equal(expected, output);
+    fprintf(stderr,
+            "%-20s scalar: %8.2f us  memcpy: %8.2f us  speedup: %.2f  %s\n",
+            "TensorAsStrided", scalar_us, us, scalar_us / us,
+            same ? "OK" : "MISMATCH");
+
+    ok &= same;
+
+    auto forward = [&](const ncnn::Mat &x) {
+      ncnn::Mat y;
+      layer.forward(x, y, opt);
+      return y;
+    };
+
+    for (bool fp16 : {false, true}) {
+      for (int32_t elempack : {4, 8}) {
+        ok &= CompareLayout("TensorAsStrided", forward, input, elempack, fp16,
+                            num_runs, opt);
+      }
+    }
+  }
+
+  return ok ? 0 : -1;
+}
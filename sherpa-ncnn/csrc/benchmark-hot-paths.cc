@@ -0,0 +1,632 @@
+// sherpa-ncnn/csrc/benchmark-hot-paths.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Microbenchmarks of the code run for every chunk outside of ncnn: the
+// math helpers, the hypotheses and the context graph of beam search, the
+// symbol table and result building, resampling, the decode counters and
+// the custom layers.
+//
+// Each benchmark runs with several sizes, e.g., vocab sizes, beam widths
+// and numbers of hotwords, and is named as Name/arg0/arg1 in the output.
+// A benchmark is repeated until it takes at least --min-time seconds and
+// the time per iteration is reported.
+//
+// Usage:
+//   ./bin/benchmark-hot-paths [--filter=substring] [--min-time=0.2]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "allocator.h"  // NOLINT
+#include "mat.h"        // NOLINT
+#include "option.h"     // NOLINT
+#include "sherpa-ncnn/csrc/context-graph.h"
+#include "sherpa-ncnn/csrc/convert-result.h"
+#include "sherpa-ncnn/csrc/hypothesis.h"
+#include "sherpa-ncnn/csrc/math.h"
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/poolingmodulenoproj.h"
+#include "sherpa-ncnn/csrc/random-mat.h"
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/resample.h"
+#include "sherpa-ncnn/csrc/simpleupsample.h"
+#include "sherpa-ncnn/csrc/stack.h"
+#include "sherpa-ncnn/csrc/stage-counters.h"
+#include "sherpa-ncnn/csrc/stage-timer.h"
+#include "sherpa-ncnn/csrc/symbol-table.h"
+#include "sherpa-ncnn/csrc/tensorasstrided.h"
+#include "sherpa-ncnn/csrc/thread-allocator.h"
+
+// Results are written here so that the compiler cannot drop the work
+static volatile float g_sink;
+
+using Body = std::function<void()>;
+
+// Prepare the inputs for the given sizes and return the code to time
+using Setup = std::function<Body(const std::vector<int32_t> &args)>;
+
+struct Benchmark {
+  std::string name;
+  std::vector<std::vector<int32_t>> args;
+  Setup setup;
+};
+
+static const int32_t kVocabSizes[] = {500, 2000, 5000};
+static const int32_t kBeams[] = {4, 8, 16};
+static const int32_t kNumHotwords[] = {10, 100, 1000};
+static const int32_t kDims[] = {256, 384, 512};
+
+// Number of frames of a chunk after subsampling
+static const int32_t kNumFrames = 16;
+
+static float RandFloat() {
+  return static_cast<float>(rand()) / RAND_MAX - 0.5f;  // NOLINT
+}
+
+static int32_t RandInt(int32_t n) {
+  return rand() % n;  // NOLINT
+}
+
+static std::vector<int32_t> RandTokens(int32_t n, int32_t vocab_size) {
+  std::vector<int32_t> ans(n);
+  // 0 is blank
+  for (auto &t : ans) t = 1 + RandInt(vocab_size - 1);
+  return ans;
+}
+
+// Hotwords of 2 to 8 tokens
+static std::vector<std::vector<int32_t>> RandHotwords(int32_t n,
+                                                      int32_t vocab_size) {
+  std::vector<std::vector<int32_t>> ans(n);
+  for (auto &h : ans) h = RandTokens(2 + RandInt(7), vocab_size);
+  return ans;
+}
+
+// The expansions of beam hyps by their beam best tokens, as in one frame
+// of modified beam search. Half of the hyps do not get a new token, so
+// some of them have the same key.
+static std::vector<sherpa_ncnn::Hypothesis> RandExpansions(int32_t beam) {
+  const int32_t vocab_size = 500;
+  const int32_t num_tokens = 32;
+
+  std::vector<sherpa_ncnn::Hypothesis> prev;
+  for (int32_t i = 0; i != beam; ++i) {
+    prev.emplace_back(RandTokens(num_tokens, vocab_size), -RandFloat() - 1);
+  }
+
+  std::vector<sherpa_ncnn::Hypothesis> ans;
+  for (const auto &h : prev) {
+    for (int32_t k = 0; k != beam; ++k) {
+      sherpa_ncnn::Hypothesis e = h;
+      if (k % 2 == 1) e.ys.push_back(1 + RandInt(vocab_size - 1));
+      e.log_prob += RandFloat() - 1;
+      ans.push_back(std::move(e));
+    }
+  }
+
+  return ans;
+}
+
+static std::vector<std::vector<int32_t>> Product(
+    const std::vector<int32_t> &a, const std::vector<int32_t> &b) {
+  std::vector<std::vector<int32_t>> ans;
+  for (auto i : a) {
+    for (auto k : b) ans.push_back({i, k});
+  }
+  return ans;
+}
+
+static std::vector<std::vector<int32_t>> Each(const std::vector<int32_t> &a) {
+  std::vector<std::vector<int32_t>> ans;
+  for (auto i : a) ans.push_back({i});
+  return ans;
+}
+
+template <class T, size_t N>
+static std::vector<int32_t> ToVector(const T (&a)[N]) {
+  return std::vector<int32_t>(a, a + N);
+}
+
+// It replaces ScopedDecodeCounters to run the stages without counters
+struct NoDecodeCounters {
+  NoDecodeCounters(sherpa_ncnn::AtomicDecodeCounters * /*stream*/,
+                   sherpa_ncnn::AtomicDecodeCounters * /*recognizer*/) {}
+
+  void AddChunk(int32_t /*num_frames*/) {}
+};
+
+// The stages of one chunk of greedy search as RunEncoder(), Search() and
+// GetResult() of recognizer.cc run them, with a decoder run for every
+// 4th frame. Each of them has its own Counters.
+template <typename Counters>
+static void RunChunkStages(int32_t num_frames,
+                           sherpa_ncnn::AtomicDecodeCounters *stream,
+                           sherpa_ncnn::AtomicDecodeCounters *recognizer) {
+  using sherpa_ncnn::ScopedStage;
+  using sherpa_ncnn::Stage;
+
+  {
+    Counters counters(stream, recognizer);
+    counters.AddChunk(4 * num_frames);
+    ScopedStage stage(Stage::kEncoder);
+  }
+
+  {
+    Counters counters(stream, recognizer);
+    ScopedStage stage(Stage::kSearch);
+    for (int32_t t = 0; t != num_frames; ++t) {
+      {
+        ScopedStage joiner(Stage::kJoiner);
+      }
+
+      if (t % 4 == 0) {
+        ScopedStage decoder(Stage::kDecoder);
+      }
+    }
+  }
+
+  {
+    Counters counters(stream, recognizer);
+    ScopedStage stage(Stage::kResult);
+  }
+}
+
+static std::vector<Benchmark> GetBenchmarks() {
+  std::vector<Benchmark> ans;
+
+  auto vocab_sizes = ToVector(kVocabSizes);
+  auto beams = ToVector(kBeams);
+  auto num_hotwords = ToVector(kNumHotwords);
+  auto dims = ToVector(kDims);
+
+  // Args: vocab_size
+  ans.push_back({"LogSoftmax", Each(vocab_sizes), [](const auto &args) {
+                   auto logits = std::make_shared<std::vector<float>>(args[0]);
+                   for (auto &f : *logits) f = RandFloat() * 10;
+
+                   // The output of LogSoftmax is its own fixed point
+                   return Body([logits]() {
+                     sherpa_ncnn::LogSoftmax(logits->data(), logits->size());
+                     g_sink = (*logits)[0];
+                   });
+                 }});
+
+  // Args: vocab_size x beam. The beam is searched in beam * vocab_size
+  // scores as in modified beam search.
+  ans.push_back({"TopkIndex", Product(vocab_sizes, beams),
+                 [](const auto &args) {
+                   int32_t beam = args[1];
+                   auto scores =
+                       std::make_shared<std::vector<float>>(args[0] * beam);
+                   for (auto &f : *scores) f = RandFloat();
+
+                   return Body([scores, beam]() {
+                     auto topk = sherpa_ncnn::TopkIndex(
+                         scores->data(), scores->size(), beam);
+                     g_sink = topk[0];
+                   });
+                 }});
+
+  // Args: number of values to add
+  ans.push_back({"LogAdd<float>", {{1024}}, [](const auto &args) {
+                   auto values = std::make_shared<std::vector<float>>(args[0]);
+                   for (auto &f : *values) f = RandFloat() * 20;
+
+                   return Body([values]() {
+                     sherpa_ncnn::LogAdd<float> log_add;
+                     float sum = -1e30f;
+                     for (auto f : *values) sum = log_add(sum, f);
+                     g_sink = sum;
+                   });
+                 }});
+
+  ans.push_back({"LogAdd<double>", {{1024}}, [](const auto &args) {
+                   auto values = std::make_shared<std::vector<double>>(args[0]);
+                   for (auto &f : *values) f = RandFloat() * 20;
+
+                   return Body([values]() {
+                     sherpa_ncnn::LogAdd<double> log_add;
+                     double sum = -1e300;
+                     for (auto f : *values) sum = log_add(sum, f);
+                     g_sink = sum;
+                   });
+                 }});
+
+  // Args: beam. Add beam * beam expansions of hyps with 32 tokens.
+  ans.push_back({"Hypotheses::Add", Each(beams), [](const auto &args) {
+                   auto hyps = std::make_shared<
+                       std::vector<sherpa_ncnn::Hypothesis>>(
+                       RandExpansions(args[0]));
+
+                   return Body([hyps]() {
+                     sherpa_ncnn::Hypotheses h;
+                     for (const auto &hyp : *hyps) h.Add(hyp);
+                     g_sink = h.Size();
+                   });
+                 }});
+
+  ans.push_back({"Hypotheses::GetTopK", Each(beams), [](const auto &args) {
+                   int32_t beam = args[0];
+                   auto h = std::make_shared<sherpa_ncnn::Hypotheses>();
+                   for (auto &hyp : RandExpansions(beam)) h->Add(hyp);
+
+                   return Body([h, beam]() {
+                     auto topk = h->GetTopK(beam, true);
+                     g_sink = topk[0].log_prob;
+                   });
+                 }});
+
+  ans.push_back({"Hypotheses::GetMostProbable", Each(beams),
+                 [](const auto &args) {
+                   auto h = std::make_shared<sherpa_ncnn::Hypotheses>();
+                   for (auto &hyp : RandExpansions(args[0])) h->Add(hyp);
+
+                   return Body([h]() {
+                     g_sink = h->GetMostProbable(true).log_prob;
+                   });
+                 }});
+
+  // Args: number of hotwords
+  ans.push_back({"ContextGraph::Build", Each(num_hotwords),
+                 [](const auto &args) {
+                   auto hotwords =
+                       std::make_shared<std::vector<std::vector<int32_t>>>(
+                           RandHotwords(args[0], 500));
+
+                   return Body([hotwords]() {
+                     sherpa_ncnn::ContextGraph graph(*hotwords, 1.5);
+                     g_sink = graph.Root()->next.size();
+                   });
+                 }});
+
+  // Args: number of hotwords. Feed 1024 tokens one by one.
+  ans.push_back(
+      {"ContextGraph::ForwardOneStep", Each(num_hotwords),
+       [](const auto &args) {
+         const int32_t vocab_size = 500;
+         auto hotwords = RandHotwords(args[0], vocab_size);
+         auto graph =
+             std::make_shared<sherpa_ncnn::ContextGraph>(hotwords, 1.5);
+
+         // Mix the hotwords with random tokens so that both matches and
+         // failures are taken
+         auto tokens = std::make_shared<std::vector<int32_t>>();
+         while (tokens->size() < 1024) {
+           if (RandInt(2)) {
+             const auto &h = hotwords[RandInt(hotwords.size())];
+             tokens->insert(tokens->end(), h.begin(), h.end());
+           } else {
+             tokens->push_back(1 + RandInt(vocab_size - 1));
+           }
+         }
+
+         return Body([graph, tokens]() {
+           const sherpa_ncnn::ContextState *state = graph->Root();
+           float score = 0;
+           for (auto t : *tokens) {
+             auto p = graph->ForwardOneStep(state, t);
+             score += p.first;
+             state = p.second;
+           }
+           g_sink = score;
+         });
+       }});
+
+  // Args: vocab_size. Look up 1024 IDs and their symbols.
+  ans.push_back({"SymbolTable::Lookup", Each(vocab_sizes),
+                 [](const auto &args) {
+                   int32_t vocab_size = args[0];
+                   std::ostringstream os;
+                   for (int32_t i = 0; i != vocab_size; ++i) {
+                     os << "tok" << i << " " << i << "\n";
+                   }
+                   std::string s = os.str();
+                   auto table = std::make_shared<sherpa_ncnn::SymbolTable>(
+                       reinterpret_cast<const unsigned char *>(s.data()),
+                       s.size());
+
+                   auto ids = std::make_shared<std::vector<int32_t>>(
+                       RandTokens(1024, vocab_size));
+
+                   return Body([table, ids]() {
+                     size_t n = 0;
+                     for (auto i : *ids) {
+                       const std::string &sym = (*table)[i];
+                       n += (*table)[sym];
+                     }
+                     g_sink = n;
+                   });
+                 }});
+
+  // Args: number of decoded tokens
+  ans.push_back({"Convert", Each({16, 64, 256}), [](const auto &args) {
+                   const int32_t vocab_size = 500;
+                   std::ostringstream os;
+                   os << "<blk> 0\n";
+                   for (int32_t i = 1; i != vocab_size; ++i) {
+                     os << "\xe2\x96\x81tok" << i << " " << i << "\n";
+                   }
+                   std::string s = os.str();
+                   auto table = std::make_shared<sherpa_ncnn::SymbolTable>(
+                       reinterpret_cast<const unsigned char *>(s.data()),
+                       s.size());
+
+                   auto result = std::make_shared<sherpa_ncnn::DecoderResult>();
+                   result->tokens = RandTokens(args[0], vocab_size);
+                   for (int32_t i = 0; i != args[0]; ++i) {
+                     result->timestamps.push_back(i * 2);
+                   }
+
+                   return Body([table, result]() {
+                     auto r = sherpa_ncnn::Convert(*result, *table, 10, 4);
+                     g_sink = r.text.size();
+                   });
+                 }});
+
+  // Args: encoder frames per chunk x counters. The stages of a chunk
+  // without (0) and with (1) the counters of a stream and its recognizer.
+  // Without counters and tracing, a stage reads no clock, so the
+  // difference is the cost of the counters per chunk.
+  ans.push_back(
+      {"DecodeCounters", Product({8, 16}, {0, 1}), [](const auto &args) {
+         int32_t num_frames = args[0];
+         auto stream = std::make_shared<sherpa_ncnn::AtomicDecodeCounters>();
+         auto recognizer =
+             std::make_shared<sherpa_ncnn::AtomicDecodeCounters>();
+
+         if (args[1] == 0) {
+           return Body([num_frames, stream, recognizer]() {
+             RunChunkStages<NoDecodeCounters>(num_frames, stream.get(),
+                                              recognizer.get());
+           });
+         }
+
+         return Body([num_frames, stream, recognizer]() {
+           RunChunkStages<sherpa_ncnn::ScopedDecodeCounters>(
+               num_frames, stream.get(), recognizer.get());
+         });
+       }});
+
+  // Args: input sampling rate. Resample 100 ms to 16 kHz, as a client
+  // sends it.
+  ans.push_back({"LinearResample::Resample", Each({8000, 44100, 48000}),
+                 [](const auto &args) {
+                   int32_t sample_rate = args[0];
+                   float cutoff = 0.99f * 0.5f * std::min(sample_rate, 16000);
+                   auto resampler =
+                       std::make_shared<sherpa_ncnn::LinearResample>(
+                           sample_rate, 16000, cutoff, 6);
+
+                   auto samples =
+                       std::make_shared<std::vector<float>>(sample_rate / 10);
+                   for (auto &f : *samples) f = RandFloat();
+
+                   auto out = std::make_shared<std::vector<float>>();
+
+                   return Body([resampler, samples, out]() {
+                     resampler->Resample(samples->data(), samples->size(),
+                                         false, out.get());
+                     g_sink = out->size();
+                   });
+                 }});
+
+  // The custom layers with the shapes of a streaming Zipformer.
+  // Args: encoder dim
+  ans.push_back({"PoolingModuleNoProj", Each(dims), [](const auto &args) {
+                   int32_t dim = args[0];
+                   auto layer =
+                       std::make_shared<sherpa_ncnn::PoolingModuleNoProj>();
+
+                   auto inputs = std::make_shared<std::vector<ncnn::Mat>>(3);
+                   (*inputs)[0].create(dim, kNumFrames);
+                   (*inputs)[1].create(1);
+                   (*inputs)[2].create(dim, 1);
+                   sherpa_ncnn::FillRandom(&(*inputs)[0]);
+                   sherpa_ncnn::FillRandom(&(*inputs)[2]);
+                   (*inputs)[1][0] = 32;
+
+                   return Body([layer, inputs]() {
+                     ncnn::Option opt;
+                     opt.num_threads = 1;
+                     std::vector<ncnn::Mat> outputs(3);
+                     layer->forward(*inputs, outputs, opt);
+                     g_sink = outputs[0][0];
+                   });
+                 }});
+
+  ans.push_back({"SimpleUpsample", Each(dims), [](const auto &args) {
+                   int32_t dim = args[0];
+                   auto layer = std::make_shared<sherpa_ncnn::SimpleUpsample>();
+                   layer->upsample = 2;
+                   layer->num_channels = dim;
+                   layer->bias.create(dim, layer->upsample);
+                   sherpa_ncnn::FillRandom(&layer->bias);
+
+                   auto input = std::make_shared<ncnn::Mat>(dim, kNumFrames);
+                   sherpa_ncnn::FillRandom(input.get());
+
+                   return Body([layer, input]() {
+                     ncnn::Option opt;
+                     opt.num_threads = 1;
+                     ncnn::Mat output;
+                     layer->forward(*input, output, opt);
+                     g_sink = output[0];
+                   });
+                 }});
+
+  // Args: number of heads x left context. Relative positional encoding.
+  ans.push_back(
+      {"TensorAsStrided", Product({4, 8}, {32, 64, 128}),
+       [](const auto &args) {
+         int32_t num_heads = args[0];
+         int32_t outw = kNumFrames + args[1];
+         int32_t inw = 2 * outw - 1;
+
+         auto layer = std::make_shared<sherpa_ncnn::TensorAsStrided>();
+         layer->sizes.create(3, sizeof(int32_t));
+         layer->strides.create(3, sizeof(int32_t));
+         int32_t *sizes = layer->sizes;
+         int32_t *strides = layer->strides;
+         sizes[0] = num_heads;
+         sizes[1] = kNumFrames;
+         sizes[2] = outw;
+         strides[0] = kNumFrames * inw;
+         strides[1] = inw - 1;
+         strides[2] = 1;
+         layer->storage_offset = kNumFrames - 1;
+
+         auto input = std::make_shared<ncnn::Mat>(inw, kNumFrames, num_heads);
+         sherpa_ncnn::FillRandom(input.get());
+
+         return Body([layer, input]() {
+           ncnn::Option opt;
+           opt.num_threads = 1;
+           ncnn::Mat output;
+           layer->forward(*input, output, opt);
+           g_sink = output[0];
+         });
+       }});
+
+  // Args: encoder dim. Stack the cached_key of 4 layers with 64 frames of
+  // left context.
+  ans.push_back({"Stack", Each(dims), [](const auto &args) {
+                   int32_t dim = args[0];
+                   auto layer = std::make_shared<sherpa_ncnn::Stack>();
+                   layer->axis = 0;
+
+                   auto inputs = std::make_shared<std::vector<ncnn::Mat>>(4);
+                   for (auto &m : *inputs) {
+                     m.create(dim, 64);
+                     sherpa_ncnn::FillRandom(&m);
+                   }
+
+                   return Body([layer, inputs]() {
+                     ncnn::Option opt;
+                     opt.num_threads = 1;
+                     std::vector<ncnn::Mat> outputs(1);
+                     layer->forward(*inputs, outputs, opt);
+                     g_sink = outputs[0][0];
+                   });
+                 }});
+
+  // Args: allocator x encoder dim. The Stack benchmark above with the
+  // blob allocator 0: malloc() for each blob, 1: a locked pool shared by
+  // all threads as ncnn uses by default, 2: the pool of the calling thread
+  // from thread-allocator.h
+  ans.push_back(
+      {"BlobAllocator", Product({0, 1, 2}, dims), [](const auto &args) {
+         std::shared_ptr<ncnn::Allocator> pool;
+         ncnn::Allocator *allocator = nullptr;
+         if (args[0] == 1) {
+           pool = std::make_shared<ncnn::PoolAllocator>();
+           allocator = pool.get();
+         } else if (args[0] == 2) {
+           allocator = sherpa_ncnn::GetThreadBlobAllocator();
+         }
+
+         int32_t dim = args[1];
+         auto layer = std::make_shared<sherpa_ncnn::Stack>();
+         layer->axis = 0;
+
+         auto inputs = std::make_shared<std::vector<ncnn::Mat>>(4);
+         for (auto &m : *inputs) {
+           m.create(dim, 64);
+           sherpa_ncnn::FillRandom(&m);
+         }
+
+         return Body([layer, inputs, pool, allocator]() {
+           ncnn::Option opt;
+           opt.num_threads = 1;
+           opt.use_local_pool_allocator = false;
+           opt.blob_allocator = allocator;
+           std::vector<ncnn::Mat> outputs(1);
+           layer->forward(*inputs, outputs, opt);
+           g_sink = outputs[0][0];
+         });
+       }});
+
+  return ans;
+}
+
+static std::string GetName(const Benchmark &b,
+                           const std::vector<int32_t> &args) {
+  std::string ans = b.name;
+  for (auto a : args) ans += "/" + std::to_string(a);
+  return ans;
+}
+
+// Run body until it takes at least min_time seconds. Return the time per
+// iteration in nanoseconds and set the number of iterations.
+static double Run(const Body &body, double min_time,
+                  int64_t *num_iterations) {
+  body();  // warm up
+
+  int64_t n = 1;
+  while (true) {
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i != n; ++i) {
+      body();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (seconds >= min_time || n >= 1000000000) {
+      *num_iterations = n;
+      return seconds * 1e9 / n;
+    }
+
+    // Aim at 1.4 * min_time, but grow by at most 10x per round
+    double scale = seconds > 0 ? 1.4 * min_time / seconds : 10;
+    n = static_cast<int64_t>(n * std::min(10.0, std::max(2.0, scale)));
+  }
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  std::string filter;
+  double min_time = 0.2;
+
+  for (int32_t i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "filter", &value)) {
+      filter = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "min-time", &value)) {
+      min_time = atof(value.c_str());
+    } else {
+      fprintf(stderr, "Usage: %s [--filter=substring] [--min-time=0.2]\n",
+              argv[0]);
+      return -1;
+    }
+  }
+
+  srand(0);
+
+  fprintf(stdout, "%-44s %14s %12s\n", "Benchmark", "Time", "Iterations");
+
+  for (const auto &b : GetBenchmarks()) {
+    for (const auto &args : b.args) {
+      std::string name = GetName(b, args);
+      if (name.find(filter) == std::string::npos) continue;
+
+      int64_t n = 0;
+      double ns = Run(b.setup(args), min_time, &n);
+
+      fprintf(stdout, "%-44s %11.1f ns %12lld\n", name.c_str(), ns,
+              static_cast<long long>(n));  // NOLINT
+      fflush(stdout);
+    }
+  }
+
+  return 0;
+}
@@ -4,9 +4,11 @@
 
 #include "sherpa-ncnn/csrc/context-graph.h"
 
+#include <algorithm>
 #include <cassert>
 #include <queue>
 #include <utility>
+#include <vector>
 
 namespace sherpa_ncnn {
 void ContextGraph::Build(
@@ -54,6 +56,53 @@ std::pair<float, const ContextState *> ContextGraph::Finalize(
   return std::make_pair(score, root_.get());
 }
 
+std::vector<const ContextState *> ContextGraph::GetStates() const {
+  std::vector<const ContextState *> ans;
+  if (!root_) return ans;
+
+  ans.push_back(root_.get());
+
+  std::vector<int32_t> tokens;
+  for (size_t i = 0; i != ans.size(); ++i) {
+    const auto &next = ans[i]->next;
+
+    tokens.clear();
+    for (const auto &kv : next) {
+      tokens.push_back(kv.first);
+    }
+    std::sort(tokens.begin(), tokens.end());
+
+    for (auto t : tokens) {
+      ans.push_back(next.at(t).get());
+    }
+  }
+
+  return ans;
+}
+
+int64_t ContextGraph::NumBytes() const {
+  using Map = decltype(ContextState::next);
+
+  int64_t ans = 0;
+  std::queue<const ContextState *> node_queue;
+  if (root_) node_queue.push(root_.get());
+
+  while (!node_queue.empty()) {
+    const ContextState *state = node_queue.front();
+    node_queue.pop();
+
+    ans += sizeof(ContextState) + state->next.bucket_count() * sizeof(void *);
+    // Each node of the map keeps a pointer to the next node
+    ans += state->next.size() * (sizeof(Map::value_type) + sizeof(void *));
+
+    for (const auto &kv : state->next) {
+      node_queue.push(kv.second.get());
+    }
+  }
+
+  return ans;
+}
+
 void ContextGraph::FillFailOutput() const {
   std::queue<const ContextState *> node_queue;
   for (auto &kv : root_->next) {
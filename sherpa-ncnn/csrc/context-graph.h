@@ -54,6 +54,20 @@ class ContextGraph {
 
   const ContextState *Root() const { return root_.get(); }
 
+  /** Return all states of the graph in breadth-first order, where the
+   * children of a state are visited in increasing order of their tokens.
+   *
+   * Graphs built from the same hotwords return the same order, so the
+   * index of a state in the returned vector can be used to refer to it
+   * across graphs, e.g., when saving and restoring a stream.
+   */
+  std::vector<const ContextState *> GetStates() const;
+
+  /** Estimate the bytes held by the states of the graph, including the
+   * nodes and buckets of their hash maps. It visits all states.
+   */
+  int64_t NumBytes() const;
+
  private:
   float context_score_;
   std::unique_ptr<ContextState> root_;
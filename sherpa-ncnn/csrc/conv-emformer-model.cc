@@ -12,6 +12,7 @@
 #include "net.h"       // NOLINT
 #include "platform.h"  // NOLINT
 #include "sherpa-ncnn/csrc/meta-data.h"
+#include "sherpa-ncnn/csrc/thread-budget.h"
 
 namespace sherpa_ncnn {
 
@@ -89,6 +90,7 @@ ConvEmformerModel::ConvEmformerModel(AAssetManager *mgr,
 std::pair<ncnn::Mat, std::vector<ncnn::Mat>> ConvEmformerModel::RunEncoder(
     ncnn::Mat &features, const std::vector<ncnn::Mat> &states) {
   ncnn::Extractor encoder_ex = encoder_.create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kEncoder, &encoder_ex);
   return RunEncoder(features, states, &encoder_ex);
 }
 
@@ -122,8 +124,44 @@ std::pair<ncnn::Mat, std::vector<ncnn::Mat>> ConvEmformerModel::RunEncoder(
   return {encoder_out, next_states};
 }
 
+ncnn::Mat ConvEmformerModel::RunEncoder(ncnn::Mat &features,
+                                        EncoderStateArena *states) {
+  ncnn::Extractor encoder_ex = encoder_.create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kEncoder, &encoder_ex);
+  return RunEncoder(features, states, &encoder_ex);
+}
+
+ncnn::Mat ConvEmformerModel::RunEncoder(ncnn::Mat &features,
+                                        EncoderStateArena *states,
+                                        ncnn::Extractor *encoder_ex) {
+  if (states->Empty()) {
+    states->Init(GetEncoderInitStates());
+  }
+
+  // Note: We ignore error check there
+  encoder_ex->input(encoder_input_indexes_[0], features);
+  for (int32_t i = 1; i != encoder_input_indexes_.size(); ++i) {
+    encoder_ex->input(encoder_input_indexes_[i], states->Input(i - 1));
+  }
+
+  ncnn::Mat encoder_out;
+  encoder_ex->extract(encoder_output_indexes_[0], encoder_out);
+
+  // The output blobs may have an extra dimension of size 1, which is
+  // dropped by copying them into the pre-shaped views of the arena
+  ncnn::Mat s;
+  for (int32_t i = 1; i != encoder_output_indexes_.size(); ++i) {
+    encoder_ex->extract(encoder_output_indexes_[i], s);
+    states->SetOutput(i - 1, s);
+  }
+  states->Swap();
+
+  return encoder_out;
+}
+
 ncnn::Mat ConvEmformerModel::RunDecoder(ncnn::Mat &decoder_input) {
   ncnn::Extractor decoder_ex = decoder_.create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kDecoder, &decoder_ex);
   return RunDecoder(decoder_input, &decoder_ex);
 }
 
@@ -140,6 +178,7 @@ ncnn::Mat ConvEmformerModel::RunDecoder(ncnn::Mat &decoder_input,
 ncnn::Mat ConvEmformerModel::RunJoiner(ncnn::Mat &encoder_out,
                                        ncnn::Mat &decoder_out) {
   auto joiner_ex = joiner_.create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kJoiner, &joiner_ex);
   return RunJoiner(encoder_out, decoder_out, &joiner_ex);
 }
 
@@ -34,6 +34,12 @@ class ConvEmformerModel : public Model {
       ncnn::Mat &features, const std::vector<ncnn::Mat> &states,
       ncnn::Extractor *extractor) override;
 
+  ncnn::Mat RunEncoder(ncnn::Mat &features,
+                       EncoderStateArena *states) override;
+
+  ncnn::Mat RunEncoder(ncnn::Mat &features, EncoderStateArena *states,
+                       ncnn::Extractor *extractor) override;
+
   ncnn::Mat RunDecoder(ncnn::Mat &decoder_input) override;
 
   ncnn::Mat RunDecoder(ncnn::Mat &decoder_input,
@@ -0,0 +1,36 @@
+// sherpa-ncnn/csrc/convert-result.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/convert-result.h"
+
+#include <string>
+#include <utility>
+
+namespace sherpa_ncnn {
+
+RecognitionResult Convert(const DecoderResult &src,
+                          const SymbolTable &sym_table, int32_t frame_shift_ms,
+                          int32_t subsampling_factor) {
+  RecognitionResult ans;
+  ans.stokens.reserve(src.tokens.size());
+  ans.timestamps.reserve(src.timestamps.size());
+
+  std::string text;
+  for (auto i : src.tokens) {
+    auto sym = sym_table[i];
+    text.append(sym);
+    ans.stokens.push_back(sym);
+  }
+
+  ans.text = std::move(text);
+  ans.tokens = src.tokens;
+  float frame_shift_s = frame_shift_ms / 1000. * subsampling_factor;
+  for (auto t : src.timestamps) {
+    float time = frame_shift_s * t;
+    ans.timestamps.push_back(time);
+  }
+  return ans;
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,31 @@
+// sherpa-ncnn/csrc/convert-result.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_CONVERT_RESULT_H_
+#define SHERPA_NCNN_CSRC_CONVERT_RESULT_H_
+
+#include "sherpa-ncnn/csrc/decoder.h"
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/symbol-table.h"
+
+namespace sherpa_ncnn {
+
+/** Build the text and the timestamps in seconds of a decoder result.
+ * It is used by Recognizer::GetResult().
+ *
+ * It is not part of the public API in recognizer.h. It is declared here
+ * so that benchmark-hot-paths can measure it.
+ *
+ * @param src  The decoded tokens and their frames after subsampling.
+ * @param sym_table  Map token IDs to symbols.
+ * @param frame_shift_ms  Frame shift of the features.
+ * @param subsampling_factor  Subsampling factor of the encoder.
+ */
+RecognitionResult Convert(const DecoderResult &src,
+                          const SymbolTable &sym_table, int32_t frame_shift_ms,
+                          int32_t subsampling_factor);
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_CONVERT_RESULT_H_
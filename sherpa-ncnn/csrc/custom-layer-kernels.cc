@@ -0,0 +1,285 @@
+// sherpa-ncnn/csrc/custom-layer-kernels.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/custom-layer-kernels.h"
+
+#include <atomic>
+#include <string>
+
+#include "cpu.h"  // NOLINT
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define SHERPA_NCNN_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SHERPA_NCNN_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// The x86 kernels are compiled for their instruction set without changing
+// the flags of the whole file, so the library still runs on older CPUs
+#if defined(__GNUC__) || defined(__clang__)
+#define SHERPA_NCNN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SHERPA_NCNN_TARGET(isa)
+#endif
+
+namespace sherpa_ncnn {
+
+// Note: The compiler may fuse a multiply and an add of the SIMD kernels,
+// so add_scaled() can differ from the scalar kernels in the last bit.
+
+static void AddScalar(const float *a, const float *b, float *out, int32_t n) {
+  for (int32_t i = 0; i < n; ++i) {
+    out[i] = a[i] + b[i];
+  }
+}
+
+static void AddScaledScalar(const float *a, const float *b, float scale,
+                            float *out, int32_t n) {
+  for (int32_t i = 0; i < n; ++i) {
+    out[i] = a[i] + scale * b[i];
+  }
+}
+
+static void CumsumStepScalar(const float *x, float *prev, float *cur,
+                             float scale, int32_t n) {
+  for (int32_t i = 0; i < n; ++i) {
+    cur[i] = prev[i] + x[i];
+    prev[i] *= scale;
+  }
+}
+
+static void ScaleScalar(const float *in, float scale, float *out, int32_t n) {
+  for (int32_t i = 0; i < n; ++i) {
+    out[i] = in[i] * scale;
+  }
+}
+
+static const CustomLayerKernels kScalarKernels = {
+    "scalar", AddScalar, AddScaledScalar, CumsumStepScalar, ScaleScalar};
+
+#if SHERPA_NCNN_KERNELS_NEON
+static void AddNeon(const float *a, const float *b, float *out, int32_t n) {
+  int32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(out + i, vaddq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+  }
+  AddScalar(a + i, b + i, out + i, n - i);
+}
+
+static void AddScaledNeon(const float *a, const float *b, float scale,
+                          float *out, int32_t n) {
+  float32x4_t s = vdupq_n_f32(scale);
+  int32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t t = vmulq_f32(s, vld1q_f32(b + i));
+    vst1q_f32(out + i, vaddq_f32(vld1q_f32(a + i), t));
+  }
+  AddScaledScalar(a + i, b + i, scale, out + i, n - i);
+}
+
+static void CumsumStepNeon(const float *x, float *prev, float *cur,
+                           float scale, int32_t n) {
+  float32x4_t s = vdupq_n_f32(scale);
+  int32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t p = vld1q_f32(prev + i);
+    vst1q_f32(cur + i, vaddq_f32(p, vld1q_f32(x + i)));
+    vst1q_f32(prev + i, vmulq_f32(p, s));
+  }
+  CumsumStepScalar(x + i, prev + i, cur + i, scale, n - i);
+}
+
+static void ScaleNeon(const float *in, float scale, float *out, int32_t n) {
+  float32x4_t s = vdupq_n_f32(scale);
+  int32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(out + i, vmulq_f32(vld1q_f32(in + i), s));
+  }
+  ScaleScalar(in + i, scale, out + i, n - i);
+}
+
+static const CustomLayerKernels kNeonKernels = {
+    "neon", AddNeon, AddScaledNeon, CumsumStepNeon, ScaleNeon};
+#endif
+
+#if SHERPA_NCNN_KERNELS_X86
+SHERPA_NCNN_TARGET("avx2")
+static void AddAvx2(const float *a, const float *b, float *out, int32_t n) {
+  int32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 t = _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    _mm256_storeu_ps(out + i, t);
+  }
+  AddScalar(a + i, b + i, out + i, n - i);
+}
+
+SHERPA_NCNN_TARGET("avx2")
+static void AddScaledAvx2(const float *a, const float *b, float scale,
+                          float *out, int32_t n) {
+  __m256 s = _mm256_set1_ps(scale);
+  int32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 t = _mm256_mul_ps(s, _mm256_loadu_ps(b + i));
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(a + i), t));
+  }
+  AddScaledScalar(a + i, b + i, scale, out + i, n - i);
+}
+
+SHERPA_NCNN_TARGET("avx2")
+static void CumsumStepAvx2(const float *x, float *prev, float *cur,
+                           float scale, int32_t n) {
+  __m256 s = _mm256_set1_ps(scale);
+  int32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 p = _mm256_loadu_ps(prev + i);
+    _mm256_storeu_ps(cur + i, _mm256_add_ps(p, _mm256_loadu_ps(x + i)));
+    _mm256_storeu_ps(prev + i, _mm256_mul_ps(p, s));
+  }
+  CumsumStepScalar(x + i, prev + i, cur + i, scale, n - i);
+}
+
+SHERPA_NCNN_TARGET("avx2")
+static void ScaleAvx2(const float *in, float scale, float *out, int32_t n) {
+  __m256 s = _mm256_set1_ps(scale);
+  int32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), s));
+  }
+  ScaleScalar(in + i, scale, out + i, n - i);
+}
+
+static const CustomLayerKernels kAvx2Kernels = {
+    "avx2", AddAvx2, AddScaledAvx2, CumsumStepAvx2, ScaleAvx2};
+
+// The tails of up to 15 elements use masked loads and stores
+SHERPA_NCNN_TARGET("avx512f")
+static void AddAvx512(const float *a, const float *b, float *out, int32_t n) {
+  int32_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 t = _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    _mm512_storeu_ps(out + i, t);
+  }
+
+  if (i < n) {
+    __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+    __m512 t = _mm512_add_ps(_mm512_maskz_loadu_ps(m, a + i),
+                             _mm512_maskz_loadu_ps(m, b + i));
+    _mm512_mask_storeu_ps(out + i, m, t);
+  }
+}
+
+SHERPA_NCNN_TARGET("avx512f")
+static void AddScaledAvx512(const float *a, const float *b, float scale,
+                            float *out, int32_t n) {
+  __m512 s = _mm512_set1_ps(scale);
+  int32_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 t = _mm512_mul_ps(s, _mm512_loadu_ps(b + i));
+    _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(a + i), t));
+  }
+
+  if (i < n) {
+    __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+    __m512 t = _mm512_mul_ps(s, _mm512_maskz_loadu_ps(m, b + i));
+    t = _mm512_add_ps(_mm512_maskz_loadu_ps(m, a + i), t);
+    _mm512_mask_storeu_ps(out + i, m, t);
+  }
+}
+
+SHERPA_NCNN_TARGET("avx512f")
+static void CumsumStepAvx512(const float *x, float *prev, float *cur,
+                             float scale, int32_t n) {
+  __m512 s = _mm512_set1_ps(scale);
+  int32_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 p = _mm512_loadu_ps(prev + i);
+    _mm512_storeu_ps(cur + i, _mm512_add_ps(p, _mm512_loadu_ps(x + i)));
+    _mm512_storeu_ps(prev + i, _mm512_mul_ps(p, s));
+  }
+
+  if (i < n) {
+    __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+    __m512 p = _mm512_maskz_loadu_ps(m, prev + i);
+    __m512 t = _mm512_add_ps(p, _mm512_maskz_loadu_ps(m, x + i));
+    _mm512_mask_storeu_ps(cur + i, m, t);
+    _mm512_mask_storeu_ps(prev + i, m, _mm512_mul_ps(p, s));
+  }
+}
+
+SHERPA_NCNN_TARGET("avx512f")
+static void ScaleAvx512(const float *in, float scale, float *out, int32_t n) {
+  __m512 s = _mm512_set1_ps(scale);
+  int32_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(in + i), s));
+  }
+
+  if (i < n) {
+    __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+    __m512 t = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, in + i), s);
+    _mm512_mask_storeu_ps(out + i, m, t);
+  }
+}
+
+static const CustomLayerKernels kAvx512Kernels = {
+    "avx512", AddAvx512, AddScaledAvx512, CumsumStepAvx512, ScaleAvx512};
+#endif
+
+// Return nullptr if the kernels are not available on this CPU
+static const CustomLayerKernels *FindKernels(const std::string &name) {
+  if (name == "scalar") return &kScalarKernels;
+
+#if SHERPA_NCNN_KERNELS_NEON
+  if (name == "neon") return &kNeonKernels;
+#endif
+
+#if SHERPA_NCNN_KERNELS_X86
+  if (name == "avx2" && ncnn::cpu_support_x86_avx2()) return &kAvx2Kernels;
+
+  if (name == "avx512" && ncnn::cpu_support_x86_avx512()) {
+    return &kAvx512Kernels;
+  }
+#endif
+
+  return nullptr;
+}
+
+static const CustomLayerKernels *DetectKernels() {
+  for (const char *name : {"avx512", "avx2", "neon"}) {
+    const CustomLayerKernels *k = FindKernels(name);
+    if (k) return k;
+  }
+
+  return &kScalarKernels;
+}
+
+static std::atomic<const CustomLayerKernels *> g_selected{nullptr};
+
+const CustomLayerKernels &GetCustomLayerKernels() {
+  const CustomLayerKernels *k = g_selected.load(std::memory_order_relaxed);
+  if (k) return *k;
+
+  static const CustomLayerKernels *detected = DetectKernels();
+  return *detected;
+}
+
+bool SelectCustomLayerKernels(const std::string &name) {
+  if (name == "auto") {
+    g_selected = nullptr;
+    return true;
+  }
+
+  const CustomLayerKernels *k = FindKernels(name);
+  if (!k) return false;
+
+  g_selected = k;
+  return true;
+}
+
+}  // namespace sherpa_ncnn
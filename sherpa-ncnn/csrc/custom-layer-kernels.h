@@ -0,0 +1,53 @@
+// sherpa-ncnn/csrc/custom-layer-kernels.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_CUSTOM_LAYER_KERNELS_H_
+#define SHERPA_NCNN_CSRC_CUSTOM_LAYER_KERNELS_H_
+
+#include <cstdint>
+#include <string>
+
+namespace sherpa_ncnn {
+
+// Row kernels used by the custom Zipformer layers. All of them work on
+// fp32 and allow out to be the same as an input.
+struct CustomLayerKernels {
+  // scalar, neon, avx2 or avx512
+  const char *name;
+
+  // out[i] = a[i] + b[i]
+  void (*add)(const float *a, const float *b, float *out, int32_t n);
+
+  // out[i] = a[i] + scale * b[i]
+  void (*add_scaled)(const float *a, const float *b, float scale, float *out,
+                     int32_t n);
+
+  // One step of a running average:
+  //   cur[i] = prev[i] + x[i]
+  //   prev[i] = prev[i] * scale
+  void (*cumsum_step)(const float *x, float *prev, float *cur, float scale,
+                      int32_t n);
+
+  // out[i] = in[i] * scale
+  void (*scale)(const float *in, float scale, float *out, int32_t n);
+};
+
+/** Return the kernels for this CPU.
+ *
+ * The instruction set is detected at runtime on x86. On ARM, NEON is used
+ * if the library is compiled with it.
+ */
+const CustomLayerKernels &GetCustomLayerKernels();
+
+/** Use the given kernels instead of the detected ones. It is meant for
+ * benchmarks and debugging and must be called before running any model.
+ *
+ * @param name  auto, scalar, neon, avx2 or avx512.
+ * @return Return false if the kernels are not available on this CPU.
+ */
+bool SelectCustomLayerKernels(const std::string &name);
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_CUSTOM_LAYER_KERNELS_H_
@@ -0,0 +1,361 @@
+// sherpa-ncnn/csrc/encoder-state-arena.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/encoder-state-arena.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "platform.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+// Each state starts at a cache line boundary
+static constexpr size_t kAlignment = 64;
+
+EncoderStateStorage ParseEncoderStateStorage(const std::string &name) {
+  if (name.empty() || name == "fp32") {
+    return EncoderStateStorage::kFloat32;
+  } else if (name == "fp16") {
+    return EncoderStateStorage::kFloat16;
+  } else if (name == "bf16") {
+    return EncoderStateStorage::kBFloat16;
+  }
+
+  NCNN_LOGE("Unsupported state storage: %s. Valid values are: fp32, fp16, bf16",
+            name.c_str());
+  exit(-1);
+}
+
+static size_t NumElements(const ncnn::Mat &m) {
+  return static_cast<size_t>(m.w) * m.h * m.d * m.c;
+}
+
+// Create a Mat of the same shape as m, but backed by the given data
+static ncnn::Mat MakeView(const ncnn::Mat &m, void *data, size_t elemsize) {
+  switch (m.dims) {
+    case 1:
+      return ncnn::Mat(m.w, data, elemsize);
+    case 2:
+      return ncnn::Mat(m.w, m.h, data, elemsize);
+    case 3:
+      return ncnn::Mat(m.w, m.h, m.c, data, elemsize);
+    case 4:
+      return ncnn::Mat(m.w, m.h, m.d, m.c, data, elemsize);
+    default:
+      NCNN_LOGE("Unsupported dims for encoder states: %d", m.dims);
+      exit(-1);
+  }
+}
+
+// Create a Mat of the same shape as m with the given element size
+static ncnn::Mat CreateLike(const ncnn::Mat &m, size_t elemsize) {
+  ncnn::Mat ans;
+  switch (m.dims) {
+    case 1:
+      ans.create(m.w, elemsize);
+      break;
+    case 2:
+      ans.create(m.w, m.h, elemsize);
+      break;
+    case 3:
+      ans.create(m.w, m.h, m.c, elemsize);
+      break;
+    case 4:
+      ans.create(m.w, m.h, m.d, m.c, elemsize);
+      break;
+    default:
+      NCNN_LOGE("Unsupported dims for encoder states: %d", m.dims);
+      exit(-1);
+  }
+  return ans;
+}
+
+static void ShapeMismatch(const ncnn::Mat &src, const ncnn::Mat &dst) {
+  NCNN_LOGE(
+      "Encoder state shape mismatch. src: (%d, %d, %d, %d), elemsize %d. "
+      "dst: (%d, %d, %d, %d), elemsize %d",
+      src.w, src.h, src.d, src.c, static_cast<int32_t>(src.elemsize), dst.w,
+      dst.h, dst.d, dst.c, static_cast<int32_t>(dst.elemsize));
+  exit(-1);
+}
+
+// Call f(p, q, n) for each run of n elements that are contiguous in both
+// src and dst, in row-major order. p points into src and q into dst.
+// Padding caused by cstep is skipped in both Mats, whose element sizes
+// may differ.
+template <typename F>
+static void ForEachRun(const ncnn::Mat &src, ncnn::Mat *dst, F f) {
+  if (NumElements(src) != NumElements(*dst)) {
+    ShapeMismatch(src, *dst);
+  }
+
+  size_t src_elemsize = src.elemsize;
+  size_t dst_elemsize = dst->elemsize;
+
+  // Number of contiguous elements in a channel
+  size_t src_plane = static_cast<size_t>(src.w) * src.h * src.d;
+  size_t dst_plane = static_cast<size_t>(dst->w) * dst->h * dst->d;
+
+  const auto *src_base = static_cast<const unsigned char *>(src.data);
+  auto *dst_base = static_cast<unsigned char *>(dst->data);
+
+  if (src.c == 1 && dst->c == 1) {
+    f(src_base, dst_base, src_plane);
+    return;
+  }
+
+  int32_t src_c = 0;
+  int32_t dst_c = 0;
+  size_t src_left = src_plane;
+  size_t dst_left = dst_plane;
+  const unsigned char *p = src_base;
+  unsigned char *q = dst_base;
+
+  while (src_c < src.c && dst_c < dst->c) {
+    size_t n = std::min(src_left, dst_left);
+    f(p, q, n);
+
+    p += n * src_elemsize;
+    q += n * dst_elemsize;
+    src_left -= n;
+    dst_left -= n;
+
+    if (src_left == 0) {
+      ++src_c;
+      p = src_base + src_c * src.cstep * src_elemsize;
+      src_left = src_plane;
+    }
+
+    if (dst_left == 0) {
+      ++dst_c;
+      q = dst_base + dst_c * dst->cstep * dst_elemsize;
+      dst_left = dst_plane;
+    }
+  }
+}
+
+// Conversions of n contiguous elements between fp32 and 16 bits. They are
+// called for every state of every chunk, so they convert in a plain loop
+// instead of creating a Cast layer of ncnn each time.
+static void Float32ToFloat16(const unsigned char *p, unsigned char *q,
+                             size_t n) {
+  const auto *src = reinterpret_cast<const float *>(p);
+  auto *dst = reinterpret_cast<uint16_t *>(q);
+  for (size_t k = 0; k != n; ++k) {
+    dst[k] = ncnn::float32_to_float16(src[k]);
+  }
+}
+
+static void Float16ToFloat32(const unsigned char *p, unsigned char *q,
+                             size_t n) {
+  const auto *src = reinterpret_cast<const uint16_t *>(p);
+  auto *dst = reinterpret_cast<float *>(q);
+  for (size_t k = 0; k != n; ++k) {
+    dst[k] = ncnn::float16_to_float32(src[k]);
+  }
+}
+
+static void Float32ToBFloat16(const unsigned char *p, unsigned char *q,
+                              size_t n) {
+  const auto *src = reinterpret_cast<const float *>(p);
+  auto *dst = reinterpret_cast<uint16_t *>(q);
+  for (size_t k = 0; k != n; ++k) {
+    dst[k] = ncnn::float32_to_bfloat16(src[k]);
+  }
+}
+
+static void BFloat16ToFloat32(const unsigned char *p, unsigned char *q,
+                              size_t n) {
+  const auto *src = reinterpret_cast<const uint16_t *>(p);
+  auto *dst = reinterpret_cast<float *>(q);
+  for (size_t k = 0; k != n; ++k) {
+    dst[k] = ncnn::bfloat16_to_float32(src[k]);
+  }
+}
+
+EncoderStateArena::~EncoderStateArena() { Release(); }
+
+void EncoderStateArena::Release() {
+  // Drop the views before the memory they point to
+  views_[0].clear();
+  views_[1].clear();
+  integer_states_.clear();
+
+  ncnn::fastFree(data_);
+  data_ = nullptr;
+  half_bytes_ = 0;
+  current_ = 0;
+}
+
+void EncoderStateArena::Init(const std::vector<ncnn::Mat> &states,
+                             EncoderStateStorage storage,
+                             const std::vector<bool> &integer_states) {
+  Release();
+
+  storage_ = storage;
+  num_halves_ = storage == EncoderStateStorage::kFloat32 ? 2 : 1;
+
+  integer_states_.assign(states.size(), false);
+  for (size_t i = 0; i < states.size() && i < integer_states.size(); ++i) {
+    integer_states_[i] = integer_states[i];
+  }
+
+  std::vector<size_t> offsets;
+  offsets.reserve(states.size());
+
+  size_t offset = 0;
+  for (size_t i = 0; i != states.size(); ++i) {
+    const auto &s = states[i];
+    if (s.elempack != 1 || s.elemsize != 4) {
+      NCNN_LOGE(
+          "Encoder states must be fp32 with elempack 1. Given: elemsize %d, "
+          "elempack %d",
+          static_cast<int32_t>(s.elemsize), s.elempack);
+      exit(-1);
+    }
+
+    offsets.push_back(offset);
+
+    // cstep of the view is computed from the shape only
+    ncnn::Mat probe = MakeView(s, nullptr, IsFloat32(i) ? 4 : 2);
+    offset += ncnn::alignSize(probe.total() * probe.elemsize, kAlignment);
+  }
+
+  half_bytes_ = offset;
+  if (half_bytes_ == 0) {
+    return;
+  }
+
+  data_ =
+      static_cast<unsigned char *>(ncnn::fastMalloc(half_bytes_ * num_halves_));
+  std::memset(data_, 0, half_bytes_ * num_halves_);
+
+  for (int32_t k = 0; k != num_halves_; ++k) {
+    unsigned char *base = data_ + k * half_bytes_;
+
+    views_[k].reserve(states.size());
+    for (size_t i = 0; i != states.size(); ++i) {
+      ncnn::Mat v =
+          MakeView(states[i], base + offsets[i], IsFloat32(i) ? 4 : 2);
+      v.refcount = &refcount_;
+      v.addref();
+
+      views_[k].push_back(v);
+
+      // v is destroyed at the end of this scope and drops its reference
+    }
+  }
+
+  Assign(states);
+}
+
+void EncoderStateArena::Assign(const std::vector<ncnn::Mat> &states) {
+  auto &current = views_[current_];
+  if (states.size() != current.size()) {
+    NCNN_LOGE("Number of encoder states mismatch: %d vs %d",
+              static_cast<int32_t>(states.size()),
+              static_cast<int32_t>(current.size()));
+    exit(-1);
+  }
+
+  for (size_t i = 0; i != states.size(); ++i) {
+    Store(i, states[i], &current[i]);
+  }
+}
+
+ncnn::Mat EncoderStateArena::Input(int32_t i) const {
+  const ncnn::Mat &v = views_[current_][i];
+
+  if (storage_ != EncoderStateStorage::kFloat32 && integer_states_[i]) {
+    // There is only one half and SetOutput() overwrites it, so the encoder
+    // gets a copy
+    return v.clone();
+  }
+
+  if (storage_ == EncoderStateStorage::kFloat32) {
+    return v;
+  }
+
+  ncnn::Mat ans = CreateLike(v, 4);
+  if (storage_ == EncoderStateStorage::kFloat16) {
+    ForEachRun(v, &ans, Float16ToFloat32);
+  } else {
+    ForEachRun(v, &ans, BFloat16ToFloat32);
+  }
+
+  return ans;
+}
+
+void EncoderStateArena::SetOutput(int32_t i, const ncnn::Mat &m) {
+  // With 16-bit storage, there is only one half and the encoder inputs
+  // have already been converted to separate fp32 Mats by Input()
+  int32_t next = num_halves_ == 2 ? 1 - current_ : current_;
+  Store(i, m, &views_[next][i]);
+}
+
+void EncoderStateArena::Store(int32_t i, const ncnn::Mat &src,
+                              ncnn::Mat *dst) const {
+  if (IsFloat32(i)) {
+    CopyMat(src, dst);
+    return;
+  }
+
+  if (src.elemsize != 4 || src.elempack != 1) {
+    NCNN_LOGE(
+        "Encoder states must be fp32 with elempack 1. Given: elemsize %d, "
+        "elempack %d",
+        static_cast<int32_t>(src.elemsize), src.elempack);
+    exit(-1);
+  }
+
+  // Convert into the arena directly, whatever the shape of src
+  if (storage_ == EncoderStateStorage::kFloat16) {
+    ForEachRun(src, dst, Float32ToFloat16);
+  } else {
+    ForEachRun(src, dst, Float32ToBFloat16);
+  }
+}
+
+std::vector<ncnn::Mat> EncoderStateArena::Clone() const {
+  std::vector<ncnn::Mat> ans;
+  ans.reserve(Current().size());
+  for (int32_t i = 0; i != NumStates(); ++i) {
+    ncnn::Mat m = Input(i);
+    ans.push_back(storage_ == EncoderStateStorage::kFloat32 ? m.clone() : m);
+  }
+  return ans;
+}
+
+const void *EncoderStateArena::Data() const {
+  return data_ ? data_ + current_ * half_bytes_ : nullptr;
+}
+
+bool EncoderStateArena::SetData(const void *data, size_t n) {
+  if (n != half_bytes_) {
+    return false;
+  }
+
+  if (n != 0) {
+    std::memcpy(data_ + current_ * half_bytes_, data, n);
+  }
+
+  return true;
+}
+
+void EncoderStateArena::CopyMat(const ncnn::Mat &src, ncnn::Mat *dst) {
+  if (src.elemsize != dst->elemsize) {
+    ShapeMismatch(src, *dst);
+  }
+
+  size_t elemsize = src.elemsize;
+  ForEachRun(src, dst,
+             [elemsize](const unsigned char *p, unsigned char *q, size_t n) {
+               std::memcpy(q, p, n * elemsize);
+             });
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,165 @@
+// sherpa-ncnn/csrc/encoder-state-arena.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_ENCODER_STATE_ARENA_H_
+#define SHERPA_NCNN_CSRC_ENCODER_STATE_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mat.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+enum class EncoderStateStorage {
+  kFloat32,
+  kFloat16,
+  kBFloat16,
+};
+
+/** Parse "fp32", "fp16" or "bf16". It exits on invalid names.
+ */
+EncoderStateStorage ParseEncoderStateStorage(const std::string &name);
+
+/** Storage for all encoder states of a stream.
+ *
+ * The states live in a single aligned buffer.
+ *
+ * With fp32 storage, the buffer is split into two halves with identical
+ * layout. One half holds the current states, which are fed to the encoder;
+ * the encoder outputs are written into the other half and the two halves
+ * are swapped afterwards. No memory is allocated per chunk.
+ *
+ * With fp16 or bf16 storage, there is only one half holding 16-bit states.
+ * Input() converts them to fp32 right before running the encoder and
+ * SetOutput() converts the encoder outputs back in place. It uses about
+ * a quarter of the memory of fp32 storage at the cost of two conversions
+ * per chunk. States marked as integer-valued, e.g., the frame counter
+ * cached_len of Zipformer, are kept in fp32 in that half since fp16
+ * holds integers exactly only up to 2048.
+ *
+ * In either case, the current states of a stream can be snapshotted with
+ * one memcpy of [Data(), Data() + NumBytes()).
+ *
+ * The states are exposed as ncnn::Mat views into the buffer. The views
+ * share a reference count that the arena pins, so ncnn neither frees them
+ * nor runs in-place layers on them (it clones shared blobs instead).
+ */
+class EncoderStateArena {
+ public:
+  EncoderStateArena() = default;
+  ~EncoderStateArena();
+
+  EncoderStateArena(const EncoderStateArena &) = delete;
+  EncoderStateArena &operator=(const EncoderStateArena &) = delete;
+
+  /** Allocate the buffer with the layout of the given fp32 states and copy
+   * them into the current half.
+   *
+   * It can be called again to replace the layout.
+   *
+   * @param states  The initial states in fp32.
+   * @param storage  Storage type of the states.
+   * @param integer_states  If integer_states[i] is true, states[i] holds
+   *                        integers and is always stored in fp32. It may
+   *                        be shorter than states; missing entries are
+   *                        false.
+   */
+  void Init(const std::vector<ncnn::Mat> &states,
+            EncoderStateStorage storage = EncoderStateStorage::kFloat32,
+            const std::vector<bool> &integer_states = {});
+
+  bool Empty() const { return data_ == nullptr; }
+
+  EncoderStateStorage Storage() const { return storage_; }
+
+  const std::vector<bool> &IntegerStates() const { return integer_states_; }
+
+  int32_t NumStates() const {
+    return static_cast<int32_t>(views_[current_].size());
+  }
+
+  /** Copy the given fp32 states into the current half. They must have the
+   * same number of elements as the states passed to Init(); their shapes
+   * may differ, e.g., an extra dimension of size 1.
+   */
+  void Assign(const std::vector<ncnn::Mat> &states);
+
+  /// Return the i-th current state as fp32 for feeding the encoder.
+  /// With fp32 storage, it is a view into the arena.
+  ncnn::Mat Input(int32_t i) const;
+
+  /// Store the i-th next state, which is given in fp32. With fp32
+  /// storage, it is written into the half not returned by Current().
+  void SetOutput(int32_t i, const ncnn::Mat &m);
+
+  /// Views of the current states in the storage type. Note: They are
+  /// overwritten by SetOutput() (16-bit storage) or by the second Swap()
+  /// after this call (fp32 storage).
+  const std::vector<ncnn::Mat> &Current() const { return views_[current_]; }
+
+  /// Make the next states the current ones.
+  void Swap() {
+    if (num_halves_ == 2) current_ = 1 - current_;
+  }
+
+  /// Return a deep copy of the current states in fp32.
+  std::vector<ncnn::Mat> Clone() const;
+
+  /// Start address of the current half.
+  const void *Data() const;
+
+  /// Overwrite the current half with n bytes previously obtained from
+  /// Data() of an arena with the same layout and storage type.
+  /// Return false if n does not match NumBytes().
+  bool SetData(const void *data, size_t n);
+
+  /// Number of bytes of one half.
+  size_t NumBytes() const { return half_bytes_; }
+
+  /// Number of bytes allocated by this arena.
+  size_t AllocatedBytes() const { return half_bytes_ * num_halves_; }
+
+  /** Copy src into dst element by element in row-major order.
+   *
+   * dst must be pre-allocated and contain the same number of elements as
+   * src. Padding caused by cstep is skipped in both Mats.
+   */
+  static void CopyMat(const ncnn::Mat &src, ncnn::Mat *dst);
+
+ private:
+  void Release();
+
+  // True if the i-th state is stored in fp32
+  bool IsFloat32(int32_t i) const {
+    return storage_ == EncoderStateStorage::kFloat32 || integer_states_[i];
+  }
+
+  // Convert the fp32 src to the storage type of the i-th state and write
+  // it into dst
+  void Store(int32_t i, const ncnn::Mat &src, ncnn::Mat *dst) const;
+
+ private:
+  EncoderStateStorage storage_ = EncoderStateStorage::kFloat32;
+
+  // One entry per state
+  std::vector<bool> integer_states_;
+
+  unsigned char *data_ = nullptr;
+  size_t half_bytes_ = 0;
+  int32_t num_halves_ = 2;
+  int32_t current_ = 0;
+
+  // Shared by all views. The arena holds one reference so that it never
+  // drops to 0.
+  int refcount_ = 1;
+
+  std::vector<ncnn::Mat> views_[2];
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_ENCODER_STATE_ARENA_H_
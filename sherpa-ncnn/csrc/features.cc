@@ -26,6 +26,7 @@
 #include "kaldi-native-fbank/csrc/online-feature.h"
 #include "mat.h"  // NOLINT
 #include "sherpa-ncnn/csrc/resample.h"
+#include "sherpa-ncnn/csrc/stage-timer.h"
 
 namespace sherpa_ncnn {
 
@@ -49,6 +50,16 @@ class FeatureExtractor::Impl {
     opts_.mel_opts.num_bins = config.feature_dim;
 
     fbank_ = std::make_unique<knf::OnlineFbank>(opts_);
+
+    // With snip_edges == false, frame i covers samples
+    // [i * shift + shift / 2 - size / 2, i * shift + shift / 2 + size / 2).
+    // The first few frames are padded by reflection, so we need to skip
+    // this number of frames after replaying samples from the middle of
+    // a waveform.
+    int32_t shift = opts_.frame_opts.WindowShift();
+    int32_t size = opts_.frame_opts.WindowSize();
+    int32_t lead = size / 2 - shift / 2;
+    num_padded_frames_ = lead > 0 ? (lead + shift - 1) / shift : 0;
   }
 
   void AcceptWaveform(int32_t sampling_rate, const float *waveform, int32_t n) {
@@ -64,8 +75,7 @@ class FeatureExtractor::Impl {
 
       std::vector<float> samples;
       resampler_->Resample(waveform, n, false, &samples);
-      fbank_->AcceptWaveform(opts_.frame_opts.samp_freq, samples.data(),
-                             samples.size());
+      AcceptSamples(samples.data(), samples.size());
       return;
     }
 
@@ -87,33 +97,42 @@ class FeatureExtractor::Impl {
 
       std::vector<float> samples;
       resampler_->Resample(waveform, n, false, &samples);
-      fbank_->AcceptWaveform(opts_.frame_opts.samp_freq, samples.data(),
-                             samples.size());
+      AcceptSamples(samples.data(), samples.size());
       return;
     }
 
-    fbank_->AcceptWaveform(sampling_rate, waveform, n);
+    AcceptSamples(waveform, n);
   }
 
   void InputFinished() {
     std::lock_guard<std::mutex> lock(mutex_);
     fbank_->InputFinished();
+    input_finished_ = true;
   }
 
   int32_t NumFramesReady() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return fbank_->NumFramesReady();
+    return fbank_->NumFramesReady() + frame_offset_;
+  }
+
+  int64_t NumBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Frames before last_frame_index_ have been popped from fbank_
+    int64_t num_frames =
+        fbank_->NumFramesReady() - (last_frame_index_ - frame_offset_);
+    return (num_frames * fbank_->Dim() + samples_.capacity()) * sizeof(float);
   }
 
   bool IsLastFrame(int32_t frame) const {
     std::lock_guard<std::mutex> lock(mutex_);
-    return fbank_->IsLastFrame(frame);
+    return fbank_->IsLastFrame(frame - frame_offset_);
   }
 
   ncnn::Mat GetFrames(int32_t frame_index, int32_t n) {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (frame_index + n > fbank_->NumFramesReady()) {
-      NCNN_LOGE("%d + %d > %d", frame_index, n, fbank_->NumFramesReady());
+    int32_t num_frames_ready = fbank_->NumFramesReady() + frame_offset_;
+    if (frame_index + n > num_frames_ready) {
+      NCNN_LOGE("%d + %d > %d", frame_index, n, num_frames_ready);
       exit(-1);
     }
 
@@ -131,7 +150,7 @@ class FeatureExtractor::Impl {
     features.create(feature_dim, n);
 
     for (int32_t i = 0; i != n; ++i) {
-      const float *f = fbank_->GetFrame(i + frame_index);
+      const float *f = fbank_->GetFrame(i + frame_index - frame_offset_);
       std::copy(f, f + feature_dim, features.row(i));
     }
 
@@ -140,12 +159,88 @@ class FeatureExtractor::Impl {
     return features;
   }
 
+  FeatureExtractorSnapshot GetSnapshot(int32_t first_frame) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (first_frame < last_frame_index_) {
+      NCNN_LOGE("first_frame: %d, last_frame_index_: %d", first_frame,
+                last_frame_index_);
+      exit(-1);
+    }
+
+    int32_t shift = opts_.frame_opts.WindowShift();
+
+    FeatureExtractorSnapshot ans;
+    ans.frame_offset = FirstKeptFrame(first_frame);
+    ans.last_frame_index = ans.frame_offset;
+    ans.input_finished = input_finished_;
+
+    int64_t begin = static_cast<int64_t>(ans.frame_offset) * shift;
+    int64_t skip = std::min<int64_t>(begin - samples_offset_, samples_.size());
+    ans.samples.assign(samples_.begin() + skip, samples_.end());
+
+    return ans;
+  }
+
+  void RestoreSnapshot(const FeatureExtractorSnapshot &snapshot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fbank_ = std::make_unique<knf::OnlineFbank>(opts_);
+    resampler_.reset();
+
+    frame_offset_ = snapshot.frame_offset;
+    last_frame_index_ = snapshot.last_frame_index;
+    samples_offset_ =
+        static_cast<int64_t>(frame_offset_) * opts_.frame_opts.WindowShift();
+    samples_.clear();
+
+    AcceptSamples(snapshot.samples.data(), snapshot.samples.size());
+
+    input_finished_ = snapshot.input_finished;
+    if (input_finished_) {
+      fbank_->InputFinished();
+    }
+  }
+
+ private:
+  // Return the first frame whose samples we need to keep so that frames
+  // starting from first_frame can be recomputed
+  int32_t FirstKeptFrame(int32_t first_frame) const {
+    return std::max(frame_offset_, first_frame - num_padded_frames_);
+  }
+
+  // Caller should hold the lock
+  void AcceptSamples(const float *samples, int32_t n) {
+    fbank_->AcceptWaveform(opts_.frame_opts.samp_freq, samples, n);
+
+    samples_.insert(samples_.end(), samples, samples + n);
+
+    // Discard samples that are not needed by GetSnapshot()
+    int64_t keep = static_cast<int64_t>(FirstKeptFrame(last_frame_index_)) *
+                   opts_.frame_opts.WindowShift();
+    if (keep > samples_offset_) {
+      int64_t num_discarded =
+          std::min<int64_t>(keep - samples_offset_, samples_.size());
+      samples_.erase(samples_.begin(), samples_.begin() + num_discarded);
+      samples_offset_ += num_discarded;
+    }
+  }
+
  private:
   std::unique_ptr<knf::OnlineFbank> fbank_;
   knf::FbankOptions opts_;
   mutable std::mutex mutex_;
   std::unique_ptr<LinearResample> resampler_;
   int32_t last_frame_index_ = 0;
+
+  // Frame i of fbank_ is frame i + frame_offset_ of the stream.
+  // It is non-zero only after RestoreSnapshot().
+  int32_t frame_offset_ = 0;
+  int32_t num_padded_frames_ = 0;
+  bool input_finished_ = false;
+
+  // Accepted samples starting at sample index samples_offset_.
+  // Kept for GetSnapshot().
+  std::vector<float> samples_;
+  int64_t samples_offset_ = 0;
 };
 
 FeatureExtractor::FeatureExtractor(const FeatureExtractorConfig &config)
@@ -155,15 +250,21 @@ FeatureExtractor::~FeatureExtractor() = default;
 
 void FeatureExtractor::AcceptWaveform(int32_t sampling_rate,
                                       const float *waveform, int32_t n) {
+  ScopedStage stage(Stage::kFbank);
   impl_->AcceptWaveform(sampling_rate, waveform, n);
 }
 
-void FeatureExtractor::InputFinished() { impl_->InputFinished(); }
+void FeatureExtractor::InputFinished() {
+  ScopedStage stage(Stage::kFbank);
+  impl_->InputFinished();
+}
 
 int32_t FeatureExtractor::NumFramesReady() const {
   return impl_->NumFramesReady();
 }
 
+int64_t FeatureExtractor::NumBytes() const { return impl_->NumBytes(); }
+
 bool FeatureExtractor::IsLastFrame(int32_t frame) const {
   return impl_->IsLastFrame(frame);
 }
@@ -172,4 +273,14 @@ ncnn::Mat FeatureExtractor::GetFrames(int32_t frame_index, int32_t n) const {
   return impl_->GetFrames(frame_index, n);
 }
 
+FeatureExtractorSnapshot FeatureExtractor::GetSnapshot(
+    int32_t first_frame) const {
+  return impl_->GetSnapshot(first_frame);
+}
+
+void FeatureExtractor::RestoreSnapshot(
+    const FeatureExtractorSnapshot &snapshot) {
+  impl_->RestoreSnapshot(snapshot);
+}
+
 }  // namespace sherpa_ncnn
@@ -21,6 +21,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace ncnn {
 class Mat;
@@ -35,6 +36,24 @@ struct FeatureExtractorConfig {
   std::string ToString() const;
 };
 
+/** Internal state of a FeatureExtractor that is needed to compute the
+ * remaining frames. See FeatureExtractor::GetSnapshot().
+ */
+struct FeatureExtractorSnapshot {
+  // Index of the first frame that can be computed from samples.
+  // Frames before it are not available after restoring.
+  int32_t frame_offset = 0;
+
+  // Frames before it have already been popped
+  int32_t last_frame_index = 0;
+
+  bool input_finished = false;
+
+  // Samples starting at sample index frame_offset * frame_shift.
+  // If the input is resampled, they are samples after resampling.
+  std::vector<float> samples;
+};
+
 class FeatureExtractor {
  public:
   explicit FeatureExtractor(const FeatureExtractorConfig &config);
@@ -59,6 +78,10 @@ class FeatureExtractor {
 
   int32_t NumFramesReady() const;
 
+  // Bytes held by the frames that have not been popped by GetFrames() and
+  // the samples kept for GetSnapshot()
+  int64_t NumBytes() const;
+
   // Note: IsLastFrame() will only ever return true if you have called
   // InputFinished() (and this frame is the last frame).
   bool IsLastFrame(int32_t frame) const;
@@ -72,6 +95,26 @@ class FeatureExtractor {
    */
   ncnn::Mat GetFrames(int32_t frame_index, int32_t n) const;
 
+  /** Return the state needed to compute frames starting from first_frame.
+   *
+   * Frames are computed only from samples inside their windows, so the
+   * snapshot keeps the samples covering those frames and restoring replays
+   * them. The restored frames are bit-identical to the original ones.
+   *
+   * @param first_frame  Index of the first frame the caller still needs.
+   *                     It must not be less than the frame_index passed
+   *                     to the last call of GetFrames().
+   */
+  FeatureExtractorSnapshot GetSnapshot(int32_t first_frame) const;
+
+  /** Replace the state of this object with the given snapshot.
+   *
+   * Caution: If the input is resampled, the history of the resampler is
+   * not part of the snapshot. Samples accepted after restoring may differ
+   * slightly at the boundary.
+   */
+  void RestoreSnapshot(const FeatureExtractorSnapshot &snapshot);
+
  private:
   class Impl;
   std::unique_ptr<Impl> impl_;
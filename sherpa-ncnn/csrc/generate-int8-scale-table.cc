@@ -22,19 +22,33 @@
 
 #include <float.h>
 #include <stdio.h>  // for FLT_MAX
+#include <stdlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT
+#include <cmath>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <tuple>
 #include <vector>
 
 #include "kaldi-native-fbank/csrc/online-feature.h"
 #include "layer/convolution.h"
 #include "layer/convolutiondepthwise.h"
 #include "layer/innerproduct.h"
+#include "layer.h"
 #include "mat.h"
+#include "modelbin.h"
 #include "net.h"
 #include "sherpa-ncnn/csrc/features.h"
 #include "sherpa-ncnn/csrc/model.h"
+#include "sherpa-ncnn/csrc/parse-options.h"
 #include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/thread-budget.h"
 #include "sherpa-ncnn/csrc/wave-reader.h"
 
 static float compute_kl_divergence(const std::vector<float> &a,
@@ -244,29 +258,617 @@ float compute_kl_threshold(QuantBlobStat &stat, int num_histogram_bins = 2048) {
   return scale;
 }
 
+// ACIQ: the clipping threshold of a gaussian with the given absmax over N
+// values. See https://arxiv.org/abs/1810.05723
+static float compute_aciq_gaussian_clip(float absmax, int N,
+                                        int num_bits = 8) {
+  const float alpha_gaussian[8] = {0,          1.71063519, 2.15159277,
+                                   2.55913646, 2.93620062, 3.28691474,
+                                   3.6151146,  3.92403714};
+
+  const double gaussian_const =
+      (0.5 * 0.35) * (1 + sqrt(3.14159265358979323846 * log(4)));
+
+  double std = (absmax * 2 * gaussian_const) / sqrt(2 * log(N));
+
+  return std::min(absmax, (float)(alpha_gaussian[num_bits - 1] * std));
+}
+
+// Scale of weights whose absmax is given. With ACIQ, they are clipped to
+// the gaussian threshold of their N values.
+static float compute_weight_scale(float absmax, int N, int num_bits,
+                                  bool aciq) {
+  float threshold =
+      aciq ? compute_aciq_gaussian_clip(absmax, N, num_bits) : absmax;
+
+  return ((1 << (num_bits - 1)) - 1) / threshold;
+}
+
+static float compute_cosine_similarity(const ncnn::Mat &a,
+                                       const ncnn::Mat &b) {
+  double dot = 0;
+  double norm_a = 0;
+  double norm_b = 0;
+
+  const int size = a.w * a.h * a.d;
+  for (int p = 0; p < a.c; p++) {
+    const float *pa = a.channel(p);
+    const float *pb = b.channel(p);
+    for (int k = 0; k < size; k++) {
+      dot += (double)pa[k] * pb[k];
+      norm_a += (double)pa[k] * pa[k];
+      norm_b += (double)pb[k] * pb[k];
+    }
+  }
+
+  return (float)(dot / (sqrt(norm_a) * sqrt(norm_b) + 1e-20));
+}
+
+static float compute_absmax(const ncnn::Mat &out) {
+  float absmax = 0.f;
+
+  const int outc = out.c;
+  const int outsize = out.w * out.h;
+  for (int p = 0; p < outc; p++) {
+    const float *ptr = out.channel(p);
+    for (int k = 0; k < outsize; k++) {
+      absmax = std::max(absmax, (float)fabs(ptr[k]));
+    }
+  }
+
+  return absmax;
+}
+
+static void add_to_histogram(const ncnn::Mat &out, float absmax,
+                             std::vector<uint64_t> *histogram) {
+  const int num_histogram_bins = (int)histogram->size();
+
+  const int outc = out.c;
+  const int outsize = out.w * out.h;
+  for (int p = 0; p < outc; p++) {
+    const float *ptr = out.channel(p);
+    for (int k = 0; k < outsize; k++) {
+      if (ptr[k] == 0.f) continue;
+
+      const int index =
+          std::min((int)(fabs(ptr[k]) / absmax * num_histogram_bins),
+                   (num_histogram_bins - 1));
+
+      (*histogram)[index] += 1;
+    }
+  }
+}
+
+// Call f(worker, i) for each i in [0, n) from num_workers threads. A thread
+// takes the next i when it is done with the previous one.
+static void run_workers(int num_workers, int n,
+                        const std::function<void(int, int)> &f) {
+  std::atomic<int> next{0};
+
+  std::vector<std::thread> threads;
+  for (int w = 0; w < num_workers; w++) {
+    threads.emplace_back([&next, &f, n, w]() {
+      for (int i = next++; i < n; i = next++) {
+        f(w, i);
+      }
+    });
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+// Features of the calibration waves. They are computed in the first pass
+// over the waves and kept for the following passes as long as the total
+// size stays below the limit.
+class FeatureCache {
+ public:
+  FeatureCache(const std::vector<std::string> &filenames, size_t max_bytes)
+      : filenames_(filenames),
+        features_(filenames.size()),
+        max_bytes_(max_bytes) {}
+
+  int size() const { return (int)filenames_.size(); }
+
+  // Return an empty mat if the file cannot be read. Different i can be
+  // used from different threads.
+  ncnn::Mat get(int i) {
+    if (!features_[i].empty()) return features_[i];
+
+    ncnn::Mat features = compute(filenames_[i]);
+
+    size_t bytes = features.total() * features.elemsize;
+    if (used_bytes_.fetch_add(bytes) + bytes <= max_bytes_) {
+      features_[i] = features;
+    } else {
+      used_bytes_ -= bytes;
+    }
+
+    return features;
+  }
+
+ private:
+  static ncnn::Mat compute(const std::string &filename) {
+    float expected_sampling_rate = 16000;
+
+    bool is_ok = false;
+    std::vector<float> samples =
+        sherpa_ncnn::ReadWave(filename, expected_sampling_rate, &is_ok);
+    if (!is_ok) {
+      fprintf(stderr, "Failed to read %s\n", filename.c_str());
+      return ncnn::Mat();
+    }
+    fprintf(stderr, "Processing %s\n", filename.c_str());
+
+    sherpa_ncnn::FeatureExtractorConfig config;
+    config.sampling_rate = expected_sampling_rate;
+    config.feature_dim = 80;
+    sherpa_ncnn::FeatureExtractor feature_extractor(config);
+    feature_extractor.AcceptWaveform(expected_sampling_rate, samples.data(),
+                                     samples.size());
+    feature_extractor.InputFinished();
+
+    int32_t n = feature_extractor.NumFramesReady();
+    if (n == 0) return ncnn::Mat();
+
+    return feature_extractor.GetFrames(0, n);
+  }
+
+ private:
+  std::vector<std::string> filenames_;
+  std::vector<ncnn::Mat> features_;
+  size_t max_bytes_;
+  std::atomic<size_t> used_bytes_{0};
+};
+
+// Called with the extractor, the input chunk and the output of the encoder
+using EncoderCallback =
+    std::function<void(ncnn::Extractor &, const ncnn::Mat &chunk,
+                       const ncnn::Mat &encoder_out)>;
+
+// Called with the extractor, the two inputs and the output of the joiner
+using JoinerCallback = std::function<void(
+    ncnn::Extractor &, const ncnn::Mat &encoder_out,
+    const ncnn::Mat &decoder_out, const ncnn::Mat &joiner_out)>;
+
+// Run greedy search over the features of a wave. on_encoder() is called
+// for each chunk after running the encoder, and on_joiner() for each frame
+// after running the joiner.
+static void run_greedy_search(sherpa_ncnn::Model *model,
+                              const ncnn::Mat &features,
+                              ncnn::Allocator *blob_allocator,
+                              ncnn::Allocator *workspace_allocator,
+                              const EncoderCallback &on_encoder,
+                              const JoinerCallback &on_joiner) {
+  int32_t segment = model->Segment();
+  int32_t offset = model->Offset();
+  int32_t context_size = model->ContextSize();
+  int32_t blank_id = model->BlankId();
+
+  std::vector<int32_t> hyp(context_size, blank_id);
+
+  ncnn::Mat decoder_input(context_size);
+  for (int32_t i = 0; i != context_size; ++i) {
+    static_cast<int32_t *>(decoder_input)[i] = blank_id;
+  }
+
+  ncnn::Mat decoder_out = model->RunDecoder(decoder_input);
+
+  std::vector<ncnn::Mat> states;
+  ncnn::Mat encoder_out;
+
+  for (int32_t start = 0; start + segment <= features.h; start += offset) {
+    ncnn::Extractor encoder_ex = model->GetEncoder().create_extractor();
+    encoder_ex.set_light_mode(false);
+    encoder_ex.set_blob_allocator(blob_allocator);
+    encoder_ex.set_workspace_allocator(workspace_allocator);
+
+    ncnn::Extractor joiner_ex = model->GetJoiner().create_extractor();
+    joiner_ex.set_light_mode(false);
+    joiner_ex.set_blob_allocator(blob_allocator);
+    joiner_ex.set_workspace_allocator(workspace_allocator);
+
+    ncnn::Mat chunk = features.row_range(start, segment).clone();
+    std::tie(encoder_out, states) =
+        model->RunEncoder(chunk, states, &encoder_ex);
+
+    on_encoder(encoder_ex, chunk, encoder_out);
+
+    for (int32_t t = 0; t != encoder_out.h; ++t) {
+      ncnn::Mat encoder_out_t(encoder_out.w, encoder_out.row(t));
+      ncnn::Mat joiner_out =
+          model->RunJoiner(encoder_out_t, decoder_out, &joiner_ex);
+
+      on_joiner(joiner_ex, encoder_out_t, decoder_out, joiner_out);
+
+      auto y = static_cast<int32_t>(std::distance(
+          static_cast<const float *>(joiner_out),
+          std::max_element(
+              static_cast<const float *>(joiner_out),
+              static_cast<const float *>(joiner_out) + joiner_out.w)));
+
+      if (y != blank_id) {
+        static_cast<int32_t *>(decoder_input)[0] = hyp.back();
+        static_cast<int32_t *>(decoder_input)[1] = y;
+        hyp.push_back(y);
+
+        decoder_out = model->RunDecoder(decoder_input);
+      }
+    }  // for (int32_t t = 0; t != encoder_out.h; ++t)
+  }
+}
+
+// Params and weights shared by Convolution and ConvolutionDepthWise
+template <typename Conv>
+static void get_conv_param(const Conv *c, ncnn::ParamDict *pd,
+                           ncnn::Mat *weights) {
+  pd->set(0, c->num_output);
+  pd->set(1, c->kernel_w);
+  pd->set(11, c->kernel_h);
+  pd->set(2, c->dilation_w);
+  pd->set(12, c->dilation_h);
+  pd->set(3, c->stride_w);
+  pd->set(13, c->stride_h);
+  pd->set(4, c->pad_left);
+  pd->set(15, c->pad_right);
+  pd->set(14, c->pad_top);
+  pd->set(16, c->pad_bottom);
+  pd->set(18, c->pad_value);
+  pd->set(5, c->bias_term);
+  pd->set(6, c->weight_data_size);
+  pd->set(9, c->activation_type);
+  pd->set(10, c->activation_params);
+
+  weights[0] = c->weight_data;
+  weights[1] = c->bias_data;
+}
+
+// An int8 copy of a Convolution, ConvolutionDepthWise or InnerProduct
+// layer with the given scales. Return nullptr for other layers.
+static ncnn::Layer *create_int8_layer(const ncnn::Layer *layer,
+                                      const ncnn::Mat &weight_scales,
+                                      const ncnn::Mat &bottom_blob_scales,
+                                      const ncnn::Option &opt) {
+  ncnn::ParamDict pd;
+  ncnn::Mat weights[4];
+  int bias_term = 0;
+
+  if (layer->type == "Convolution") {
+    const ncnn::Convolution *c = (const ncnn::Convolution *)layer;
+    get_conv_param(c, &pd, weights);
+    bias_term = c->bias_term;
+  } else if (layer->type == "ConvolutionDepthWise") {
+    const ncnn::ConvolutionDepthWise *c =
+        (const ncnn::ConvolutionDepthWise *)layer;
+    get_conv_param(c, &pd, weights);
+    pd.set(7, c->group);
+    bias_term = c->bias_term;
+  } else if (layer->type == "InnerProduct") {
+    const ncnn::InnerProduct *c = (const ncnn::InnerProduct *)layer;
+    pd.set(0, c->num_output);
+    pd.set(1, c->bias_term);
+    pd.set(2, c->weight_data_size);
+    pd.set(9, c->activation_type);
+    pd.set(10, c->activation_params);
+
+    weights[0] = c->weight_data;
+    weights[1] = c->bias_data;
+    bias_term = c->bias_term;
+  } else {
+    return nullptr;
+  }
+
+  pd.set(8, 1);  // int8_scale_term
+
+  // The scales follow the bias, if any
+  const int k = bias_term ? 2 : 1;
+  weights[k] = weight_scales;
+  weights[k + 1] = bottom_blob_scales;
+
+  // Copy what the net sets, so the int8 layer can replace the original one
+  ncnn::Layer *layer_int8 = ncnn::create_layer(layer->typeindex);
+  layer_int8->type = layer->type;
+  layer_int8->name = layer->name;
+  layer_int8->bottoms = layer->bottoms;
+  layer_int8->tops = layer->tops;
+  layer_int8->bottom_shapes = layer->bottom_shapes;
+  layer_int8->top_shapes = layer->top_shapes;
+  layer_int8->featmask = layer->featmask;
+
+  layer_int8->load_param(pd);
+  layer_int8->load_model(ncnn::ModelBinFromMatArray(weights));
+  layer_int8->create_pipeline(opt);
+
+  return layer_int8;
+}
+
+// Inputs and fp32 outputs of a layer
+struct LayerSamples {
+  std::vector<ncnn::Mat> inputs;
+  std::vector<ncnn::Mat> outputs;
+};
+
+// Average cosine similarity of the int8 outputs with the fp32 outputs
+static float compute_int8_similarity(const ncnn::Layer *layer,
+                                     const ncnn::Mat &weight_scales,
+                                     const ncnn::Mat &bottom_blob_scales,
+                                     const LayerSamples &samples) {
+  ncnn::Option opt;
+  opt.num_threads = 1;
+  opt.use_packing_layout = false;
+  opt.use_fp16_packed = false;
+  opt.use_fp16_storage = false;
+  opt.use_fp16_arithmetic = false;
+  opt.use_int8_inference = true;
+
+  ncnn::Layer *layer_int8 =
+      create_int8_layer(layer, weight_scales, bottom_blob_scales, opt);
+  if (!layer_int8) return 0;
+
+  double sum = 0;
+  for (size_t i = 0; i < samples.inputs.size(); i++) {
+    ncnn::Mat out;
+    layer_int8->forward(samples.inputs[i], out, opt);
+    sum += compute_cosine_similarity(samples.outputs[i], out);
+  }
+
+  layer_int8->destroy_pipeline(opt);
+  delete layer_int8;
+
+  return (float)(sum / std::max((size_t)1, samples.inputs.size()));
+}
+
+// EQ: search a factor for the weight scales of a layer and then one for
+// its bottom blob scale that keep the int8 outputs closest to the fp32
+// outputs
+static void equalize_layer(const ncnn::Layer *layer,
+                           const LayerSamples &samples,
+                           ncnn::Mat *weight_scales,
+                           ncnn::Mat *bottom_blob_scales) {
+  const float scale_range_lower = 0.5f;
+  const float scale_range_upper = 2.0f;
+  const int search_steps = 100;
+
+  if (samples.inputs.empty()) return;
+
+  for (int pass = 0; pass < 2; pass++) {
+    ncnn::Mat &scales = pass == 0 ? *weight_scales : *bottom_blob_scales;
+    const ncnn::Mat old_scales = scales.clone();
+
+    float best_similarity = -1.f;
+    float best_factor = 1.f;
+    for (int k = 0; k <= search_steps; k++) {
+      const float factor = scale_range_lower + (scale_range_upper -
+                                                scale_range_lower) *
+                                                   k / search_steps;
+      for (int j = 0; j < scales.w; j++) {
+        scales[j] = old_scales[j] * factor;
+      }
+
+      float similarity = compute_int8_similarity(layer, *weight_scales,
+                                                 *bottom_blob_scales, samples);
+      if (similarity > best_similarity) {
+        best_similarity = similarity;
+        best_factor = factor;
+      }
+    }
+
+    for (int j = 0; j < scales.w; j++) {
+      scales[j] = old_scales[j] * best_factor;
+    }
+  }
+}
+
+// Outputs of the float model on the first chunks of the waves. They are
+// the reference of the sensitivity analysis.
+struct ReferenceOutputs {
+  // chunks[i] and encoder_out[i] are the chunks of wave i
+  std::vector<std::vector<ncnn::Mat>> chunks;
+  std::vector<std::vector<ncnn::Mat>> encoder_out;
+
+  // All frames of the chunks above
+  std::vector<ncnn::Mat> joiner_encoder_out;
+  std::vector<ncnn::Mat> joiner_decoder_out;
+  std::vector<ncnn::Mat> joiner_out;
+
+  // in seconds
+  float duration = 0;
+};
+
+static void record_reference(sherpa_ncnn::Model *model, FeatureCache *cache,
+                             int num_chunks, ReferenceOutputs *ref) {
+  // shift of the 80-dim fbank is 10 ms
+  const float chunk_duration = model->Offset() * 0.01f;
+
+  int count = 0;
+  for (int i = 0; i < cache->size() && count < num_chunks; i++) {
+    ncnn::Mat features = cache->get(i);
+    if (features.empty()) continue;
+
+    ncnn::UnlockedPoolAllocator blob_allocator;
+    ncnn::UnlockedPoolAllocator workspace_allocator;
+
+    ref->chunks.emplace_back();
+    ref->encoder_out.emplace_back();
+
+    bool recording = true;
+    run_greedy_search(
+        model, features, &blob_allocator, &workspace_allocator,
+        [&](ncnn::Extractor &, const ncnn::Mat &chunk,
+            const ncnn::Mat &encoder_out) {
+          // Stop at a chunk boundary, so the joiner frames match the chunks
+          recording = count < num_chunks;
+          if (!recording) return;
+          count += 1;
+
+          ref->chunks.back().push_back(chunk.clone());
+          ref->encoder_out.back().push_back(encoder_out.clone());
+          ref->duration += chunk_duration;
+        },
+        [&](ncnn::Extractor &, const ncnn::Mat &encoder_out,
+            const ncnn::Mat &decoder_out, const ncnn::Mat &joiner_out) {
+          if (!recording) return;
+
+          ref->joiner_encoder_out.push_back(encoder_out.clone());
+          ref->joiner_decoder_out.push_back(decoder_out.clone());
+          ref->joiner_out.push_back(joiner_out.clone());
+        });
+  }
+}
+
+// Run the encoder over the reference chunks. Return the mean of
+// 1 - cosine similarity of its outputs with the reference. If seconds is
+// not nullptr, it is set to the time taken.
+static float compute_encoder_error(sherpa_ncnn::Model *model,
+                                   const ReferenceOutputs &ref,
+                                   double *seconds = nullptr) {
+  double sum = 0;
+  int n = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ref.chunks.size(); i++) {
+    std::vector<ncnn::Mat> states;
+    for (size_t k = 0; k < ref.chunks[i].size(); k++) {
+      ncnn::Mat chunk = ref.chunks[i][k];
+
+      ncnn::Mat encoder_out;
+      std::tie(encoder_out, states) = model->RunEncoder(chunk, states);
+
+      sum += 1 - compute_cosine_similarity(encoder_out, ref.encoder_out[i][k]);
+      n += 1;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  if (seconds) {
+    *seconds = std::chrono::duration<double>(end - start).count();
+  }
+
+  return (float)(sum / std::max(n, 1));
+}
+
+// Like compute_encoder_error() but for the joiner on the reference frames
+static float compute_joiner_error(sherpa_ncnn::Model *model,
+                                  const ReferenceOutputs &ref,
+                                  double *seconds = nullptr) {
+  double sum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ref.joiner_out.size(); i++) {
+    ncnn::Mat encoder_out = ref.joiner_encoder_out[i];
+    ncnn::Mat decoder_out = ref.joiner_decoder_out[i];
+
+    ncnn::Mat joiner_out = model->RunJoiner(encoder_out, decoder_out);
+
+    sum += 1 - compute_cosine_similarity(joiner_out, ref.joiner_out[i]);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  if (seconds) {
+    *seconds = std::chrono::duration<double>(end - start).count();
+  }
+
+  return (float)(sum / std::max((size_t)1, ref.joiner_out.size()));
+}
+
+// Choose the layers to keep in float. The least sensitive layers are
+// quantized as long as the sum of their errors stays within the budget.
+static std::vector<bool> plan_float_layers(
+    const std::vector<float> &sensitivity, float budget) {
+  std::vector<int> order(sensitivity.size());
+  for (int i = 0; i < (int)order.size(); i++) {
+    order[i] = i;
+  }
+
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return sensitivity[a] < sensitivity[b];
+  });
+
+  std::vector<bool> keep_float(sensitivity.size(), true);
+
+  float sum = 0;
+  for (int i : order) {
+    if (sum + sensitivity[i] > budget) break;
+
+    sum += sensitivity[i];
+    keep_float[i] = false;
+  }
+
+  return keep_float;
+}
+
 class QuantNet : public ncnn::Net {
  public:
-  QuantNet(sherpa_ncnn::Model *model);
+  // models[0] is used for the layers and the weights. Each model is used
+  // by one worker thread during calibration.
+  explicit QuantNet(const std::vector<sherpa_ncnn::Model *> &models);
 
+  std::vector<sherpa_ncnn::Model *> models;
   sherpa_ncnn::Model *model;
   std::vector<ncnn::Layer *> &encoder_layers;
   std::vector<ncnn::Layer *> &joiner_layers;
 
+  // Features larger than this are computed again in each pass
+  size_t feature_cache_bytes = (size_t)2 << 30;
+
  public:
   int init();
   void print_quant_info() const;
   int save_table_encoder(const char *tablepath);
   int save_table_joiner(const char *tablepath);
   int quantize_KL(const std::vector<std::string> &wave_filenames);
-  int quantize_ACIQ();
-  int quantize_EQ();
+  int quantize_ACIQ(const std::vector<std::string> &wave_filenames);
+  int quantize_EQ(const std::vector<std::string> &wave_filenames);
+
+  // Measure the error of the network outputs when only one layer is int8.
+  // One of the quantize_*() methods must be called first.
+  int analyze_sensitivity(const std::vector<std::string> &wave_filenames,
+                          int num_chunks);
+
+  // Keep the most sensitive layers in float, so the summed errors of the
+  // int8 layers of each network stay within the budget. The float layers
+  // are left out of the tables.
+  void plan_mixed_precision(float budget);
+
+  void print_sensitivity() const;
+
+  // Print the errors and the RTF of the float, mixed and int8 models
+  void report_mixed_precision();
 
  private:
   int init_encoder();
   int init_joiner();
 
-  void quantize_encoder_weight();
-  void quantize_joiner_weight();
+  void quantize_encoder_weight(bool aciq);
+  void quantize_joiner_weight(bool aciq);
+
+  // Run all models over the waves in parallel. update() is called for the
+  // bottom blob j of the encoder or joiner conv layers with the index of
+  // the worker.
+  void run_pass(FeatureCache *cache,
+                const std::function<void(int worker, bool encoder, int j,
+                                         const ncnn::Mat &out)> &update);
+
+  // Set absmax and total of the blob stats
+  void count_absmax(FeatureCache *cache);
+
+  // Set the histograms of the blob stats. count_absmax() must be called
+  // first.
+  void count_histogram(FeatureCache *cache, int num_histogram_bins);
+
+  // Replace conv layer i of the encoder or joiner of m by an int8 copy
+  // with the current scales. Return the replaced layer.
+  ncnn::Layer *swap_to_int8(sherpa_ncnn::Model *m, bool encoder, int i);
+
+  // Undo swap_to_int8()
+  void swap_back(sherpa_ncnn::Model *m, bool encoder, int i,
+                 ncnn::Layer *layer);
+
+  // Run model over the reference with the given layers in int8
+  void measure(const std::vector<bool> &encoder_int8,
+               const std::vector<bool> &joiner_int8, float *encoder_error,
+               float *joiner_error, double *seconds);
 
  public:
   std::vector<int> encoder_conv_layers;
@@ -283,10 +885,18 @@ class QuantNet : public ncnn::Net {
   std::vector<QuantBlobStat> joiner_quant_blob_stats;
   std::vector<ncnn::Mat> joiner_weight_scales;
   std::vector<ncnn::Mat> joiner_bottom_blob_scales;
+
+  // mixed precision
+  ReferenceOutputs reference;
+  std::vector<float> encoder_sensitivity;
+  std::vector<float> joiner_sensitivity;
+  std::vector<bool> encoder_keep_float;
+  std::vector<bool> joiner_keep_float;
 };
 
-QuantNet::QuantNet(sherpa_ncnn::Model *model)
-    : model(model),
+QuantNet::QuantNet(const std::vector<sherpa_ncnn::Model *> &models)
+    : models(models),
+      model(models[0]),
       encoder_layers(model->GetEncoder().mutable_layers()),
       joiner_layers(model->GetJoiner().mutable_layers()) {}
 
@@ -311,6 +921,7 @@ int QuantNet::init_encoder() {
   encoder_quant_blob_stats.resize(encoder_conv_bottom_blob_count);
   encoder_weight_scales.resize(encoder_conv_layer_count);
   encoder_bottom_blob_scales.resize(encoder_conv_bottom_blob_count);
+  encoder_keep_float.resize(encoder_conv_layer_count, false);
 
   return 0;
 }
@@ -336,6 +947,7 @@ int QuantNet::init_joiner() {
   joiner_quant_blob_stats.resize(joiner_conv_bottom_blob_count);
   joiner_weight_scales.resize(joiner_conv_layer_count);
   joiner_bottom_blob_scales.resize(joiner_conv_bottom_blob_count);
+  joiner_keep_float.resize(joiner_conv_layer_count, false);
 
   return 0;
 }
@@ -347,7 +959,7 @@ int QuantNet::init() {
   return 0;
 }
 
-void QuantNet::quantize_encoder_weight() {
+void QuantNet::quantize_encoder_weight(bool aciq) {
   const int encoder_conv_layer_count = (int)encoder_conv_layers.size();
 
   for (int i = 0; i < encoder_conv_layer_count; i++) {
@@ -383,11 +995,8 @@ void QuantNet::quantize_encoder_weight() {
           absmax = std::max(absmax, (float)fabs(weight_data_n[k]));
         }
 
-        if (quant_6bit) {
-          encoder_weight_scales[i][n] = 31 / absmax;
-        } else {
-          encoder_weight_scales[i][n] = 127 / absmax;
-        }
+        encoder_weight_scales[i][n] = compute_weight_scale(
+            absmax, weight_data_size_output, quant_6bit ? 6 : 8, aciq);
       }
     }  // if (layer->type == "Convolution")
 
@@ -412,7 +1021,8 @@ void QuantNet::quantize_encoder_weight() {
           absmax = std::max(absmax, (float)fabs(weight_data_n[k]));
         }
 
-        encoder_weight_scales[i][n] = 127 / absmax;
+        encoder_weight_scales[i][n] =
+            compute_weight_scale(absmax, weight_data_size_output, 8, aciq);
       }
     }  // if (layer->type == "ConvolutionDepthWise")
 
@@ -435,13 +1045,14 @@ void QuantNet::quantize_encoder_weight() {
           absmax = std::max(absmax, (float)fabs(weight_data_n[k]));
         }
 
-        encoder_weight_scales[i][n] = 127 / absmax;
+        encoder_weight_scales[i][n] =
+            compute_weight_scale(absmax, weight_data_size_output, 8, aciq);
       }
     }  // if (layer->type == "InnerProduct")
   }    // for (int i = 0; i < encoder_conv_layer_count; i++)
 }
 
-void QuantNet::quantize_joiner_weight() {
+void QuantNet::quantize_joiner_weight(bool aciq) {
   const int joiner_conv_layer_count = (int)joiner_conv_layers.size();
 
   for (int i = 0; i < joiner_conv_layer_count; i++) {
@@ -477,11 +1088,8 @@ void QuantNet::quantize_joiner_weight() {
           absmax = std::max(absmax, (float)fabs(weight_data_n[k]));
         }
 
-        if (quant_6bit) {
-          joiner_weight_scales[i][n] = 31 / absmax;
-        } else {
-          joiner_weight_scales[i][n] = 127 / absmax;
-        }
+        joiner_weight_scales[i][n] = compute_weight_scale(
+            absmax, weight_data_size_output, quant_6bit ? 6 : 8, aciq);
       }
     }  // if (layer->type == "Convolution")
 
@@ -506,7 +1114,8 @@ void QuantNet::quantize_joiner_weight() {
           absmax = std::max(absmax, (float)fabs(weight_data_n[k]));
         }
 
-        joiner_weight_scales[i][n] = 127 / absmax;
+        joiner_weight_scales[i][n] =
+            compute_weight_scale(absmax, weight_data_size_output, 8, aciq);
       }
     }  // if (layer->type == "ConvolutionDepthWise")
 
@@ -529,337 +1138,474 @@ void QuantNet::quantize_joiner_weight() {
           absmax = std::max(absmax, (float)fabs(weight_data_n[k]));
         }
 
-        joiner_weight_scales[i][n] = 127 / absmax;
+        joiner_weight_scales[i][n] =
+            compute_weight_scale(absmax, weight_data_size_output, 8, aciq);
       }
     }  // if (layer->type == "InnerProduct")
   }    // for (int i = 0; i < joiner_conv_layer_count; i++)
 }
 
-int QuantNet::quantize_KL(const std::vector<std::string> &wave_filenames) {
-  const int encoder_conv_bottom_blob_count =
-      (int)encoder_conv_bottom_blobs.size();
+void QuantNet::run_pass(
+    FeatureCache *cache,
+    const std::function<void(int worker, bool encoder, int j,
+                             const ncnn::Mat &out)> &update) {
+  const int num_workers = (int)models.size();
+
+  std::vector<ncnn::UnlockedPoolAllocator> blob_allocators(num_workers);
+  std::vector<ncnn::UnlockedPoolAllocator> workspace_allocators(num_workers);
+
+  run_workers(num_workers, cache->size(), [&](int w, int i) {
+    ncnn::Mat features = cache->get(i);
+    if (features.empty()) return;
+
+    run_greedy_search(
+        models[w], features, &blob_allocators[w], &workspace_allocators[w],
+        [&](ncnn::Extractor &encoder_ex, const ncnn::Mat & /*chunk*/,
+            const ncnn::Mat & /*encoder_out*/) {
+          for (int j = 0; j < (int)encoder_conv_bottom_blobs.size(); j++) {
+            ncnn::Mat out;
+            encoder_ex.extract(encoder_conv_bottom_blobs[j], out);
+            update(w, true, j, out);
+          }
+        },
+        [&](ncnn::Extractor &joiner_ex, const ncnn::Mat &, const ncnn::Mat &,
+            const ncnn::Mat &) {
+          for (int j = 0; j < (int)joiner_conv_bottom_blobs.size(); j++) {
+            ncnn::Mat out;
+            joiner_ex.extract(joiner_conv_bottom_blobs[j], out);
+            update(w, false, j, out);
+          }
+        });
+  });
+}
 
-  const int joiner_conv_bottom_blob_count =
-      (int)joiner_conv_bottom_blobs.size();
+void QuantNet::count_absmax(FeatureCache *cache) {
+  const int num_workers = (int)models.size();
+
+  std::vector<std::vector<QuantBlobStat>> encoder_stats(
+      num_workers, encoder_quant_blob_stats);
+  std::vector<std::vector<QuantBlobStat>> joiner_stats(num_workers,
+                                                       joiner_quant_blob_stats);
+
+  run_pass(cache, [&](int w, bool encoder, int j, const ncnn::Mat &out) {
+    QuantBlobStat &stat = encoder ? encoder_stats[w][j] : joiner_stats[w][j];
+    stat.absmax = std::max(stat.absmax, compute_absmax(out));
+    stat.total = std::max(stat.total, (int)out.total());
+  });
+
+  // merge the workers
+  for (int w = 0; w < num_workers; w++) {
+    for (size_t j = 0; j < encoder_quant_blob_stats.size(); j++) {
+      QuantBlobStat &stat = encoder_quant_blob_stats[j];
+      stat.absmax = std::max(stat.absmax, encoder_stats[w][j].absmax);
+      stat.total = std::max(stat.total, encoder_stats[w][j].total);
+    }
 
-  fprintf(stderr, "num files: %d\n", (int)wave_filenames.size());
+    for (size_t j = 0; j < joiner_quant_blob_stats.size(); j++) {
+      QuantBlobStat &stat = joiner_quant_blob_stats[j];
+      stat.absmax = std::max(stat.absmax, joiner_stats[w][j].absmax);
+      stat.total = std::max(stat.total, joiner_stats[w][j].total);
+    }
+  }
+}
 
-  const int num_histogram_bins = 2048;
-  std::vector<ncnn::UnlockedPoolAllocator> blob_allocators(1);
-  std::vector<ncnn::UnlockedPoolAllocator> workspace_allocators(1);
+void QuantNet::count_histogram(FeatureCache *cache, int num_histogram_bins) {
+  const int num_workers = (int)models.size();
+
+  // histograms of each worker
+  std::vector<std::vector<std::vector<uint64_t>>> encoder_histograms(
+      num_workers);
+  std::vector<std::vector<std::vector<uint64_t>>> joiner_histograms(
+      num_workers);
+  for (int w = 0; w < num_workers; w++) {
+    encoder_histograms[w].resize(
+        encoder_quant_blob_stats.size(),
+        std::vector<uint64_t>(num_histogram_bins, 0));
+    joiner_histograms[w].resize(joiner_quant_blob_stats.size(),
+                                std::vector<uint64_t>(num_histogram_bins, 0));
+  }
 
-  // initialize conv weight scales
-  quantize_encoder_weight();
-  quantize_joiner_weight();
+  run_pass(cache, [&](int w, bool encoder, int j, const ncnn::Mat &out) {
+    if (encoder) {
+      add_to_histogram(out, encoder_quant_blob_stats[j].absmax,
+                       &encoder_histograms[w][j]);
+    } else {
+      add_to_histogram(out, joiner_quant_blob_stats[j].absmax,
+                       &joiner_histograms[w][j]);
+    }
+  });
 
-  float expected_sampling_rate = 16000;
+  // merge the workers
+  for (size_t j = 0; j < encoder_quant_blob_stats.size(); j++) {
+    QuantBlobStat &stat = encoder_quant_blob_stats[j];
+    stat.histogram.assign(num_histogram_bins, 0);
+    stat.histogram_normed.assign(num_histogram_bins, 0);
 
-  knf::FbankOptions fbank_opts;
-  fbank_opts.frame_opts.dither = 0;
-  fbank_opts.frame_opts.snip_edges = false;
-  fbank_opts.frame_opts.samp_freq = expected_sampling_rate;
-  fbank_opts.mel_opts.num_bins = 80;
+    for (int w = 0; w < num_workers; w++) {
+      for (int k = 0; k < num_histogram_bins; k++) {
+        stat.histogram[k] += encoder_histograms[w][j][k];
+      }
+    }
+  }
 
-  int32_t segment = model->Segment();
-  int32_t offset = model->Offset();
+  for (size_t j = 0; j < joiner_quant_blob_stats.size(); j++) {
+    QuantBlobStat &stat = joiner_quant_blob_stats[j];
+    stat.histogram.assign(num_histogram_bins, 0);
+    stat.histogram_normed.assign(num_histogram_bins, 0);
 
-  // count the absmax
-  for (const auto &filename : wave_filenames) {
-    bool is_ok = false;
-    std::vector<float> samples =
-        sherpa_ncnn::ReadWave(filename, expected_sampling_rate, &is_ok);
-    if (!is_ok) {
-      fprintf(stderr, "Failed to read %s\n", filename.c_str());
-      continue;
+    for (int w = 0; w < num_workers; w++) {
+      for (int k = 0; k < num_histogram_bins; k++) {
+        stat.histogram[k] += joiner_histograms[w][j][k];
+      }
     }
-    fprintf(stderr, "Processing %s\n", filename.c_str());
+  }
+}
 
-    sherpa_ncnn::FeatureExtractorConfig config;
-    config.sampling_rate = 16000;
-    config.feature_dim = 80;
-    sherpa_ncnn::FeatureExtractor feature_extractor(config);
-    feature_extractor.AcceptWaveform(expected_sampling_rate, samples.data(),
-                                     samples.size());
-    feature_extractor.InputFinished();
+int QuantNet::quantize_KL(const std::vector<std::string> &wave_filenames) {
+  const int encoder_conv_bottom_blob_count =
+      (int)encoder_conv_bottom_blobs.size();
 
-    int32_t context_size = model->ContextSize();
-    int32_t blank_id = model->BlankId();
+  const int joiner_conv_bottom_blob_count =
+      (int)joiner_conv_bottom_blobs.size();
 
-    std::vector<int32_t> hyp(context_size, blank_id);
+  fprintf(stderr, "num files: %d, num workers: %d\n",
+          (int)wave_filenames.size(), (int)models.size());
 
-    ncnn::Mat decoder_input(context_size);
-    for (int32_t i = 0; i != context_size; ++i) {
-      static_cast<int32_t *>(decoder_input)[i] = blank_id;
-    }
+  const int num_histogram_bins = 2048;
 
-    ncnn::Mat decoder_out = model->RunDecoder(decoder_input);
+  // initialize conv weight scales
+  quantize_encoder_weight(false);
+  quantize_joiner_weight(false);
 
-    std::vector<ncnn::Mat> states;
-    ncnn::Mat encoder_out;
-
-    int32_t num_processed = 0;
-    while (feature_extractor.NumFramesReady() - num_processed >= segment) {
-      ncnn::Extractor encoder_ex = model->GetEncoder().create_extractor();
-      encoder_ex.set_light_mode(false);
-      encoder_ex.set_blob_allocator(&blob_allocators[0]);
-      encoder_ex.set_workspace_allocator(&workspace_allocators[0]);
-
-      ncnn::Extractor joiner_ex = model->GetJoiner().create_extractor();
-      joiner_ex.set_light_mode(false);
-      joiner_ex.set_blob_allocator(&blob_allocators[0]);
-      joiner_ex.set_workspace_allocator(&workspace_allocators[0]);
-
-      ncnn::Mat features = feature_extractor.GetFrames(num_processed, segment);
-      num_processed += offset;
-      std::tie(encoder_out, states) =
-          model->RunEncoder(features, states, &encoder_ex);
-
-      for (int j = 0; j < encoder_conv_bottom_blob_count; j++) {
-        ncnn::Mat out;
-        encoder_ex.extract(encoder_conv_bottom_blobs[j], out);
-
-        {
-          // count absmax
-          float absmax = 0.f;
-
-          const int outc = out.c;
-          const int outsize = out.w * out.h;
-          for (int p = 0; p < outc; p++) {
-            const float *ptr = out.channel(p);
-            for (int k = 0; k < outsize; k++) {
-              absmax = std::max(absmax, (float)fabs(ptr[k]));
-            }
-          }
+  // The features are computed in the first pass and reused in the second
+  FeatureCache cache(wave_filenames, feature_cache_bytes);
 
-          QuantBlobStat &stat = encoder_quant_blob_stats[j];
-          stat.absmax = std::max(stat.absmax, absmax);
-        }
-      }  // for (int j = 0; j < encoder_conv_bottom_blob_count; j++)
-
-      // now for joiner
-      for (int32_t t = 0; t != encoder_out.h; ++t) {
-        ncnn::Mat encoder_out_t(encoder_out.w, encoder_out.row(t));
-        ncnn::Mat joiner_out =
-            model->RunJoiner(encoder_out_t, decoder_out, &joiner_ex);
-
-        for (int j = 0; j < joiner_conv_bottom_blob_count; j++) {
-          ncnn::Mat out;
-          joiner_ex.extract(joiner_conv_bottom_blobs[j], out);
-
-          {
-            // count absmax
-            float absmax = 0.f;
-
-            const int outc = out.c;
-            const int outsize = out.w * out.h;
-            for (int p = 0; p < outc; p++) {
-              const float *ptr = out.channel(p);
-              for (int k = 0; k < outsize; k++) {
-                absmax = std::max(absmax, (float)fabs(ptr[k]));
-              }
-            }
-
-            QuantBlobStat &stat = joiner_quant_blob_stats[j];
-            stat.absmax = std::max(stat.absmax, absmax);
-          }
-        }  // for (int j = 0; j < joiner_conv_bottom_blob_count; j++)
+  count_absmax(&cache);
+  count_histogram(&cache, num_histogram_bins);
 
-        auto y = static_cast<int32_t>(std::distance(
-            static_cast<const float *>(joiner_out),
-            std::max_element(
-                static_cast<const float *>(joiner_out),
-                static_cast<const float *>(joiner_out) + joiner_out.w)));
+  // using kld to find the best threshold value
+  std::vector<float> encoder_scales(encoder_conv_bottom_blob_count);
+  std::vector<float> joiner_scales(joiner_conv_bottom_blob_count);
+
+  run_workers((int)models.size(),
+              encoder_conv_bottom_blob_count + joiner_conv_bottom_blob_count,
+              [&](int /*w*/, int i) {
+                if (i < encoder_conv_bottom_blob_count) {
+                  encoder_scales[i] = compute_kl_threshold(
+                      encoder_quant_blob_stats[i], num_histogram_bins);
+                } else {
+                  i -= encoder_conv_bottom_blob_count;
+                  joiner_scales[i] = compute_kl_threshold(
+                      joiner_quant_blob_stats[i], num_histogram_bins);
+                }
+              });
 
-        if (y != blank_id) {
-          static_cast<int32_t *>(decoder_input)[0] = hyp.back();
-          static_cast<int32_t *>(decoder_input)[1] = y;
-          hyp.push_back(y);
+  for (int i = 0; i < encoder_conv_bottom_blob_count; i++) {
+    encoder_bottom_blob_scales[i].create(1);
+    encoder_bottom_blob_scales[i][0] = encoder_scales[i];
+  }
 
-          decoder_out = model->RunDecoder(decoder_input);
-        }
-      }  // for (int32_t t = 0; t != encoder_out.h; ++t)
+  for (int i = 0; i < joiner_conv_bottom_blob_count; i++) {
+    joiner_bottom_blob_scales[i].create(1);
+    joiner_bottom_blob_scales[i][0] = joiner_scales[i];
+  }
 
-    }  // while (feature_extractor.NumFramesReady() - num_processed >=
-       // segment)
-  }    // for (const auto &filename : wave_filenames)
+  return 0;
+}
 
-  // initialize histogram
-  for (int i = 0; i < encoder_conv_bottom_blob_count; i++) {
+int QuantNet::quantize_ACIQ(const std::vector<std::string> &wave_filenames) {
+  fprintf(stderr, "num files: %d, num workers: %d\n",
+          (int)wave_filenames.size(), (int)models.size());
+
+  quantize_encoder_weight(true);
+  quantize_joiner_weight(true);
+
+  // A single pass, so nothing needs to be cached
+  FeatureCache cache(wave_filenames, 0);
+  count_absmax(&cache);
+
+  for (int i = 0; i < (int)encoder_conv_bottom_blobs.size(); i++) {
     QuantBlobStat &stat = encoder_quant_blob_stats[i];
+    stat.threshold = compute_aciq_gaussian_clip(stat.absmax, stat.total);
 
-    stat.histogram.resize(num_histogram_bins, 0);
-    stat.histogram_normed.resize(num_histogram_bins, 0);
+    encoder_bottom_blob_scales[i].create(1);
+    encoder_bottom_blob_scales[i][0] = 127 / stat.threshold;
   }
 
-  for (int i = 0; i < joiner_conv_bottom_blob_count; i++) {
+  for (int i = 0; i < (int)joiner_conv_bottom_blobs.size(); i++) {
     QuantBlobStat &stat = joiner_quant_blob_stats[i];
+    stat.threshold = compute_aciq_gaussian_clip(stat.absmax, stat.total);
 
-    stat.histogram.resize(num_histogram_bins, 0);
-    stat.histogram_normed.resize(num_histogram_bins, 0);
+    joiner_bottom_blob_scales[i].create(1);
+    joiner_bottom_blob_scales[i][0] = 127 / stat.threshold;
   }
 
-  // build histogram
-  for (const auto &filename : wave_filenames) {
-    bool is_ok = false;
-    std::vector<float> samples =
-        sherpa_ncnn::ReadWave(filename, expected_sampling_rate, &is_ok);
-    if (!is_ok) {
-      fprintf(stderr, "Failed to read %s\n", filename.c_str());
-      continue;
-    }
-    fprintf(stderr, "Processing %s\n", filename.c_str());
-
-    sherpa_ncnn::FeatureExtractorConfig config;
-    config.sampling_rate = 16000;
-    config.feature_dim = 80;
-    sherpa_ncnn::FeatureExtractor feature_extractor(config);
-    feature_extractor.AcceptWaveform(expected_sampling_rate, samples.data(),
-                                     samples.size());
-    feature_extractor.InputFinished();
-
-    int32_t context_size = model->ContextSize();
-    int32_t blank_id = model->BlankId();
-
-    std::vector<int32_t> hyp(context_size, blank_id);
+  return 0;
+}
 
-    ncnn::Mat decoder_input(context_size);
-    for (int32_t i = 0; i != context_size; ++i) {
-      static_cast<int32_t *>(decoder_input)[i] = blank_id;
-    }
+int QuantNet::quantize_EQ(const std::vector<std::string> &wave_filenames) {
+  // find the initial scales via KL
+  quantize_KL(wave_filenames);
+
+  print_quant_info();
+
+  // The inputs and outputs of all conv layers are kept in memory, so only
+  // a few chunks are used
+  const int num_encoder_chunks = 8;
+  const int num_joiner_frames = 64;
+
+  std::vector<LayerSamples> encoder_samples(encoder_conv_layers.size());
+  std::vector<LayerSamples> joiner_samples(joiner_conv_layers.size());
+
+  int encoder_count = 0;
+  int joiner_count = 0;
+
+  FeatureCache cache(wave_filenames, 0);
+  for (int i = 0; i < cache.size() && (encoder_count < num_encoder_chunks ||
+                                       joiner_count < num_joiner_frames);
+       i++) {
+    ncnn::Mat features = cache.get(i);
+    if (features.empty()) continue;
+
+    ncnn::UnlockedPoolAllocator blob_allocator;
+    ncnn::UnlockedPoolAllocator workspace_allocator;
+
+    run_greedy_search(
+        model, features, &blob_allocator, &workspace_allocator,
+        [&](ncnn::Extractor &ex, const ncnn::Mat &, const ncnn::Mat &) {
+          if (encoder_count >= num_encoder_chunks) return;
+          encoder_count += 1;
+
+          for (size_t j = 0; j < encoder_conv_layers.size(); j++) {
+            const ncnn::Layer *layer = encoder_layers[encoder_conv_layers[j]];
+            ncnn::Mat in;
+            ncnn::Mat out;
+            ex.extract(layer->bottoms[0], in);
+            ex.extract(layer->tops[0], out);
+            encoder_samples[j].inputs.push_back(in.clone());
+            encoder_samples[j].outputs.push_back(out.clone());
+          }
+        },
+        [&](ncnn::Extractor &ex, const ncnn::Mat &, const ncnn::Mat &,
+            const ncnn::Mat &) {
+          if (joiner_count >= num_joiner_frames) return;
+          joiner_count += 1;
+
+          for (size_t j = 0; j < joiner_conv_layers.size(); j++) {
+            const ncnn::Layer *layer = joiner_layers[joiner_conv_layers[j]];
+            ncnn::Mat in;
+            ncnn::Mat out;
+            ex.extract(layer->bottoms[0], in);
+            ex.extract(layer->tops[0], out);
+            joiner_samples[j].inputs.push_back(in.clone());
+            joiner_samples[j].outputs.push_back(out.clone());
+          }
+        });
+  }
 
-    ncnn::Mat decoder_out = model->RunDecoder(decoder_input);
+  const int encoder_conv_layer_count = (int)encoder_conv_layers.size();
+  const int joiner_conv_layer_count = (int)joiner_conv_layers.size();
 
-    std::vector<ncnn::Mat> states;
-    ncnn::Mat encoder_out;
-
-    int32_t num_processed = 0;
-    while (feature_extractor.NumFramesReady() - num_processed >= segment) {
-      ncnn::Extractor encoder_ex = model->GetEncoder().create_extractor();
-      encoder_ex.set_light_mode(false);
-      encoder_ex.set_blob_allocator(&blob_allocators[0]);
-      encoder_ex.set_workspace_allocator(&workspace_allocators[0]);
-
-      ncnn::Extractor joiner_ex = model->GetJoiner().create_extractor();
-      joiner_ex.set_light_mode(false);
-      joiner_ex.set_blob_allocator(&blob_allocators[0]);
-      joiner_ex.set_workspace_allocator(&workspace_allocators[0]);
-
-      ncnn::Mat features = feature_extractor.GetFrames(num_processed, segment);
-      num_processed += offset;
-      std::tie(encoder_out, states) =
-          model->RunEncoder(features, states, &encoder_ex);
-
-      for (int j = 0; j < encoder_conv_bottom_blob_count; j++) {
-        ncnn::Mat out;
-        encoder_ex.extract(encoder_conv_bottom_blobs[j], out);
-
-        // count histogram bin
-        {
-          const float absmax = encoder_quant_blob_stats[j].absmax;
-
-          std::vector<uint64_t> histogram(num_histogram_bins, 0);
-
-          const int outc = out.c;
-          const int outsize = out.w * out.h;
-          for (int p = 0; p < outc; p++) {
-            const float *ptr = out.channel(p);
-            for (int k = 0; k < outsize; k++) {
-              if (ptr[k] == 0.f) continue;
-
-              const int index =
-                  std::min((int)(fabs(ptr[k]) / absmax * num_histogram_bins),
-                           (num_histogram_bins - 1));
-
-              histogram[index] += 1;
-            }
-          }
+  run_workers((int)models.size(),
+              encoder_conv_layer_count + joiner_conv_layer_count,
+              [&](int /*w*/, int i) {
+                if (i < encoder_conv_layer_count) {
+                  equalize_layer(encoder_layers[encoder_conv_layers[i]],
+                                 encoder_samples[i], &encoder_weight_scales[i],
+                                 &encoder_bottom_blob_scales[i]);
+                } else {
+                  i -= encoder_conv_layer_count;
+                  equalize_layer(joiner_layers[joiner_conv_layers[i]],
+                                 joiner_samples[i], &joiner_weight_scales[i],
+                                 &joiner_bottom_blob_scales[i]);
+                }
+              });
 
-          QuantBlobStat &stat = encoder_quant_blob_stats[j];
+  return 0;
+}
+ncnn::Layer *QuantNet::swap_to_int8(sherpa_ncnn::Model *m, bool encoder,
+                                     int i) {
+  ncnn::Net &net = encoder ? m->GetEncoder() : m->GetJoiner();
+  const int index = encoder ? encoder_conv_layers[i] : joiner_conv_layers[i];
+
+  const ncnn::Mat &weight_scales =
+      encoder ? encoder_weight_scales[i] : joiner_weight_scales[i];
+  const ncnn::Mat &bottom_blob_scales =
+      encoder ? encoder_bottom_blob_scales[i] : joiner_bottom_blob_scales[i];
+
+  std::vector<ncnn::Layer *> &layers = net.mutable_layers();
+  ncnn::Layer *layer = layers[index];
+  layers[index] =
+      create_int8_layer(layer, weight_scales, bottom_blob_scales, net.opt);
+
+  return layer;
+}
 
-          for (int k = 0; k < num_histogram_bins; k++) {
-            stat.histogram[k] += histogram[k];
-          }
-        }
-      }  // for (int j = 0; j < encoder_conv_bottom_blob_count; j++)
+void QuantNet::swap_back(sherpa_ncnn::Model *m, bool encoder, int i,
+                         ncnn::Layer *layer) {
+  ncnn::Net &net = encoder ? m->GetEncoder() : m->GetJoiner();
+  const int index = encoder ? encoder_conv_layers[i] : joiner_conv_layers[i];
 
-      // now for joiner
-      for (int32_t t = 0; t != encoder_out.h; ++t) {
-        ncnn::Mat encoder_out_t(encoder_out.w, encoder_out.row(t));
-        ncnn::Mat joiner_out =
-            model->RunJoiner(encoder_out_t, decoder_out, &joiner_ex);
+  std::vector<ncnn::Layer *> &layers = net.mutable_layers();
+  layers[index]->destroy_pipeline(net.opt);
+  delete layers[index];
+  layers[index] = layer;
+}
 
-        for (int j = 0; j < joiner_conv_bottom_blob_count; j++) {
-          ncnn::Mat out;
-          joiner_ex.extract(joiner_conv_bottom_blobs[j], out);
+int QuantNet::analyze_sensitivity(
+    const std::vector<std::string> &wave_filenames, int num_chunks) {
+  FeatureCache cache(wave_filenames, 0);
 
-          // count histogram bin
-          {
-            const float absmax = joiner_quant_blob_stats[j].absmax;
+  reference = ReferenceOutputs();
+  record_reference(model, &cache, num_chunks, &reference);
+  if (reference.duration == 0) {
+    fprintf(stderr, "No chunks for the sensitivity analysis\n");
+    return -1;
+  }
 
-            std::vector<uint64_t> histogram(num_histogram_bins, 0);
+  const int encoder_conv_layer_count = (int)encoder_conv_layers.size();
+  const int joiner_conv_layer_count = (int)joiner_conv_layers.size();
 
-            const int outc = out.c;
-            const int outsize = out.w * out.h;
-            for (int p = 0; p < outc; p++) {
-              const float *ptr = out.channel(p);
-              for (int k = 0; k < outsize; k++) {
-                if (ptr[k] == 0.f) continue;
+  fprintf(stderr,
+          "sensitivity of %d layers on %.2f seconds of audio, %d joiner "
+          "frames\n",
+          encoder_conv_layer_count + joiner_conv_layer_count,
+          reference.duration, (int)reference.joiner_out.size());
+
+  encoder_sensitivity.assign(encoder_conv_layer_count, 0);
+  joiner_sensitivity.assign(joiner_conv_layer_count, 0);
+
+  // Each worker quantizes one layer of its own model at a time
+  run_workers((int)models.size(),
+              encoder_conv_layer_count + joiner_conv_layer_count,
+              [&](int w, int i) {
+                const bool encoder = i < encoder_conv_layer_count;
+                const int j = encoder ? i : i - encoder_conv_layer_count;
+
+                ncnn::Layer *layer = swap_to_int8(models[w], encoder, j);
+
+                if (encoder) {
+                  encoder_sensitivity[j] =
+                      compute_encoder_error(models[w], reference);
+                } else {
+                  joiner_sensitivity[j] =
+                      compute_joiner_error(models[w], reference);
+                }
+
+                swap_back(models[w], encoder, j, layer);
+              });
 
-                const int index =
-                    std::min((int)(fabs(ptr[k]) / absmax * num_histogram_bins),
-                             (num_histogram_bins - 1));
+  return 0;
+}
 
-                histogram[index] += 1;
-              }
-            }
+void QuantNet::plan_mixed_precision(float budget) {
+  encoder_keep_float = plan_float_layers(encoder_sensitivity, budget);
+  joiner_keep_float = plan_float_layers(joiner_sensitivity, budget);
+}
 
-            QuantBlobStat &stat = joiner_quant_blob_stats[j];
+void QuantNet::print_sensitivity() const {
+  fprintf(stderr, "----------encoder sensitivity----------\n");
+  for (int i = 0; i < (int)encoder_sensitivity.size(); i++) {
+    fprintf(stderr, "%-40s : error = %-15g  %s\n",
+            encoder_layers[encoder_conv_layers[i]]->name.c_str(),
+            encoder_sensitivity[i], encoder_keep_float[i] ? "float" : "int8");
+  }
 
-            for (int k = 0; k < num_histogram_bins; k++) {
-              stat.histogram[k] += histogram[k];
-            }
-          }
-        }  // for (int j = 0; j < joiner_conv_bottom_blob_count; j++)
+  fprintf(stderr, "----------joiner sensitivity----------\n");
+  for (int i = 0; i < (int)joiner_sensitivity.size(); i++) {
+    fprintf(stderr, "%-40s : error = %-15g  %s\n",
+            joiner_layers[joiner_conv_layers[i]]->name.c_str(),
+            joiner_sensitivity[i], joiner_keep_float[i] ? "float" : "int8");
+  }
+}
 
-        auto y = static_cast<int32_t>(std::distance(
-            static_cast<const float *>(joiner_out),
-            std::max_element(
-                static_cast<const float *>(joiner_out),
-                static_cast<const float *>(joiner_out) + joiner_out.w)));
+void QuantNet::measure(const std::vector<bool> &encoder_int8,
+                       const std::vector<bool> &joiner_int8,
+                       float *encoder_error, float *joiner_error,
+                       double *seconds) {
+  std::vector<ncnn::Layer *> encoder_float(encoder_int8.size(), nullptr);
+  std::vector<ncnn::Layer *> joiner_float(joiner_int8.size(), nullptr);
 
-        if (y != blank_id) {
-          static_cast<int32_t *>(decoder_input)[0] = hyp.back();
-          static_cast<int32_t *>(decoder_input)[1] = y;
-          hyp.push_back(y);
+  for (int i = 0; i < (int)encoder_int8.size(); i++) {
+    if (encoder_int8[i]) encoder_float[i] = swap_to_int8(model, true, i);
+  }
 
-          decoder_out = model->RunDecoder(decoder_input);
-        }
-      }  // for (int32_t t = 0; t != encoder_out.h; ++t)
+  for (int i = 0; i < (int)joiner_int8.size(); i++) {
+    if (joiner_int8[i]) joiner_float[i] = swap_to_int8(model, false, i);
+  }
 
-    }  // while (feature_extractor.NumFramesReady() - num_processed >=
-       // segment)
-  }    // for (const auto &filename : wave_filenames)
+  // warm up
+  compute_encoder_error(model, reference);
 
-  // using kld to find the best threshold value
-  for (int i = 0; i < encoder_conv_bottom_blob_count; i++) {
-    QuantBlobStat &stat = encoder_quant_blob_stats[i];
+  double encoder_seconds = 0;
+  double joiner_seconds = 0;
+  *encoder_error = compute_encoder_error(model, reference, &encoder_seconds);
+  *joiner_error = compute_joiner_error(model, reference, &joiner_seconds);
+  *seconds = encoder_seconds + joiner_seconds;
 
-    float scale = compute_kl_threshold(stat, num_histogram_bins);
+  for (int i = 0; i < (int)encoder_int8.size(); i++) {
+    if (encoder_int8[i]) swap_back(model, true, i, encoder_float[i]);
+  }
 
-    encoder_bottom_blob_scales[i].create(1);
-    encoder_bottom_blob_scales[i][0] = scale;
-  }  // for (int i = 0; i < encoder_conv_bottom_blob_count; i++)
+  for (int i = 0; i < (int)joiner_int8.size(); i++) {
+    if (joiner_int8[i]) swap_back(model, false, i, joiner_float[i]);
+  }
+}
 
-  for (int i = 0; i < joiner_conv_bottom_blob_count; i++) {
-    QuantBlobStat &stat = joiner_quant_blob_stats[i];
+void QuantNet::report_mixed_precision() {
+  const int encoder_conv_layer_count = (int)encoder_conv_layers.size();
+  const int joiner_conv_layer_count = (int)joiner_conv_layers.size();
 
-    float scale = compute_kl_threshold(stat, num_histogram_bins);
+  std::vector<bool> encoder_mixed(encoder_conv_layer_count);
+  std::vector<bool> joiner_mixed(joiner_conv_layer_count);
+  for (int i = 0; i < encoder_conv_layer_count; i++) {
+    encoder_mixed[i] = !encoder_keep_float[i];
+  }
 
-    joiner_bottom_blob_scales[i].create(1);
-    joiner_bottom_blob_scales[i][0] = scale;
-  }  // for (int i = 0; i < joiner_conv_bottom_blob_count; i++)
+  for (int i = 0; i < joiner_conv_layer_count; i++) {
+    joiner_mixed[i] = !joiner_keep_float[i];
+  }
 
-  return 0;
+  struct Plan {
+    const char *name;
+    std::vector<bool> encoder_int8;
+    std::vector<bool> joiner_int8;
+  };
+
+  const Plan plans[] = {
+      {"float", std::vector<bool>(encoder_conv_layer_count, false),
+       std::vector<bool>(joiner_conv_layer_count, false)},
+      {"mixed", encoder_mixed, joiner_mixed},
+      {"int8", std::vector<bool>(encoder_conv_layer_count, true),
+       std::vector<bool>(joiner_conv_layer_count, true)},
+  };
+
+  fprintf(stderr, "----------mixed precision----------\n");
+  fprintf(stderr,
+          "RTF of the encoder and the joiner with 1 thread, on %.2f seconds "
+          "of audio\n",
+          reference.duration);
+
+  for (const auto &plan : plans) {
+    float encoder_error = 0;
+    float joiner_error = 0;
+    double seconds = 0;
+    measure(plan.encoder_int8, plan.joiner_int8, &encoder_error,
+            &joiner_error, &seconds);
+
+    int num_int8 =
+        (int)(std::count(plan.encoder_int8.begin(), plan.encoder_int8.end(),
+                         true) +
+              std::count(plan.joiner_int8.begin(), plan.joiner_int8.end(),
+                         true));
+
+    fprintf(stderr,
+            "%-6s : int8 layers = %d/%d  encoder error = %-12g  joiner error "
+            "= %-12g  RTF = %.4f\n",
+            plan.name, num_int8,
+            encoder_conv_layer_count + joiner_conv_layer_count, encoder_error,
+            joiner_error, seconds / reference.duration);
+  }
 }
 
 void QuantNet::print_quant_info() const {
@@ -899,6 +1645,8 @@ int QuantNet::save_table_encoder(const char *tablepath) {
       (int)encoder_conv_bottom_blobs.size();
 
   for (int i = 0; i < encoder_conv_layer_count; i++) {
+    if (encoder_keep_float[i]) continue;
+
     const ncnn::Mat &weight_scale = encoder_weight_scales[i];
 
     fprintf(fp, "%s_param_0 ",
@@ -910,6 +1658,8 @@ int QuantNet::save_table_encoder(const char *tablepath) {
   }
 
   for (int i = 0; i < encoder_conv_bottom_blob_count; i++) {
+    if (encoder_keep_float[i]) continue;
+
     const ncnn::Mat &bottom_blob_scale = encoder_bottom_blob_scales[i];
 
     fprintf(fp, "%s ", encoder_layers[encoder_conv_layers[i]]->name.c_str());
@@ -936,6 +1686,8 @@ int QuantNet::save_table_joiner(const char *tablepath) {
       (int)joiner_conv_bottom_blobs.size();
 
   for (int i = 0; i < joiner_conv_layer_count; i++) {
+    if (joiner_keep_float[i]) continue;
+
     const ncnn::Mat &weight_scale = joiner_weight_scales[i];
 
     fprintf(fp, "%s_param_0 ",
@@ -948,6 +1700,8 @@ int QuantNet::save_table_joiner(const char *tablepath) {
   }
 
   for (int i = 0; i < joiner_conv_bottom_blob_count; i++) {
+    if (joiner_keep_float[i]) continue;
+
     const ncnn::Mat &bottom_blob_scale = joiner_bottom_blob_scales[i];
 
     fprintf(fp, "%s ", joiner_layers[joiner_conv_layers[i]]->name.c_str());
@@ -981,20 +1735,70 @@ static void ShowUsage() {
       stderr,
       "Usage:\ngenerate-int8-scale-table encoder.param "
       "encoder.bin decoder.param decoder.bin joiner.param joiner.bin "
-      "encoder-scale-table.txt joiner-scale-table.txt wave_filenames.txt\n\n"
+      "encoder-scale-table.txt joiner-scale-table.txt wave_filenames.txt "
+      "[--method=kl] [--num-threads=N] [--feature-cache-mb=2048] "
+      "[--mixed-precision-budget=0.01] [--sensitivity-chunks=16]\n\n"
       "Each line in wave_filenames.txt is a path to some 16k Hz mono wave "
-      "file.\n");
+      "file.\n\n"
+      "--method is kl, aciq or eq. eq starts from the kl scales and searches\n"
+      "  the scales of each layer that keep its int8 outputs closest to the\n"
+      "  fp32 outputs.\n"
+      "--num-threads is the number of waves processed in parallel. It\n"
+      "  defaults to the number of CPUs available, but at most the number\n"
+      "  of waves. Each thread loads its own model and the layers repack\n"
+      "  their weights when it is loaded, so the memory for the weights\n"
+      "  grows linearly with it. Lower it if the memory is not enough.\n"
+      "--feature-cache-mb is the size of the features kept between the\n"
+      "  passes over the waves. Features above it are computed again.\n"
+      "--mixed-precision-budget enables the sensitivity analysis. Each conv\n"
+      "  layer is quantized alone and the error of the network output,\n"
+      "  1 - cosine similarity, is measured on the first\n"
+      "  --sensitivity-chunks chunks. The most sensitive layers are left\n"
+      "  out of the tables, so they stay in fp32 or fp16, until the summed\n"
+      "  errors of the int8 layers of each network are within the budget.\n");
 }
 
 int main(int argc, char **argv) {
-  if (argc != 10) {
-    fprintf(stderr, "Please provide 10 arg. Currently given: %d\n", argc);
+  if (argc < 10) {
+    fprintf(stderr, "Please provide at least 10 arg. Currently given: %d\n",
+            argc);
 
     ShowUsage();
     return 1;
   }
 
-  int32_t num_threads = 10;
+  int32_t num_threads = sherpa_ncnn::GetAvailableCpus();
+  std::string method = "kl";
+  int32_t feature_cache_mb = 2048;
+  float mixed_precision_budget = -1;
+  int32_t sensitivity_chunks = 16;
+
+  for (int i = 10; i < argc; i++) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "num-threads", &value)) {
+      num_threads = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "method", &value)) {
+      method = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "feature-cache-mb", &value)) {
+      feature_cache_mb = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "mixed-precision-budget", &value)) {
+      mixed_precision_budget = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "sensitivity-chunks", &value)) {
+      sensitivity_chunks = atoi(value.c_str());
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+      ShowUsage();
+      return 1;
+    }
+  }
+
+  if (num_threads < 1 || feature_cache_mb < 0 || sensitivity_chunks < 1 ||
+      (method != "kl" && method != "aciq" && method != "eq")) {
+    ShowUsage();
+    return 1;
+  }
+
   sherpa_ncnn::ModelConfig config;
 
   config.encoder_param = argv[1];
@@ -1003,14 +1807,22 @@ int main(int argc, char **argv) {
   config.decoder_bin = argv[4];
   config.joiner_param = argv[5];
   config.joiner_bin = argv[6];
+  config.use_buffer = false;
 
   const char *encoder_scale_table = argv[7];
   const char *joiner_scale_table = argv[8];
   std::vector<std::string> wave_filenames = ReadWaveFilenames(argv[9]);
 
+  // A thread without a wave would only hold a copy of the weights
+  num_threads = std::min<int32_t>(
+      num_threads, std::max<int32_t>(1, wave_filenames.size()));
+
+  // The waves are processed in parallel, so each model uses one thread.
+  // The blobs are read as unpacked fp32.
   ncnn::Option opt;
-  opt.num_threads = num_threads;
+  opt.num_threads = 1;
   opt.lightmode = false;
+  opt.use_packing_layout = false;
   opt.use_fp16_packed = false;
   opt.use_fp16_storage = false;
   opt.use_fp16_arithmetic = false;
@@ -1019,17 +1831,42 @@ int main(int argc, char **argv) {
   config.decoder_opt = opt;
   config.joiner_opt = opt;
 
-  auto model = sherpa_ncnn::Model::Create(config);
+  std::vector<std::unique_ptr<sherpa_ncnn::Model>> models;
+  std::vector<sherpa_ncnn::Model *> model_ptrs;
+  for (int32_t i = 0; i < num_threads; i++) {
+    models.push_back(sherpa_ncnn::Model::Create(config));
+    if (!models.back()) {
+      fprintf(stderr, "Failed to load the model\n");
+      return 1;
+    }
+    model_ptrs.push_back(models.back().get());
+  }
 
-  QuantNet net(model.get());
+  QuantNet net(model_ptrs);
+  net.feature_cache_bytes = (size_t)feature_cache_mb << 20;
 
   net.init();
 
-  // TODO(fangjun): We support only KL right now.
-  net.quantize_KL(wave_filenames);
+  if (method == "aciq") {
+    net.quantize_ACIQ(wave_filenames);
+  } else if (method == "eq") {
+    net.quantize_EQ(wave_filenames);
+  } else {
+    net.quantize_KL(wave_filenames);
+  }
 
   net.print_quant_info();
 
+  if (mixed_precision_budget >= 0) {
+    if (net.analyze_sensitivity(wave_filenames, sensitivity_chunks) != 0) {
+      return 1;
+    }
+
+    net.plan_mixed_precision(mixed_precision_budget);
+    net.print_sensitivity();
+    net.report_mixed_precision();
+  }
+
   net.save_table_encoder(encoder_scale_table);
   net.save_table_joiner(joiner_scale_table);
 
@@ -20,6 +20,8 @@
 
 #include <vector>
 
+#include "sherpa-ncnn/csrc/stage-timer.h"
+
 namespace sherpa_ncnn {
 
 ncnn::Mat GreedySearchDecoder::BuildDecoderInput(
@@ -56,13 +58,18 @@ void GreedySearchDecoder::Decode(ncnn::Mat encoder_out, DecoderResult *result) {
   ncnn::Mat decoder_out = result->decoder_out;
   if (decoder_out.empty()) {
     ncnn::Mat decoder_input = BuildDecoderInput(*result);
+    ScopedStage stage(Stage::kDecoder);
     decoder_out = model_->RunDecoder(decoder_input);
   }
 
   int32_t frame_offset = result->frame_offset;
   for (int32_t t = 0; t != encoder_out.h; ++t) {
     ncnn::Mat encoder_out_t(encoder_out.w, encoder_out.row(t));
-    ncnn::Mat joiner_out = model_->RunJoiner(encoder_out_t, decoder_out);
+    ncnn::Mat joiner_out;
+    {
+      ScopedStage stage(Stage::kJoiner);
+      joiner_out = model_->RunJoiner(encoder_out_t, decoder_out);
+    }
 
     const float *joiner_out_ptr = joiner_out.row(0);
 
@@ -74,7 +81,10 @@ void GreedySearchDecoder::Decode(ncnn::Mat encoder_out, DecoderResult *result) {
     if (new_token != 0) {
       result->tokens.push_back(new_token);
       ncnn::Mat decoder_input = BuildDecoderInput(*result);
-      decoder_out = model_->RunDecoder(decoder_input);
+      {
+        ScopedStage stage(Stage::kDecoder);
+        decoder_out = model_->RunDecoder(decoder_input);
+      }
       result->num_trailing_blanks = 0;
       result->timestamps.push_back(t + frame_offset);
     } else {
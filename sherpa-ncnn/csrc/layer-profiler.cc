@@ -0,0 +1,147 @@
+// sherpa-ncnn/csrc/layer-profiler.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/layer-profiler.h"
+
+#include <chrono>  // NOLINT
+#include <vector>
+
+#include "layer_type.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+namespace {
+
+class ScopedLayerTimer {
+ public:
+  explicit ScopedLayerTimer(LayerStats *stats)
+      : stats_(stats), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedLayerTimer() {
+    auto end = std::chrono::steady_clock::now();
+    stats_->num_calls += 1;
+    stats_->seconds += std::chrono::duration<double>(end - start_).count();
+  }
+
+ private:
+  LayerStats *stats_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+static void CountInput(const ncnn::Mat &m, LayerStats *stats) {
+  if (m.elempack > 1) {
+    stats->num_packed_inputs += 1;
+  }
+
+  if (m.elempack > 0 && m.elemsize / m.elempack == 2) {
+    stats->num_16bit_inputs += 1;
+  }
+}
+
+static void CountInputs(const std::vector<ncnn::Mat> &blobs,
+                        LayerStats *stats) {
+  for (const auto &m : blobs) {
+    CountInput(m, stats);
+  }
+}
+
+// It copies the attributes of the wrapped layer that ncnn::Net reads to
+// decide how to call it and how to convert its inputs
+class ProfiledLayer : public ncnn::Layer {
+ public:
+  ProfiledLayer(ncnn::Layer *layer, LayerStats *stats)
+      : layer_(layer), stats_(stats) {
+    one_blob_only = layer->one_blob_only;
+    support_inplace = layer->support_inplace;
+    support_vulkan = false;
+    support_packing = layer->support_packing;
+    support_bf16_storage = layer->support_bf16_storage;
+    support_fp16_storage = layer->support_fp16_storage;
+    support_int8_storage = layer->support_int8_storage;
+    support_image_storage = layer->support_image_storage;
+    support_tensor_storage = layer->support_tensor_storage;
+    featmask = layer->featmask;
+
+    userdata = layer->userdata;
+    typeindex = layer->typeindex;
+    type = layer->type;
+    name = layer->name;
+    bottoms = layer->bottoms;
+    tops = layer->tops;
+    bottom_shapes = layer->bottom_shapes;
+    top_shapes = layer->top_shapes;
+  }
+
+  int forward(const std::vector<ncnn::Mat> &bottom_blobs,
+              std::vector<ncnn::Mat> &top_blobs,
+              const ncnn::Option &opt) const override {
+    CountInputs(bottom_blobs, stats_);
+    ScopedLayerTimer timer(stats_);
+    return layer_->forward(bottom_blobs, top_blobs, opt);
+  }
+
+  int forward(const ncnn::Mat &bottom_blob, ncnn::Mat &top_blob,
+              const ncnn::Option &opt) const override {
+    CountInput(bottom_blob, stats_);
+    ScopedLayerTimer timer(stats_);
+    return layer_->forward(bottom_blob, top_blob, opt);
+  }
+
+  int forward_inplace(std::vector<ncnn::Mat> &bottom_top_blobs,
+                      const ncnn::Option &opt) const override {
+    CountInputs(bottom_top_blobs, stats_);
+    ScopedLayerTimer timer(stats_);
+    return layer_->forward_inplace(bottom_top_blobs, opt);
+  }
+
+  int forward_inplace(ncnn::Mat &bottom_top_blob,
+                      const ncnn::Option &opt) const override {
+    CountInput(bottom_top_blob, stats_);
+    ScopedLayerTimer timer(stats_);
+    return layer_->forward_inplace(bottom_top_blob, opt);
+  }
+
+ private:
+  ncnn::Layer *layer_;  // not owned
+  LayerStats *stats_;
+};
+
+}  // namespace
+
+LayerProfiler::LayerProfiler(ncnn::Net *net) : net_(net) {
+  std::vector<ncnn::Layer *> &layers = net_->mutable_layers();
+
+  // stats_ must not be resized after the wrappers point to its elements
+  stats_.resize(layers.size());
+  layers_ = layers;
+
+  for (size_t i = 0; i != layers.size(); ++i) {
+    stats_[i].type = layers[i]->type;
+    stats_[i].name = layers[i]->name;
+    stats_[i].is_custom =
+        (layers[i]->typeindex & ncnn::LayerType::CustomBit) != 0;
+
+    layers[i] = new ProfiledLayer(layers[i], &stats_[i]);
+  }
+}
+
+LayerProfiler::~LayerProfiler() {
+  std::vector<ncnn::Layer *> &layers = net_->mutable_layers();
+
+  for (size_t i = 0; i != layers.size(); ++i) {
+    delete layers[i];
+    layers[i] = layers_[i];
+  }
+}
+
+void LayerProfiler::Reset() {
+  for (auto &s : stats_) {
+    s.num_calls = 0;
+    s.seconds = 0;
+    s.num_packed_inputs = 0;
+    s.num_16bit_inputs = 0;
+  }
+}
+
+}  // namespace sherpa_ncnn
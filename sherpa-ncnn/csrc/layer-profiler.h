@@ -0,0 +1,69 @@
+// sherpa-ncnn/csrc/layer-profiler.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_LAYER_PROFILER_H_
+#define SHERPA_NCNN_CSRC_LAYER_PROFILER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "layer.h"  // NOLINT
+#include "net.h"    // NOLINT
+
+namespace sherpa_ncnn {
+
+struct LayerStats {
+  std::string type;
+  std::string name;
+
+  // True for layers registered with register_custom_layer(), e.g., the
+  // Zipformer layers of sherpa-ncnn
+  bool is_custom = false;
+
+  int64_t num_calls = 0;
+  double seconds = 0;
+
+  // Inputs that reached the layer packed (elempack > 1) or with 16-bit
+  // elements (fp16 or bf16). ncnn converts such an input, and converts the
+  // output back, only for layers that do not support packing or 16-bit
+  // storage, so for custom layers these are conversions that are saved.
+  int64_t num_packed_inputs = 0;
+  int64_t num_16bit_inputs = 0;
+};
+
+/* Time each layer of a loaded ncnn::Net.
+ *
+ * Each layer is replaced by a wrapper that measures its forward() and
+ * forward_inplace() and counts its packed and 16-bit inputs. The layout
+ * and type conversions that ncnn inserts between layers are not included.
+ * Vulkan is not supported.
+ *
+ * The wrappers are removed when the profiler is destroyed. The net must
+ * outlive the profiler and must not run in another thread at the same
+ * time.
+ */
+class LayerProfiler {
+ public:
+  explicit LayerProfiler(ncnn::Net *net);
+  ~LayerProfiler();
+
+  LayerProfiler(const LayerProfiler &) = delete;
+  LayerProfiler &operator=(const LayerProfiler &) = delete;
+
+  /// Set the counts and times of all layers to 0
+  void Reset();
+
+  /// Return the stats of all layers, in the order of the .param file
+  const std::vector<LayerStats> &GetStats() const { return stats_; }
+
+ private:
+  ncnn::Net *net_;
+  std::vector<ncnn::Layer *> layers_;  // the wrapped layers
+  std::vector<LayerStats> stats_;
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_LAYER_PROFILER_H_
@@ -22,6 +22,7 @@
 
 #include "platform.h"  // NOLINT
 #include "sherpa-ncnn/csrc/meta-data.h"
+#include "sherpa-ncnn/csrc/thread-budget.h"
 
 namespace sherpa_ncnn {
 
@@ -132,11 +133,50 @@ std::pair<ncnn::Mat, std::vector<ncnn::Mat>> LstmModel::RunEncoder(
 std::pair<ncnn::Mat, std::vector<ncnn::Mat>> LstmModel::RunEncoder(
     ncnn::Mat &features, const std::vector<ncnn::Mat> &states) {
   ncnn::Extractor encoder_ex = encoder_.create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kEncoder, &encoder_ex);
   return RunEncoder(features, states, &encoder_ex);
 }
 
+ncnn::Mat LstmModel::RunEncoder(ncnn::Mat &features,
+                               EncoderStateArena *states) {
+  ncnn::Extractor encoder_ex = encoder_.create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kEncoder, &encoder_ex);
+  return RunEncoder(features, states, &encoder_ex);
+}
+
+ncnn::Mat LstmModel::RunEncoder(ncnn::Mat &features, EncoderStateArena *states,
+                                ncnn::Extractor *encoder_ex) {
+  if (states->Empty()) {
+    states->Init(GetEncoderInitStates());
+  }
+
+  ncnn::Mat feature_length(1);
+  feature_length[0] = features.h;
+
+  encoder_ex->input(encoder_input_indexes_[0], features);
+  encoder_ex->input(encoder_input_indexes_[1], feature_length);
+  encoder_ex->input(encoder_input_indexes_[2], states->Input(0));
+  encoder_ex->input(encoder_input_indexes_[3], states->Input(1));
+
+  ncnn::Mat encoder_out;
+  encoder_ex->extract(encoder_output_indexes_[0], encoder_out);
+
+  ncnn::Mat s;
+
+  encoder_ex->extract(encoder_output_indexes_[1], s);
+  states->SetOutput(0, s);
+
+  encoder_ex->extract(encoder_output_indexes_[2], s);
+  states->SetOutput(1, s);
+
+  states->Swap();
+
+  return encoder_out;
+}
+
 ncnn::Mat LstmModel::RunDecoder(ncnn::Mat &decoder_input) {
   ncnn::Extractor decoder_ex = decoder_.create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kDecoder, &decoder_ex);
   return RunDecoder(decoder_input, &decoder_ex);
 }
 
@@ -152,6 +192,7 @@ ncnn::Mat LstmModel::RunDecoder(ncnn::Mat &decoder_input,
 
 ncnn::Mat LstmModel::RunJoiner(ncnn::Mat &encoder_out, ncnn::Mat &decoder_out) {
   auto joiner_ex = joiner_.create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kJoiner, &joiner_ex);
   return RunJoiner(encoder_out, decoder_out, &joiner_ex);
 }
 
@@ -0,0 +1,78 @@
+// sherpa-ncnn/csrc/memory-usage.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/memory-usage.h"
+
+#include <sstream>
+
+namespace sherpa_ncnn {
+
+// The size of an allocation is kept in front of it. Use the alignment of
+// ncnn so that the returned pointer is aligned as well.
+static constexpr size_t kHeaderSize = NCNN_MALLOC_ALIGN < sizeof(size_t)
+                                          ? sizeof(size_t)
+                                          : NCNN_MALLOC_ALIGN;
+
+std::string StreamMemoryUsage::ToString() const {
+  std::ostringstream os;
+
+  os << "StreamMemoryUsage(";
+  os << "features=" << features << ", ";
+  os << "encoder_states=" << encoder_states << ", ";
+  os << "decoder_result=" << decoder_result << ", ";
+  os << "context_graph=" << context_graph << ", ";
+  os << "total=" << Total() << ")";
+
+  return os.str();
+}
+
+std::string RecognizerMemoryUsage::ToString() const {
+  std::ostringstream os;
+
+  os << "RecognizerMemoryUsage(";
+  os << "model_weights=" << model_weights << ", ";
+  os << "blob_bytes=" << blob_bytes << ", ";
+  os << "blob_peak_bytes=" << blob_peak_bytes << ", ";
+  os << "workspace_bytes=" << workspace_bytes << ", ";
+  os << "workspace_peak_bytes=" << workspace_peak_bytes << ", ";
+  os << "num_allocs=" << num_allocs << ", ";
+  os << "pooled_bytes=" << pooled_bytes << ", ";
+  os << "new_stream_bytes=" << new_stream_bytes << ")";
+
+  return os.str();
+}
+
+void *CountingAllocator::fastMalloc(size_t size) {
+  size_t n = size + kHeaderSize;
+  uint8_t *p = static_cast<uint8_t *>(base_ ? base_->fastMalloc(n)
+                                             : ncnn::fastMalloc(n));
+  if (!p) return nullptr;
+
+  *reinterpret_cast<size_t *>(p) = size;
+
+  num_allocs_.fetch_add(1, std::memory_order_relaxed);
+  int64_t bytes = bytes_.fetch_add(size, std::memory_order_relaxed) + size;
+
+  int64_t peak = peak_bytes_.load(std::memory_order_relaxed);
+  while (peak < bytes && !peak_bytes_.compare_exchange_weak(
+                             peak, bytes, std::memory_order_relaxed)) {
+  }
+
+  return p + kHeaderSize;
+}
+
+void CountingAllocator::fastFree(void *ptr) {
+  if (!ptr) return;
+
+  uint8_t *p = static_cast<uint8_t *>(ptr) - kHeaderSize;
+  bytes_.fetch_sub(*reinterpret_cast<size_t *>(p), std::memory_order_relaxed);
+
+  if (base_) {
+    base_->fastFree(p);
+  } else {
+    ncnn::fastFree(p);
+  }
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,106 @@
+// sherpa-ncnn/csrc/memory-usage.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_MEMORY_USAGE_H_
+#define SHERPA_NCNN_CSRC_MEMORY_USAGE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "allocator.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+// Bytes held by a stream. See Stream::GetMemoryUsage().
+struct StreamMemoryUsage {
+  // Feature frames not yet consumed by the encoder and the samples kept
+  // for Stream::SaveState()
+  int64_t features = 0;
+
+  // Both halves of the encoder state arena
+  int64_t encoder_states = 0;
+
+  // Tokens, timestamps, the cached decoder output and the hypotheses
+  // of modified_beam_search
+  int64_t decoder_result = 0;
+
+  // The hotwords graph of this stream, if any
+  int64_t context_graph = 0;
+
+  int64_t Total() const {
+    return features + encoder_states + decoder_result + context_graph;
+  }
+
+  std::string ToString() const;
+};
+
+// Bytes held by a recognizer. See Recognizer::GetMemoryUsage().
+struct RecognizerMemoryUsage {
+  // Size of the weights read from the model files. See
+  // Model::WeightBytes()
+  int64_t model_weights = 0;
+
+  // Bytes of the ncnn blobs, i.e., the inputs and outputs of the layers,
+  // that are currently allocated and the most that have been allocated
+  // at the same time since the recognizer was created
+  int64_t blob_bytes = 0;
+  int64_t blob_peak_bytes = 0;
+
+  // The same for the scratch memory used within layers
+  int64_t workspace_bytes = 0;
+  int64_t workspace_peak_bytes = 0;
+
+  // Number of blobs and workspace buffers allocated so far
+  int64_t num_allocs = 0;
+
+  // Bytes of the free blob and workspace buffers kept by the pools for
+  // reuse. With ModelConfig::use_thread_allocators, the pools of each
+  // thread are shared by all recognizers and this is the sum over all of
+  // them. See TrimThreadAllocators().
+  int64_t pooled_bytes = 0;
+
+  // StreamMemoryUsage::Total() of a stream just returned by
+  // Recognizer::CreateStream()
+  int64_t new_stream_bytes = 0;
+
+  std::string ToString() const;
+};
+
+/* An ncnn::Allocator that counts the bytes allocated through it.
+ *
+ * Allocations are passed on to base, or to ncnn::fastMalloc() if base is
+ * nullptr. Each of them is prefixed with a small header keeping its size.
+ * The counters are atomic, so it is thread-safe if base is.
+ */
+class CountingAllocator : public ncnn::Allocator {
+ public:
+  explicit CountingAllocator(ncnn::Allocator *base = nullptr) : base_(base) {}
+
+  void *fastMalloc(size_t size) override;
+  void fastFree(void *ptr) override;
+
+  // Bytes currently allocated
+  int64_t Bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+  // The largest value of Bytes() so far
+  int64_t PeakBytes() const {
+    return peak_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // Number of calls of fastMalloc() so far
+  int64_t NumAllocs() const {
+    return num_allocs_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  ncnn::Allocator *base_;
+  std::atomic<int64_t> bytes_{0};
+  std::atomic<int64_t> peak_bytes_{0};
+  std::atomic<int64_t> num_allocs_{0};
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_MEMORY_USAGE_H_
@@ -17,15 +17,23 @@
  */
 #include "sherpa-ncnn/csrc/model.h"
 
+#include <stdio.h>
+
 #include <sstream>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "sherpa-ncnn/csrc/conv-emformer-model.h"
 #include "sherpa-ncnn/csrc/lstm-model.h"
 #include "sherpa-ncnn/csrc/meta-data.h"
+#include "sherpa-ncnn/csrc/option-profile.h"
 #include "sherpa-ncnn/csrc/poolingmodulenoproj.h"
 #include "sherpa-ncnn/csrc/simpleupsample.h"
 #include "sherpa-ncnn/csrc/stack.h"
 #include "sherpa-ncnn/csrc/tensorasstrided.h"
+#include "sherpa-ncnn/csrc/thread-allocator.h"
+#include "sherpa-ncnn/csrc/thread-budget.h"
 #include "sherpa-ncnn/csrc/zipformer-model.h"
 
 namespace sherpa_ncnn {
@@ -40,6 +48,9 @@ std::string ModelConfig::ToString() const {
   os << "joiner_param=\"" << joiner_param << "\", ";
   os << "joiner_bin=\"" << joiner_bin << "\", ";
   os << "tokens=\"" << tokens << "\", ";
+  os << "option_profile=\"" << option_profile << "\", ";
+  os << "use_thread_allocators=" << (use_thread_allocators ? "True" : "False")
+     << ", ";
   os << "encoder num_threads=" << encoder_opt.num_threads << ", ";
   os << "decoder num_threads=" << decoder_opt.num_threads << ", ";
   os << "joiner num_threads=" << joiner_opt.num_threads << ")";
@@ -130,24 +141,32 @@ void Model::InitNet(ncnn::Net &net, const std::string &param,
     exit(-1);
   }
 
-  if (net.load_model(bin.c_str())) {
+  FILE *fp = fopen(bin.c_str(), "rb");
+  if (!fp || net.load_model(fp)) {
     NCNN_LOGE("failed to load %s", bin.c_str());
     exit(-1);
   }
+
+  weight_bytes_ += ftell(fp);
+  fclose(fp);
 }
 
 void Model::InitNet(ncnn::Net &net, const unsigned char *param_buf,
-                      const unsigned char *bin_buf) {
-  
-  const char* param_buf_char = reinterpret_cast<const char*>(param_buf);
-  if (net.load_param_mem(param_buf_char) != 0 ) {
+                    const unsigned char *bin_buf) {
+  const char *param_buf_char = reinterpret_cast<const char *>(param_buf);
+  if (net.load_param_mem(param_buf_char) != 0) {
     NCNN_LOGE("failed to load param_buf");
     exit(-1);
   }
-  if (net.load_model(bin_buf) == 0 ) {
+
+  // It returns the number of bytes consumed
+  int32_t n = net.load_model(bin_buf);
+  if (n == 0) {
     NCNN_LOGE("failed to load bin_buf");
     exit(-1);
   }
+
+  weight_bytes_ += n;
 }
 
 
@@ -159,13 +178,33 @@ void Model::InitNet(AAssetManager *mgr, ncnn::Net &net,
     exit(-1);
   }
 
-  if (net.load_model(mgr, bin.c_str())) {
+  AAsset *asset = AAssetManager_open(mgr, bin.c_str(), AASSET_MODE_BUFFER);
+  if (!asset || net.load_model(asset)) {
     NCNN_LOGE("failed to load %s", bin.c_str());
     exit(-1);
   }
+
+  weight_bytes_ += AAsset_getLength(asset);
+  AAsset_close(asset);
 }
 #endif
 
+// It is done after loading so that the weights are not kept in the pools
+static void UseThreadAllocators(const ModelConfig &config, Model *model) {
+  if (!config.use_thread_allocators) return;
+
+  for (ncnn::Net *net :
+       {&model->GetEncoder(), &model->GetDecoder(), &model->GetJoiner()}) {
+    if (!net->opt.blob_allocator) {
+      net->opt.blob_allocator = GetThreadBlobAllocator();
+    }
+
+    if (!net->opt.workspace_allocator) {
+      net->opt.workspace_allocator = GetThreadWorkspaceAllocator();
+    }
+  }
+}
+
 void Model::RegisterCustomLayers(ncnn::Net &net) {
   RegisterMetaDataLayer(net);
 
@@ -175,7 +214,13 @@ void Model::RegisterCustomLayers(ncnn::Net &net) {
   RegisterStackLayer(net);                 // for zipformer only
 }
 
-std::unique_ptr<Model> Model::Create(const ModelConfig &config) {
+std::unique_ptr<Model> Model::Create(const ModelConfig &in_config) {
+  ModelConfig config = in_config;
+  if (!config.option_profile.empty() &&
+      !LoadOptionProfile(config.option_profile, &config)) {
+    return nullptr;
+  }
+
   // 1. Load the encoder network
   // 2. If the encoder network has LSTM layers, we assume it is a LstmModel
   // 3. Otherwise, we assume it is a ConvEmformer
@@ -201,16 +246,18 @@ std::unique_ptr<Model> Model::Create(const ModelConfig &config) {
   }
   
 
+  std::unique_ptr<Model> ans;
   if (IsLstmModel(net)) {
-    return std::make_unique<LstmModel>(config);
-  }
-
-  if (IsConvEmformerModel(net)) {
-    return std::make_unique<ConvEmformerModel>(config);
+    ans = std::make_unique<LstmModel>(config);
+  } else if (IsConvEmformerModel(net)) {
+    ans = std::make_unique<ConvEmformerModel>(config);
+  } else if (IsZipformerModel(net)) {
+    ans = std::make_unique<ZipformerModel>(config);
   }
 
-  if (IsZipformerModel(net)) {
-    return std::make_unique<ZipformerModel>(config);
+  if (ans) {
+    UseThreadAllocators(config, ans.get());
+    return ans;
   }
 
   NCNN_LOGE(
@@ -229,7 +276,13 @@ std::unique_ptr<Model> Model::Create(const ModelConfig &config) {
 
 #if __ANDROID_API__ >= 9
 std::unique_ptr<Model> Model::Create(AAssetManager *mgr,
-                                     const ModelConfig &config) {
+                                     const ModelConfig &in_config) {
+  ModelConfig config = in_config;
+  if (!config.option_profile.empty() &&
+      !LoadOptionProfile(config.option_profile, &config)) {
+    return nullptr;
+  }
+
   ncnn::Net net;
   RegisterCustomLayers(net);
 
@@ -239,16 +292,18 @@ std::unique_ptr<Model> Model::Create(AAssetManager *mgr,
     return nullptr;
   }
 
+  std::unique_ptr<Model> ans;
   if (IsLstmModel(net)) {
-    return std::make_unique<LstmModel>(mgr, config);
+    ans = std::make_unique<LstmModel>(mgr, config);
+  } else if (IsConvEmformerModel(net)) {
+    ans = std::make_unique<ConvEmformerModel>(mgr, config);
+  } else if (IsZipformerModel(net)) {
+    ans = std::make_unique<ZipformerModel>(mgr, config);
   }
 
-  if (IsConvEmformerModel(net)) {
-    return std::make_unique<ConvEmformerModel>(mgr, config);
-  }
-
-  if (IsZipformerModel(net)) {
-    return std::make_unique<ZipformerModel>(mgr, config);
+  if (ans) {
+    UseThreadAllocators(config, ans.get());
+    return ans;
   }
 
   NCNN_LOGE(
@@ -266,4 +321,36 @@ std::unique_ptr<Model> Model::Create(AAssetManager *mgr,
 }
 #endif
 
+ncnn::Mat Model::RunEncoder(ncnn::Mat &features, EncoderStateArena *states) {
+  ncnn::Extractor encoder_ex = GetEncoder().create_extractor();
+  ApplyThreadLocalPlan(NetworkType::kEncoder, &encoder_ex);
+  return RunEncoder(features, states, &encoder_ex);
+}
+
+ncnn::Mat Model::RunEncoder(ncnn::Mat &features, EncoderStateArena *states,
+                            ncnn::Extractor *extractor) {
+  // Models that know their input/output blobs override this function
+  // to avoid the intermediate std::vector<ncnn::Mat>
+  if (states->Empty()) {
+    states->Init(GetEncoderInitStates());
+  }
+
+  std::vector<ncnn::Mat> current;
+  current.reserve(states->NumStates());
+  for (int32_t i = 0; i != states->NumStates(); ++i) {
+    current.push_back(states->Input(i));
+  }
+
+  ncnn::Mat encoder_out;
+  std::vector<ncnn::Mat> next_states;
+  std::tie(encoder_out, next_states) = RunEncoder(features, current, extractor);
+
+  for (int32_t i = 0; i != static_cast<int32_t>(next_states.size()); ++i) {
+    states->SetOutput(i, next_states[i]);
+  }
+  states->Swap();
+
+  return encoder_out;
+}
+
 }  // namespace sherpa_ncnn
@@ -25,6 +25,7 @@
 #include <vector>
 
 #include "net.h"  // NOLINT
+#include "sherpa-ncnn/csrc/encoder-state-arena.h"
 
 namespace sherpa_ncnn {
 
@@ -57,6 +58,18 @@ struct ModelConfig {
   ncnn::Option decoder_opt;
   ncnn::Option joiner_opt;
 
+  // Optional. Path to a profile written by sherpa-ncnn-autotune. If not
+  // empty, the options in it override encoder_opt, decoder_opt and
+  // joiner_opt when the model is created. See option-profile.h
+  std::string option_profile;
+
+  // If true, networks whose option sets no blob or workspace allocator
+  // use pools of the calling thread. See thread-allocator.h
+  //
+  // It is off by default until sherpa-ncnn-bench shows that it is faster
+  // than the pools of the recognizer shared by all threads.
+  bool use_thread_allocators = false;
+
   std::string ToString() const;
 };
 
@@ -83,8 +96,19 @@ class Model {
   // Return the joiner network.
   virtual ncnn::Net &GetJoiner() = 0;
 
+  /** Size of the weights of the encoder, decoder and joiner as read
+   * from the .bin files or buffers.
+   */
+  int64_t WeightBytes() const { return weight_bytes_; }
+
   virtual std::vector<ncnn::Mat> GetEncoderInitStates() const = 0;
 
+  /** Return a mask over the states from GetEncoderInitStates(). An entry
+   * is true if the state holds integers, e.g., a frame count. Such states
+   * are never stored in 16-bit floats. Missing entries are false.
+   */
+  virtual std::vector<bool> GetEncoderIntegerStates() const { return {}; }
+
   /** Run the encoder network.
    *
    * @param features  A 2-d mat of shape (num_frames, feature_dim).
@@ -106,6 +130,26 @@ class Model {
       ncnn::Mat &features, const std::vector<ncnn::Mat> &states,
       ncnn::Extractor *extractor) = 0;
 
+  /** Run the encoder network with states kept in an arena.
+   *
+   * The current states of the arena are fed to the encoder and the next
+   * states are written into its other half, which becomes the current one
+   * on return. If the arena is empty, it is initialized with
+   * GetEncoderInitStates().
+   *
+   * @param features  A 2-d mat of shape (num_frames, feature_dim).
+   * @param states  The encoder states of a stream.
+   *
+   * @return Return encoder_out.
+   */
+  virtual ncnn::Mat RunEncoder(ncnn::Mat &features, EncoderStateArena *states);
+
+  /** Run the encoder network with states kept in an arena and a user
+   * provided extractor.
+   */
+  virtual ncnn::Mat RunEncoder(ncnn::Mat &features, EncoderStateArena *states,
+                               ncnn::Extractor *extractor);
+
   /** Run the decoder network.
    *
    * @param  decoder_input A mat of shape (context_size,). Note: Its underlying
@@ -148,18 +192,22 @@ class Model {
   virtual int32_t Offset() const = 0;
 
  protected:
-  static void InitNet(ncnn::Net &net, const std::string &param,
-                      const std::string &bin);
+  void InitNet(ncnn::Net &net, const std::string &param,
+               const std::string &bin);
 
   /// initialize net with buffer
-  static void InitNet(ncnn::Net &net, const unsigned char *param_buf,
-                      const unsigned char *bin_buf);
+  void InitNet(ncnn::Net &net, const unsigned char *param_buf,
+               const unsigned char *bin_buf);
 
 
 #if __ANDROID_API__ >= 9
-  static void InitNet(AAssetManager *mgr, ncnn::Net &net,
-                      const std::string &param, const std::string &bin);
+  void InitNet(AAssetManager *mgr, ncnn::Net &net, const std::string &param,
+               const std::string &bin);
 #endif
+
+ protected:
+  // Sum of the sizes of the weights loaded by InitNet()
+  int64_t weight_bytes_ = 0;
 };
 
 }  // namespace sherpa_ncnn
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "sherpa-ncnn/csrc/math.h"
+#include "sherpa-ncnn/csrc/stage-timer.h"
 
 namespace sherpa_ncnn {
 
@@ -77,6 +78,8 @@ static void LogSoftmax(ncnn::Mat *in_out) {
 //
 // TODO(fangjun): Change Embed in ncnn to output 2-d tensors
 static ncnn::Mat RunDecoder2D(Model *model_, ncnn::Mat decoder_input) {
+  ScopedStage stage(Stage::kDecoder);
+
   ncnn::Mat decoder_out;
   int32_t h = decoder_input.h;
 
@@ -141,7 +144,11 @@ void ModifiedBeamSearchDecoder::Decode(ncnn::Mat encoder_out,
     // in ncnn
     // See https://github.com/Tencent/ncnn/wiki/binaryop-broadcasting
     // broadcast B for outer axis, type 14
-    ncnn::Mat joiner_out = model_->RunJoiner(encoder_out_t, decoder_out);
+    ncnn::Mat joiner_out;
+    {
+      ScopedStage stage(Stage::kJoiner);
+      joiner_out = model_->RunJoiner(encoder_out_t, decoder_out);
+    }
 
     // joiner_out.w == vocab_size
     // joiner_out.h == num_active_paths
@@ -189,7 +196,10 @@ void ModifiedBeamSearchDecoder::Decode(ncnn::Mat encoder_out,
 
   // set decoder_out in case of endpointing
   ncnn::Mat decoder_input = BuildDecoderInput({hyp});
-  result->decoder_out = model_->RunDecoder(decoder_input);
+  {
+    ScopedStage stage(Stage::kDecoder);
+    result->decoder_out = model_->RunDecoder(decoder_input);
+  }
 
   result->tokens = std::move(hyp.ys);
   result->num_trailing_blanks = hyp.num_trailing_blanks;
@@ -218,7 +228,11 @@ void ModifiedBeamSearchDecoder::Decode(ncnn::Mat encoder_out, Stream *s,
     // decoder_out.h == num_active_paths
     ncnn::Mat encoder_out_t(encoder_out.w, 1, encoder_out.row(t));
 
-    ncnn::Mat joiner_out = model_->RunJoiner(encoder_out_t, decoder_out);
+    ncnn::Mat joiner_out;
+    {
+      ScopedStage stage(Stage::kJoiner);
+      joiner_out = model_->RunJoiner(encoder_out_t, decoder_out);
+    }
     // joiner_out.w == vocab_size
     // joiner_out.h == num_active_paths
     LogSoftmax(&joiner_out);
@@ -273,7 +287,10 @@ void ModifiedBeamSearchDecoder::Decode(ncnn::Mat encoder_out, Stream *s,
 
   // set decoder_out in case of endpointing
   ncnn::Mat decoder_input = BuildDecoderInput({hyp});
-  result->decoder_out = model_->RunDecoder(decoder_input);
+  {
+    ScopedStage stage(Stage::kDecoder);
+    result->decoder_out = model_->RunDecoder(decoder_input);
+  }
 
   result->tokens = std::move(hyp.ys);
   result->num_trailing_blanks = hyp.num_trailing_blanks;
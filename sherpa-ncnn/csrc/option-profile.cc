@@ -0,0 +1,148 @@
+// sherpa-ncnn/csrc/option-profile.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/option-profile.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "platform.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+namespace {
+
+struct BoolField {
+  const char *name;
+  bool ncnn::Option::*field;
+};
+
+}  // namespace
+
+// num_threads is handled separately since it is an int
+static const BoolField kBoolFields[] = {
+    {"lightmode", &ncnn::Option::lightmode},
+    {"use_winograd_convolution", &ncnn::Option::use_winograd_convolution},
+    {"use_sgemm_convolution", &ncnn::Option::use_sgemm_convolution},
+    {"use_packing_layout", &ncnn::Option::use_packing_layout},
+    {"use_fp16_packed", &ncnn::Option::use_fp16_packed},
+    {"use_fp16_storage", &ncnn::Option::use_fp16_storage},
+    {"use_fp16_arithmetic", &ncnn::Option::use_fp16_arithmetic},
+    {"use_bf16_storage", &ncnn::Option::use_bf16_storage},
+    {"use_int8_inference", &ncnn::Option::use_int8_inference},
+};
+
+static ncnn::Option *GetOption(const std::string &network,
+                               ModelConfig *config) {
+  if (network == "encoder") return &config->encoder_opt;
+  if (network == "decoder") return &config->decoder_opt;
+  if (network == "joiner") return &config->joiner_opt;
+  return nullptr;
+}
+
+// Set a field from a line "network.name=value". Return false on error.
+static bool SetField(const std::string &line, ModelConfig *config) {
+  auto dot = line.find('.');
+  auto eq = line.find('=');
+  if (dot == std::string::npos || eq == std::string::npos || eq < dot) {
+    return false;
+  }
+
+  ncnn::Option *opt = GetOption(line.substr(0, dot), config);
+  if (!opt) return false;
+
+  std::string name = line.substr(dot + 1, eq - dot - 1);
+  int32_t value = atoi(line.c_str() + eq + 1);
+
+  if (name == "num_threads") {
+    if (value < 1) return false;
+    opt->num_threads = value;
+    return true;
+  }
+
+  for (const auto &f : kBoolFields) {
+    if (name == f.name) {
+      opt->*f.field = value != 0;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool LoadOptionProfile(const std::string &filename, ModelConfig *config) {
+  std::ifstream is(filename);
+  if (!is) {
+    NCNN_LOGE("Failed to open %s", filename.c_str());
+    return false;
+  }
+
+  std::string line;
+  int32_t line_num = 0;
+  while (std::getline(is, line)) {
+    ++line_num;
+
+    // Strip comments and trailing spaces, e.g., \r on Windows
+    auto pos = line.find('#');
+    if (pos != std::string::npos) line.resize(pos);
+    while (!line.empty() && isspace(static_cast<unsigned char>(line.back()))) {
+      line.pop_back();
+    }
+
+    if (line.empty()) continue;
+
+    if (!SetField(line, config)) {
+      NCNN_LOGE("%s:%d: invalid line: %s", filename.c_str(), line_num,
+                line.c_str());
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void WriteOption(const std::string &network, const ncnn::Option &opt,
+                        std::ostream &os) {
+  os << network << ".num_threads=" << opt.num_threads << "\n";
+  for (const auto &f : kBoolFields) {
+    os << network << "." << f.name << "=" << (opt.*f.field ? 1 : 0) << "\n";
+  }
+}
+
+bool SaveOptionProfile(const std::string &filename, const ModelConfig &config,
+                       const std::string &header) {
+  std::ofstream os(filename);
+  if (!os) {
+    NCNN_LOGE("Failed to create %s", filename.c_str());
+    return false;
+  }
+
+  std::istringstream is(header);
+  std::string line;
+  while (std::getline(is, line)) {
+    os << "# " << line << "\n";
+  }
+
+  WriteOption("encoder", config.encoder_opt, os);
+  WriteOption("decoder", config.decoder_opt, os);
+  WriteOption("joiner", config.joiner_opt, os);
+
+  return static_cast<bool>(os);
+}
+
+std::string OptionToString(const ncnn::Option &opt) {
+  std::ostringstream os;
+
+  os << "num_threads=" << opt.num_threads;
+  for (const auto &f : kBoolFields) {
+    os << ", " << f.name << "=" << (opt.*f.field ? 1 : 0);
+  }
+
+  return os.str();
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,41 @@
+// sherpa-ncnn/csrc/option-profile.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_OPTION_PROFILE_H_
+#define SHERPA_NCNN_CSRC_OPTION_PROFILE_H_
+
+#include <string>
+
+#include "option.h"  // NOLINT
+#include "sherpa-ncnn/csrc/model.h"
+
+namespace sherpa_ncnn {
+
+/* An option profile stores the ncnn::Option of the encoder, the decoder
+ * and the joiner in a text file. It is written by sherpa-ncnn-autotune and
+ * loaded through ModelConfig::option_profile. Example:
+ *
+ *   # Comments start with #
+ *   encoder.num_threads=4
+ *   encoder.use_winograd_convolution=1
+ *   decoder.num_threads=1
+ *   joiner.use_fp16_storage=0
+ *
+ * Options not in the file keep their values.
+ */
+
+/// Set the options in the given profile file. Return false on error.
+bool LoadOptionProfile(const std::string &filename, ModelConfig *config);
+
+/// Write the tunable options of the three networks into a profile file.
+/// header is written as comments at the beginning of the file.
+bool SaveOptionProfile(const std::string &filename, const ModelConfig &config,
+                       const std::string &header = "");
+
+/// Return the tunable fields of opt as "name=value, ..."
+std::string OptionToString(const ncnn::Option &opt);
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_OPTION_PROFILE_H_
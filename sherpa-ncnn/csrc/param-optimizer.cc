@@ -0,0 +1,1151 @@
+// sherpa-ncnn/csrc/param-optimizer.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/param-optimizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <regex>  // NOLINT
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "platform.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+static constexpr int32_t kParamMagic = 7767517;
+
+// Tags of weights loaded with type 0, see ncnn::ModelBinFromDataReader
+static constexpr uint32_t kFloat16Tag = 0x01306B47;
+static constexpr uint32_t kInt8Tag = 0x000D4B38;
+static constexpr uint32_t kRawFloat32Tag = 0x0002C056;
+
+// ncnn stores array params with the key -23300 - key
+static constexpr int32_t kArrayKeyBase = -23300;
+
+// Params of Convolution, ConvolutionDepthWise and InnerProduct
+static constexpr int32_t kActivationType = 9;
+static constexpr int32_t kActivationParams = 10;
+static constexpr int32_t kInt8ScaleTerm = 8;
+
+// For each order_type of ncnn::Permute, the input axis of output w, h and c.
+// 0 is w, 1 is h and 2 is c. The first two are also the order types of
+// 2-D blobs.
+static const int32_t kPermuteOrders[6][3] = {
+    {0, 1, 2},  // 0 = w h c
+    {1, 0, 2},  // 1 = h w c
+    {0, 2, 1},  // 2 = w c h
+    {2, 0, 1},  // 3 = c w h
+    {1, 2, 0},  // 4 = h c w
+    {2, 1, 0},  // 5 = c h w
+};
+
+std::string ParamOptimizerStats::ToString() const {
+  std::ostringstream os;
+
+  os << "ParamOptimizerStats(";
+  os << "num_layers_before=" << num_layers_before << ", ";
+  os << "num_layers_after=" << num_layers_after << ", ";
+  os << "removed_identity=" << removed_identity << ", ";
+  os << "merged_permute=" << merged_permute << ", ";
+  os << "merged_reshape=" << merged_reshape << ", ";
+  os << "removed_split=" << removed_split << ", ";
+  os << "fused_activation=" << fused_activation << ", ";
+  os << "folded_constant=" << folded_constant << ", ";
+  os << "fused_scalar=" << fused_scalar << ")";
+
+  return os.str();
+}
+
+std::string ParamOptimizerConfig::ToString() const {
+  std::ostringstream os;
+
+  os << "ParamOptimizerConfig(";
+  os << "fold_weights=" << (fold_weights ? "True" : "False") << ", ";
+  os << "exact=" << (exact ? "True" : "False") << ")";
+
+  return os.str();
+}
+
+bool ReadParamGraph(const std::string &filename, ParamGraph *graph) {
+  std::ifstream is(filename);
+  if (!is) {
+    NCNN_LOGE("Failed to open %s", filename.c_str());
+    return false;
+  }
+
+  int32_t magic = 0;
+  int32_t layer_count = 0;
+  int32_t blob_count = 0;
+  is >> magic >> layer_count >> blob_count;
+  if (!is || magic != kParamMagic) {
+    NCNN_LOGE("%s is not a text ncnn param file", filename.c_str());
+    return false;
+  }
+
+  graph->layers.clear();
+
+  std::string line;
+  while (graph->layers.size() < layer_count && std::getline(is, line)) {
+    std::istringstream ls(line);
+
+    ParamLayer layer;
+    int32_t num_bottoms = 0;
+    int32_t num_tops = 0;
+    if (!(ls >> layer.type)) continue;  // empty line
+
+    if (!(ls >> layer.name >> num_bottoms >> num_tops)) {
+      NCNN_LOGE("Invalid line in %s: %s", filename.c_str(), line.c_str());
+      return false;
+    }
+
+    layer.bottoms.resize(num_bottoms);
+    for (auto &b : layer.bottoms) ls >> b;
+
+    layer.tops.resize(num_tops);
+    for (auto &t : layer.tops) ls >> t;
+
+    if (!ls) {
+      NCNN_LOGE("Invalid line in %s: %s", filename.c_str(), line.c_str());
+      return false;
+    }
+
+    std::string p;
+    while (ls >> p) layer.params.push_back(p);
+
+    graph->layers.push_back(std::move(layer));
+  }
+
+  if (graph->layers.size() != layer_count) {
+    NCNN_LOGE("Expect %d layers in %s. Given %d", layer_count,
+              filename.c_str(), static_cast<int32_t>(graph->layers.size()));
+    return false;
+  }
+
+  return true;
+}
+
+bool WriteParamGraph(const std::string &filename, const ParamGraph &graph) {
+  std::set<std::string> blobs;
+  for (const auto &layer : graph.layers) {
+    blobs.insert(layer.bottoms.begin(), layer.bottoms.end());
+    blobs.insert(layer.tops.begin(), layer.tops.end());
+  }
+
+  std::ofstream os(filename);
+  if (!os) {
+    NCNN_LOGE("Failed to create %s", filename.c_str());
+    return false;
+  }
+
+  os << kParamMagic << "\n";
+  os << graph.layers.size() << " " << blobs.size() << "\n";
+
+  for (const auto &layer : graph.layers) {
+    os << std::left << std::setw(24) << layer.type << " " << std::setw(24)
+       << layer.name << " " << layer.bottoms.size() << " "
+       << layer.tops.size();
+
+    for (const auto &b : layer.bottoms) os << " " << b;
+    for (const auto &t : layer.tops) os << " " << t;
+    for (const auto &p : layer.params) os << " " << p;
+
+    os << "\n";
+  }
+
+  return static_cast<bool>(os);
+}
+
+// Return the value of a param as in the file, or an empty string if it is
+// not given
+static std::string GetParam(const ParamLayer &layer, int32_t key) {
+  std::string prefix = std::to_string(key) + "=";
+  for (const auto &p : layer.params) {
+    if (p.compare(0, prefix.size(), prefix) == 0) {
+      return p.substr(prefix.size());
+    }
+  }
+
+  return {};
+}
+
+static int32_t GetIntParam(const ParamLayer &layer, int32_t key,
+                           int32_t default_value) {
+  std::string value = GetParam(layer, key);
+  return value.empty() ? default_value : atoi(value.c_str());
+}
+
+static float GetFloatParam(const ParamLayer &layer, int32_t key,
+                           float default_value) {
+  std::string value = GetParam(layer, key);
+  return value.empty() ? default_value : strtof(value.c_str(), nullptr);
+}
+
+// Replace the param with the given key or add it
+static void SetParam(int32_t key, const std::string &value,
+                     ParamLayer *layer) {
+  std::string prefix = std::to_string(key) + "=";
+  for (auto &p : layer->params) {
+    if (p.compare(0, prefix.size(), prefix) == 0) {
+      p = prefix + value;
+      return;
+    }
+  }
+
+  layer->params.push_back(prefix + value);
+}
+
+// ncnn parses a value as float only if it has a decimal point or an
+// exponent. 9 significant digits are enough to restore a float exactly.
+static std::string FloatToString(float f) {
+  std::ostringstream os;
+  os << std::scientific << std::setprecision(8) << f;
+  return os.str();
+}
+
+// Number of elements and whether it is loaded with type 0, i.e., with a tag
+using WeightSpec = std::pair<int64_t, bool>;
+
+// Layers whose load_model() reads nothing
+static bool IsWeightless(const ParamLayer &layer) {
+  static const std::set<std::string> kTypes = {
+      "AbsVal", "BinaryOp", "BNLL", "Cast", "Clip", "Concat", "CopyTo",
+      "Crop", "CumulativeSum", "Dropout", "ELU", "Eltwise", "Exp",
+      "ExpandDims", "Flatten", "Fold", "GELU", "GLU", "HardSigmoid",
+      "HardSwish", "Input", "Interp", "Log", "LRN", "MatMul", "Mish", "Noop",
+      "Packing", "Permute", "PixelShuffle", "Pooling", "Pooling1D",
+      "Pooling3D", "Power", "ReLU", "Reduction", "Reorg", "Reshape", "SELU",
+      "ShuffleChannel", "Sigmoid", "Slice", "Softmax", "Softplus", "Split",
+      "Squeeze", "Swish", "TanH", "Threshold", "Tile", "UnaryOp", "Unfold",
+      // Custom layers of sherpa-ncnn
+      "PoolingModuleNoProj", "SherpaMetaData", "Stack", "TensorAsStrided",
+  };
+
+  return kTypes.count(layer.type) != 0;
+}
+
+// Return the weights of a layer in the order its load_model() in ncnn
+// reads them. Return false if the layout is unknown, e.g., for int8
+// layers.
+static bool GetWeightSpecs(const ParamLayer &layer,
+                           std::vector<WeightSpec> *specs) {
+  const std::string &type = layer.type;
+  if (IsWeightless(layer)) return true;
+
+  if (type == "Convolution" || type == "ConvolutionDepthWise" ||
+      type == "Convolution1D" || type == "ConvolutionDepthWise1D") {
+    if (GetIntParam(layer, kInt8ScaleTerm, 0) != 0) return false;
+
+    // dynamic_weight: the weights are the second input
+    if (GetIntParam(layer, 19, 0) != 0) return true;
+
+    specs->emplace_back(GetIntParam(layer, 6, 0), true);
+    if (GetIntParam(layer, 5, 0) != 0) {
+      specs->emplace_back(GetIntParam(layer, 0, 0), false);
+    }
+    return true;
+  }
+
+  if (type == "InnerProduct") {
+    if (GetIntParam(layer, kInt8ScaleTerm, 0) != 0) return false;
+
+    specs->emplace_back(GetIntParam(layer, 2, 0), true);
+    if (GetIntParam(layer, 1, 0) != 0) {
+      specs->emplace_back(GetIntParam(layer, 0, 0), false);
+    }
+    return true;
+  }
+
+  if (type == "Embed" || type == "Embedding") {
+    if (GetIntParam(layer, 18, 0) != 0) return false;
+
+    specs->emplace_back(GetIntParam(layer, 3, 0), true);
+    if (GetIntParam(layer, 2, 0) != 0) {
+      specs->emplace_back(GetIntParam(layer, 0, 0), false);
+    }
+    return true;
+  }
+
+  if (type == "MemoryData") {
+    // Newer versions of ncnn can load fp16 and int8 data
+    if (GetIntParam(layer, 21, 1) != 1) return false;
+
+    int64_t n = GetIntParam(layer, 0, 0);
+    for (int32_t key : {1, 11, 2}) {
+      n *= std::max(GetIntParam(layer, key, 0), 1);
+    }
+    specs->emplace_back(n, false);
+    return true;
+  }
+
+  if (type == "LayerNorm") {
+    if (GetIntParam(layer, 2, 1) != 0) {
+      specs->emplace_back(GetIntParam(layer, 0, 0), false);
+      specs->emplace_back(GetIntParam(layer, 0, 0), false);
+    }
+    return true;
+  }
+
+  if (type == "GroupNorm") {
+    if (GetIntParam(layer, 3, 1) != 0) {
+      specs->emplace_back(GetIntParam(layer, 1, 0), false);
+      specs->emplace_back(GetIntParam(layer, 1, 0), false);
+    }
+    return true;
+  }
+
+  if (type == "BatchNorm") {
+    // slope, mean, var and bias
+    for (int32_t i = 0; i != 4; ++i) {
+      specs->emplace_back(GetIntParam(layer, 0, 0), false);
+    }
+    return true;
+  }
+
+  if (type == "Scale") {
+    int32_t n = GetIntParam(layer, 0, 0);
+    if (n == -233) return true;  // the scale is the second input
+
+    specs->emplace_back(n, false);
+    if (GetIntParam(layer, 1, 0) != 0) specs->emplace_back(n, false);
+    return true;
+  }
+
+  if (type == "PReLU" || type == "Bias") {
+    specs->emplace_back(GetIntParam(layer, 0, 0), false);
+    return true;
+  }
+
+  if (type == "Padding") {
+    int32_t n = GetIntParam(layer, 6, 0);
+    if (n > 0) specs->emplace_back(n, false);
+    return true;
+  }
+
+  if (type == "Gemm") {
+    // Only Gemm without constant A, B and C is supported
+    return GetIntParam(layer, 4, 0) == 0 && GetIntParam(layer, 5, 0) == 0 &&
+           GetIntParam(layer, 6, 0) == 0;
+  }
+
+  if (type == "SimpleUpsample") {
+    specs->emplace_back(GetIntParam(layer, 2, 0), true);
+    return true;
+  }
+
+  return false;
+}
+
+static size_t AlignSize(size_t n, size_t alignment) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+// Number of bytes after the tag of n weights
+static size_t TaggedSize(uint32_t tag, int64_t n) {
+  if (tag == kFloat16Tag) return AlignSize(n * 2, 4);
+  if (tag == kInt8Tag) return AlignSize(n, 4);
+  if (tag == 0 || tag == kRawFloat32Tag) return n * 4;
+
+  // 8-bit indexes into a table of 256 floats
+  return 256 * 4 + AlignSize(n, 4);
+}
+
+bool ReadParamBin(const std::string &filename, ParamGraph *graph) {
+  std::ifstream is(filename, std::ios::binary);
+  if (!is) {
+    NCNN_LOGE("Failed to open %s", filename.c_str());
+    return false;
+  }
+
+  std::vector<char> bin{std::istreambuf_iterator<char>(is),
+                        std::istreambuf_iterator<char>()};
+
+  std::vector<std::vector<ParamWeight>> weights(graph->layers.size());
+
+  size_t offset = 0;
+  for (size_t i = 0; i != graph->layers.size(); ++i) {
+    const ParamLayer &layer = graph->layers[i];
+
+    std::vector<WeightSpec> specs;
+    if (!GetWeightSpecs(layer, &specs)) {
+      NCNN_LOGE("Unknown weight layout of %s (%s)", layer.name.c_str(),
+                layer.type.c_str());
+      return false;
+    }
+
+    for (const auto &spec : specs) {
+      ParamWeight w;
+      size_t n = spec.first * 4;
+      if (spec.second) {
+        if (offset + sizeof(w.tag) > bin.size()) {
+          NCNN_LOGE("%s is too short for the weights of %s",
+                    filename.c_str(), layer.name.c_str());
+          return false;
+        }
+
+        memcpy(&w.tag, &bin[offset], sizeof(w.tag));
+        w.has_tag = true;
+        offset += sizeof(w.tag);
+        n = TaggedSize(w.tag, spec.first);
+      }
+
+      if (spec.first < 0 || offset + n > bin.size()) {
+        NCNN_LOGE("%s is too short for the weights of %s", filename.c_str(),
+                  layer.name.c_str());
+        return false;
+      }
+
+      w.data.assign(bin.begin() + offset, bin.begin() + offset + n);
+      offset += n;
+
+      weights[i].push_back(std::move(w));
+    }
+  }
+
+  if (offset != bin.size()) {
+    NCNN_LOGE("The layers use %d bytes of %s, which has %d bytes",
+              static_cast<int32_t>(offset), filename.c_str(),
+              static_cast<int32_t>(bin.size()));
+    return false;
+  }
+
+  for (size_t i = 0; i != graph->layers.size(); ++i) {
+    graph->layers[i].weights = std::move(weights[i]);
+  }
+  graph->has_weights = true;
+
+  return true;
+}
+
+bool WriteParamBin(const std::string &filename, const ParamGraph &graph) {
+  std::ofstream os(filename, std::ios::binary);
+  if (!os) {
+    NCNN_LOGE("Failed to create %s", filename.c_str());
+    return false;
+  }
+
+  for (const auto &layer : graph.layers) {
+    for (const auto &w : layer.weights) {
+      if (w.has_tag) {
+        os.write(reinterpret_cast<const char *>(&w.tag), sizeof(w.tag));
+      }
+      os.write(w.data.data(), w.data.size());
+    }
+  }
+
+  return static_cast<bool>(os);
+}
+
+// Blobs fed or extracted by sherpa-ncnn
+static bool IsNetworkBlob(const std::string &name) {
+  static const std::regex kPattern("(in|out)\\d+");
+  return std::regex_match(name, kPattern);
+}
+
+// Parse the integer params of a layer. Return false if any of them is an
+// array, a float or a string.
+static bool GetIntParams(const ParamLayer &layer,
+                         std::map<int32_t, int32_t> *params) {
+  for (const auto &p : layer.params) {
+    auto eq = p.find('=');
+    if (eq == std::string::npos) return false;
+
+    std::string value = p.substr(eq + 1);
+    if (value.find_first_not_of("-0123456789") != std::string::npos) {
+      return false;
+    }
+
+    (*params)[atoi(p.c_str())] = atoi(value.c_str());
+  }
+
+  return true;
+}
+
+// Return the order_type of a Permute, or -1 if it is not supported
+static int32_t GetPermuteOrder(const ParamLayer &layer) {
+  std::map<int32_t, int32_t> params;
+  if (!GetIntParams(layer, &params)) return -1;
+
+  for (const auto &p : params) {
+    if (p.first != 0) return -1;
+  }
+
+  int32_t order = params.count(0) ? params[0] : 0;
+  return (order >= 0 && order < 6) ? order : -1;
+}
+
+// Layers that only change the shape and keep the order of the elements
+static bool IsShapeOnly(const ParamLayer &layer) {
+  if (layer.bottoms.size() != 1 || layer.tops.size() != 1) return false;
+
+  if (layer.type == "Flatten" || layer.type == "Squeeze" ||
+      layer.type == "ExpandDims") {
+    return true;
+  }
+
+  if (layer.type != "Reshape") return false;
+
+  // 3=1 permutes the input as caffe does
+  std::map<int32_t, int32_t> params;
+  return GetIntParams(layer, &params) && params[3] == 0;
+}
+
+// Return true if the output shape of a Reshape does not depend on the input
+// shape, i.e., w, h, d and c are given and none of them is 0, which means
+// to copy the input dim.
+static bool IsFixedReshape(const ParamLayer &layer) {
+  if (layer.type != "Reshape" || layer.bottoms.size() != 1) return false;
+
+  std::map<int32_t, int32_t> params;
+  if (!GetIntParams(layer, &params)) return false;
+
+  for (const auto &p : params) {
+    if (p.first != 0 && p.first != 1 && p.first != 2 && p.first != 11) {
+      return false;
+    }
+
+    if (p.second == 0) return false;
+  }
+
+  return true;
+}
+
+// Map each blob to the layers consuming it
+static std::map<std::string, std::vector<int32_t>> GetConsumers(
+    const ParamGraph &graph) {
+  std::map<std::string, std::vector<int32_t>> ans;
+  for (int32_t i = 0; i != graph.layers.size(); ++i) {
+    for (const auto &b : graph.layers[i].bottoms) {
+      ans[b].push_back(i);
+    }
+  }
+  return ans;
+}
+
+// Remove a layer with one input and one output. Its consumers read its
+// input instead.
+static void RemoveLayer(int32_t index, ParamGraph *graph) {
+  std::string bottom = graph->layers[index].bottoms[0];
+  std::string top = graph->layers[index].tops[0];
+
+  graph->layers.erase(graph->layers.begin() + index);
+
+  for (auto &layer : graph->layers) {
+    std::replace(layer.bottoms.begin(), layer.bottoms.end(), top, bottom);
+  }
+}
+
+// Return true if the layer has one input and one output, and the output is
+// not used by sherpa-ncnn
+static bool IsRemovable(const ParamLayer &layer) {
+  return layer.bottoms.size() == 1 && layer.tops.size() == 1 &&
+         !IsNetworkBlob(layer.tops[0]);
+}
+
+static bool RemoveIdentity(const std::map<std::string, BlobShape> &shapes,
+                           ParamGraph *graph) {
+  for (int32_t i = 0; i != graph->layers.size(); ++i) {
+    const ParamLayer &layer = graph->layers[i];
+    if (!IsRemovable(layer)) continue;
+
+    bool identity = false;
+    if (layer.type == "Noop") {
+      identity = true;
+    } else if (layer.type == "Permute") {
+      identity = GetPermuteOrder(layer) == 0;
+    } else if (IsShapeOnly(layer)) {
+      auto in = shapes.find(layer.bottoms[0]);
+      auto out = shapes.find(layer.tops[0]);
+      identity = in != shapes.end() && out != shapes.end() &&
+                 in->second == out->second;
+    }
+
+    if (identity) {
+      RemoveLayer(i, graph);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Permute -> Permute. The second one does both and the first one is
+// removed.
+static bool MergePermute(const std::map<std::string, BlobShape> &shapes,
+                         ParamGraph *graph) {
+  auto consumers = GetConsumers(*graph);
+
+  for (int32_t i = 0; i != graph->layers.size(); ++i) {
+    const ParamLayer &first = graph->layers[i];
+    if (first.type != "Permute" || !IsRemovable(first)) continue;
+
+    const auto &next = consumers[first.tops[0]];
+    if (next.size() != 1) continue;
+
+    ParamLayer &second = graph->layers[next[0]];
+    if (second.type != "Permute") continue;
+
+    // The order types of 4-D blobs differ, so the input must be 2-D or 3-D
+    auto in = shapes.find(first.bottoms[0]);
+    if (in == shapes.end() || in->second.dims < 2 || in->second.dims > 3) {
+      continue;
+    }
+
+    int32_t a = GetPermuteOrder(first);
+    int32_t b = GetPermuteOrder(second);
+    if (a < 0 || b < 0) continue;
+
+    int32_t composed[3];
+    for (int32_t k = 0; k != 3; ++k) {
+      composed[k] = kPermuteOrders[a][kPermuteOrders[b][k]];
+    }
+
+    for (int32_t order = 0; order != 6; ++order) {
+      if (std::equal(composed, composed + 3, kPermuteOrders[order])) {
+        second.params = {"0=" + std::to_string(order)};
+        break;
+      }
+    }
+
+    RemoveLayer(i, graph);
+    return true;
+  }
+
+  return false;
+}
+
+// Reshape -> Reshape to a fixed shape. The first one is removed.
+static bool MergeReshape(ParamGraph *graph) {
+  auto consumers = GetConsumers(*graph);
+
+  for (int32_t i = 0; i != graph->layers.size(); ++i) {
+    const ParamLayer &first = graph->layers[i];
+    if (!IsShapeOnly(first) || !IsRemovable(first)) continue;
+
+    const auto &next = consumers[first.tops[0]];
+    if (next.size() != 1 || !IsFixedReshape(graph->layers[next[0]])) {
+      continue;
+    }
+
+    RemoveLayer(i, graph);
+    return true;
+  }
+
+  return false;
+}
+
+// Remove unused outputs of a Split. If only one is left, remove the Split.
+static bool PruneSplit(ParamGraph *graph) {
+  auto consumers = GetConsumers(*graph);
+
+  for (int32_t i = 0; i != graph->layers.size(); ++i) {
+    ParamLayer &layer = graph->layers[i];
+    if (layer.type != "Split") continue;
+
+    std::vector<std::string> used;
+    for (const auto &t : layer.tops) {
+      if (!consumers[t].empty() || IsNetworkBlob(t)) used.push_back(t);
+    }
+
+    // Keep at least one output
+    if (used.empty()) used.push_back(layer.tops[0]);
+
+    bool changed = used.size() != layer.tops.size();
+    layer.tops = std::move(used);
+
+    if (IsRemovable(layer)) {
+      RemoveLayer(i, graph);
+      return true;
+    }
+
+    if (changed) return true;
+  }
+
+  return false;
+}
+
+// Map each blob to the layer producing it
+static std::map<std::string, int32_t> GetProducers(const ParamGraph &graph) {
+  std::map<std::string, int32_t> ans;
+  for (int32_t i = 0; i != graph.layers.size(); ++i) {
+    for (const auto &t : graph.layers[i].tops) {
+      ans[t] = i;
+    }
+  }
+  return ans;
+}
+
+// Layers that can apply an activation to their output and fold a scalar
+// into their weights
+static bool IsFusable(const ParamLayer &layer) {
+  if (layer.type != "Convolution" && layer.type != "ConvolutionDepthWise" &&
+      layer.type != "InnerProduct") {
+    return false;
+  }
+
+  return layer.bottoms.size() == 1 && layer.tops.size() == 1 &&
+         !IsNetworkBlob(layer.tops[0]) &&
+         GetIntParam(layer, kActivationType, 0) == 0 &&
+         GetIntParam(layer, kInt8ScaleTerm, 0) == 0;
+}
+
+// Return the only consumer of the output of a fusable layer if it has one
+// input and one output, or nullptr
+static ParamLayer *GetOnlyConsumer(
+    const std::map<std::string, std::vector<int32_t>> &consumers,
+    const ParamLayer &layer, ParamGraph *graph) {
+  auto it = consumers.find(layer.tops[0]);
+  if (it == consumers.end() || it->second.size() != 1) return nullptr;
+
+  ParamLayer *next = &graph->layers[it->second[0]];
+  if (next->bottoms.size() != 1 || next->tops.size() != 1) return nullptr;
+
+  return next;
+}
+
+// Remove the layer after a fusable layer, which then produces its output
+static void RemoveConsumer(ParamLayer *layer, ParamLayer *next,
+                           ParamGraph *graph) {
+  layer->tops[0] = next->tops[0];
+  graph->layers.erase(graph->layers.begin() + (next - graph->layers.data()));
+}
+
+// Convolution, ConvolutionDepthWise or InnerProduct followed by an
+// activation
+static bool FuseActivation(bool exact, ParamGraph *graph) {
+  auto consumers = GetConsumers(*graph);
+
+  for (auto &layer : graph->layers) {
+    if (!IsFusable(layer)) continue;
+
+    ParamLayer *next = GetOnlyConsumer(consumers, layer, graph);
+    if (!next) continue;
+
+    // See ncnn::create_activation_layer() for the types and their params
+    int32_t activation_type = 0;
+    std::vector<float> activation_params;
+    if (next->type == "ReLU") {
+      float slope = GetFloatParam(*next, 0, 0);
+      activation_type = slope == 0 ? 1 : 2;
+      if (slope != 0) activation_params = {slope};
+    } else if (next->type == "Clip") {
+      activation_type = 3;
+      activation_params = {GetFloatParam(*next, 0, -FLT_MAX),
+                           GetFloatParam(*next, 1, FLT_MAX)};
+    } else if (!exact && next->type == "Sigmoid") {
+      // The fused sigmoid of some platforms uses a different approximation
+      activation_type = 4;
+    } else if (!exact && next->type == "Mish") {
+      activation_type = 5;
+    } else if (!exact && next->type == "HardSwish") {
+      activation_type = 6;
+      activation_params = {GetFloatParam(*next, 0, 0.2f),
+                           GetFloatParam(*next, 1, 0.5f)};
+    } else {
+      continue;
+    }
+
+    SetParam(kActivationType, std::to_string(activation_type), &layer);
+    if (!activation_params.empty()) {
+      std::string value = std::to_string(activation_params.size());
+      for (auto f : activation_params) value += "," + FloatToString(f);
+
+      SetParam(kArrayKeyBase - kActivationParams, value, &layer);
+    }
+
+    RemoveConsumer(&layer, next, graph);
+    return true;
+  }
+
+  return false;
+}
+
+// Return true if multiplying by f never changes the rounding, i.e., f is
+// +-2^k
+static bool IsPowerOfTwo(float f) {
+  if (!std::isfinite(f) || f == 0) return false;
+
+  int32_t e = 0;
+  return std::fabs(std::frexp(f, &e)) == 0.5f;
+}
+
+// Convolution, ConvolutionDepthWise or InnerProduct followed by a BinaryOp
+// with a scalar. Multiplication and division are folded into the weights
+// and the bias, addition and subtraction into the bias.
+static bool FuseScalar(bool exact, ParamGraph *graph) {
+  auto consumers = GetConsumers(*graph);
+
+  for (auto &layer : graph->layers) {
+    if (!IsFusable(layer) || layer.weights.empty() ||
+        (layer.weights[0].has_tag && layer.weights[0].tag != 0)) {
+      continue;
+    }
+
+    ParamLayer *next = GetOnlyConsumer(consumers, layer, graph);
+    if (!next || next->type != "BinaryOp" || GetIntParam(*next, 1, 0) == 0) {
+      continue;
+    }
+
+    int32_t op = GetIntParam(*next, 0, 0);
+    float b = GetFloatParam(*next, 2, 0);
+
+    // 0 - add, 1 - sub, 2 - mul, 3 - div
+    float scale = 1;
+    float shift = 0;
+    if (op == 2) {
+      scale = b;
+    } else if (op == 3) {
+      scale = 1 / b;
+    } else if (op == 0 && !exact) {
+      shift = b;
+    } else if (op == 1 && !exact) {
+      shift = -b;
+    } else {
+      continue;
+    }
+
+    if (!std::isfinite(scale) || (exact && op >= 2 && !IsPowerOfTwo(scale))) {
+      continue;
+    }
+
+    int32_t bias_key = layer.type == "InnerProduct" ? 1 : 5;
+    bool has_bias = GetIntParam(layer, bias_key, 0) != 0;
+
+    // Scaling must not produce subnormals, which would lose precision
+    bool ok = true;
+    for (auto &w : layer.weights) {
+      const float *p = w.Float32();
+      for (int64_t i = 0; i != w.NumFloat32() && ok; ++i) {
+        ok = std::fpclassify(p[i] * scale) != FP_SUBNORMAL &&
+             std::isfinite(p[i] * scale);
+      }
+    }
+    if (!ok) continue;
+
+    for (auto &w : layer.weights) {
+      float *p = w.Float32();
+      for (int64_t i = 0; i != w.NumFloat32(); ++i) {
+        p[i] *= scale;
+      }
+    }
+
+    if (shift != 0) {
+      if (!has_bias) {
+        ParamWeight bias;
+        bias.data.resize(GetIntParam(layer, 0, 0) * sizeof(float));
+        layer.weights.push_back(std::move(bias));
+        SetParam(bias_key, "1", &layer);
+      }
+
+      ParamWeight &bias = layer.weights[1];
+      float *p = bias.Float32();
+      for (int64_t i = 0; i != bias.NumFloat32(); ++i) {
+        p[i] += shift;
+      }
+    }
+
+    RemoveConsumer(&layer, next, graph);
+    return true;
+  }
+
+  return false;
+}
+
+// A constant blob, i.e., the output of a MemoryData
+struct Constant {
+  BlobShape shape;
+  const float *data = nullptr;
+};
+
+static int64_t NumElements(const BlobShape &s) {
+  return static_cast<int64_t>(s.w) * s.h * s.d * s.c;
+}
+
+static bool GetConstant(const ParamGraph &graph,
+                        const std::map<std::string, int32_t> &producers,
+                        const std::string &blob, Constant *c) {
+  auto it = producers.find(blob);
+  if (it == producers.end()) return false;
+
+  const ParamLayer &layer = graph.layers[it->second];
+  if (layer.type != "MemoryData" || layer.weights.size() != 1) return false;
+
+  BlobShape &s = c->shape;
+  s.w = GetIntParam(layer, 0, 0);
+  s.h = GetIntParam(layer, 1, 0);
+  s.d = GetIntParam(layer, 11, 0);
+  s.c = GetIntParam(layer, 2, 0);
+  s.dims = s.d ? 4 : (s.c ? 3 : (s.h ? 2 : 1));
+  s.h = std::max(s.h, 1);
+  s.d = std::max(s.d, 1);
+  s.c = std::max(s.c, 1);
+
+  c->data = layer.weights[0].Float32();
+
+  return NumElements(s) == layer.weights[0].NumFloat32();
+}
+
+static ParamLayer MakeMemoryData(const std::string &name,
+                                 const std::string &top,
+                                 const BlobShape &shape,
+                                 const std::vector<float> &data) {
+  ParamLayer layer;
+  layer.type = "MemoryData";
+  layer.name = name;
+  layer.tops = {top};
+
+  layer.params.push_back("0=" + std::to_string(shape.w));
+  if (shape.dims >= 2) layer.params.push_back("1=" + std::to_string(shape.h));
+  if (shape.dims == 4) layer.params.push_back("11=" + std::to_string(shape.d));
+  if (shape.dims >= 3) layer.params.push_back("2=" + std::to_string(shape.c));
+
+  ParamWeight w;
+  const char *p = reinterpret_cast<const char *>(data.data());
+  w.data.assign(p, p + data.size() * sizeof(float));
+  layer.weights.push_back(std::move(w));
+
+  return layer;
+}
+
+// Compute a BinaryOp in the same way as ncnn. Return false if the op is not
+// supported.
+static bool ApplyBinaryOp(int32_t op, bool exact, float a, float b,
+                          float *ans) {
+  switch (op) {
+    case 0:
+      *ans = a + b;
+      return true;
+    case 1:
+      *ans = a - b;
+      return true;
+    case 2:
+      *ans = a * b;
+      return true;
+    case 4:
+      *ans = std::max(a, b);
+      return true;
+    case 5:
+      *ans = std::min(a, b);
+      return true;
+    case 7:
+      *ans = b - a;
+      return true;
+    default:
+      break;
+  }
+
+  if (exact) return false;
+
+  // Some platforms multiply by the reciprocal or use approximations
+  switch (op) {
+    case 3:
+      *ans = a / b;
+      return true;
+    case 6:
+      *ans = std::pow(a, b);
+      return true;
+    case 8:
+      *ans = b / a;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Compute a UnaryOp in the same way as ncnn. Return false if the op is not
+// supported.
+static bool ApplyUnaryOp(int32_t op, bool exact, float a, float *ans) {
+  switch (op) {
+    case 0:
+      *ans = std::fabs(a);
+      return true;
+    case 1:
+      *ans = -a;
+      return true;
+    case 2:
+      *ans = std::floor(a);
+      return true;
+    case 3:
+      *ans = std::ceil(a);
+      return true;
+    case 4:
+      *ans = a * a;
+      return true;
+    case 5:
+      *ans = std::sqrt(a);
+      return true;
+    default:
+      break;
+  }
+
+  if (exact) return false;
+
+  switch (op) {
+    case 6:
+      *ans = 1 / std::sqrt(a);
+      return true;
+    case 7:
+      *ans = std::exp(a);
+      return true;
+    case 8:
+      *ans = std::log(a);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Compute the output of a layer whose inputs are all constants. Return
+// false if the layer is not supported.
+static bool Evaluate(const ParamLayer &layer,
+                     const std::vector<Constant> &inputs,
+                     const std::map<std::string, BlobShape> &shapes,
+                     bool exact, BlobShape *shape, std::vector<float> *out) {
+  const Constant &a = inputs[0];
+
+  if (layer.type == "BinaryOp") {
+    int32_t op = GetIntParam(layer, 0, 0);
+
+    if (GetIntParam(layer, 1, 0) != 0) {
+      if (inputs.size() != 1) return false;
+
+      float b = GetFloatParam(layer, 2, 0);
+      *shape = a.shape;
+      out->resize(NumElements(a.shape));
+      for (size_t i = 0; i != out->size(); ++i) {
+        if (!ApplyBinaryOp(op, exact, a.data[i], b, &(*out)[i])) return false;
+      }
+      return true;
+    }
+
+    if (inputs.size() != 2) return false;
+    const Constant &b = inputs[1];
+
+    // Broadcasting other than a scalar is not supported
+    int64_t na = NumElements(a.shape);
+    int64_t nb = NumElements(b.shape);
+    if (!(a.shape == b.shape) && na != 1 && nb != 1) return false;
+
+    *shape = na >= nb ? a.shape : b.shape;
+    out->resize(std::max(na, nb));
+    for (size_t i = 0; i != out->size(); ++i) {
+      float x = a.data[na == 1 ? 0 : i];
+      float y = b.data[nb == 1 ? 0 : i];
+      if (!ApplyBinaryOp(op, exact, x, y, &(*out)[i])) return false;
+    }
+  } else if (layer.type == "UnaryOp") {
+    if (inputs.size() != 1) return false;
+
+    int32_t op = GetIntParam(layer, 0, 0);
+    *shape = a.shape;
+    out->resize(NumElements(a.shape));
+    for (size_t i = 0; i != out->size(); ++i) {
+      if (!ApplyUnaryOp(op, exact, a.data[i], &(*out)[i])) return false;
+    }
+  } else if (IsShapeOnly(layer)) {
+    auto it = shapes.find(layer.tops[0]);
+    if (it == shapes.end() || NumElements(it->second) != NumElements(a.shape)) {
+      return false;
+    }
+
+    *shape = it->second;
+    out->assign(a.data, a.data + NumElements(a.shape));
+  } else {
+    return false;
+  }
+
+  // The shape given by a run of the network wins if it is known
+  auto it = shapes.find(layer.tops[0]);
+  return it == shapes.end() || it->second == *shape;
+}
+
+// Remove MemoryData whose output is not used
+static void RemoveUnusedConstants(ParamGraph *graph) {
+  auto consumers = GetConsumers(*graph);
+
+  auto &layers = graph->layers;
+  layers.erase(std::remove_if(layers.begin(), layers.end(),
+                              [&consumers](const ParamLayer &layer) {
+                                return layer.type == "MemoryData" &&
+                                       consumers[layer.tops[0]].empty() &&
+                                       !IsNetworkBlob(layer.tops[0]);
+                              }),
+               layers.end());
+}
+
+// Replace a layer whose inputs are all constants by a MemoryData
+static bool FoldConstant(const std::map<std::string, BlobShape> &shapes,
+                         bool exact, ParamGraph *graph) {
+  auto producers = GetProducers(*graph);
+
+  for (auto &layer : graph->layers) {
+    if (layer.bottoms.empty() || layer.tops.size() != 1) continue;
+
+    std::vector<Constant> inputs(layer.bottoms.size());
+    bool constant = true;
+    for (size_t i = 0; i != inputs.size() && constant; ++i) {
+      constant = GetConstant(*graph, producers, layer.bottoms[i], &inputs[i]);
+    }
+    if (!constant) continue;
+
+    BlobShape shape;
+    std::vector<float> out;
+    if (!Evaluate(layer, inputs, shapes, exact, &shape, &out)) continue;
+
+    layer = MakeMemoryData(layer.name, layer.tops[0], shape, out);
+    RemoveUnusedConstants(graph);
+
+    return true;
+  }
+
+  return false;
+}
+
+ParamOptimizerStats OptimizeParamGraph(
+    const std::map<std::string, BlobShape> &shapes,
+    const ParamOptimizerConfig &config, ParamGraph *graph) {
+  bool fold_weights = config.fold_weights && graph->has_weights;
+
+  ParamOptimizerStats stats;
+  stats.num_layers_before = graph->layers.size();
+
+  while (true) {
+    if (RemoveIdentity(shapes, graph)) {
+      stats.removed_identity += 1;
+    } else if (MergePermute(shapes, graph)) {
+      stats.merged_permute += 1;
+    } else if (MergeReshape(graph)) {
+      stats.merged_reshape += 1;
+    } else if (PruneSplit(graph)) {
+      stats.removed_split += 1;
+    } else if (FuseActivation(config.exact, graph)) {
+      stats.fused_activation += 1;
+    } else if (fold_weights && FoldConstant(shapes, config.exact, graph)) {
+      stats.folded_constant += 1;
+    } else if (fold_weights && FuseScalar(config.exact, graph)) {
+      stats.fused_scalar += 1;
+    } else {
+      break;
+    }
+  }
+
+  stats.num_layers_after = graph->layers.size();
+
+  return stats;
+}
+
+ParamOptimizerStats OptimizeParamGraph(
+    const std::map<std::string, BlobShape> &shapes, ParamGraph *graph) {
+  return OptimizeParamGraph(shapes, ParamOptimizerConfig(), graph);
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,169 @@
+// sherpa-ncnn/csrc/param-optimizer.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_PARAM_OPTIMIZER_H_
+#define SHERPA_NCNN_CSRC_PARAM_OPTIMIZER_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace sherpa_ncnn {
+
+/* Graph rewrites on the text .param files exported by pnnx.
+ *
+ * The following rewrites only touch layers without weights:
+ *
+ *  - Remove Noop, Permute with order_type 0, and Reshape, Flatten, Squeeze
+ *    and ExpandDims whose output has the same shape as their input
+ *  - Merge a chain of two Permute into one
+ *  - Remove a Reshape, Flatten, Squeeze or ExpandDims followed by a
+ *    Reshape to a fixed shape
+ *  - Remove unused outputs of Split, and Split with a single output
+ *  - Fuse ReLU and Clip into the activation of a preceding Convolution,
+ *    ConvolutionDepthWise or InnerProduct
+ *
+ * If the weights are read with ReadParamBin(), the following rewrites
+ * change them as well, and the graph must be saved with WriteParamBin():
+ *
+ *  - Fold BinaryOp, UnaryOp and shape-only layers whose inputs are all
+ *    MemoryData into a single MemoryData
+ *  - Fold a BinaryOp with a scalar into the weights and bias of a
+ *    preceding Convolution, ConvolutionDepthWise or InnerProduct
+ *
+ * By default, only rewrites that keep the outputs bit-identical are done,
+ * e.g., a scalar is folded into weights only if it is a power of 2.
+ *
+ * Blobs named in0, in1, ..., out0, out1, ... are never removed since
+ * sherpa-ncnn feeds and extracts them by name.
+ */
+
+// Weights of a layer that ncnn reads with one call to ModelBin::load()
+struct ParamWeight {
+  // Weights loaded with type 0 start with a tag giving their format.
+  // Weights loaded with type 1 are always fp32 and have no tag.
+  bool has_tag = false;
+  uint32_t tag = 0;
+
+  // Bytes after the tag
+  std::vector<char> data;
+
+  // Return true if data holds fp32 values
+  bool IsFloat32() const { return !has_tag || tag == 0; }
+
+  float *Float32() { return reinterpret_cast<float *>(data.data()); }
+
+  const float *Float32() const {
+    return reinterpret_cast<const float *>(data.data());
+  }
+
+  int64_t NumFloat32() const { return data.size() / sizeof(float); }
+};
+
+struct ParamLayer {
+  std::string type;
+  std::string name;
+  std::vector<std::string> bottoms;
+  std::vector<std::string> tops;
+
+  // key=value as in the file, e.g., 0=1 or -23303=3,1,2,3
+  std::vector<std::string> params;
+
+  // In the order they are stored in the .bin file. Empty if the weights
+  // have not been read.
+  std::vector<ParamWeight> weights;
+};
+
+struct ParamGraph {
+  std::vector<ParamLayer> layers;
+
+  // True if the weights of all layers have been read by ReadParamBin()
+  bool has_weights = false;
+};
+
+// Shape of a blob without packing
+struct BlobShape {
+  int32_t dims = 0;
+  int32_t w = 0;
+  int32_t h = 0;
+  int32_t d = 0;
+  int32_t c = 0;
+
+  bool operator==(const BlobShape &other) const {
+    return dims == other.dims && w == other.w && h == other.h &&
+           d == other.d && c == other.c;
+  }
+};
+
+struct ParamOptimizerStats {
+  int32_t num_layers_before = 0;
+  int32_t num_layers_after = 0;
+
+  int32_t removed_identity = 0;
+  int32_t merged_permute = 0;
+  int32_t merged_reshape = 0;
+  int32_t removed_split = 0;
+  int32_t fused_activation = 0;
+  int32_t folded_constant = 0;
+  int32_t fused_scalar = 0;
+
+  std::string ToString() const;
+};
+
+struct ParamOptimizerConfig {
+  // Fold constants and scalars into weights. Used only if the graph has
+  // weights.
+  bool fold_weights = true;
+
+  // If false, also do rewrites that change the rounding of the outputs,
+  // e.g., folding any scalar into weights and fusing Sigmoid into the
+  // activation of the preceding layer.
+  bool exact = true;
+
+  ParamOptimizerConfig() = default;
+
+  ParamOptimizerConfig(bool fold_weights, bool exact)
+      : fold_weights(fold_weights), exact(exact) {}
+
+  std::string ToString() const;
+};
+
+/// Read a text .param file. Return false on error.
+bool ReadParamGraph(const std::string &filename, ParamGraph *graph);
+
+/// Write a text .param file. Return false on error.
+bool WriteParamGraph(const std::string &filename, const ParamGraph &graph);
+
+/** Split a .bin file into the weights of the layers of graph.
+ *
+ * The layout of the weights of each layer type is derived from its params
+ * in the same way as its load_model() in ncnn does. Return false if a layer
+ * type with unknown layout is found, or if the size of the file does not
+ * match. The graph is not changed in that case.
+ */
+bool ReadParamBin(const std::string &filename, ParamGraph *graph);
+
+/// Write the weights of all layers. Return false on error.
+bool WriteParamBin(const std::string &filename, const ParamGraph &graph);
+
+/** Apply the rewrites until none applies.
+ *
+ * @param shapes  Shapes of the blobs, by name, from a run of the network.
+ *                Layers are removed as identities only if the shapes of
+ *                their input and output are known. It can be empty.
+ * @param config  Which rewrites to apply.
+ * @param graph  It is changed in place.
+ */
+ParamOptimizerStats OptimizeParamGraph(
+    const std::map<std::string, BlobShape> &shapes,
+    const ParamOptimizerConfig &config, ParamGraph *graph);
+
+/// Same as above with the default config.
+ParamOptimizerStats OptimizeParamGraph(
+    const std::map<std::string, BlobShape> &shapes, ParamGraph *graph);
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_PARAM_OPTIMIZER_H_
@@ -0,0 +1,22 @@
+// sherpa-ncnn/csrc/parse-options.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/parse-options.h"
+
+#include <string>
+
+namespace sherpa_ncnn {
+
+bool ParseFlag(const std::string &arg, const std::string &name,
+               std::string *value) {
+  std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,25 @@
+// sherpa-ncnn/csrc/parse-options.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_PARSE_OPTIONS_H_
+#define SHERPA_NCNN_CSRC_PARSE_OPTIONS_H_
+
+#include <string>
+
+namespace sherpa_ncnn {
+
+/** Parse a command-line flag of the form --name=value.
+ *
+ * @param arg  A command-line argument, e.g., argv[i].
+ * @param name  Name of the flag without the leading "--".
+ * @param value  On return, it contains the value if arg matches.
+ *
+ * @return Return true if arg is --name=value and set value.
+ */
+bool ParseFlag(const std::string &arg, const std::string &name,
+               std::string *value);
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_PARSE_OPTIONS_H_
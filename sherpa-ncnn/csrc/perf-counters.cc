@@ -0,0 +1,184 @@
+// sherpa-ncnn/csrc/perf-counters.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/perf-counters.h"
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace sherpa_ncnn {
+
+const char *PerfEventName(PerfEvent event) {
+  switch (event) {
+    case PerfEvent::kCycles:
+      return "cycles";
+    case PerfEvent::kInstructions:
+      return "instructions";
+    case PerfEvent::kBranchMisses:
+      return "branch_misses";
+    case PerfEvent::kL1dReadMisses:
+      return "l1d_read_misses";
+    case PerfEvent::kLlcReferences:
+      return "llc_references";
+    case PerfEvent::kLlcMisses:
+      return "llc_misses";
+  }
+  return "";
+}
+
+#if defined(__linux__)
+
+static void SetEventConfig(PerfEvent event, struct perf_event_attr *attr) {
+  attr->type = PERF_TYPE_HARDWARE;
+  switch (event) {
+    case PerfEvent::kCycles:
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PerfEvent::kInstructions:
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PerfEvent::kBranchMisses:
+      attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PerfEvent::kL1dReadMisses:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_L1D |
+                     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PerfEvent::kLlcReferences:
+      attr->config = PERF_COUNT_HW_CACHE_REFERENCES;
+      break;
+    case PerfEvent::kLlcMisses:
+      attr->config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+  }
+}
+
+static int32_t OpenEvent(PerfEvent event, int32_t group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  SetEventConfig(event, &attr);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  // pid 0 and cpu -1: the calling thread on any CPU. Threads it creates
+  // are not counted. See perf-counters.h
+  return static_cast<int32_t>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+PerfCounters::PerfCounters() {
+  fd_.fill(-1);
+  index_.fill(-1);
+
+  int32_t leader = -1;
+  for (int32_t i = 0; i != kNumPerfEvents; ++i) {
+    int32_t fd = OpenEvent(static_cast<PerfEvent>(i), leader);
+    if (fd < 0) {
+      if (leader < 0 && error_.empty()) {
+        error_ = std::string("perf_event_open: ") + strerror(errno);
+      }
+      continue;
+    }
+
+    if (leader < 0) leader = fd;
+    fd_[i] = fd;
+    index_[i] = num_open_++;
+  }
+
+  if (num_open_ > 0) error_.clear();
+}
+
+PerfCounters::~PerfCounters() {
+  // Close the leader last
+  for (int32_t i = kNumPerfEvents - 1; i >= 0; --i) {
+    if (fd_[i] >= 0) close(fd_[i]);
+  }
+}
+
+void PerfCounters::Read(PerfValues *values) {
+  values->counts.fill(0);
+  if (num_open_ == 0) return;
+
+  // nr, time_enabled, time_running, values
+  uint64_t buf[3 + kNumPerfEvents];
+  int32_t leader = -1;
+  for (int32_t fd : fd_) {
+    if (fd >= 0) {
+      leader = fd;
+      break;
+    }
+  }
+
+  ssize_t n = read(leader, buf, sizeof(buf));
+  if (n < static_cast<ssize_t>(3 * sizeof(uint64_t))) return;
+
+  if (buf[2] < buf[1]) multiplexed_ = true;
+
+  for (int32_t i = 0; i != kNumPerfEvents; ++i) {
+    if (index_[i] >= 0 && index_[i] < static_cast<int32_t>(buf[0])) {
+      values->counts[i] = buf[3 + index_[i]];
+    }
+  }
+}
+
+#else
+
+PerfCounters::PerfCounters() : error_("perf events need Linux") {
+  fd_.fill(-1);
+  index_.fill(-1);
+}
+
+PerfCounters::~PerfCounters() = default;
+
+void PerfCounters::Read(PerfValues *values) { values->counts.fill(0); }
+
+#endif
+
+void PerfStageCounters::OnStageStart(Stage stage) {
+  if (next_) next_->OnStageStart(stage);
+
+  if (!counters_.IsAvailable()) return;
+
+  if (depth_ < kMaxDepth) {
+    Frame &f = stack_[depth_];
+    f.nested.counts.fill(0);
+    counters_.Read(&f.start);
+  }
+  ++depth_;
+}
+
+void PerfStageCounters::OnStage(Stage stage, StageClock::time_point start,
+                                StageClock::time_point end,
+                                StageClock::duration self) {
+  if (counters_.IsAvailable() && depth_ > 0) {
+    --depth_;
+    if (depth_ < kMaxDepth) {
+      PerfValues total;
+      counters_.Read(&total);
+      total.Sub(stack_[depth_].start);
+
+      if (depth_ > 0) {
+        stack_[depth_ - 1].nested.Add(total);
+      }
+
+      total.Sub(stack_[depth_].nested);
+      values_[static_cast<int32_t>(stage)].Add(total);
+    }
+  }
+
+  if (next_) next_->OnStage(stage, start, end, self);
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,139 @@
+// sherpa-ncnn/csrc/perf-counters.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_PERF_COUNTERS_H_
+#define SHERPA_NCNN_CSRC_PERF_COUNTERS_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "sherpa-ncnn/csrc/stage-timer.h"
+
+namespace sherpa_ncnn {
+
+// Hardware events counted with perf_event_open(2) on Linux
+enum class PerfEvent : int32_t {
+  kCycles = 0,
+  kInstructions,
+  kBranchMisses,
+  kL1dReadMisses,
+  kLlcReferences,
+  kLlcMisses,
+};
+
+constexpr int32_t kNumPerfEvents = 6;
+
+const char *PerfEventName(PerfEvent event);
+
+struct PerfValues {
+  std::array<uint64_t, kNumPerfEvents> counts{};
+
+  uint64_t operator[](PerfEvent event) const {
+    return counts[static_cast<int32_t>(event)];
+  }
+
+  void Add(const PerfValues &other) {
+    for (int32_t i = 0; i != kNumPerfEvents; ++i) counts[i] += other.counts[i];
+  }
+
+  void Sub(const PerfValues &other) {
+    for (int32_t i = 0; i != kNumPerfEvents; ++i) counts[i] -= other.counts[i];
+  }
+};
+
+/* Hardware counters of the calling thread.
+ *
+ * Only the calling thread is counted, not the worker threads of ncnn, so
+ * with ncnn threads > 1 the counts miss most of the work of the networks.
+ * The counters are not inherited by child threads: the kernel cannot read
+ * inherited events as a group, and ncnn creates its thread pool before the
+ * counters are opened.
+ *
+ * The events are opened as one group so that they are read with a single
+ * system call and always count the same instructions. Events that the CPU
+ * or the kernel does not support are left out. If none can be opened,
+ * e.g., on other platforms, in containers or when
+ * /proc/sys/kernel/perf_event_paranoid is too high, IsAvailable() returns
+ * false and Read() returns zeros.
+ *
+ * Only user space is counted. It must be used on the thread that created
+ * it.
+ */
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  bool IsAvailable() const { return num_open_ > 0; }
+
+  bool Has(PerfEvent event) const {
+    return fd_[static_cast<int32_t>(event)] >= 0;
+  }
+
+  // Why no event could be opened, or an empty string
+  const std::string &Error() const { return error_; }
+
+  void Read(PerfValues *values);
+
+  // True if the kernel had to multiplex the group with other events, so
+  // that it did not count all the time
+  bool IsMultiplexed() const { return multiplexed_; }
+
+ private:
+  std::array<int32_t, kNumPerfEvents> fd_;
+
+  // Position of each open event in the group
+  std::array<int32_t, kNumPerfEvents> index_;
+
+  int32_t num_open_ = 0;
+  bool multiplexed_ = false;
+  std::string error_;
+};
+
+/* Count the hardware events of each stage on the calling thread.
+ *
+ * Install it with SetThreadStageObserver(). Like the self time passed to
+ * StageObserver::OnStage(), the counts of a stage exclude the stages run
+ * within it. All stages are passed on to next, if it is not nullptr.
+ */
+class PerfStageCounters : public StageObserver {
+ public:
+  explicit PerfStageCounters(StageObserver *next = nullptr) : next_(next) {}
+
+  const PerfCounters &GetCounters() const { return counters_; }
+
+  // Self counts of the given stage
+  const PerfValues &Get(Stage stage) const {
+    return values_[static_cast<int32_t>(stage)];
+  }
+
+  void OnStageStart(Stage stage) override;
+
+  void OnStage(Stage stage, StageClock::time_point start,
+               StageClock::time_point end, StageClock::duration self) override;
+
+ private:
+  struct Frame {
+    PerfValues start;
+
+    // Counts of the stages run within this one
+    PerfValues nested;
+  };
+
+  static constexpr int32_t kMaxDepth = 8;
+
+  StageObserver *next_;
+  PerfCounters counters_;
+  std::array<PerfValues, kNumStages> values_;
+  std::array<Frame, kMaxDepth> stack_;
+  int32_t depth_ = 0;
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_PERF_COUNTERS_H_
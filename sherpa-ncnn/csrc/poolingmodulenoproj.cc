@@ -18,11 +18,65 @@
 
 #include "sherpa-ncnn/csrc/poolingmodulenoproj.h"
 
+#include <string.h>
+
+#include <vector>
+
+#include "sherpa-ncnn/csrc/custom-layer-kernels.h"
+
 namespace sherpa_ncnn {
 
 PoolingModuleNoProj::PoolingModuleNoProj() {
   one_blob_only = false;
   support_inplace = false;
+
+  // fp16 storage is not enabled since ncnn would cast all inputs,
+  // including cached_len, which is exact in fp16 only up to 2048 frames
+  support_packing = true;
+}
+
+// x is packed along T, i.e., frame r * elempack + i of column c is at
+// x.row(r)[c * elempack + i]. The running sums are kept per column and
+// every frame is scaled by its own count.
+static void ForwardPacked(const ncnn::Mat &x, const float *cached_avg_ptr,
+                          float n, ncnn::Mat *out_x,
+                          float *out_cached_avg_ptr) {
+  int32_t w = x.w;
+  int32_t h = x.h;
+  int32_t elempack = x.elempack;
+
+  std::vector<float> sum(w);
+  for (int32_t c = 0; c != w; ++c) {
+    sum[c] = n * cached_avg_ptr[c];
+  }
+
+  std::vector<float> scales(elempack);
+  for (int32_t r = 0; r != h; ++r) {
+    for (int32_t i = 0; i != elempack; ++i) {
+      scales[i] = 1. / (n + r * elempack + i + 1);
+    }
+
+    const float *x_ptr = x.row(r);
+    float *out_ptr = out_x->row(r);
+
+    for (int32_t c = 0; c != w; ++c) {
+      float s = sum[c];
+      for (int32_t i = 0; i != elempack; ++i) {
+        s += x_ptr[i];
+        out_ptr[i] = s * scales[i];
+      }
+      sum[c] = s;
+
+      x_ptr += elempack;
+      out_ptr += elempack;
+    }
+  }
+
+  // The last frame is the last lane of the last row
+  const float *last_row = out_x->row(h - 1);
+  for (int32_t c = 0; c != w; ++c) {
+    out_cached_avg_ptr[c] = last_row[c * elempack + elempack - 1];
+  }
 }
 
 int32_t PoolingModuleNoProj::forward(const std::vector<ncnn::Mat> &bottom_blobs,
@@ -32,7 +86,7 @@ int32_t PoolingModuleNoProj::forward(const std::vector<ncnn::Mat> &bottom_blobs,
   ncnn::Mat cached_len = bottom_blobs[1];
   ncnn::Mat cached_avg = bottom_blobs[2];
 
-  // x.dims = 2, x.w = C, x.h = T
+  // x.dims = 2, x.w = C, x.h * x.elempack = T
   // cached_len.dims = 1, cached_len.w = 1
   // cached_avg.dims = 2, cached_avg.w = C, cached_avg.h = 1
 
@@ -51,14 +105,21 @@ int32_t PoolingModuleNoProj::forward(const std::vector<ncnn::Mat> &bottom_blobs,
   const float *x_ptr = x;
   const float *cached_avg_ptr = cached_avg;
   float *out_ptr = out_x;
+  float *out_cached_avg_ptr = out_cached_avg;
 
   float n = cached_len[0];
 
-  // process row 0
-  for (int32_t c = 0; c < w; ++c) {
-    out_ptr[c] = x_ptr[c] + n * cached_avg_ptr[c];
+  if (x.elempack > 1) {
+    ForwardPacked(x, cached_avg_ptr, n, &out_x, out_cached_avg_ptr);
+    out_cached_len[0] = n + h * x.elempack;
+    return 0;
   }
 
+  const CustomLayerKernels &k = GetCustomLayerKernels();
+
+  // process row 0
+  k.add_scaled(x_ptr, cached_avg_ptr, n, out_ptr, w);
+
   for (int32_t r = 1; r < h; ++r) {
     const float *x_cur = x.row(r);
 
@@ -66,20 +127,14 @@ int32_t PoolingModuleNoProj::forward(const std::vector<ncnn::Mat> &bottom_blobs,
     float *out_cur = out_x.row(r);
 
     float scale = 1. / (n + r);  // scale for the previous row
-    for (int32_t c = 0; c < w; ++c) {
-      out_cur[c] = out_prev[c] + x_cur[c];
-      out_prev[c] *= scale;
-    }
+    k.cumsum_step(x_cur, out_prev, out_cur, scale, w);
   }
 
   float *last_row = out_x.row(h - 1);
   float scale = 1. / (n + h);
 
-  float *out_cached_avg_ptr = out_cached_avg;
-  for (int32_t c = 0; c < w; ++c) {
-    last_row[c] *= scale;
-    out_cached_avg_ptr[c] = last_row[c];
-  }
+  k.scale(last_row, scale, last_row, w);
+  memcpy(out_cached_avg_ptr, last_row, w * sizeof(float));
 
   out_cached_len[0] = n + h;
 
@@ -0,0 +1,20 @@
+// sherpa-ncnn/csrc/random-mat.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/random-mat.h"
+
+#include <stdlib.h>
+
+namespace sherpa_ncnn {
+
+void FillRandom(ncnn::Mat *m) {
+  for (int32_t q = 0; q != m->c; ++q) {
+    float *p = m->channel(q);
+    for (int32_t i = 0; i != m->w * m->h * m->d; ++i) {
+      p[i] = static_cast<float>(rand()) / RAND_MAX - 0.5f;  // NOLINT
+    }
+  }
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,21 @@
+// sherpa-ncnn/csrc/random-mat.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_RANDOM_MAT_H_
+#define SHERPA_NCNN_CSRC_RANDOM_MAT_H_
+
+#include "mat.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+/** Fill an fp32 Mat with values uniformly distributed in [-0.5, 0.5].
+ *
+ * It uses rand(), so call srand() for other values. Padding between
+ * channels is not touched. It is used by the benchmarks and the profiler.
+ */
+void FillRandom(ncnn::Mat *m);
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_RANDOM_MAT_H_
@@ -19,15 +19,22 @@
 
 #include "sherpa-ncnn/csrc/recognizer.h"
 
+#include <algorithm>
 #include <fstream>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "sherpa-ncnn/csrc/convert-result.h"
 #include "sherpa-ncnn/csrc/decoder.h"
 #include "sherpa-ncnn/csrc/greedy-search-decoder.h"
+#include "sherpa-ncnn/csrc/memory-usage.h"
 #include "sherpa-ncnn/csrc/modified-beam-search-decoder.h"
+#include "sherpa-ncnn/csrc/stage-counters.h"
+#include "sherpa-ncnn/csrc/stage-timer.h"
+#include "sherpa-ncnn/csrc/thread-allocator.h"
+#include "sherpa-ncnn/csrc/trace-recorder.h"
 
 #if __ANDROID_API__ >= 9
 #include <strstream>
@@ -39,31 +46,6 @@
 
 namespace sherpa_ncnn {
 
-static RecognitionResult Convert(const DecoderResult &src,
-                                 const SymbolTable &sym_table,
-                                 int32_t frame_shift_ms,
-                                 int32_t subsampling_factor) {
-  RecognitionResult ans;
-  ans.stokens.reserve(src.tokens.size());
-  ans.timestamps.reserve(src.timestamps.size());
-
-  std::string text;
-  for (auto i : src.tokens) {
-    auto sym = sym_table[i];
-    text.append(sym);
-    ans.stokens.push_back(sym);
-  }
-
-  ans.text = std::move(text);
-  ans.tokens = src.tokens;
-  float frame_shift_s = frame_shift_ms / 1000. * subsampling_factor;
-  for (auto t : src.timestamps) {
-    float time = frame_shift_s * t;
-    ans.timestamps.push_back(time);
-  }
-  return ans;
-}
-
 std::string RecognitionResult::ToString() const {
   std::ostringstream os;
 
@@ -87,7 +69,8 @@ std::string RecognizerConfig::ToString() const {
   os << "endpoint_config=" << endpoint_config.ToString() << ", ";
   os << "enable_endpoint=" << (enable_endpoint ? "True" : "False") << ", ";
   os << "hotwords_file=\"" << hotwords_file << "\", ";
-  os << "hotwrods_score=" << hotwords_score << ")";
+  os << "hotwrods_score=" << hotwords_score << ", ";
+  os << "state_storage=\"" << state_storage << "\")";
 
   return os.str();
 }
@@ -97,16 +80,8 @@ class Recognizer::Impl {
   explicit Impl(const RecognizerConfig &config)
       : config_(config),
         model_(Model::Create(config.model_config)),
-        endpoint_(config.endpoint_config) {
-    if (config.decoder_config.method == "greedy_search") {
-      decoder_ = std::make_unique<GreedySearchDecoder>(model_.get());
-    } else if (config.decoder_config.method == "modified_beam_search") {
-      decoder_ = std::make_unique<ModifiedBeamSearchDecoder>(
-          model_.get(), config.decoder_config.num_active_paths);
-    } else {
-      NCNN_LOGE("Unsupported method: %s", config.decoder_config.method.c_str());
-      exit(-1);
-    }
+        endpoint_(config.endpoint_config),
+        state_storage_(ParseEncoderStateStorage(config.state_storage)) {
     if (config.model_config.use_buffer) {
       sym_ = SymbolTable(config.model_config.tokens_buf, config.model_config.tokens_buf_size);
     }
@@ -116,6 +91,10 @@ class Recognizer::Impl {
     if (!config_.hotwords_file.empty()) {
         InitHotwords();
       }
+
+    InitAllocators();
+    InitDecoders();
+    new_stream_bytes_ = CreateStream()->GetMemoryUsage().Total();
   }
 
 #if __ANDROID_API__ >= 9
@@ -123,31 +102,31 @@ class Recognizer::Impl {
       : config_(config),
         model_(Model::Create(mgr, config.model_config)),
         endpoint_(config.endpoint_config),
-        sym_(mgr, config.model_config.tokens) {
-    if (config.decoder_config.method == "greedy_search") {
-      decoder_ = std::make_unique<GreedySearchDecoder>(model_.get());
-    } else if (config.decoder_config.method == "modified_beam_search") {
-      decoder_ = std::make_unique<ModifiedBeamSearchDecoder>(
-          model_.get(), config.decoder_config.num_active_paths);
-
-      if (!config_.hotwords_file.empty()) {
-        InitHotwords(mgr);
-      }
-    } else {
-      NCNN_LOGE("Unsupported method: %s", config.decoder_config.method.c_str());
-      exit(-1);
+        sym_(mgr, config.model_config.tokens),
+        state_storage_(ParseEncoderStateStorage(config.state_storage)) {
+    if (config.decoder_config.method == "modified_beam_search" &&
+        !config_.hotwords_file.empty()) {
+      InitHotwords(mgr);
     }
+
+    InitAllocators();
+    InitDecoders();
+    new_stream_bytes_ = CreateStream()->GetMemoryUsage().Total();
   }
 #endif
 
   std::unique_ptr<Stream> CreateStream() const {
     if (hotwords_.empty()) {
       auto stream = std::make_unique<Stream>(config_.feat_config);
-      stream->SetResult(decoder_->GetEmptyResult());
-      stream->SetStates(model_->GetEncoderInitStates());
+      stream->SetResult(decoders_[0]->GetEmptyResult());
+      stream->GetStateArena().Init(model_->GetEncoderInitStates(),
+                                   state_storage_,
+                                   model_->GetEncoderIntegerStates());
+      stream->SetRecognizerCounters(counters_);
+      stream->SetAllocators(allocators_);
       return stream;
     } else {
-      auto r = decoder_->GetEmptyResult();
+      auto r = decoders_[0]->GetEmptyResult();
 
       auto context_graph =
           std::make_shared<ContextGraph>(hotwords_, config_.hotwords_score);
@@ -163,7 +142,11 @@ class Recognizer::Impl {
       }
 
       stream->SetResult(r);
-      stream->SetStates(model_->GetEncoderInitStates());
+      stream->GetStateArena().Init(model_->GetEncoderInitStates(),
+                                   state_storage_,
+                                   model_->GetEncoderIntegerStates());
+      stream->SetRecognizerCounters(counters_);
+      stream->SetAllocators(allocators_);
 
       return stream;
     }
@@ -179,17 +162,33 @@ class Recognizer::Impl {
 
     ncnn::Mat features = s->GetFrames(s->GetNumProcessedFrames(), segment);
     s->GetNumProcessedFrames() += offset;
-    std::vector<ncnn::Mat> states = s->GetStates();
 
-    ncnn::Mat encoder_out;
-    std::tie(encoder_out, states) = model_->RunEncoder(features, states);
+    Search(s, RunEncoder(s, features));
+  }
 
-    if (s->GetContextGraph()) {
-      decoder_->Decode(encoder_out, s, &s->GetResult());
+  ncnn::Mat RunEncoder(Stream *s, ncnn::Mat features) const {
+    ScopedTraceStream trace_stream(s->GetId());
+    ScopedDecodeCounters counters(&s->GetAtomicCounters(), counters_.get());
+    counters.AddChunk(model_->Offset());
+
+    ScopedStage stage(Stage::kEncoder);
+
+    // The encoder reads the current states from the arena of the stream
+    // and writes the next states into it
+    return model_->RunEncoder(features, &s->GetStateArena());
+  }
+
+  void Search(Stream *s, ncnn::Mat encoder_out) const {
+    ScopedTraceStream trace_stream(s->GetId());
+    ScopedDecodeCounters counters(&s->GetAtomicCounters(), counters_.get());
+    ScopedStage stage(Stage::kSearch);
+
+    int32_t level = s->GetDegradationLevel();
+    if (s->GetContextGraph() && levels_[level].use_hotwords) {
+      decoders_[level]->Decode(encoder_out, s, &s->GetResult());
     } else {
-      decoder_->Decode(encoder_out, &s->GetResult());
+      decoders_[level]->Decode(encoder_out, &s->GetResult());
     }
-    s->SetStates(states);
   }
 
   bool IsEndpoint(Stream *s) const {
@@ -207,7 +206,7 @@ class Recognizer::Impl {
   }
 
   void Reset(Stream *s) const {
-    auto r = decoder_->GetEmptyResult();
+    auto r = decoders_[s->GetDegradationLevel()]->GetEmptyResult();
 
     if (s->GetContextGraph()) {
       for (auto it = r.hyps.begin(); it != r.hyps.end(); ++it) {
@@ -229,18 +228,168 @@ class Recognizer::Impl {
   }
 
   RecognitionResult GetResult(Stream *s) const {
+    ScopedTraceStream trace_stream(s->GetId());
+    ScopedDecodeCounters counters(&s->GetAtomicCounters(), counters_.get());
+    ScopedStage stage(Stage::kResult);
+
     DecoderResult decoder_result = s->GetResult();
-    decoder_->StripLeadingBlanks(&decoder_result);
+    decoders_[s->GetDegradationLevel()]->StripLeadingBlanks(&decoder_result);
 
     // Those 2 parameters are figured out from sherpa source code
     int32_t frame_shift_ms = 10;
     int32_t subsampling_factor = 4;
-    return Convert(decoder_result, sym_, frame_shift_ms, subsampling_factor);
+    auto ans =
+        Convert(decoder_result, sym_, frame_shift_ms, subsampling_factor);
+    ans.degradation_level = s->GetDegradationLevel();
+    return ans;
+  }
+
+  int32_t NumDegradationLevels() const {
+    return static_cast<int32_t>(levels_.size());
+  }
+
+  DecodeCounters GetCounters() const { return counters_->Get(); }
+
+  void ResetCounters() const { counters_->Reset(); }
+
+  RecognizerMemoryUsage GetMemoryUsage() const {
+    RecognizerMemoryUsage ans;
+    ans.model_weights = model_->WeightBytes();
+    ans.blob_bytes = allocators_->blob.Bytes();
+    ans.blob_peak_bytes = allocators_->blob.PeakBytes();
+    ans.workspace_bytes = allocators_->workspace.Bytes();
+    ans.workspace_peak_bytes = allocators_->workspace.PeakBytes();
+    ans.num_allocs =
+        allocators_->blob.NumAllocs() + allocators_->workspace.NumAllocs();
+    ans.pooled_bytes = config_.model_config.use_thread_allocators
+                           ? GetThreadAllocatorStats().pooled_bytes
+                           : allocators_->blob_pool.PooledBytes() +
+                                 allocators_->workspace_pool.PooledBytes();
+    ans.new_stream_bytes = new_stream_bytes_;
+    return ans;
+  }
+
+  void SetDegradationLevel(Stream *s, int32_t level) const {
+    level = std::max(0, std::min(level, NumDegradationLevels() - 1));
+
+    const DecodingLevel &from = levels_[s->GetDegradationLevel()];
+    const DecodingLevel &to = levels_[level];
+    DecoderResult &r = s->GetResult();
+
+    if (from.num_active_paths == 0 && to.num_active_paths != 0) {
+      // greedy_search -> modified_beam_search. Start from a single
+      // hypothesis containing the greedy result.
+      const ContextState *context_state =
+          s->GetContextGraph() ? s->GetContextGraph()->Root() : nullptr;
+      Hypothesis hyp(r.tokens, 0, context_state);
+      hyp.timestamps = r.timestamps;
+      hyp.num_trailing_blanks = r.num_trailing_blanks;
+
+      r.hyps = Hypotheses({std::move(hyp)});
+      r.decoder_out = ncnn::Mat();
+    } else if (from.num_active_paths != 0 && to.num_active_paths == 0) {
+      // modified_beam_search -> greedy_search. Keep the best hypothesis.
+      Hypothesis hyp = r.hyps.GetMostProbable(true);
+      r.tokens = std::move(hyp.ys);
+      r.timestamps = std::move(hyp.timestamps);
+      r.num_trailing_blanks = hyp.num_trailing_blanks;
+
+      r.hyps.Clear();
+      r.decoder_out = ncnn::Mat();
+    }
+
+    // Between beam widths, the hypotheses are kept as they are. The next
+    // chunk keeps only the top num_active_paths of them.
+
+    s->SetDegradationLevel(level);
+  }
+
+  void SaveStreamState(Stream *s, std::vector<uint8_t> *state) const {
+    s->SaveState(state);
+  }
+
+  std::unique_ptr<Stream> RestoreStreamState(const uint8_t *state,
+                                             size_t n) const {
+    auto s = CreateStream();
+    if (!s->RestoreState(state, n)) {
+      return nullptr;
+    }
+
+    if (s->GetDegradationLevel() < 0 ||
+        s->GetDegradationLevel() >= NumDegradationLevels()) {
+      NCNN_LOGE("Invalid degradation level: %d. Please use the same decoder "
+                "config for saving and restoring.",
+                s->GetDegradationLevel());
+      return nullptr;
+    }
+
+    return s;
   }
 
   const Model *GetModel() const { return model_.get(); }
 
  private:
+  // Count the blobs and the workspace of the networks whose options do
+  // not set an allocator, i.e., that use the pools of each thread from
+  // thread-allocator.h or, without ModelConfig::use_thread_allocators,
+  // pools shared by all threads like the local pools of ncnn.
+  void InitAllocators() {
+    for (ncnn::Net *net :
+         {&model_->GetEncoder(), &model_->GetDecoder(), &model_->GetJoiner()}) {
+      ncnn::Option &opt = net->opt;
+      if (!opt.blob_allocator ||
+          opt.blob_allocator == GetThreadBlobAllocator()) {
+        opt.blob_allocator = &allocators_->blob;
+      }
+
+      if (!opt.workspace_allocator ||
+          opt.workspace_allocator == GetThreadWorkspaceAllocator()) {
+        opt.workspace_allocator = &allocators_->workspace;
+      }
+    }
+  }
+
+  // Build the quality ladder. Level 0 is the configured decoding method.
+  // Each following level is cheaper than the previous one: the beam is
+  // halved down to 2, then hotwords are disabled, then greedy_search is
+  // used. greedy_search does not support hotwords.
+  void InitDecoders() {
+    const std::string &method = config_.decoder_config.method;
+    if (method == "modified_beam_search") {
+      bool use_hotwords = !hotwords_.empty();
+
+      int32_t n = config_.decoder_config.num_active_paths;
+      AddLevel(n, use_hotwords);
+      while (n > 2) {
+        n = std::max(2, n / 2);
+        AddLevel(n, use_hotwords);
+      }
+
+      if (use_hotwords) {
+        AddLevel(n, false);
+      }
+
+      AddLevel(0, false);
+    } else if (method == "greedy_search") {
+      AddLevel(0, false);
+    } else {
+      NCNN_LOGE("Unsupported method: %s", method.c_str());
+      exit(-1);
+    }
+  }
+
+  // num_active_paths 0 means greedy_search
+  void AddLevel(int32_t num_active_paths, bool use_hotwords) {
+    levels_.push_back({num_active_paths, use_hotwords});
+
+    if (num_active_paths == 0) {
+      decoders_.push_back(std::make_unique<GreedySearchDecoder>(model_.get()));
+    } else {
+      decoders_.push_back(std::make_unique<ModifiedBeamSearchDecoder>(
+          model_.get(), num_active_paths));
+    }
+  }
+
 #if __ANDROID_API__ >= 9
   void InitHotwords(AAssetManager *mgr) {
     AAsset *asset = AAssetManager_open(mgr, config_.hotwords_file.c_str(),
@@ -298,12 +447,51 @@ class Recognizer::Impl {
   }
 
  private:
+  struct DecodingLevel {
+    // 0 means greedy_search
+    int32_t num_active_paths;
+    bool use_hotwords;
+  };
+
+  // Allocators of the networks of model_
+  struct Allocators {
+    explicit Allocators(bool use_thread_allocators)
+        : blob(use_thread_allocators ? GetThreadBlobAllocator()
+                                     : &blob_pool),
+          workspace(use_thread_allocators ? GetThreadWorkspaceAllocator()
+                                          : &workspace_pool) {}
+
+    // Used only if ModelConfig::use_thread_allocators is false
+    BufferPool blob_pool;
+    BufferPool workspace_pool;
+
+    CountingAllocator blob;
+    CountingAllocator workspace;
+  };
+
   RecognizerConfig config_;
+
+  // The decoder output cached in each stream is allocated from them and
+  // streams may outlive the recognizer, so the streams share them
+  std::shared_ptr<Allocators> allocators_ = std::make_shared<Allocators>(
+      config_.model_config.use_thread_allocators);
+
   std::unique_ptr<Model> model_;
-  std::unique_ptr<Decoder> decoder_;
+
+  // decoders_[i] implements levels_[i]
+  std::vector<DecodingLevel> levels_;
+  std::vector<std::unique_ptr<Decoder>> decoders_;
   Endpoint endpoint_;
   SymbolTable sym_;
   std::vector<std::vector<int32_t>> hotwords_;
+  EncoderStateStorage state_storage_;
+
+  // Sum of the counters of all streams created by this recognizer. The
+  // streams share it since they may outlive the recognizer.
+  std::shared_ptr<AtomicDecodeCounters> counters_ =
+      std::make_shared<AtomicDecodeCounters>();
+
+  int64_t new_stream_bytes_ = 0;
 };
 
 Recognizer::Recognizer(const RecognizerConfig &config)
@@ -324,6 +512,14 @@ bool Recognizer::IsReady(Stream *s) const { return impl_->IsReady(s); }
 
 void Recognizer::DecodeStream(Stream *s) const { impl_->DecodeStream(s); }
 
+ncnn::Mat Recognizer::RunEncoder(Stream *s, ncnn::Mat features) const {
+  return impl_->RunEncoder(s, features);
+}
+
+void Recognizer::Search(Stream *s, ncnn::Mat encoder_out) const {
+  impl_->Search(s, encoder_out);
+}
+
 bool Recognizer::IsEndpoint(Stream *s) const { return impl_->IsEndpoint(s); }
 
 void Recognizer::Reset(Stream *s) const { impl_->Reset(s); }
@@ -332,6 +528,34 @@ RecognitionResult Recognizer::GetResult(Stream *s) const {
   return impl_->GetResult(s);
 }
 
+void Recognizer::SaveStreamState(Stream *s,
+                                 std::vector<uint8_t> *state) const {
+  impl_->SaveStreamState(s, state);
+}
+
+std::unique_ptr<Stream> Recognizer::RestoreStreamState(const uint8_t *state,
+                                                       size_t n) const {
+  return impl_->RestoreStreamState(state, n);
+}
+
+int32_t Recognizer::NumDegradationLevels() const {
+  return impl_->NumDegradationLevels();
+}
+
+void Recognizer::SetDegradationLevel(Stream *s, int32_t level) const {
+  impl_->SetDegradationLevel(s, level);
+}
+
+DecodeCounters Recognizer::GetCounters() const {
+  return impl_->GetCounters();
+}
+
+void Recognizer::ResetCounters() const { impl_->ResetCounters(); }
+
+RecognizerMemoryUsage Recognizer::GetMemoryUsage() const {
+  return impl_->GetMemoryUsage();
+}
+
 const Model *Recognizer::GetModel() const { return impl_->GetModel(); }
 
 }  // namespace sherpa_ncnn
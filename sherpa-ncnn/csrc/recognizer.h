@@ -27,6 +27,7 @@
 #include "sherpa-ncnn/csrc/endpoint.h"
 #include "sherpa-ncnn/csrc/features.h"
 #include "sherpa-ncnn/csrc/hypothesis.h"
+#include "sherpa-ncnn/csrc/memory-usage.h"
 #include "sherpa-ncnn/csrc/model.h"
 #include "sherpa-ncnn/csrc/stream.h"
 #include "sherpa-ncnn/csrc/symbol-table.h"
@@ -46,6 +47,10 @@ struct RecognitionResult {
   // String based tokens
   std::vector<std::string> stokens;
 
+  // Quality level the stream was decoded with. 0 is the configured
+  // decoding method. See Recognizer::SetDegradationLevel().
+  int32_t degradation_level = 0;
+
   std::string ToString() const;
 };
 
@@ -61,20 +66,28 @@ struct RecognizerConfig {
   /// used only for modified_beam_search
   float hotwords_score = 1.5;
 
+  /// Element type for keeping encoder states of a stream between chunks.
+  /// Valid values are: fp32, fp16, bf16. fp16 and bf16 use about 1/4 of
+  /// the memory of fp32 per stream. The encoder itself still runs on fp32
+  /// states.
+  std::string state_storage = "fp32";
+
   RecognizerConfig() = default;
 
   RecognizerConfig(const FeatureExtractorConfig &feat_config,
                    const ModelConfig &model_config,
                    const DecoderConfig decoder_config,
                    const EndpointConfig &endpoint_config, bool enable_endpoint,
-                   const std::string &hotwords_file, float hotwords_score)
+                   const std::string &hotwords_file, float hotwords_score,
+                   const std::string &state_storage = "fp32")
       : feat_config(feat_config),
         model_config(model_config),
         decoder_config(decoder_config),
         endpoint_config(endpoint_config),
         enable_endpoint(enable_endpoint),
         hotwords_file(hotwords_file),
-        hotwords_score(hotwords_score) {}
+        hotwords_score(hotwords_score),
+        state_storage(state_storage) {}
 
   std::string ToString() const;
 };
@@ -100,6 +113,20 @@ class Recognizer {
 
   void DecodeStream(Stream *s) const;
 
+  /** The two stages of DecodeStream(). DecodeStream(s) is equivalent to
+   *
+   *   ncnn::Mat features = s->GetFrames(s->GetNumProcessedFrames(),
+   *                                     GetModel()->Segment());
+   *   s->GetNumProcessedFrames() += GetModel()->Offset();
+   *   Search(s, RunEncoder(s, features));
+   *
+   * RunEncoder() uses only the encoder states of the stream and Search()
+   * uses only its decoder result, so the encoder of one chunk can run
+   * while the previous chunk is being searched. See StreamPipeline.
+   */
+  ncnn::Mat RunEncoder(Stream *s, ncnn::Mat features) const;
+  void Search(Stream *s, ncnn::Mat encoder_out) const;
+
   // Return true if we detect an endpoint for this stream.
   // Note: If this function returns true, you usually want to
   // invoke Reset(s).
@@ -111,6 +138,64 @@ class Recognizer {
 
   RecognitionResult GetResult(Stream *s) const;
 
+  /** Serialize the state of a stream, e.g., for moving it to another
+   * process. See Stream::SaveState() for what is saved.
+   *
+   * @param s  The stream to save. It is not changed.
+   * @param state  On return, it contains the serialized state.
+   */
+  void SaveStreamState(Stream *s, std::vector<uint8_t> *state) const;
+
+  /** Create a stream from a state produced by SaveStreamState().
+   *
+   * The recognizer must use the same config (model, state storage and
+   * hotwords) as the one that saved the state.
+   *
+   * @return Return nullptr if the state is invalid or incompatible.
+   */
+  std::unique_ptr<Stream> RestoreStreamState(const uint8_t *state,
+                                             size_t n) const;
+
+  /** Number of levels of the quality ladder, which is at least 1.
+   *
+   * Level 0 is the configured decoding method. For modified_beam_search,
+   * the next levels halve num_active_paths down to 2, then disable
+   * hotwords (if any), and the last level uses greedy_search.
+   */
+  int32_t NumDegradationLevels() const;
+
+  /** Switch the decoding method of a stream to the given level of the
+   * quality ladder. It is clamped to [0, NumDegradationLevels() - 1].
+   *
+   * The current result is carried over, so decoding continues without
+   * losing text. It must not be called while the stream is being decoded.
+   */
+  void SetDegradationLevel(Stream *s, int32_t level) const;
+
+  /** Return the counters of all streams created by this recognizer.
+   *
+   * They count decoded chunks, feature frames and the runs and time of
+   * each stage in stage-timer.h. They are always on and cheap to update;
+   * use Stream::GetCounters() for a single stream.
+   */
+  DecodeCounters GetCounters() const;
+
+  // Set the counters returned by GetCounters() to 0. The counters of
+  // the streams are not changed.
+  void ResetCounters() const;
+
+  /** Return the memory used by the model and the networks.
+   *
+   * The peaks of the blob and workspace allocators grow with the number
+   * of streams decoded at the same time. Together with
+   * Stream::GetMemoryUsage() and RecognizerMemoryUsage::new_stream_bytes,
+   * it can be used to reject new streams before running out of memory.
+   *
+   * The allocators are shared with the streams, so streams may be
+   * destroyed after the recognizer.
+   */
+  RecognizerMemoryUsage GetMemoryUsage() const;
+
   // Return the contained model
   //
   // The user should not free it.
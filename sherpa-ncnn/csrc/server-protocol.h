@@ -0,0 +1,86 @@
+// sherpa-ncnn/csrc/server-protocol.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_SERVER_PROTOCOL_H_
+#define SHERPA_NCNN_CSRC_SERVER_PROTOCOL_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Wire format between sherpa-ncnn-server and its clients.
+//
+// A connection carries one stream. Each message is a frame
+//
+//   | type (1 byte) | payload size (4 bytes, little endian) | payload |
+//
+// Client to server:
+//   - kAudio: int32 sampling rate, followed by float32 samples in [-1, 1].
+//             All numbers are little endian.
+//   - kEndOfStream: empty payload. No audio may follow.
+//
+// Server to client (payload is UTF-8 text):
+//   - kPartial: the current result of the ongoing segment
+//   - kFinal: the result of a segment that ended at an endpoint, or the
+//             last segment after kEndOfStream. The server closes the
+//             connection after sending the kFinal for kEndOfStream.
+//   - kError: the server closes the connection after sending it
+
+namespace sherpa_ncnn {
+
+enum ServerMessageType : uint8_t {
+  kAudio = 1,
+  kEndOfStream = 2,
+  kPartial = 3,
+  kFinal = 4,
+  kError = 5,
+};
+
+// Size of the frame header in bytes
+constexpr int32_t kFrameHeaderSize = 5;
+
+// Frames with a larger payload are rejected
+constexpr uint32_t kMaxFramePayloadSize = 1 << 20;
+
+inline void AppendFrame(uint8_t type, const void *payload, uint32_t n,
+                        std::string *buf) {
+  char header[kFrameHeaderSize];
+  header[0] = static_cast<char>(type);
+  for (int32_t i = 0; i != 4; ++i) {
+    header[1 + i] = static_cast<char>((n >> (8 * i)) & 0xff);
+  }
+
+  buf->append(header, kFrameHeaderSize);
+  if (n > 0) {
+    buf->append(static_cast<const char *>(payload), n);
+  }
+}
+
+/** Parse the header of a frame starting at p.
+ *
+ * @param p  Start of the received bytes.
+ * @param size  Number of received bytes.
+ * @param type  On return, it contains the message type.
+ * @param n  On return, it contains the payload size.
+ *
+ * @return Return false if there are less than kFrameHeaderSize bytes.
+ */
+inline bool ParseFrameHeader(const char *p, size_t size, uint8_t *type,
+                             uint32_t *n) {
+  if (size < kFrameHeaderSize) {
+    return false;
+  }
+
+  *type = static_cast<uint8_t>(p[0]);
+  *n = 0;
+  for (int32_t i = 0; i != 4; ++i) {
+    *n |= static_cast<uint32_t>(static_cast<uint8_t>(p[1 + i])) << (8 * i);
+  }
+
+  return true;
+}
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_SERVER_PROTOCOL_H_
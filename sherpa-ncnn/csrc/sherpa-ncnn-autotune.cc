@@ -0,0 +1,548 @@
+// sherpa-ncnn/csrc/sherpa-ncnn-autotune.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Find the fastest ncnn::Option of the encoder, the decoder and the joiner
+// on this machine and write them into an option profile, which is loaded
+// through ModelConfig::option_profile.
+//
+// The inputs of each network are recorded from a wave file with reference
+// options (fp32, single thread). Options are then tuned one at a time for
+// each network: a value is kept only if it is faster and the outputs stay
+// within the given tolerance of the reference outputs.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "net.h"  // NOLINT
+#include "sherpa-ncnn/csrc/features.h"
+#include "sherpa-ncnn/csrc/model.h"
+#include "sherpa-ncnn/csrc/option-profile.h"
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/thread-budget.h"
+#include "sherpa-ncnn/csrc/wave-reader.h"
+
+namespace sherpa_ncnn {
+
+struct AutotuneConfig {
+  std::vector<int32_t> num_threads;
+
+  // Number of timed runs over all recorded inputs for each candidate
+  int32_t num_runs = 3;
+
+  // Maximum number of recorded inputs of each network
+  int32_t num_chunks = 8;
+  int32_t num_decoder_inputs = 32;
+  int32_t num_joiner_inputs = 64;
+
+  // Maximum relative difference to the reference outputs, i.e.,
+  // max|out - ref| / max|ref|
+  float tolerance = 0.01;
+
+  // A candidate must be at least this much faster to replace the current
+  // best. It avoids picking options because of timing noise.
+  float min_gain = 0.03;
+};
+
+// Inputs and reference outputs of the three networks
+struct Recording {
+  std::vector<ncnn::Mat> features;
+  std::vector<std::vector<ncnn::Mat>> states;
+  std::vector<std::vector<ncnn::Mat>> encoder_out;  // encoder_out + states
+
+  std::vector<ncnn::Mat> decoder_in;
+  std::vector<ncnn::Mat> decoder_out;
+
+  std::vector<std::pair<ncnn::Mat, ncnn::Mat>> joiner_in;
+  std::vector<ncnn::Mat> joiner_out;
+};
+
+enum class Network { kEncoder, kDecoder, kJoiner };
+
+static const char *NetworkName(Network n) {
+  switch (n) {
+    case Network::kEncoder:
+      return "encoder";
+    case Network::kDecoder:
+      return "decoder";
+    case Network::kJoiner:
+      return "joiner";
+  }
+  return "";
+}
+
+static ncnn::Option *GetOption(Network n, ModelConfig *config) {
+  switch (n) {
+    case Network::kEncoder:
+      return &config->encoder_opt;
+    case Network::kDecoder:
+      return &config->decoder_opt;
+    case Network::kJoiner:
+      return &config->joiner_opt;
+  }
+  return nullptr;
+}
+
+// Options whose outputs are used as the reference
+static ncnn::Option ReferenceOption() {
+  ncnn::Option opt;
+  opt.num_threads = 1;
+  opt.use_fp16_packed = false;
+  opt.use_fp16_storage = false;
+  opt.use_fp16_arithmetic = false;
+  opt.use_bf16_storage = false;
+  return opt;
+}
+
+static ncnn::Mat BuildDecoderInput(const std::vector<int32_t> &tokens,
+                                   int32_t context_size) {
+  ncnn::Mat decoder_input(context_size);
+  for (int32_t i = 0; i != context_size; ++i) {
+    static_cast<int32_t *>(decoder_input)[i] =
+        *(tokens.end() - context_size + i);
+  }
+  return decoder_input;
+}
+
+// Run the model with greedy search over the features and record the inputs
+// and outputs of each network
+static Recording Record(Model *model, const FeatureExtractor &fe,
+                        const AutotuneConfig &config) {
+  Recording r;
+
+  int32_t segment = model->Segment();
+  int32_t offset = model->Offset();
+  int32_t context_size = model->ContextSize();
+
+  std::vector<ncnn::Mat> states = model->GetEncoderInitStates();
+  std::vector<int32_t> tokens(context_size, model->BlankId());
+
+  ncnn::Mat decoder_input = BuildDecoderInput(tokens, context_size);
+  ncnn::Mat decoder_out = model->RunDecoder(decoder_input);
+
+  for (int32_t start = 0; start + segment <= fe.NumFramesReady() &&
+                          r.features.size() < config.num_chunks;
+       start += offset) {
+    ncnn::Mat features = fe.GetFrames(start, segment);
+    r.features.push_back(features.clone());
+
+    std::vector<ncnn::Mat> saved;
+    for (const auto &s : states) saved.push_back(s.clone());
+    r.states.push_back(std::move(saved));
+
+    auto p = model->RunEncoder(features, states);
+    ncnn::Mat encoder_out = p.first;
+    states = std::move(p.second);
+
+    std::vector<ncnn::Mat> out = {encoder_out.clone()};
+    for (const auto &s : states) out.push_back(s.clone());
+    r.encoder_out.push_back(std::move(out));
+
+    for (int32_t t = 0; t != encoder_out.h; ++t) {
+      ncnn::Mat encoder_out_t(encoder_out.w, encoder_out.row(t));
+      ncnn::Mat joiner_out = model->RunJoiner(encoder_out_t, decoder_out);
+
+      if (r.joiner_in.size() < config.num_joiner_inputs) {
+        r.joiner_in.emplace_back(encoder_out_t.clone(), decoder_out.clone());
+        r.joiner_out.push_back(joiner_out.clone());
+      }
+
+      const float *p_out = joiner_out;
+      auto new_token = static_cast<int32_t>(
+          std::max_element(p_out, p_out + joiner_out.w) - p_out);
+
+      if (new_token != model->BlankId()) {
+        tokens.push_back(new_token);
+        decoder_input = BuildDecoderInput(tokens, context_size);
+        decoder_out = model->RunDecoder(decoder_input);
+
+        if (r.decoder_in.size() < config.num_decoder_inputs) {
+          r.decoder_in.push_back(decoder_input.clone());
+          r.decoder_out.push_back(decoder_out.clone());
+        }
+      }
+    }
+  }
+
+  // Short or silent waves may produce no tokens
+  if (r.decoder_in.empty()) {
+    decoder_input = BuildDecoderInput(tokens, context_size);
+    r.decoder_in.push_back(decoder_input.clone());
+    r.decoder_out.push_back(model->RunDecoder(decoder_input).clone());
+  }
+
+  return r;
+}
+
+// Return max|a - b| / max|ref|, or a negative value if the shapes differ
+static float RelativeDiff(const ncnn::Mat &a, const ncnn::Mat &ref) {
+  if (a.total() != ref.total() || a.elemsize != ref.elemsize) return -1;
+
+  // ncnn::Mat may have padding between channels, so compare channel by
+  // channel
+  float max_diff = 0;
+  float max_ref = 0;
+  for (int32_t c = 0; c != ref.c; ++c) {
+    const float *pa = a.channel(c);
+    const float *pr = ref.channel(c);
+    int32_t n = ref.w * ref.h * ref.d;
+    for (int32_t i = 0; i != n; ++i) {
+      max_diff = std::max(max_diff, std::abs(pa[i] - pr[i]));
+      max_ref = std::max(max_ref, std::abs(pr[i]));
+    }
+  }
+
+  return max_diff / std::max(max_ref, 1e-6f);
+}
+
+struct Measurement {
+  bool ok = false;
+  float ms = 0;  // average time per call in milliseconds
+  float diff = 0;
+};
+
+// Run a network on all recorded inputs once. Return the maximum relative
+// difference to the reference outputs.
+static float RunOnce(Network n, Model *model, const Recording &r) {
+  float diff = 0;
+  auto update = [&diff](const ncnn::Mat &a, const ncnn::Mat &ref) {
+    float d = RelativeDiff(a, ref);
+    diff = (d < 0 || diff < 0) ? -1 : std::max(diff, d);
+  };
+
+  switch (n) {
+    case Network::kEncoder:
+      for (size_t i = 0; i != r.features.size(); ++i) {
+        ncnn::Mat features = r.features[i].clone();
+        auto p = model->RunEncoder(features, r.states[i]);
+
+        const auto &ref = r.encoder_out[i];
+        if (p.second.size() + 1 != ref.size()) return -1;
+
+        update(p.first, ref[0]);
+        for (size_t k = 0; k != p.second.size(); ++k) {
+          update(p.second[k], ref[k + 1]);
+        }
+      }
+      break;
+    case Network::kDecoder:
+      for (size_t i = 0; i != r.decoder_in.size(); ++i) {
+        ncnn::Mat decoder_input = r.decoder_in[i].clone();
+        update(model->RunDecoder(decoder_input), r.decoder_out[i]);
+      }
+      break;
+    case Network::kJoiner:
+      for (size_t i = 0; i != r.joiner_in.size(); ++i) {
+        ncnn::Mat encoder_out = r.joiner_in[i].first;
+        ncnn::Mat decoder_out = r.joiner_in[i].second;
+        update(model->RunJoiner(encoder_out, decoder_out), r.joiner_out[i]);
+      }
+      break;
+  }
+
+  return diff;
+}
+
+static int32_t NumCalls(Network n, const Recording &r) {
+  switch (n) {
+    case Network::kEncoder:
+      return r.features.size();
+    case Network::kDecoder:
+      return r.decoder_in.size();
+    case Network::kJoiner:
+      return r.joiner_in.size();
+  }
+  return 0;
+}
+
+static Measurement Measure(Network n, const ModelConfig &model_config,
+                           const Recording &r, const AutotuneConfig &config) {
+  Measurement m;
+
+  std::unique_ptr<Model> model = Model::Create(model_config);
+  if (!model) return m;
+
+  // The first run also warms up the caches and the thread pool
+  m.diff = RunOnce(n, model.get(), r);
+  if (m.diff < 0 || m.diff > config.tolerance) return m;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int32_t i = 0; i != config.num_runs; ++i) {
+    RunOnce(n, model.get(), r);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  float total_ms =
+      std::chrono::duration<float, std::milli>(end - start).count();
+
+  m.ok = true;
+  m.ms = total_ms / (config.num_runs * std::max(1, NumCalls(n, r)));
+  return m;
+}
+
+struct Knob {
+  std::string name;
+  int32_t num_values;
+  std::function<void(int32_t, ncnn::Option *)> set;
+};
+
+static std::vector<Knob> GetKnobs(const AutotuneConfig &config) {
+  std::vector<Knob> knobs;
+
+  std::vector<int32_t> threads = config.num_threads;
+  knobs.push_back({"num_threads", static_cast<int32_t>(threads.size()),
+                   [threads](int32_t v, ncnn::Option *opt) {
+                     opt->num_threads = threads[v];
+                   }});
+
+  auto flag = [](const char *name, bool ncnn::Option::*field) {
+    return Knob{name, 2, [field](int32_t v, ncnn::Option *opt) {
+                  opt->*field = v != 0;
+                }};
+  };
+
+  using O = ncnn::Option;
+  knobs.push_back(flag("use_packing_layout", &O::use_packing_layout));
+  knobs.push_back(
+      flag("use_winograd_convolution", &O::use_winograd_convolution));
+  knobs.push_back(flag("use_sgemm_convolution", &O::use_sgemm_convolution));
+  knobs.push_back(flag("lightmode", &O::lightmode));
+
+  // use_int8_inference is not tuned. It has no effect on fp32 models, and
+  // int8 models cannot run without it since their weights are int8.
+
+  // 0: fp32, 1: fp16 storage, 2: fp16 storage and arithmetic
+  knobs.push_back({"fp16", 3, [](int32_t v, ncnn::Option *opt) {
+                     opt->use_fp16_packed = v >= 1;
+                     opt->use_fp16_storage = v >= 1;
+                     opt->use_fp16_arithmetic = v >= 2;
+                   }});
+
+  return knobs;
+}
+
+// Tune the options of one network. Return the time per call in ms.
+static float Tune(Network n, const Recording &r, const AutotuneConfig &config,
+                  ModelConfig *model_config) {
+  ncnn::Option *opt = GetOption(n, model_config);
+
+  Measurement best = Measure(n, *model_config, r, config);
+  if (!best.ok) {
+    fprintf(stderr, "Failed to run the %s with the reference options\n",
+            NetworkName(n));
+    exit(-1);
+  }
+
+  fprintf(stderr, "%s: reference %.3f ms\n", NetworkName(n), best.ms);
+
+  std::vector<Knob> knobs = GetKnobs(config);
+
+  // Options interact, e.g., packing and fp16, so repeat until no change
+  for (int32_t pass = 0; pass != 3; ++pass) {
+    bool changed = false;
+    for (const auto &knob : knobs) {
+      for (int32_t v = 0; v != knob.num_values; ++v) {
+        ncnn::Option saved = *opt;
+        knob.set(v, opt);
+        if (OptionToString(*opt) == OptionToString(saved)) continue;
+
+        Measurement m = Measure(n, *model_config, r, config);
+        fprintf(stderr, "%s: %s=%d: %s, %.3f ms, diff %.2e\n", NetworkName(n),
+                knob.name.c_str(), v, m.ok ? "ok" : "rejected", m.ms,
+                m.diff);
+
+        if (m.ok && m.ms < best.ms * (1 - config.min_gain)) {
+          best = m;
+          changed = true;
+        } else {
+          *opt = saved;
+        }
+      }
+    }
+
+    if (!changed) break;
+  }
+
+  fprintf(stderr, "%s: best %.3f ms with %s\n", NetworkName(n), best.ms,
+          OptionToString(*opt).c_str());
+
+  return best.ms;
+}
+
+static std::vector<int32_t> ParseIntList(const std::string &s) {
+  std::vector<int32_t> ans;
+  std::istringstream is(s);
+  std::string item;
+  while (std::getline(is, item, ',')) {
+    int32_t v = atoi(item.c_str());
+    if (v > 0) ans.push_back(v);
+  }
+  return ans;
+}
+
+// 1, 2, 4, ... up to the number of available CPUs, which is included
+static std::vector<int32_t> DefaultNumThreads() {
+  int32_t num_cpus = GetAvailableCpus();
+
+  std::vector<int32_t> ans;
+  for (int32_t n = 1; n < num_cpus; n *= 2) {
+    ans.push_back(n);
+  }
+  ans.push_back(num_cpus);
+
+  return ans;
+}
+
+}  // namespace sherpa_ncnn
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *usage = R"usage(
+Usage:
+  ./bin/sherpa-ncnn-autotune \
+    /path/to/encoder.ncnn.param \
+    /path/to/encoder.ncnn.bin \
+    /path/to/decoder.ncnn.param \
+    /path/to/decoder.ncnn.bin \
+    /path/to/joiner.ncnn.param \
+    /path/to/joiner.ncnn.bin \
+    /path/to/foo.wav \
+    [--output=option-profile.txt] \
+    [--num-threads=1,2,4] \
+    [--num-runs=3] \
+    [--num-chunks=8] \
+    [--tolerance=0.01]
+
+It tunes the following options of the encoder, the decoder and the joiner
+separately: num_threads, use_packing_layout, use_winograd_convolution,
+use_sgemm_convolution, lightmode and fp16 storage and arithmetic. Options whose outputs differ from the fp32 outputs by more than
+--tolerance (relative to the largest output value) are rejected.
+
+--num-threads is the list of thread counts to try. The default is
+1, 2, 4, ... up to the number of CPUs available to the process. For a
+server decoding many streams in parallel, tune with the number of threads
+each worker gets.
+
+Use the output with ModelConfig::option_profile, e.g.,
+  config.model_config.option_profile = "option-profile.txt";
+)usage";
+
+  if (argc < 8) {
+    fprintf(stderr, "%s\n", usage);
+    return 0;
+  }
+
+  sherpa_ncnn::ModelConfig model_config;
+  model_config.encoder_param = argv[1];
+  model_config.encoder_bin = argv[2];
+  model_config.decoder_param = argv[3];
+  model_config.decoder_bin = argv[4];
+  model_config.joiner_param = argv[5];
+  model_config.joiner_bin = argv[6];
+  model_config.use_buffer = false;
+  model_config.use_vulkan_compute = false;
+
+  std::string wav_filename = argv[7];
+  std::string output = "option-profile.txt";
+
+  sherpa_ncnn::AutotuneConfig config;
+  config.num_threads = sherpa_ncnn::DefaultNumThreads();
+
+  for (int32_t i = 8; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "output", &value)) {
+      output = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-threads", &value)) {
+      config.num_threads = sherpa_ncnn::ParseIntList(value);
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-runs", &value)) {
+      config.num_runs = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-chunks", &value)) {
+      config.num_chunks = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "tolerance", &value)) {
+      config.tolerance = atof(value.c_str());
+    } else {
+      fprintf(stderr, "Unknown option: %s\n%s\n", arg.c_str(), usage);
+      return -1;
+    }
+  }
+
+  if (config.num_threads.empty() || config.num_runs < 1 ||
+      config.num_chunks < 1) {
+    fprintf(stderr, "--num-threads, --num-runs and --num-chunks "
+                    "must be positive\n");
+    return -1;
+  }
+
+  model_config.encoder_opt = sherpa_ncnn::ReferenceOption();
+  model_config.decoder_opt = sherpa_ncnn::ReferenceOption();
+  model_config.joiner_opt = sherpa_ncnn::ReferenceOption();
+
+  float expected_sampling_rate = 16000;
+  bool is_ok = false;
+  std::vector<float> samples =
+      sherpa_ncnn::ReadWave(wav_filename, expected_sampling_rate, &is_ok);
+  if (!is_ok) {
+    fprintf(stderr, "Failed to read %s\n", wav_filename.c_str());
+    return -1;
+  }
+
+  sherpa_ncnn::FeatureExtractorConfig feat_config;
+  feat_config.sampling_rate = expected_sampling_rate;
+  feat_config.feature_dim = 80;
+
+  sherpa_ncnn::FeatureExtractor fe(feat_config);
+  fe.AcceptWaveform(expected_sampling_rate, samples.data(), samples.size());
+  fe.InputFinished();
+
+  sherpa_ncnn::Recording recording;
+  {
+    auto model = sherpa_ncnn::Model::Create(model_config);
+    if (!model) {
+      fprintf(stderr, "Failed to load the model\n");
+      return -1;
+    }
+
+    recording = sherpa_ncnn::Record(model.get(), fe, config);
+  }
+
+  if (recording.features.empty()) {
+    fprintf(stderr, "%s is too short\n", wav_filename.c_str());
+    return -1;
+  }
+
+  fprintf(stderr,
+          "Recorded %d encoder, %d decoder and %d joiner inputs from %s\n",
+          static_cast<int32_t>(recording.features.size()),
+          static_cast<int32_t>(recording.decoder_in.size()),
+          static_cast<int32_t>(recording.joiner_in.size()),
+          wav_filename.c_str());
+
+  std::ostringstream header;
+  header << "Generated by sherpa-ncnn-autotune\n";
+  header << "encoder: " << model_config.encoder_param << "\n";
+
+  for (auto n : {sherpa_ncnn::Network::kEncoder,
+                 sherpa_ncnn::Network::kDecoder,
+                 sherpa_ncnn::Network::kJoiner}) {
+    float ms = sherpa_ncnn::Tune(n, recording, config, &model_config);
+    header << sherpa_ncnn::NetworkName(n) << ": " << ms << " ms per call\n";
+  }
+
+  if (!sherpa_ncnn::SaveOptionProfile(output, model_config, header.str())) {
+    return -1;
+  }
+
+  fprintf(stderr, "Saved to %s\n", output.c_str());
+
+  return 0;
+}
@@ -0,0 +1,733 @@
+// sherpa-ncnn/csrc/sherpa-ncnn-bench.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Decode wave files with many streams and threads and report the RTF, the
+// chunk throughput and latency and the time of each stage of decoding.
+//
+// All streams share one Recognizer. Each stream decodes one of the wave
+// files, which are assigned round-robin. Worker threads take turns on the
+// streams, one chunk at a time, and get the partial result after each
+// chunk, as a live application does. The latency of a chunk is the time
+// of DecodeStream() plus GetResult().
+//
+// A human-readable summary goes to stderr and a JSON report to stdout, or
+// to the file given by --json.
+//
+// With --perf, hardware events of each stage are counted on Linux, see
+// perf-counters.h. The report then has the IPC and the cache and branch
+// miss rates of each stage. Only the worker threads of the bench are
+// counted, not the threads of ncnn, so use --ncnn-threads=1 with it.
+//
+// The report also has the number of ncnn allocations and, with the pool
+// allocators of each thread (--thread-allocators=true, see
+// thread-allocator.h), how many of them went to the heap and the bytes
+// kept by the pools. Compare the chunk latency with and without them.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>  // NOLINT
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/perf-counters.h"
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/stage-timer.h"
+#include "sherpa-ncnn/csrc/thread-allocator.h"
+#include "sherpa-ncnn/csrc/thread-budget.h"
+#include "sherpa-ncnn/csrc/trace-recorder.h"
+#include "sherpa-ncnn/csrc/wave-reader.h"
+
+#ifndef SHERPA_NCNN_VERSION
+#define SHERPA_NCNN_VERSION "unknown"
+#endif
+
+namespace sherpa_ncnn {
+
+struct BenchConfig {
+  int32_t num_streams = 1;
+  int32_t num_threads = 1;
+
+  // Seconds of silence appended to each wave, as sherpa-ncnn does
+  float tail_padding = 0.3;
+
+  std::string json;
+
+  // Count hardware events of each stage
+  bool perf = false;
+
+  // See ModelConfig::use_thread_allocators
+  bool thread_allocators = false;
+};
+
+// Stage times of one worker thread
+class StageStats : public StageObserver {
+ public:
+  void OnStage(Stage stage, StageClock::time_point /*start*/,
+               StageClock::time_point /*end*/,
+               StageClock::duration self) override {
+    int32_t i = static_cast<int32_t>(stage);
+    count[i] += 1;
+    seconds[i] += std::chrono::duration<double>(self).count();
+  }
+
+  void Add(const StageStats &other) {
+    for (int32_t i = 0; i != kNumStages; ++i) {
+      count[i] += other.count[i];
+      seconds[i] += other.seconds[i];
+    }
+  }
+
+  std::array<int64_t, kNumStages> count{};
+
+  // Self time, i.e., search does not include decoder and joiner
+  std::array<double, kNumStages> seconds{};
+};
+
+struct BenchStream {
+  std::unique_ptr<Stream> stream;
+  int32_t file = 0;
+  bool fed = false;
+};
+
+struct BenchResult {
+  double wall_seconds = 0;
+  double audio_seconds = 0;
+
+  int64_t num_chunks = 0;
+
+  // of all chunks, in seconds
+  std::vector<double> latencies;
+
+  StageStats stages;
+
+  // Self counts of each stage. Only with BenchConfig::perf and if perf
+  // events are available.
+  bool has_perf = false;
+  std::array<bool, kNumPerfEvents> has_event{};
+  bool perf_multiplexed = false;
+  std::string perf_error;
+  std::array<PerfValues, kNumStages> perf;
+
+  // ncnn allocations while decoding
+  RecognizerMemoryUsage memory;
+  int64_t num_allocs = 0;
+
+  // Only with ModelConfig::use_thread_allocators
+  bool has_mallocs = false;
+  int64_t num_mallocs = 0;
+  int32_t num_pools = 0;
+};
+
+class Bench {
+ public:
+  Bench(const Recognizer *recognizer,
+        const std::vector<std::vector<float>> &waves, float sampling_rate,
+        const BenchConfig &config)
+      : recognizer_(recognizer),
+        waves_(waves),
+        sampling_rate_(sampling_rate),
+        config_(config) {}
+
+  BenchResult Run() {
+    std::vector<float> tail_padding(
+        static_cast<int32_t>(config_.tail_padding * sampling_rate_));
+
+    streams_.resize(config_.num_streams);
+    for (int32_t i = 0; i != config_.num_streams; ++i) {
+      streams_[i].stream = recognizer_->CreateStream();
+      streams_[i].file = i % waves_.size();
+      queue_.push_back(i);
+    }
+
+    std::vector<StageStats> stats(config_.num_threads);
+    std::vector<std::vector<double>> latencies(config_.num_threads);
+
+    // Perf counters can only be opened and read on their own thread
+    std::vector<std::unique_ptr<PerfStageCounters>> perf(config_.num_threads);
+
+    int64_t num_allocs = recognizer_->GetMemoryUsage().num_allocs;
+    ThreadAllocatorStats allocator_stats = GetThreadAllocatorStats();
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int32_t t = 0; t != config_.num_threads; ++t) {
+      threads.emplace_back([&, t]() {
+        StageObserver *observer = &stats[t];
+        if (config_.perf) {
+          perf[t] = std::make_unique<PerfStageCounters>(&stats[t]);
+          observer = perf[t].get();
+        }
+
+        SetThreadStageObserver(observer);
+        Work(tail_padding, &latencies[t]);
+        SetThreadStageObserver(nullptr);
+      });
+    }
+
+    for (auto &t : threads) {
+      t.join();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+
+    BenchResult r;
+    r.wall_seconds = std::chrono::duration<double>(end - start).count();
+
+    for (const auto &s : streams_) {
+      r.audio_seconds += waves_[s.file].size() / sampling_rate_;
+    }
+
+    for (int32_t t = 0; t != config_.num_threads; ++t) {
+      r.stages.Add(stats[t]);
+      r.latencies.insert(r.latencies.end(), latencies[t].begin(),
+                         latencies[t].end());
+    }
+
+    r.num_chunks = r.latencies.size();
+    std::sort(r.latencies.begin(), r.latencies.end());
+
+    if (config_.perf) {
+      MergePerf(perf, &r);
+    }
+
+    r.memory = recognizer_->GetMemoryUsage();
+    r.num_allocs = r.memory.num_allocs - num_allocs;
+
+    if (config_.thread_allocators) {
+      ThreadAllocatorStats stats = GetThreadAllocatorStats();
+      r.has_mallocs = true;
+      r.num_mallocs = stats.num_mallocs - allocator_stats.num_mallocs;
+      r.num_pools = stats.num_pools;
+    }
+
+    return r;
+  }
+
+ private:
+  static void MergePerf(
+      const std::vector<std::unique_ptr<PerfStageCounters>> &perf,
+      BenchResult *r) {
+    r->has_perf = true;
+    r->has_event.fill(true);
+
+    for (const auto &p : perf) {
+      const PerfCounters &c = p->GetCounters();
+      if (!c.IsAvailable()) {
+        r->has_perf = false;
+        r->perf_error = c.Error();
+        return;
+      }
+
+      for (int32_t i = 0; i != kNumPerfEvents; ++i) {
+        r->has_event[i] = r->has_event[i] && c.Has(static_cast<PerfEvent>(i));
+      }
+
+      r->perf_multiplexed = r->perf_multiplexed || c.IsMultiplexed();
+
+      for (int32_t i = 0; i != kNumStages; ++i) {
+        r->perf[i].Add(p->Get(static_cast<Stage>(i)));
+      }
+    }
+  }
+
+  // Take streams from the queue until all are done. A stream is put back
+  // after each chunk so that the streams are decoded in turn.
+  void Work(const std::vector<float> &tail_padding,
+            std::vector<double> *latencies) {
+    while (true) {
+      int32_t i = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty()) return;
+
+        i = queue_.front();
+        queue_.pop_front();
+      }
+
+      BenchStream &s = streams_[i];
+      if (!s.fed) {
+        const std::vector<float> &wave = waves_[s.file];
+        s.stream->AcceptWaveform(sampling_rate_, wave.data(), wave.size());
+        s.stream->AcceptWaveform(sampling_rate_, tail_padding.data(),
+                                 tail_padding.size());
+        s.stream->InputFinished();
+        s.fed = true;
+      }
+
+      if (!recognizer_->IsReady(s.stream.get())) continue;  // done
+
+      auto start = std::chrono::steady_clock::now();
+      recognizer_->DecodeStream(s.stream.get());
+      recognizer_->GetResult(s.stream.get());
+      auto end = std::chrono::steady_clock::now();
+
+      latencies->push_back(std::chrono::duration<double>(end - start).count());
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(i);
+    }
+  }
+
+ private:
+  const Recognizer *recognizer_;
+  const std::vector<std::vector<float>> &waves_;
+  float sampling_rate_;
+  BenchConfig config_;
+
+  std::vector<BenchStream> streams_;
+
+  std::mutex mutex_;
+  std::deque<int32_t> queue_;
+};
+
+// Derived metrics of the hardware events of a stage
+struct PerfRatios {
+  // Instructions per cycle
+  double ipc = -1;
+
+  // Misses per 1000 instructions
+  double l1d_mpki = -1;
+  double branch_mpki = -1;
+
+  // llc_misses / llc_references
+  double llc_miss_ratio = -1;
+};
+
+// A ratio is -1 if one of its events is not available
+static PerfRatios GetPerfRatios(const BenchResult &r, Stage stage) {
+  const PerfValues &v = r.perf[static_cast<int32_t>(stage)];
+  auto has = [&r](PerfEvent e) {
+    return r.has_event[static_cast<int32_t>(e)];
+  };
+
+  PerfRatios ans;
+  double instructions = v[PerfEvent::kInstructions];
+  if (has(PerfEvent::kInstructions) && instructions > 0) {
+    if (has(PerfEvent::kCycles) && v[PerfEvent::kCycles] > 0) {
+      ans.ipc = instructions / v[PerfEvent::kCycles];
+    }
+
+    if (has(PerfEvent::kL1dReadMisses)) {
+      ans.l1d_mpki = v[PerfEvent::kL1dReadMisses] * 1000 / instructions;
+    }
+
+    if (has(PerfEvent::kBranchMisses)) {
+      ans.branch_mpki = v[PerfEvent::kBranchMisses] * 1000 / instructions;
+    }
+  }
+
+  if (has(PerfEvent::kLlcReferences) && has(PerfEvent::kLlcMisses) &&
+      v[PerfEvent::kLlcReferences] > 0) {
+    ans.llc_miss_ratio = static_cast<double>(v[PerfEvent::kLlcMisses]) /
+                         v[PerfEvent::kLlcReferences];
+  }
+
+  return ans;
+}
+
+// p in [0, 1]. v must be sorted.
+static double Percentile(const std::vector<double> &v, double p) {
+  if (v.empty()) return 0;
+
+  size_t i = static_cast<size_t>(p * (v.size() - 1) + 0.5);
+  return v[std::min(i, v.size() - 1)];
+}
+
+// The model name of the first CPU, or an empty string if unknown
+static std::string GetCpuName() {
+  std::ifstream is("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(is, line)) {
+    if (line.compare(0, 10, "model name") != 0) continue;
+
+    auto pos = line.find(':');
+    if (pos == std::string::npos) break;
+
+    pos = line.find_first_not_of(' ', pos + 1);
+    return pos == std::string::npos ? "" : line.substr(pos);
+  }
+
+  return "";
+}
+
+static std::string JsonString(const std::string &s) {
+  std::ostringstream os;
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      os << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+         << static_cast<int32_t>(c) << std::dec;
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+  return os.str();
+}
+
+static std::string ToJson(const RecognizerConfig &recognizer_config,
+                          const BenchConfig &config, int32_t num_files,
+                          const BenchResult &r) {
+  const ncnn::Option &opt = recognizer_config.model_config.encoder_opt;
+
+  std::ostringstream os;
+  os << "{\n";
+  os << "  \"version\": " << JsonString(SHERPA_NCNN_VERSION) << ",\n";
+  os << "  \"cpu\": " << JsonString(GetCpuName()) << ",\n";
+  os << "  \"num_cpus\": " << GetAvailableCpus() << ",\n";
+  os << "  \"encoder\": "
+     << JsonString(recognizer_config.model_config.encoder_param) << ",\n";
+  os << "  \"decoding_method\": "
+     << JsonString(recognizer_config.decoder_config.method) << ",\n";
+  os << "  \"num_active_paths\": "
+     << recognizer_config.decoder_config.num_active_paths << ",\n";
+  os << "  \"num_files\": " << num_files << ",\n";
+  os << "  \"num_streams\": " << config.num_streams << ",\n";
+  os << "  \"num_threads\": " << config.num_threads << ",\n";
+  os << "  \"ncnn_num_threads\": " << opt.num_threads << ",\n";
+  os << "  \"audio_seconds\": " << r.audio_seconds << ",\n";
+  os << "  \"wall_seconds\": " << r.wall_seconds << ",\n";
+  os << "  \"rtf\": " << r.wall_seconds / r.audio_seconds << ",\n";
+  os << "  \"num_chunks\": " << r.num_chunks << ",\n";
+  os << "  \"chunks_per_second\": " << r.num_chunks / r.wall_seconds << ",\n";
+
+  os << "  \"chunk_latency_ms\": {";
+  os << "\"p50\": " << Percentile(r.latencies, 0.5) * 1000 << ", ";
+  os << "\"p95\": " << Percentile(r.latencies, 0.95) * 1000 << ", ";
+  os << "\"p99\": " << Percentile(r.latencies, 0.99) * 1000 << ", ";
+  os << "\"max\": " << Percentile(r.latencies, 1) * 1000 << "},\n";
+
+  os << "  \"stages\": {\n";
+  for (int32_t i = 0; i != kNumStages; ++i) {
+    os << "    " << JsonString(StageName(static_cast<Stage>(i))) << ": {";
+    os << "\"count\": " << r.stages.count[i] << ", ";
+    os << "\"seconds\": " << r.stages.seconds[i] << ", ";
+    os << "\"rtf\": " << r.stages.seconds[i] / r.audio_seconds;
+
+    if (r.has_perf) {
+      const PerfValues &v = r.perf[i];
+      os << ", \"perf\": {";
+      for (int32_t k = 0; k != kNumPerfEvents; ++k) {
+        os << JsonString(PerfEventName(static_cast<PerfEvent>(k))) << ": ";
+        if (r.has_event[k]) {
+          os << v.counts[k];
+        } else {
+          os << "null";
+        }
+        os << ", ";
+      }
+
+      auto json_ratio = [](double x) {
+        return x < 0 ? std::string("null") : std::to_string(x);
+      };
+
+      PerfRatios ratios = GetPerfRatios(r, static_cast<Stage>(i));
+      os << "\"ipc\": " << json_ratio(ratios.ipc) << ", ";
+      os << "\"l1d_mpki\": " << json_ratio(ratios.l1d_mpki) << ", ";
+      os << "\"llc_miss_ratio\": " << json_ratio(ratios.llc_miss_ratio)
+         << ", ";
+      os << "\"branch_mpki\": " << json_ratio(ratios.branch_mpki) << "}";
+    }
+
+    os << "}";
+    os << (i + 1 == kNumStages ? "\n" : ",\n");
+  }
+  os << "  }";
+
+  if (r.has_perf) {
+    os << ",\n  \"perf_multiplexed\": "
+       << (r.perf_multiplexed ? "true" : "false");
+
+    // The threads of ncnn are not counted, see perf-counters.h
+    os << ",\n  \"perf_complete\": "
+       << (opt.num_threads == 1 ? "true" : "false");
+  }
+
+  os << ",\n  \"allocators\": {";
+  os << "\"thread_allocators\": "
+     << (config.thread_allocators ? "true" : "false") << ", ";
+  os << "\"num_allocs\": " << r.num_allocs << ", ";
+  os << "\"allocs_per_chunk\": "
+     << (r.num_chunks ? static_cast<double>(r.num_allocs) / r.num_chunks : 0)
+     << ", ";
+  os << "\"num_mallocs\": ";
+  if (r.has_mallocs) {
+    os << r.num_mallocs << ", \"num_pools\": " << r.num_pools << ", ";
+  } else {
+    os << "null, ";
+  }
+  os << "\"blob_peak_bytes\": " << r.memory.blob_peak_bytes << ", ";
+  os << "\"workspace_peak_bytes\": " << r.memory.workspace_peak_bytes
+     << ", ";
+  os << "\"pooled_bytes\": " << r.memory.pooled_bytes << "}";
+
+  os << "\n}\n";
+
+  return os.str();
+}
+
+static void PrintSummary(const BenchResult &r) {
+  fprintf(stderr, "audio: %.3f s, wall: %.3f s, RTF: %.4f\n",
+          r.audio_seconds, r.wall_seconds, r.wall_seconds / r.audio_seconds);
+  fprintf(stderr, "chunks: %lld, chunks/s: %.2f\n",
+          static_cast<long long>(r.num_chunks),  // NOLINT
+          r.num_chunks / r.wall_seconds);
+  fprintf(stderr,
+          "chunk latency (ms): p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n",
+          Percentile(r.latencies, 0.5) * 1000,
+          Percentile(r.latencies, 0.95) * 1000,
+          Percentile(r.latencies, 0.99) * 1000,
+          Percentile(r.latencies, 1) * 1000);
+
+  fprintf(stderr, "ncnn allocations: %lld",
+          static_cast<long long>(r.num_allocs));  // NOLINT
+  if (r.has_mallocs) {
+    fprintf(stderr, ", from the heap: %lld, thread pools: %d",
+            static_cast<long long>(r.num_mallocs),  // NOLINT
+            r.num_pools);
+  }
+  fprintf(stderr,
+          ", blob peak: %.2f MB, workspace peak: %.2f MB, pooled: %.2f MB\n",
+          r.memory.blob_peak_bytes / 1e6, r.memory.workspace_peak_bytes / 1e6,
+          r.memory.pooled_bytes / 1e6);
+
+  double total = 0;
+  for (double s : r.stages.seconds) total += s;
+
+  fprintf(stderr, "%-8s %10s %12s %10s %7s\n", "stage", "count", "seconds",
+          "mean(us)", "share");
+  for (int32_t i = 0; i != kNumStages; ++i) {
+    int64_t n = r.stages.count[i];
+    double s = r.stages.seconds[i];
+    fprintf(stderr, "%-8s %10lld %12.4f %10.2f %6.1f%%\n",
+            StageName(static_cast<Stage>(i)),
+            static_cast<long long>(n),  // NOLINT
+            s, n ? s / n * 1e6 : 0.0, total > 0 ? s / total * 100 : 0.0);
+  }
+
+  if (!r.has_perf) {
+    if (!r.perf_error.empty()) {
+      fprintf(stderr,
+              "Hardware counters are not available (%s). Check "
+              "/proc/sys/kernel/perf_event_paranoid\n",
+              r.perf_error.c_str());
+    }
+    return;
+  }
+
+  // Print - for the ratios whose events are not available
+  auto print_ratio = [](const char *format, double x) {
+    if (x < 0) {
+      fprintf(stderr, " %9s", "-");
+    } else {
+      fprintf(stderr, format, x);
+    }
+  };
+
+  fprintf(stderr, "\n%-8s %12s %12s %9s %9s %9s %9s\n", "stage", "Mcycles",
+          "Minstr", "IPC", "L1D MPKI", "LLC miss", "br MPKI");
+  for (int32_t i = 0; i != kNumStages; ++i) {
+    Stage stage = static_cast<Stage>(i);
+    const PerfValues &v = r.perf[i];
+    PerfRatios ratios = GetPerfRatios(r, stage);
+
+    fprintf(stderr, "%-8s %12.2f %12.2f", StageName(stage),
+            v[PerfEvent::kCycles] / 1e6, v[PerfEvent::kInstructions] / 1e6);
+    print_ratio(" %9.2f", ratios.ipc);
+    print_ratio(" %9.2f", ratios.l1d_mpki);
+    print_ratio(" %8.1f%%", ratios.llc_miss_ratio * 100);
+    print_ratio(" %9.2f", ratios.branch_mpki);
+    fprintf(stderr, "\n");
+  }
+
+  fprintf(stderr, "Note: only the calling thread of each stage is counted\n");
+
+  if (r.perf_multiplexed) {
+    fprintf(stderr,
+            "Note: the counters were multiplexed with other events and "
+            "undercount\n");
+  }
+}
+
+}  // namespace sherpa_ncnn
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *usage = R"usage(
+Usage:
+  ./bin/sherpa-ncnn-bench \
+    /path/to/tokens.txt \
+    /path/to/encoder.ncnn.param \
+    /path/to/encoder.ncnn.bin \
+    /path/to/decoder.ncnn.param \
+    /path/to/decoder.ncnn.bin \
+    /path/to/joiner.ncnn.param \
+    /path/to/joiner.ncnn.bin \
+    /path/to/foo.wav [/path/to/bar.wav ...] \
+    [--num-streams=1] \
+    [--num-threads=1] \
+    [--ncnn-threads=1] \
+    [--decoding-method=greedy_search] \
+    [--num-active-paths=4] \
+    [--json=/path/to/report.json] \
+    [--trace=/path/to/trace.json] \
+    [--perf=false] \
+    [--thread-allocators=false]
+
+--num-streams streams are decoded by --num-threads worker threads.
+Stream i decodes the (i % number of waves)-th wave. --ncnn-threads is the
+number of threads of ncnn within each network.
+
+The JSON report is written to stdout if --json is not given.
+
+--perf=true counts cycles, instructions, cache and branch misses of each
+stage with perf_event_open on Linux. Counts of a stage exclude the stages
+run within it, as its time does. Only the --num-threads worker threads are
+counted, not the threads of ncnn, so the counts are incomplete with
+--ncnn-threads > 1.
+
+--thread-allocators=true makes each thread use its own pools instead of
+the pools of the recognizer shared by all threads. See thread-allocator.h
+
+--trace saves the spans of each stage, stream and thread in the Chrome
+trace event format. Open it in chrome://tracing or https://ui.perfetto.dev
+Without --trace, the environment variable
+SHERPA_NCNN_TRACE=/path/to/trace.json saves the same spans at exit.
+)usage";
+
+  if (argc < 9) {
+    fprintf(stderr, "%s\n", usage);
+    return 0;
+  }
+
+  sherpa_ncnn::RecognizerConfig config;
+  config.model_config.tokens = argv[1];
+  config.model_config.encoder_param = argv[2];
+  config.model_config.encoder_bin = argv[3];
+  config.model_config.decoder_param = argv[4];
+  config.model_config.decoder_bin = argv[5];
+  config.model_config.joiner_param = argv[6];
+  config.model_config.joiner_bin = argv[7];
+  config.model_config.use_buffer = false;
+
+  float expected_sampling_rate = 16000;
+  config.feat_config.sampling_rate = expected_sampling_rate;
+  config.feat_config.feature_dim = 80;
+
+  sherpa_ncnn::BenchConfig bench_config;
+  int32_t ncnn_threads = 1;
+  std::string trace;
+  std::vector<std::string> wav_filenames;
+
+  for (int32_t i = 8; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "num-streams", &value)) {
+      bench_config.num_streams = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-threads", &value)) {
+      bench_config.num_threads = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "ncnn-threads", &value)) {
+      ncnn_threads = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "decoding-method", &value)) {
+      config.decoder_config.method = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-active-paths", &value)) {
+      config.decoder_config.num_active_paths = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "json", &value)) {
+      bench_config.json = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "perf", &value)) {
+      bench_config.perf = value == "true" || value == "1";
+    } else if (sherpa_ncnn::ParseFlag(arg, "thread-allocators", &value)) {
+      bench_config.thread_allocators = value == "true" || value == "1";
+    } else if (sherpa_ncnn::ParseFlag(arg, "trace", &value)) {
+      trace = value;
+    } else if (arg.compare(0, 2, "--") == 0) {
+      fprintf(stderr, "Unknown option: %s\n%s\n", arg.c_str(), usage);
+      return -1;
+    } else {
+      wav_filenames.push_back(arg);
+    }
+  }
+
+  if (wav_filenames.empty() || bench_config.num_streams < 1 ||
+      bench_config.num_threads < 1 || ncnn_threads < 1) {
+    fprintf(stderr, "%s\n", usage);
+    return -1;
+  }
+
+  if (bench_config.perf && ncnn_threads > 1) {
+    fprintf(stderr,
+            "Warning: --perf counts only the calling threads. Work done by "
+            "the other %d threads of ncnn is not counted. Use "
+            "--ncnn-threads=1 for complete counts\n",
+            ncnn_threads - 1);
+  }
+
+  config.model_config.encoder_opt.num_threads = ncnn_threads;
+  config.model_config.decoder_opt.num_threads = ncnn_threads;
+  config.model_config.joiner_opt.num_threads = ncnn_threads;
+  config.model_config.use_thread_allocators = bench_config.thread_allocators;
+
+  std::vector<std::vector<float>> waves;
+  for (const auto &filename : wav_filenames) {
+    bool is_ok = false;
+    waves.push_back(
+        sherpa_ncnn::ReadWave(filename, expected_sampling_rate, &is_ok));
+    if (!is_ok) {
+      fprintf(stderr, "Failed to read %s\n", filename.c_str());
+      return -1;
+    }
+  }
+
+  fprintf(stderr, "%s\n", config.ToString().c_str());
+
+  sherpa_ncnn::Recognizer recognizer(config);
+
+  sherpa_ncnn::Bench bench(&recognizer, waves, expected_sampling_rate,
+                           bench_config);
+  if (!trace.empty()) {
+    sherpa_ncnn::StartTracing();
+  } else {
+    sherpa_ncnn::StartTracingFromEnv();
+  }
+
+  sherpa_ncnn::BenchResult r = bench.Run();
+
+  if (!trace.empty()) {
+    sherpa_ncnn::StopTracing();
+    if (!sherpa_ncnn::WriteTrace(trace)) {
+      return -1;
+    }
+    fprintf(stderr, "Trace saved to %s\n", trace.c_str());
+  }
+
+  sherpa_ncnn::PrintSummary(r);
+
+  std::string json = sherpa_ncnn::ToJson(config, bench_config,
+                                         static_cast<int32_t>(waves.size()), r);
+  if (bench_config.json.empty()) {
+    fprintf(stdout, "%s", json.c_str());
+  } else {
+    std::ofstream os(bench_config.json);
+    os << json;
+    if (!os) {
+      fprintf(stderr, "Failed to write %s\n", bench_config.json.c_str());
+      return -1;
+    }
+  }
+
+  return 0;
+}
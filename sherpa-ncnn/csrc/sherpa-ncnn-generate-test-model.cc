@@ -0,0 +1,173 @@
+// sherpa-ncnn/csrc/sherpa-ncnn-generate-test-model.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Write a transducer model with random weights, see test-model.h, and check
+// that it can be loaded and run on one chunk.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sherpa-ncnn/csrc/model.h"
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/test-model.h"
+
+namespace sherpa_ncnn {
+
+// Run the encoder, the decoder and the joiner once. Return false if any
+// output has an unexpected shape.
+static bool CheckTestModel(const TestModelConfig &config,
+                           const std::string &dir) {
+  auto model = Model::Create(GetTestModelConfig(dir));
+  if (!model) return false;
+
+  ncnn::Mat features(config.feature_dim, model->Segment());
+  features.fill(0.5f);
+
+  std::vector<ncnn::Mat> states = model->GetEncoderInitStates();
+  auto encoder_out = model->RunEncoder(features, states).first;
+
+  if (encoder_out.w != config.encoder_dim ||
+      encoder_out.h != model->Offset() / 4) {
+    fprintf(stderr, "Unexpected encoder_out shape (%d, %d)\n", encoder_out.h,
+            encoder_out.w);
+    return false;
+  }
+
+  ncnn::Mat decoder_input(model->ContextSize());
+  for (int32_t i = 0; i != model->ContextSize(); ++i) {
+    static_cast<int32_t *>(decoder_input)[i] = model->BlankId();
+  }
+
+  ncnn::Mat decoder_out = model->RunDecoder(decoder_input);
+  if (decoder_out.w != config.decoder_dim) {
+    fprintf(stderr, "Unexpected decoder_out dim %d\n", decoder_out.w);
+    return false;
+  }
+
+  ncnn::Mat encoder_out_t(encoder_out.w, encoder_out.row(0));
+  ncnn::Mat joiner_out = model->RunJoiner(encoder_out_t, decoder_out);
+  if (joiner_out.w != config.vocab_size) {
+    fprintf(stderr, "Unexpected joiner_out dim %d\n", joiner_out.w);
+    return false;
+  }
+
+  fprintf(stderr, "Checked. Segment: %d, offset: %d, num states: %d\n",
+          model->Segment(), model->Offset(),
+          static_cast<int32_t>(states.size()));
+
+  return true;
+}
+
+}  // namespace sherpa_ncnn
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *usage = R"usage(
+Usage:
+  ./bin/sherpa-ncnn-generate-test-model \
+    /path/to/output-dir \
+    [--model-type=zipformer] \
+    [--num-layers=12] \
+    [--encoder-dim=384] \
+    [--ffn-dim=1536] \
+    [--attention-dim=192] \
+    [--cnn-module-kernel=31] \
+    [--decoder-dim=512] \
+    [--joiner-dim=512] \
+    [--vocab-size=500] \
+    [--blank-bias=3] \
+    [--seed=0]
+
+--model-type is one of zipformer, conv-emformer and lstm.
+
+The directory must exist. The following files are written into it:
+
+  encoder.ncnn.param, encoder.ncnn.bin
+  decoder.ncnn.param, decoder.ncnn.bin
+  joiner.ncnn.param, joiner.ncnn.bin
+  tokens.txt
+
+They can be used with all binaries of sherpa-ncnn, e.g.,
+
+  ./bin/sherpa-ncnn-bench \
+    /path/to/output-dir/tokens.txt \
+    /path/to/output-dir/encoder.ncnn.param \
+    /path/to/output-dir/encoder.ncnn.bin \
+    /path/to/output-dir/decoder.ncnn.param \
+    /path/to/output-dir/decoder.ncnn.bin \
+    /path/to/output-dir/joiner.ncnn.param \
+    /path/to/output-dir/joiner.ncnn.bin \
+    /path/to/foo.wav
+
+The weights are random, so the recognition results are meaningless. Only
+the amount of computation is close to a real model of the same sizes.
+)usage";
+
+  if (argc < 2) {
+    fprintf(stderr, "%s\n", usage);
+    return 0;
+  }
+
+  std::string dir = argv[1];
+  sherpa_ncnn::TestModelConfig config;
+
+  for (int32_t i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "model-type", &value)) {
+      if (value == "conv-emformer") {
+        config.model_type = 1;
+      } else if (value == "zipformer") {
+        config.model_type = 2;
+      } else if (value == "lstm") {
+        config.model_type = 3;
+      } else {
+        fprintf(stderr, "Unknown model type: %s\n", value.c_str());
+        return -1;
+      }
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-layers", &value)) {
+      config.num_layers = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "encoder-dim", &value)) {
+      config.encoder_dim = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "ffn-dim", &value)) {
+      config.ffn_dim = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "attention-dim", &value)) {
+      config.attention_dim = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "cnn-module-kernel", &value)) {
+      config.cnn_module_kernel = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "decoder-dim", &value)) {
+      config.decoder_dim = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "joiner-dim", &value)) {
+      config.joiner_dim = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "vocab-size", &value)) {
+      config.vocab_size = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "blank-bias", &value)) {
+      config.blank_bias = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "seed", &value)) {
+      config.seed = strtoul(value.c_str(), nullptr, 10);
+    } else {
+      fprintf(stderr, "Unknown option: %s\n%s\n", arg.c_str(), usage);
+      return -1;
+    }
+  }
+
+  fprintf(stderr, "%s\n", config.ToString().c_str());
+
+  if (!sherpa_ncnn::GenerateTestModel(config, dir)) {
+    fprintf(stderr, "Failed to generate the model in %s\n", dir.c_str());
+    return -1;
+  }
+
+  if (!sherpa_ncnn::CheckTestModel(config, dir)) {
+    fprintf(stderr, "The generated model in %s is invalid\n", dir.c_str());
+    return -1;
+  }
+
+  fprintf(stderr, "Saved to %s\n", dir.c_str());
+
+  return 0;
+}
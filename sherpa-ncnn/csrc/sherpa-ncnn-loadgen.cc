@@ -0,0 +1,658 @@
+// sherpa-ncnn/csrc/sherpa-ncnn-loadgen.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Replay wave files as live streams and measure the latency a user sees.
+//
+// Each stream plays the wave files one after another with silence between
+// them. A feeder thread sends the audio of all streams in chunks at real
+// time, optionally with random delays, and worker threads decode the
+// streams that have a chunk ready on a shared Recognizer.
+//
+// Latencies are measured from the time the audio arrives:
+//  - partial: from the arrival of the last sample a chunk needs to its
+//    partial result
+//  - first token: from the arrival of the audio of the first token of an
+//    utterance to the first result containing it
+//  - endpoint to final: from the arrival of the last sample of the chunk
+//    after which the endpoint is detected, or of the end of the input, to
+//    the final result of an utterance. The trailing silence the endpoint
+//    rules wait for is not included.
+//
+// With --slo-ms, the number of streams is doubled until the given
+// percentile of the partial latency is above it and then bisected, to find
+// the number of streams that can be served within the SLO.
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/thread-budget.h"
+#include "sherpa-ncnn/csrc/trace-recorder.h"
+#include "sherpa-ncnn/csrc/wave-reader.h"
+
+namespace sherpa_ncnn {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadConfig {
+  int32_t num_streams = 4;
+  int32_t num_threads = 1;
+
+  // Size of the audio chunks sent to a stream
+  int32_t chunk_ms = 20;
+
+  // Each chunk is delayed by a random time in [0, jitter_ms]
+  int32_t jitter_ms = 0;
+
+  // Seconds of audio each stream plays
+  float duration = 10;
+
+  // Seconds of silence after each wave file
+  float gap = 2;
+
+  int32_t seed = 0;
+};
+
+struct Latencies {
+  // In seconds, sorted after LoadGen::Run()
+  std::vector<double> partial;
+  std::vector<double> first_token;
+  std::vector<double> endpoint;
+
+  void Add(const Latencies &other) {
+    partial.insert(partial.end(), other.partial.begin(), other.partial.end());
+    first_token.insert(first_token.end(), other.first_token.begin(),
+                       other.first_token.end());
+    endpoint.insert(endpoint.end(), other.endpoint.begin(),
+                    other.endpoint.end());
+  }
+
+  void Sort() {
+    std::sort(partial.begin(), partial.end());
+    std::sort(first_token.begin(), first_token.end());
+    std::sort(endpoint.begin(), endpoint.end());
+  }
+};
+
+struct LoadResult {
+  int32_t num_streams = 0;
+  double wall_seconds = 0;
+  double audio_seconds = 0;
+  Latencies latencies;
+};
+
+// p in [0, 1]. v must be sorted.
+static double Percentile(const std::vector<double> &v, double p) {
+  if (v.empty()) return 0;
+
+  size_t i = static_cast<size_t>(p * (v.size() - 1) + 0.5);
+  return v[std::min(i, v.size() - 1)];
+}
+
+class LoadGen {
+ public:
+  LoadGen(const Recognizer *recognizer,
+          const std::vector<std::vector<float>> &waves, float sampling_rate,
+          const LoadConfig &config)
+      : recognizer_(recognizer),
+        waves_(waves),
+        sampling_rate_(sampling_rate),
+        config_(config) {}
+
+  LoadResult Run() {
+    streams_.clear();
+    streams_.resize(config_.num_streams);
+    for (int32_t i = 0; i != config_.num_streams; ++i) {
+      streams_[i].stream = recognizer_->CreateStream();
+      streams_[i].samples = BuildAudio(i);
+    }
+    num_done_ = 0;
+    ready_.clear();
+
+    std::vector<Latencies> latencies(config_.num_threads);
+
+    auto start = Clock::now();
+
+    std::vector<std::thread> threads;
+    for (int32_t t = 0; t != config_.num_threads; ++t) {
+      threads.emplace_back([this, &latencies, t]() { Work(&latencies[t]); });
+    }
+
+    Feed(start);
+
+    for (auto &t : threads) {
+      t.join();
+    }
+
+    auto end = Clock::now();
+
+    LoadResult r;
+    r.num_streams = config_.num_streams;
+    r.wall_seconds = std::chrono::duration<double>(end - start).count();
+    for (const auto &s : streams_) {
+      r.audio_seconds += s.samples.size() / sampling_rate_;
+    }
+
+    for (const auto &l : latencies) {
+      r.latencies.Add(l);
+    }
+    r.latencies.Sort();
+
+    return r;
+  }
+
+ private:
+  struct LoadStream {
+    std::unique_ptr<Stream> stream;
+    std::vector<float> samples;
+
+    // Guarded by LoadGen::mutex_
+    //
+    // (seconds of audio received, arrival time) after each chunk
+    std::vector<std::pair<double, Clock::time_point>> arrivals;
+    bool input_finished = false;
+    bool queued = false;
+    bool busy = false;
+    bool done = false;
+
+    // Only used by the worker decoding the stream
+    bool has_token = false;
+
+    // Feature frames consumed by the encoder since the start of the
+    // stream. Unlike Stream::GetNumProcessedFrames(), it is not reset at
+    // endpoints, so it matches the arrivals.
+    int32_t num_decoded_frames = 0;
+  };
+
+  // Wave files starting from the (i % number of files)-th one with silence
+  // after each, until config_.duration seconds
+  std::vector<float> BuildAudio(int32_t i) const {
+    int32_t n = static_cast<int32_t>(config_.duration * sampling_rate_);
+    int32_t gap = static_cast<int32_t>(config_.gap * sampling_rate_);
+
+    std::vector<float> ans;
+    ans.reserve(n);
+    for (int32_t k = i; static_cast<int32_t>(ans.size()) < n; ++k) {
+      const std::vector<float> &wave = waves_[k % waves_.size()];
+      ans.insert(ans.end(), wave.begin(), wave.end());
+      ans.resize(ans.size() + gap);
+    }
+    ans.resize(n);
+
+    return ans;
+  }
+
+  // Send the chunks of all streams at their times
+  void Feed(Clock::time_point start) {
+    using Event = std::pair<Clock::time_point, int32_t>;  // (time, stream)
+
+    std::mt19937 rng(config_.seed);
+    std::uniform_real_distribution<double> jitter(0, config_.jitter_ms);
+    auto chunk = std::chrono::microseconds(config_.chunk_ms * 1000);
+
+    // Spread the starts of the streams over one chunk
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> q;
+    std::vector<Clock::time_point> nominal(config_.num_streams);
+    for (int32_t i = 0; i != config_.num_streams; ++i) {
+      nominal[i] = start + chunk * i / config_.num_streams;
+      q.emplace(nominal[i], i);
+    }
+
+    int32_t chunk_samples =
+        static_cast<int32_t>(config_.chunk_ms * sampling_rate_ / 1000);
+    std::vector<int32_t> offsets(config_.num_streams);
+
+    while (!q.empty()) {
+      Event e = q.top();
+      q.pop();
+      std::this_thread::sleep_until(e.first);
+
+      int32_t i = e.second;
+      LoadStream &s = streams_[i];
+      int32_t n = std::min<int32_t>(chunk_samples,
+                                    s.samples.size() - offsets[i]);
+      s.stream->AcceptWaveform(sampling_rate_, s.samples.data() + offsets[i],
+                               n);
+      offsets[i] += n;
+
+      bool finished = offsets[i] == static_cast<int32_t>(s.samples.size());
+      if (finished) {
+        s.stream->InputFinished();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        s.arrivals.emplace_back(offsets[i] / sampling_rate_, Clock::now());
+        s.input_finished = finished;
+        Enqueue(i);
+      }
+      cv_.notify_one();
+
+      if (!finished) {
+        // Chunks are delayed by the jitter but never reordered
+        nominal[i] += chunk;
+        auto delay = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(jitter(rng)));
+        q.emplace(std::max(nominal[i] + delay, e.first), i);
+      }
+    }
+  }
+
+  // Return true if the stream is put into the queue.
+  // Caller should hold the lock
+  bool Enqueue(int32_t i) {
+    LoadStream &s = streams_[i];
+    if (s.queued || s.busy || s.done) return false;
+
+    if (s.input_finished || recognizer_->IsReady(s.stream.get())) {
+      s.queued = true;
+      ready_.push_back(i);
+      return true;
+    }
+
+    return false;
+  }
+
+  // Caller should hold the lock
+  Clock::time_point ArrivalTime(const LoadStream &s, double seconds) const {
+    auto it = std::lower_bound(
+        s.arrivals.begin(), s.arrivals.end(), seconds,
+        [](const std::pair<double, Clock::time_point> &a, double t) {
+          return a.first < t;
+        });
+
+    return it == s.arrivals.end() ? s.arrivals.back().second : it->second;
+  }
+
+  void Work(Latencies *latencies) {
+    const Model *model = recognizer_->GetModel();
+
+    while (true) {
+      int32_t i = 0;
+      bool input_finished = false;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() {
+          return !ready_.empty() || num_done_ == config_.num_streams;
+        });
+        if (ready_.empty()) return;
+
+        i = ready_.front();
+        ready_.pop_front();
+
+        streams_[i].queued = false;
+        streams_[i].busy = true;
+        input_finished = streams_[i].input_finished;
+      }
+
+      LoadStream &s = streams_[i];
+      Stream *stream = s.stream.get();
+
+      // Seconds of audio needed by each decoded chunk. Frame t covers
+      // samples [t * 10ms, t * 10ms + 25ms).
+      std::vector<double> needed;
+
+      // Stop at the chunk after which the endpoint is detected, as an
+      // application resets the stream there. The remaining chunks are
+      // decoded after the reset.
+      bool is_endpoint = false;
+      while (recognizer_->IsReady(stream)) {
+        int32_t frames = s.num_decoded_frames + model->Segment();
+        needed.push_back((frames - 1) * 0.01 + 0.025);
+
+        int32_t processed = stream->GetNumProcessedFrames();
+        recognizer_->DecodeStream(stream);
+        s.num_decoded_frames += stream->GetNumProcessedFrames() - processed;
+
+        if (recognizer_->IsEndpoint(stream)) {
+          is_endpoint = true;
+          break;
+        }
+      }
+
+      bool is_final = input_finished && !recognizer_->IsReady(stream);
+
+      RecognitionResult r;
+      if (!needed.empty() || is_final) {
+        r = recognizer_->GetResult(stream);
+      }
+      auto now = Clock::now();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto seconds = [now](Clock::time_point t) {
+          return std::chrono::duration<double>(now - t).count();
+        };
+
+        for (double t : needed) {
+          latencies->partial.push_back(seconds(ArrivalTime(s, t)));
+        }
+
+        if (!s.has_token && !r.timestamps.empty()) {
+          s.has_token = true;
+          latencies->first_token.push_back(
+              seconds(ArrivalTime(s, r.timestamps.front())));
+        }
+
+        // The audio that made the endpoint rules true, or the end of the
+        // input
+        if ((is_endpoint || is_final) && !r.timestamps.empty()) {
+          Clock::time_point t = is_endpoint
+                                    ? ArrivalTime(s, needed.back())
+                                    : s.arrivals.back().second;
+          latencies->endpoint.push_back(seconds(t));
+        }
+      }
+
+      if (is_endpoint && !is_final) {
+        recognizer_->Reset(stream);
+        s.has_token = false;
+      }
+
+      bool all_done = false;
+      bool requeued = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        s.busy = false;
+        if (is_final) {
+          s.done = true;
+          all_done = ++num_done_ == config_.num_streams;
+        } else {
+          requeued = Enqueue(i);
+        }
+      }
+
+      if (all_done) {
+        cv_.notify_all();
+      } else if (requeued) {
+        cv_.notify_one();
+      }
+    }
+  }
+
+ private:
+  const Recognizer *recognizer_;
+  const std::vector<std::vector<float>> &waves_;
+  float sampling_rate_;
+  LoadConfig config_;
+
+  std::vector<LoadStream> streams_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  // Streams with a chunk ready or with their input finished
+  std::deque<int32_t> ready_;
+  int32_t num_done_ = 0;
+};
+
+static void PrintLatency(const char *name, const std::vector<double> &v) {
+  fprintf(stderr, "  %-18s %8zu %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+          v.size(), Percentile(v, 0.5) * 1000, Percentile(v, 0.9) * 1000,
+          Percentile(v, 0.95) * 1000, Percentile(v, 0.99) * 1000,
+          Percentile(v, 1) * 1000);
+}
+
+static void PrintResult(const LoadResult &r) {
+  fprintf(stderr, "\n%d streams: audio %.1f s, wall %.1f s, load %.2f\n",
+          r.num_streams, r.audio_seconds, r.wall_seconds,
+          r.audio_seconds / r.wall_seconds);
+  fprintf(stderr, "  %-18s %8s %9s %9s %9s %9s %9s\n", "latency (ms)", "count",
+          "p50", "p90", "p95", "p99", "max");
+  PrintLatency("partial", r.latencies.partial);
+  PrintLatency("first token", r.latencies.first_token);
+  PrintLatency("endpoint to final", r.latencies.endpoint);
+}
+
+// Return the .wav files in the given directory, sorted
+static std::vector<std::string> ListWaves(const std::string &dir) {
+  std::vector<std::string> ans;
+
+  DIR *d = opendir(dir.c_str());
+  if (!d) return ans;
+
+  while (struct dirent *e = readdir(d)) {
+    std::string name = e->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".wav") == 0) {
+      ans.push_back(dir + "/" + name);
+    }
+  }
+  closedir(d);
+
+  std::sort(ans.begin(), ans.end());
+  return ans;
+}
+
+}  // namespace sherpa_ncnn
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *usage = R"usage(
+Usage:
+  ./bin/sherpa-ncnn-loadgen \
+    /path/to/tokens.txt \
+    /path/to/encoder.ncnn.param \
+    /path/to/encoder.ncnn.bin \
+    /path/to/decoder.ncnn.param \
+    /path/to/decoder.ncnn.bin \
+    /path/to/joiner.ncnn.param \
+    /path/to/joiner.ncnn.bin \
+    /path/to/wav-dir-or-file [/path/to/bar.wav ...] \
+    [--num-streams=4] \
+    [--num-threads=number of CPUs] \
+    [--ncnn-threads=1] \
+    [--chunk-ms=20] \
+    [--jitter-ms=0] \
+    [--duration=10] \
+    [--gap=2] \
+    [--decoding-method=greedy_search] \
+    [--num-active-paths=4] \
+    [--slo-ms=0] \
+    [--slo-percentile=95] \
+    [--max-streams=256] \
+    [--seed=0]
+
+Each of the --num-streams streams plays --duration seconds of audio: the
+wave files, starting from a different one for each stream, with --gap
+seconds of silence after each. The audio is sent in chunks of --chunk-ms
+(10 to 200) milliseconds at real time. Each chunk is delayed by a random
+time of up to --jitter-ms milliseconds. --num-threads worker threads decode
+the streams on a shared recognizer with endpointing enabled.
+
+If --slo-ms is positive, the largest number of streams (up to
+--max-streams) whose --slo-percentile percentile of the partial latency is
+at most --slo-ms is searched, starting from --num-streams.
+
+Set the environment variable SHERPA_NCNN_TRACE=/path/to/trace.json to save
+the spans of each stage, stream and thread in the Chrome trace event
+format at exit. See trace-recorder.h
+)usage";
+
+  if (argc < 9) {
+    fprintf(stderr, "%s\n", usage);
+    return 0;
+  }
+
+  sherpa_ncnn::RecognizerConfig config;
+  config.model_config.tokens = argv[1];
+  config.model_config.encoder_param = argv[2];
+  config.model_config.encoder_bin = argv[3];
+  config.model_config.decoder_param = argv[4];
+  config.model_config.decoder_bin = argv[5];
+  config.model_config.joiner_param = argv[6];
+  config.model_config.joiner_bin = argv[7];
+  config.model_config.use_buffer = false;
+  config.enable_endpoint = true;
+
+  float expected_sampling_rate = 16000;
+  config.feat_config.sampling_rate = expected_sampling_rate;
+  config.feat_config.feature_dim = 80;
+
+  sherpa_ncnn::LoadConfig load_config;
+  load_config.num_threads = sherpa_ncnn::GetAvailableCpus();
+  int32_t ncnn_threads = 1;
+  float slo_ms = 0;
+  float slo_percentile = 95;
+  int32_t max_streams = 256;
+  std::vector<std::string> inputs;
+
+  for (int32_t i = 8; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "num-streams", &value)) {
+      load_config.num_streams = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-threads", &value)) {
+      load_config.num_threads = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "ncnn-threads", &value)) {
+      ncnn_threads = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "chunk-ms", &value)) {
+      load_config.chunk_ms = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "jitter-ms", &value)) {
+      load_config.jitter_ms = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "duration", &value)) {
+      load_config.duration = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "gap", &value)) {
+      load_config.gap = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "decoding-method", &value)) {
+      config.decoder_config.method = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-active-paths", &value)) {
+      config.decoder_config.num_active_paths = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "slo-ms", &value)) {
+      slo_ms = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "slo-percentile", &value)) {
+      slo_percentile = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "max-streams", &value)) {
+      max_streams = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "seed", &value)) {
+      load_config.seed = atoi(value.c_str());
+    } else if (arg.compare(0, 2, "--") == 0) {
+      fprintf(stderr, "Unknown option: %s\n%s\n", arg.c_str(), usage);
+      return -1;
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+
+  if (load_config.chunk_ms < 10 || load_config.chunk_ms > 200) {
+    fprintf(stderr, "--chunk-ms should be in [10, 200]. Given: %d\n",
+            load_config.chunk_ms);
+    return -1;
+  }
+
+  if (load_config.num_streams < 1 || load_config.num_threads < 1 ||
+      ncnn_threads < 1 || load_config.jitter_ms < 0 ||
+      load_config.duration <= 0 || load_config.gap < 0 ||
+      slo_percentile <= 0 || slo_percentile > 100) {
+    fprintf(stderr, "%s\n", usage);
+    return -1;
+  }
+
+  config.model_config.encoder_opt.num_threads = ncnn_threads;
+  config.model_config.decoder_opt.num_threads = ncnn_threads;
+  config.model_config.joiner_opt.num_threads = ncnn_threads;
+
+  std::vector<std::string> wav_filenames;
+  for (const auto &input : inputs) {
+    std::vector<std::string> files = sherpa_ncnn::ListWaves(input);
+    if (files.empty()) {
+      wav_filenames.push_back(input);
+    } else {
+      wav_filenames.insert(wav_filenames.end(), files.begin(), files.end());
+    }
+  }
+
+  if (wav_filenames.empty()) {
+    fprintf(stderr, "No wave files are given\n%s\n", usage);
+    return -1;
+  }
+
+  std::vector<std::vector<float>> waves;
+  for (const auto &filename : wav_filenames) {
+    bool is_ok = false;
+    waves.push_back(
+        sherpa_ncnn::ReadWave(filename, expected_sampling_rate, &is_ok));
+    if (!is_ok) {
+      fprintf(stderr, "Failed to read %s\n", filename.c_str());
+      return -1;
+    }
+  }
+
+  fprintf(stderr, "%s\n", config.ToString().c_str());
+  fprintf(stderr, "%d wave files, %d worker threads\n",
+          static_cast<int32_t>(waves.size()), load_config.num_threads);
+
+  sherpa_ncnn::StartTracingFromEnv();
+
+  sherpa_ncnn::Recognizer recognizer(config);
+
+  auto run = [&](int32_t num_streams) {
+    load_config.num_streams = num_streams;
+    sherpa_ncnn::LoadGen load_gen(&recognizer, waves, expected_sampling_rate,
+                                  load_config);
+    sherpa_ncnn::LoadResult r = load_gen.Run();
+    sherpa_ncnn::PrintResult(r);
+    return r;
+  };
+
+  if (slo_ms <= 0) {
+    run(load_config.num_streams);
+    return 0;
+  }
+
+  auto meets_slo = [&](int32_t num_streams) {
+    sherpa_ncnn::LoadResult r = run(num_streams);
+    double p = sherpa_ncnn::Percentile(r.latencies.partial,
+                                       slo_percentile / 100) *
+               1000;
+    bool ok = p <= slo_ms;
+    fprintf(stderr, "  p%g partial latency %.1f ms: %s\n", slo_percentile, p,
+            ok ? "within SLO" : "SLO violated");
+    return ok;
+  };
+
+  // good meets the SLO and bad does not
+  int32_t good = 0;
+  int32_t bad = max_streams + 1;
+  int32_t n = std::min(load_config.num_streams, max_streams);
+  while (n < bad) {
+    if (!meets_slo(n)) {
+      bad = n;
+      break;
+    }
+    good = n;
+    if (n == max_streams) break;
+    n = std::min(n * 2, max_streams);
+  }
+
+  while (bad - good > 1 && good != max_streams) {
+    int32_t mid = (good + bad) / 2;
+    if (meets_slo(mid)) {
+      good = mid;
+    } else {
+      bad = mid;
+    }
+  }
+
+  fprintf(stderr,
+          "\nStreams within the SLO (p%g partial latency <= %g ms): %d%s\n",
+          slo_percentile, slo_ms, good,
+          good == max_streams ? " (--max-streams reached)" : "");
+
+  return 0;
+}
@@ -0,0 +1,377 @@
+// sherpa-ncnn/csrc/sherpa-ncnn-optimize-encoder.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Remove redundant layers from an encoder exported by pnnx, fold constants
+// and fuse elementwise layers, and check that the optimized encoder gives
+// the same outputs.
+//
+// The shapes of all blobs are recorded by running the encoder on the first
+// chunk of a wave file. The rewrites are described in param-optimizer.h.
+// The original and the optimized encoder are then run on the following
+// chunks, each with its own states. With --exact=true every output must be
+// bit-identical, otherwise within --max-abs-diff. If not, the optimized
+// files are deleted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "net.h"  // NOLINT
+#include "sherpa-ncnn/csrc/features.h"
+#include "sherpa-ncnn/csrc/model.h"
+#include "sherpa-ncnn/csrc/param-optimizer.h"
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/wave-reader.h"
+
+namespace sherpa_ncnn {
+
+// Run the encoder on one chunk without light mode and return the shapes of
+// all blobs that can be extracted
+static std::map<std::string, BlobShape> GetBlobShapes(
+    Model *model, ncnn::Mat &features) {
+  std::vector<ncnn::Mat> states = model->GetEncoderInitStates();
+
+  ncnn::Net &net = model->GetEncoder();
+  ncnn::Extractor ex = net.create_extractor();
+  ex.set_light_mode(false);
+
+  ex.input("in0", features);
+  for (int32_t i = 0; i != states.size(); ++i) {
+    ex.input(("in" + std::to_string(i + 1)).c_str(), states[i]);
+  }
+
+  std::map<std::string, BlobShape> ans;
+  for (const auto &blob : net.blobs()) {
+    ncnn::Mat m;
+    if (ex.extract(blob.name.c_str(), m) != 0 || m.empty()) continue;
+
+    BlobShape s;
+    s.dims = m.dims;
+    s.w = m.w;
+    s.h = m.h;
+    s.d = m.d;
+    s.c = m.c;
+    ans[blob.name] = s;
+  }
+
+  return ans;
+}
+
+// Return true if a and b have the same shape and the same bytes
+static bool BitEqual(const ncnn::Mat &a, const ncnn::Mat &b) {
+  if (a.dims != b.dims || a.w != b.w || a.h != b.h || a.d != b.d ||
+      a.c != b.c || a.elemsize != b.elemsize || a.elempack != b.elempack) {
+    return false;
+  }
+
+  // Channels may be padded, so compare them one by one
+  size_t bytes = static_cast<size_t>(a.w) * a.h * a.d * a.elemsize;
+  for (int32_t q = 0; q != a.c; ++q) {
+    const unsigned char *pa = a.channel(q);
+    const unsigned char *pb = b.channel(q);
+    if (memcmp(pa, pb, bytes) != 0) return false;
+  }
+
+  return true;
+}
+
+// Return the largest absolute difference between two fp32 Mats of the same
+// shape, or -1 if they cannot be compared
+static float MaxAbsDiff(const ncnn::Mat &a, const ncnn::Mat &b) {
+  if (a.dims != b.dims || a.w != b.w || a.h != b.h || a.d != b.d ||
+      a.c != b.c || a.elemsize != 4 || b.elemsize != 4 || a.elempack != 1 ||
+      b.elempack != 1) {
+    return -1;
+  }
+
+  float ans = 0;
+  int32_t n = a.w * a.h * a.d;
+  for (int32_t q = 0; q != a.c; ++q) {
+    const float *pa = a.channel(q);
+    const float *pb = b.channel(q);
+    for (int32_t i = 0; i != n; ++i) {
+      float d = std::fabs(pa[i] - pb[i]);
+      if (!(d <= ans)) ans = std::isnan(d) ? INFINITY : d;
+    }
+  }
+
+  return ans;
+}
+
+// Return true if b is the same as a within max_abs_diff. A negative
+// max_abs_diff requires bit-identical outputs.
+static bool Same(const ncnn::Mat &a, const ncnn::Mat &b, float max_abs_diff,
+                 float *diff) {
+  if (max_abs_diff < 0) return BitEqual(a, b);
+
+  float d = MaxAbsDiff(a, b);
+  *diff = std::max(*diff, d);
+
+  return d >= 0 && d <= max_abs_diff;
+}
+
+// Run both encoders on num_chunks chunks of the features. Return false if
+// any output differs by more than max_abs_diff, or is not bit-identical if
+// max_abs_diff is negative.
+static bool CheckParity(Model *original, Model *optimized,
+                        const FeatureExtractor &fe, int32_t num_chunks,
+                        float max_abs_diff) {
+  int32_t segment = original->Segment();
+  int32_t offset = original->Offset();
+
+  std::vector<ncnn::Mat> states_a = original->GetEncoderInitStates();
+  std::vector<ncnn::Mat> states_b = optimized->GetEncoderInitStates();
+
+  float diff = 0;
+  int32_t n = 0;
+  for (int32_t start = 0;
+       start + segment <= fe.NumFramesReady() && n < num_chunks;
+       start += offset, ++n) {
+    ncnn::Mat features = fe.GetFrames(start, segment);
+    ncnn::Mat features_copy = features.clone();
+
+    auto a = original->RunEncoder(features, states_a);
+    auto b = optimized->RunEncoder(features_copy, states_b);
+
+    if (!Same(a.first, b.first, max_abs_diff, &diff)) {
+      fprintf(stderr, "chunk %d: encoder_out differs\n", n);
+      return false;
+    }
+
+    if (a.second.size() != b.second.size()) {
+      fprintf(stderr, "chunk %d: number of states differs\n", n);
+      return false;
+    }
+
+    for (int32_t i = 0; i != a.second.size(); ++i) {
+      if (!Same(a.second[i], b.second[i], max_abs_diff, &diff)) {
+        fprintf(stderr, "chunk %d: state %d differs\n", n, i);
+        return false;
+      }
+    }
+
+    states_a = std::move(a.second);
+    states_b = std::move(b.second);
+  }
+
+  if (n == 0) {
+    fprintf(stderr, "The wave file is too short for one chunk\n");
+    return false;
+  }
+
+  if (max_abs_diff < 0) {
+    fprintf(stderr, "Bit parity checked on %d chunks\n", n);
+  } else {
+    fprintf(stderr, "Checked on %d chunks. Max abs diff: %g\n", n, diff);
+  }
+
+  return true;
+}
+
+}  // namespace sherpa_ncnn
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *usage = R"usage(
+Usage:
+  ./bin/sherpa-ncnn-optimize-encoder \
+    /path/to/encoder.ncnn.param \
+    /path/to/encoder.ncnn.bin \
+    /path/to/decoder.ncnn.param \
+    /path/to/decoder.ncnn.bin \
+    /path/to/joiner.ncnn.param \
+    /path/to/joiner.ncnn.bin \
+    /path/to/foo.wav \
+    --output=/path/to/encoder-opt.ncnn.param \
+    [--output-bin=/path/to/encoder-opt.ncnn.bin] \
+    [--num-chunks=8] \
+    [--exact=true] \
+    [--max-abs-diff=1e-4]
+
+Noop, Permute, Reshape, Flatten, Squeeze, ExpandDims and Split layers are
+removed or merged and activations are fused into the preceding
+Convolution, ConvolutionDepthWise or InnerProduct.
+
+If the layout of encoder.ncnn.bin is understood, constant subgraphs are
+also folded into MemoryData and scalar BinaryOps are folded into the
+weights. The new weights are written to --output-bin, which defaults to
+--output with .param replaced by .bin. Otherwise only the .param file is
+written and it uses the same encoder.ncnn.bin.
+
+With --exact=true, only rewrites that keep the outputs bit-identical are
+done. With --exact=false, divisions, transcendental functions and fused
+sigmoid/mish/hardswish are rewritten as well and the outputs may differ by
+up to --max-abs-diff.
+
+The wave file must contain at least one chunk of speech. Its first chunk
+is used to find the shapes of the blobs and --num-chunks chunks are used
+to check the outputs.
+)usage";
+
+  if (argc < 8) {
+    fprintf(stderr, "%s\n", usage);
+    return 0;
+  }
+
+  sherpa_ncnn::ModelConfig model_config;
+  model_config.encoder_param = argv[1];
+  model_config.encoder_bin = argv[2];
+  model_config.decoder_param = argv[3];
+  model_config.decoder_bin = argv[4];
+  model_config.joiner_param = argv[5];
+  model_config.joiner_bin = argv[6];
+  model_config.use_buffer = false;
+  model_config.use_vulkan_compute = false;
+  model_config.encoder_opt.num_threads = 1;
+  model_config.decoder_opt.num_threads = 1;
+  model_config.joiner_opt.num_threads = 1;
+
+  std::string wav_filename = argv[7];
+  std::string output;
+  std::string output_bin;
+  int32_t num_chunks = 8;
+  bool exact = true;
+  float max_abs_diff = 1e-4f;
+
+  for (int32_t i = 8; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "output", &value)) {
+      output = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "output-bin", &value)) {
+      output_bin = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-chunks", &value)) {
+      num_chunks = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "exact", &value)) {
+      exact = value == "true" || value == "1";
+    } else if (sherpa_ncnn::ParseFlag(arg, "max-abs-diff", &value)) {
+      max_abs_diff = atof(value.c_str());
+    } else {
+      fprintf(stderr, "Unknown option: %s\n%s\n", arg.c_str(), usage);
+      return -1;
+    }
+  }
+
+  if (output.empty() || num_chunks < 1) {
+    fprintf(stderr, "Please provide --output and a positive --num-chunks\n");
+    return -1;
+  }
+
+  if (output == model_config.encoder_param) {
+    fprintf(stderr, "--output must differ from the input .param file\n");
+    return -1;
+  }
+
+  if (output_bin.empty()) {
+    std::string suffix = ".param";
+    output_bin = output;
+    if (output_bin.size() > suffix.size() &&
+        output_bin.compare(output_bin.size() - suffix.size(), suffix.size(),
+                           suffix) == 0) {
+      output_bin.resize(output_bin.size() - suffix.size());
+    }
+    output_bin += ".bin";
+  }
+
+  if (output_bin == model_config.encoder_bin || output_bin == output) {
+    fprintf(stderr,
+            "--output-bin must differ from the input .bin file and "
+            "--output\n");
+    return -1;
+  }
+
+  if (!exact && !(max_abs_diff >= 0)) {
+    fprintf(stderr, "Please provide a non-negative --max-abs-diff\n");
+    return -1;
+  }
+
+  float expected_sampling_rate = 16000;
+  bool is_ok = false;
+  std::vector<float> samples =
+      sherpa_ncnn::ReadWave(wav_filename, expected_sampling_rate, &is_ok);
+  if (!is_ok) {
+    fprintf(stderr, "Failed to read %s\n", wav_filename.c_str());
+    return -1;
+  }
+
+  sherpa_ncnn::FeatureExtractorConfig feat_config;
+  feat_config.sampling_rate = expected_sampling_rate;
+  feat_config.feature_dim = 80;
+
+  sherpa_ncnn::FeatureExtractor fe(feat_config);
+  fe.AcceptWaveform(expected_sampling_rate, samples.data(), samples.size());
+  fe.InputFinished();
+
+  auto original = sherpa_ncnn::Model::Create(model_config);
+  if (!original) {
+    fprintf(stderr, "Failed to load the model\n");
+    return -1;
+  }
+
+  if (fe.NumFramesReady() < original->Segment()) {
+    fprintf(stderr, "The wave file is too short for one chunk\n");
+    return -1;
+  }
+
+  ncnn::Mat features = fe.GetFrames(0, original->Segment());
+  auto shapes = sherpa_ncnn::GetBlobShapes(original.get(), features);
+
+  sherpa_ncnn::ParamGraph graph;
+  if (!sherpa_ncnn::ReadParamGraph(model_config.encoder_param, &graph)) {
+    return -1;
+  }
+
+  if (!sherpa_ncnn::ReadParamBin(model_config.encoder_bin, &graph)) {
+    fprintf(stderr, "Weights in %s are not rewritten\n",
+            model_config.encoder_bin.c_str());
+  }
+
+  sherpa_ncnn::ParamOptimizerConfig optimizer_config(true, exact);
+  fprintf(stderr, "%s\n", optimizer_config.ToString().c_str());
+
+  sherpa_ncnn::ParamOptimizerStats stats =
+      sherpa_ncnn::OptimizeParamGraph(shapes, optimizer_config, &graph);
+  fprintf(stderr, "%s\n", stats.ToString().c_str());
+
+  if (!sherpa_ncnn::WriteParamGraph(output, graph)) {
+    return -1;
+  }
+
+  model_config.encoder_param = output;
+
+  if (graph.has_weights) {
+    if (!sherpa_ncnn::WriteParamBin(output_bin, graph)) {
+      remove(output.c_str());
+      return -1;
+    }
+    model_config.encoder_bin = output_bin;
+  }
+
+  auto optimized = sherpa_ncnn::Model::Create(model_config);
+  if (!optimized ||
+      !sherpa_ncnn::CheckParity(original.get(), optimized.get(), fe,
+                                num_chunks, exact ? -1 : max_abs_diff)) {
+    fprintf(stderr, "The optimized encoder is wrong. Remove %s\n",
+            output.c_str());
+    remove(output.c_str());
+    if (graph.has_weights) remove(output_bin.c_str());
+    return -1;
+  }
+
+  if (graph.has_weights) {
+    fprintf(stderr, "Saved to %s and %s\n", output.c_str(),
+            output_bin.c_str());
+  } else {
+    fprintf(stderr, "Saved to %s\n", output.c_str());
+  }
+
+  return 0;
+}
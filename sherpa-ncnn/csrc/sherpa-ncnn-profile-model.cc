@@ -0,0 +1,290 @@
+// sherpa-ncnn/csrc/sherpa-ncnn-profile-model.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Run the encoder, the decoder and the joiner alone and print the time of
+// each layer, see layer-profiler.h.
+//
+// The encoder runs on chunks of Segment() frames of random features and
+// its states are carried over from one run to the next as in decoding.
+// The decoder gets ContextSize() blanks and the joiner gets the outputs
+// of the encoder and the decoder.
+//
+// For each network, the layers taking the most time and the time of each
+// layer type are printed. Custom layers are marked with *.
+//
+// It also prints how many inputs of the custom layers are packed or
+// 16-bit per run. ncnn would unpack or cast each of them to fp32 and
+// convert the output back if the layer did not support it.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "net.h"  // NOLINT
+#include "sherpa-ncnn/csrc/layer-profiler.h"
+#include "sherpa-ncnn/csrc/model.h"
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/random-mat.h"
+
+namespace sherpa_ncnn {
+
+static constexpr int32_t kFeatureDim = 80;
+
+static std::string TypeName(const LayerStats &s) {
+  return s.is_custom ? s.type + "*" : s.type;
+}
+
+static void PrintReport(const std::string &network, const LayerProfiler &p,
+                        int32_t num_runs, double seconds, int32_t top) {
+  const std::vector<LayerStats> &stats = p.GetStats();
+
+  double layer_seconds = 0;
+  double custom_seconds = 0;
+  int64_t custom_packed_inputs = 0;
+  int64_t custom_16bit_inputs = 0;
+  for (const auto &s : stats) {
+    layer_seconds += s.seconds;
+    if (s.is_custom) {
+      custom_seconds += s.seconds;
+      custom_packed_inputs += s.num_packed_inputs;
+      custom_16bit_inputs += s.num_16bit_inputs;
+    }
+  }
+
+  double ms_per_run = seconds * 1000 / num_runs;
+  auto percent = [seconds](double t) { return t / seconds * 100; };
+
+  fprintf(stderr, "\n%s: %d runs, %.3f ms per run\n", network.c_str(),
+          num_runs, ms_per_run);
+  fprintf(stderr, "  in layers: %.3f ms per run (%.1f%%)\n",
+          layer_seconds * 1000 / num_runs, percent(layer_seconds));
+  fprintf(stderr, "  in custom layers: %.3f ms per run (%.1f%%)\n",
+          custom_seconds * 1000 / num_runs, percent(custom_seconds));
+  fprintf(stderr,
+          "  packed inputs of custom layers: %.1f per run, 16-bit: %.1f "
+          "per run\n",
+          static_cast<double>(custom_packed_inputs) / num_runs,
+          static_cast<double>(custom_16bit_inputs) / num_runs);
+
+  std::vector<int32_t> order(stats.size());
+  for (int32_t i = 0; i != order.size(); ++i) order[i] = i;
+
+  std::stable_sort(order.begin(), order.end(), [&stats](int32_t a, int32_t b) {
+    return stats[a].seconds > stats[b].seconds;
+  });
+
+  fprintf(stderr, "\n  Top %d layers\n", top);
+  fprintf(stderr, "  %4s %5s %-24s %-32s %6s %10s %6s %6s\n", "rank", "index",
+          "type", "name", "calls", "ms/run", "%", "cum %");
+
+  double cumulative = 0;
+  for (int32_t k = 0; k != std::min<int32_t>(top, order.size()); ++k) {
+    const LayerStats &s = stats[order[k]];
+    if (s.num_calls == 0) break;
+
+    cumulative += s.seconds;
+    fprintf(stderr, "  %4d %5d %-24s %-32s %6.1f %10.4f %6.1f %6.1f\n", k + 1,
+            order[k], TypeName(s).c_str(), s.name.c_str(),
+            static_cast<double>(s.num_calls) / num_runs,
+            s.seconds * 1000 / num_runs, percent(s.seconds),
+            percent(cumulative));
+  }
+
+  struct TypeStats {
+    int32_t num_layers = 0;
+    int64_t num_calls = 0;
+    double seconds = 0;
+  };
+
+  std::map<std::string, TypeStats> by_type;
+  for (const auto &s : stats) {
+    if (s.num_calls == 0) continue;
+
+    TypeStats &t = by_type[TypeName(s)];
+    t.num_layers += 1;
+    t.num_calls += s.num_calls;
+    t.seconds += s.seconds;
+  }
+
+  std::vector<std::pair<std::string, TypeStats>> types(by_type.begin(),
+                                                       by_type.end());
+  std::stable_sort(types.begin(), types.end(),
+                   [](const std::pair<std::string, TypeStats> &a,
+                      const std::pair<std::string, TypeStats> &b) {
+                     return a.second.seconds > b.second.seconds;
+                   });
+
+  fprintf(stderr, "\n  By layer type\n");
+  fprintf(stderr, "  %-24s %6s %6s %10s %6s\n", "type", "layers", "calls",
+          "ms/run", "%");
+  for (const auto &t : types) {
+    fprintf(stderr, "  %-24s %6d %6.1f %10.4f %6.1f\n", t.first.c_str(),
+            t.second.num_layers,
+            static_cast<double>(t.second.num_calls) / num_runs,
+            t.second.seconds * 1000 / num_runs, percent(t.second.seconds));
+  }
+}
+
+// Run run() num_runs times with the layers of net wrapped
+static void Profile(const std::string &network, ncnn::Net *net,
+                    const std::function<void()> &run, int32_t num_runs,
+                    int32_t top) {
+  // Warm up before the layers are wrapped
+  run();
+
+  LayerProfiler profiler(net);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int32_t i = 0; i != num_runs; ++i) {
+    run();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  PrintReport(network, profiler, num_runs, seconds, top);
+}
+
+}  // namespace sherpa_ncnn
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *usage = R"usage(
+Usage:
+  ./bin/sherpa-ncnn-profile-model \
+    /path/to/encoder.ncnn.param \
+    /path/to/encoder.ncnn.bin \
+    /path/to/decoder.ncnn.param \
+    /path/to/decoder.ncnn.bin \
+    /path/to/joiner.ncnn.param \
+    /path/to/joiner.ncnn.bin \
+    [--num-runs=20] \
+    [--top=10] \
+    [--num-threads=1] \
+    [--network=all]
+
+--network is one of all, encoder, decoder and joiner.
+
+The time of a run includes the layout and type conversions between the
+layers, which are not attributed to any layer. Custom layers are marked
+with * in the tables.
+
+The packed and 16-bit inputs of the custom layers are the conversions
+they save because they support packing and fp16 storage.
+
+You can use sherpa-ncnn-generate-test-model to create a model with random
+weights.
+)usage";
+
+  if (argc < 7) {
+    fprintf(stderr, "%s\n", usage);
+    return 0;
+  }
+
+  sherpa_ncnn::ModelConfig model_config;
+  model_config.encoder_param = argv[1];
+  model_config.encoder_bin = argv[2];
+  model_config.decoder_param = argv[3];
+  model_config.decoder_bin = argv[4];
+  model_config.joiner_param = argv[5];
+  model_config.joiner_bin = argv[6];
+  model_config.use_buffer = false;
+  model_config.use_vulkan_compute = false;
+
+  int32_t num_runs = 20;
+  int32_t top = 10;
+  int32_t num_threads = 1;
+  std::string network = "all";
+
+  for (int32_t i = 7; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "num-runs", &value)) {
+      num_runs = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "top", &value)) {
+      top = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-threads", &value)) {
+      num_threads = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "network", &value)) {
+      network = value;
+    } else {
+      fprintf(stderr, "Unknown option: %s\n%s\n", arg.c_str(), usage);
+      return -1;
+    }
+  }
+
+  if (num_runs < 1 || top < 1 || num_threads < 1) {
+    fprintf(stderr, "--num-runs, --top and --num-threads should be positive\n");
+    return -1;
+  }
+
+  if (network != "all" && network != "encoder" && network != "decoder" &&
+      network != "joiner") {
+    fprintf(stderr, "Unknown network: %s\n", network.c_str());
+    return -1;
+  }
+
+  model_config.encoder_opt.num_threads = num_threads;
+  model_config.decoder_opt.num_threads = num_threads;
+  model_config.joiner_opt.num_threads = num_threads;
+
+  auto model = sherpa_ncnn::Model::Create(model_config);
+  if (!model) {
+    fprintf(stderr, "Failed to load the model\n");
+    return -1;
+  }
+
+  fprintf(stderr, "%s\n", model_config.ToString().c_str());
+
+  ncnn::Mat features(sherpa_ncnn::kFeatureDim, model->Segment());
+  sherpa_ncnn::FillRandom(&features);
+
+  std::vector<ncnn::Mat> states = model->GetEncoderInitStates();
+  ncnn::Mat encoder_out;
+
+  auto run_encoder = [&]() {
+    auto p = model->RunEncoder(features, states);
+    encoder_out = p.first;
+    states = std::move(p.second);
+  };
+
+  ncnn::Mat decoder_input(model->ContextSize());
+  for (int32_t i = 0; i != model->ContextSize(); ++i) {
+    static_cast<int32_t *>(decoder_input)[i] = model->BlankId();
+  }
+
+  ncnn::Mat decoder_out;
+  auto run_decoder = [&]() { decoder_out = model->RunDecoder(decoder_input); };
+
+  // The joiner needs the outputs of the encoder and the decoder
+  run_encoder();
+  run_decoder();
+
+  ncnn::Mat encoder_out_t =
+      ncnn::Mat(encoder_out.w, encoder_out.row(0)).clone();
+  auto run_joiner = [&]() { model->RunJoiner(encoder_out_t, decoder_out); };
+
+  if (network == "all" || network == "encoder") {
+    sherpa_ncnn::Profile("encoder", &model->GetEncoder(), run_encoder,
+                         num_runs, top);
+  }
+
+  if (network == "all" || network == "decoder") {
+    sherpa_ncnn::Profile("decoder", &model->GetDecoder(), run_decoder,
+                         num_runs, top);
+  }
+
+  if (network == "all" || network == "joiner") {
+    sherpa_ncnn::Profile("joiner", &model->GetJoiner(), run_joiner, num_runs,
+                         top);
+  }
+
+  return 0;
+}
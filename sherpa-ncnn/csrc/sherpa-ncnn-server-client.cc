@@ -0,0 +1,289 @@
+// sherpa-ncnn/csrc/sherpa-ncnn-server-client.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// A client for sherpa-ncnn-server. Each wave file is sent over its own
+// connection in chunks, optionally at real-time speed. All connections run
+// concurrently.
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <cstdint>
+#include <mutex>  // NOLINT
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/server-protocol.h"
+#include "sherpa-ncnn/csrc/wave-reader.h"
+
+struct ClientConfig {
+  std::string host = "127.0.0.1";
+  int32_t port = 6006;
+  std::string unix_socket;
+  int32_t chunk_ms = 100;
+  bool realtime = false;
+  bool print_partial = false;
+};
+
+static std::mutex print_mutex;
+
+static int32_t Connect(const ClientConfig &config) {
+  if (!config.unix_socket.empty()) {
+    int32_t fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, config.unix_socket.c_str(),
+            sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo *res = nullptr;
+  std::string port = std::to_string(config.port);
+  if (getaddrinfo(config.host.c_str(), port.c_str(), &hints, &res) != 0) {
+    return -1;
+  }
+
+  int32_t fd = -1;
+  for (addrinfo *p = res; p; p = p->ai_next) {
+    fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (fd < 0) continue;
+
+    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (fd >= 0) {
+    int32_t one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  return fd;
+}
+
+static bool SendAll(int32_t fd, const std::string &buf) {
+  size_t start = 0;
+  while (start < buf.size()) {
+    ssize_t n = send(fd, buf.data() + start, buf.size() - start, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    start += n;
+  }
+  return true;
+}
+
+static bool RecvAll(int32_t fd, char *p, size_t size) {
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static void SendSamples(int32_t fd, const ClientConfig &config,
+                        const std::vector<float> &samples) {
+  int32_t sampling_rate = 16000;
+  int32_t chunk = sampling_rate * config.chunk_ms / 1000;
+
+  auto start = std::chrono::steady_clock::now();
+  std::string frame;
+  for (size_t i = 0; i < samples.size(); i += chunk) {
+    int32_t n = std::min<size_t>(chunk, samples.size() - i);
+
+    std::string payload(4 + n * 4, '\0');
+    memcpy(&payload[0], &sampling_rate, 4);
+    memcpy(&payload[4], samples.data() + i, n * 4);
+
+    frame.clear();
+    sherpa_ncnn::AppendFrame(sherpa_ncnn::kAudio, payload.data(),
+                             payload.size(), &frame);
+    if (!SendAll(fd, frame)) return;
+
+    if (config.realtime) {
+      std::this_thread::sleep_until(
+          start + std::chrono::milliseconds((i + n) * 1000 / sampling_rate));
+    }
+  }
+
+  frame.clear();
+  sherpa_ncnn::AppendFrame(sherpa_ncnn::kEndOfStream, nullptr, 0, &frame);
+  SendAll(fd, frame);
+}
+
+// Return the elapsed seconds or -1 on error
+static float Decode(const ClientConfig &config, const std::string &filename,
+                    std::string *text) {
+  bool is_ok = false;
+  std::vector<float> samples = sherpa_ncnn::ReadWave(filename, 16000, &is_ok);
+  if (!is_ok) {
+    fprintf(stderr, "Failed to read %s\n", filename.c_str());
+    return -1;
+  }
+
+  int32_t fd = Connect(config);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to connect to the server: %s\n", strerror(errno));
+    return -1;
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  std::thread sender([&]() { SendSamples(fd, config, samples); });
+
+  bool ok = false;
+  char header[sherpa_ncnn::kFrameHeaderSize];
+  while (RecvAll(fd, header, sizeof(header))) {
+    uint8_t type;
+    uint32_t n;
+    sherpa_ncnn::ParseFrameHeader(header, sizeof(header), &type, &n);
+    if (n > sherpa_ncnn::kMaxFramePayloadSize) break;
+
+    std::string payload(n, '\0');
+    if (!RecvAll(fd, &payload[0], n)) break;
+
+    std::lock_guard<std::mutex> lock(print_mutex);
+    if (type == sherpa_ncnn::kPartial) {
+      if (config.print_partial) {
+        fprintf(stderr, "%s partial: %s\n", filename.c_str(), payload.c_str());
+      }
+    } else if (type == sherpa_ncnn::kFinal) {
+      fprintf(stderr, "%s final: %s\n", filename.c_str(), payload.c_str());
+      if (!text->empty() && !payload.empty()) *text += " ";
+      *text += payload;
+      ok = true;
+    } else if (type == sherpa_ncnn::kError) {
+      fprintf(stderr, "%s error: %s\n", filename.c_str(), payload.c_str());
+      ok = false;
+      break;
+    }
+  }
+
+  // Unblock the sender if the server has closed the connection early
+  shutdown(fd, SHUT_RDWR);
+  sender.join();
+  close(fd);
+
+  auto end = std::chrono::steady_clock::now();
+  if (!ok) return -1;
+
+  return std::chrono::duration<float>(end - begin).count();
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *usage = R"usage(
+Usage:
+  ./bin/sherpa-ncnn-server-client \
+    [--host=127.0.0.1] \
+    [--port=6006] \
+    [--unix-socket=/path/to/socket] \
+    [--chunk-ms=100] \
+    [--realtime=0] \
+    [--print-partial=0] \
+    [--num-repeats=1] \
+    foo.wav [bar.wav ...]
+
+Each wave file is sent over its own connection. All connections run
+concurrently. The wave files must be 16 kHz.
+
+With --realtime=1, audio is sent at real-time speed.
+
+--num-repeats=N sends the list of wave files N times, which is useful
+for testing many concurrent streams.
+)usage";
+
+  ClientConfig config;
+  int32_t num_repeats = 1;
+  std::vector<std::string> filenames;
+
+  for (int32_t i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "host", &value)) {
+      config.host = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "port", &value)) {
+      config.port = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "unix-socket", &value)) {
+      config.unix_socket = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "chunk-ms", &value)) {
+      config.chunk_ms = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "realtime", &value)) {
+      config.realtime = atoi(value.c_str()) != 0;
+    } else if (sherpa_ncnn::ParseFlag(arg, "print-partial", &value)) {
+      config.print_partial = atoi(value.c_str()) != 0;
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-repeats", &value)) {
+      num_repeats = atoi(value.c_str());
+    } else if (arg.compare(0, 2, "--") == 0) {
+      fprintf(stderr, "Unknown option: %s\n%s\n", arg.c_str(), usage);
+      return -1;
+    } else {
+      filenames.push_back(arg);
+    }
+  }
+
+  if (filenames.empty() || config.chunk_ms <= 0 || num_repeats < 1) {
+    fprintf(stderr, "%s\n", usage);
+    return 0;
+  }
+
+  std::vector<std::string> all;
+  for (int32_t r = 0; r != num_repeats; ++r) {
+    all.insert(all.end(), filenames.begin(), filenames.end());
+  }
+
+  std::vector<std::string> texts(all.size());
+  std::vector<float> elapsed(all.size());
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i != all.size(); ++i) {
+    threads.emplace_back(
+        [&, i]() { elapsed[i] = Decode(config, all[i], &texts[i]); });
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  int32_t num_failed = 0;
+  float max_elapsed = 0;
+  for (size_t i = 0; i != all.size(); ++i) {
+    if (elapsed[i] < 0) {
+      ++num_failed;
+      continue;
+    }
+
+    max_elapsed = std::max(max_elapsed, elapsed[i]);
+    fprintf(stderr, "%s: %s\n", all[i].c_str(), texts[i].c_str());
+  }
+
+  fprintf(stderr, "Streams: %d, failed: %d, max elapsed seconds: %.3f\n",
+          static_cast<int32_t>(all.size()), num_failed, max_elapsed);
+
+  return num_failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,991 @@
+// sherpa-ncnn/csrc/sherpa-ncnn-server.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// A streaming speech recognition server for Linux.
+//
+// One thread runs an epoll event loop that owns all sockets. Audio is fed
+// into the streams from the event loop and streams with enough frames are
+// queued for a fixed pool of decoding workers. Workers take up to
+// max-batch-size streams at a time, decode them and hand the results back
+// to the event loop through an eventfd.
+//
+// A stream is owned either by the event loop or by exactly one worker.
+// Audio received while a worker owns a stream is buffered in the
+// connection and fed into the stream once the worker is done, so streams
+// are never accessed concurrently.
+//
+// See server-protocol.h for the wire format.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>              // NOLINT
+#include <condition_variable>  // NOLINT
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sherpa-ncnn/csrc/parse-options.h"
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/server-protocol.h"
+#include "sherpa-ncnn/csrc/thread-budget.h"
+#include "sherpa-ncnn/csrc/trace-recorder.h"
+
+namespace sherpa_ncnn {
+
+struct ServerConfig {
+  // Used if unix_socket is empty
+  int32_t port = 6006;
+
+  // If not empty, listen on this Unix domain socket instead of TCP
+  std::string unix_socket;
+
+  // Number of decoding threads
+  int32_t num_workers = 2;
+
+  // Maximum number of streams a worker takes from the queue at a time
+  int32_t max_batch_size = 8;
+
+  int32_t max_connections = 1024;
+
+  // Close a connection if the server waits for its audio but it sends
+  // nothing for this number of seconds. The time in which reading is
+  // paused, e.g., by max_pending_seconds or max_write_buffer, is not
+  // counted.
+  float idle_timeout = 30;
+
+  // Close a connection if it has results to receive but receives nothing
+  // for this number of seconds. Together with max_write_buffer, it caps
+  // the results kept for a client that has stopped reading.
+  float write_timeout = 30;
+
+  // Stop reading from a connection if it has more than this number of
+  // seconds of audio waiting for a busy worker
+  float max_pending_seconds = 10;
+
+  // Stop reading from a connection if it has more than this number of
+  // bytes of results that the client has not received yet
+  int32_t max_write_buffer = 1 << 20;
+
+  // If larger than 1, fork this number of processes that share the TCP
+  // port via SO_REUSEPORT. Each process loads its own model.
+  int32_t num_processes = 1;
+
+  // If true, share the CPUs of this process between the workers and the
+  // threads of each network by the number of busy workers. See
+  // thread-budget.h
+  bool thread_budget = false;
+
+  // Used only if thread_budget is true. Valid values: none, core, numa
+  std::string pin = "none";
+
+  std::string ToString() const {
+    std::ostringstream os;
+
+    os << "ServerConfig(";
+    os << "port=" << port << ", ";
+    os << "unix_socket=\"" << unix_socket << "\", ";
+    os << "num_workers=" << num_workers << ", ";
+    os << "max_batch_size=" << max_batch_size << ", ";
+    os << "max_connections=" << max_connections << ", ";
+    os << "idle_timeout=" << idle_timeout << ", ";
+    os << "write_timeout=" << write_timeout << ", ";
+    os << "max_pending_seconds=" << max_pending_seconds << ", ";
+    os << "max_write_buffer=" << max_write_buffer << ", ";
+    os << "num_processes=" << num_processes << ", ";
+    os << "thread_budget=" << (thread_budget ? "True" : "False") << ", ";
+    os << "pin=\"" << pin << "\")";
+
+    return os.str();
+  }
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Set by SIGINT and SIGTERM while tracing, so that Server::Run() returns
+// and the trace is written at exit
+static volatile sig_atomic_t g_stop = 0;
+
+static void OnStopSignal(int32_t /*sig*/) { g_stop = 1; }
+
+struct Connection {
+  int64_t id = 0;
+  int32_t fd = -1;
+  std::unique_ptr<Stream> stream;
+
+  // The fields below are accessed only by the event loop
+  std::string rbuf;
+  std::string wbuf;
+
+  // Audio received while a worker owns the stream
+  std::vector<float> pending;
+  int32_t sampling_rate = 0;
+
+  bool busy = false;         // true while a worker owns the stream
+  bool eos = false;          // kEndOfStream is received
+  bool peer_closed = false;  // the client shut down its sending side
+  bool done = false;         // the last kFinal is queued. Close after sending
+  uint32_t events = 0;       // events registered with epoll
+
+  // When the connection last received data or reading was resumed
+  Clock::time_point last_read;
+
+  // When the connection last sent results or got results to send after
+  // it had sent all of them
+  Clock::time_point last_write;
+
+  // Set by the event loop before handing the stream to a worker
+  bool input_finished = false;
+
+  // Accessed only by the worker that owns the stream
+  std::string last_text;
+};
+
+struct Completion {
+  std::shared_ptr<Connection> conn;
+
+  // Encoded frames to send to the client
+  std::string frames;
+
+  bool done = false;
+};
+
+// epoll data for the listening socket and the eventfd. Connection ids
+// start after them.
+static constexpr uint64_t kListenId = 0;
+static constexpr uint64_t kWakeupId = 1;
+
+class Server {
+ public:
+  Server(const RecognizerConfig &config, const ServerConfig &server_config)
+      : recognizer_(config), config_(server_config) {
+    if (config_.thread_budget) {
+      // Processes forked by --num-processes share the CPUs
+      int32_t num_cpus =
+          std::max(1, GetAvailableCpus() / config_.num_processes);
+
+      budget_ = std::make_unique<ThreadBudget>(
+          ThreadBudgetConfig(num_cpus, config_.num_workers, config_.pin));
+      fprintf(stderr, "%s\n", budget_->ToString().c_str());
+    }
+  }
+
+  ~Server() {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      stop_ = true;
+    }
+    queue_cv_.notify_all();
+
+    for (auto &t : workers_) {
+      t.join();
+    }
+
+    for (auto &p : conns_) {
+      close(p.second->fd);
+    }
+
+    if (listen_fd_ >= 0) close(listen_fd_);
+    if (wakeup_fd_ >= 0) close(wakeup_fd_);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+  }
+
+  // It runs until g_stop is set. Return false on setup errors.
+  bool Run() {
+    if (!Listen()) {
+      return false;
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wakeup_fd_ < 0) {
+      perror("Failed to create epoll or eventfd");
+      return false;
+    }
+
+    AddFd(listen_fd_, kListenId, EPOLLIN);
+    AddFd(wakeup_fd_, kWakeupId, EPOLLIN);
+
+    for (int32_t i = 0; i != config_.num_workers; ++i) {
+      workers_.emplace_back([this, i]() {
+        if (budget_) budget_->PinWorker(i);
+        WorkerLoop();
+      });
+    }
+
+    fprintf(stderr, "[%d] Started! Listening on %s\n",
+            static_cast<int32_t>(getpid()),
+            config_.unix_socket.empty()
+                ? ("port " + std::to_string(config_.port)).c_str()
+                : config_.unix_socket.c_str());
+
+    std::vector<epoll_event> events(256);
+    auto last_idle_check = Clock::now();
+    while (true) {
+      int32_t n = epoll_wait(epoll_fd_, events.data(),
+                             static_cast<int32_t>(events.size()), 1000);
+      if (n < 0 && errno != EINTR) {
+        perror("epoll_wait");
+        return false;
+      }
+
+      if (g_stop) {
+        return true;
+      }
+
+      for (int32_t i = 0; i < n; ++i) {
+        uint64_t id = events[i].data.u64;
+        if (id == kListenId) {
+          Accept();
+          continue;
+        }
+
+        if (id == kWakeupId) {
+          HandleCompletions();
+          continue;
+        }
+
+        auto it = conns_.find(id);
+        if (it == conns_.end()) {
+          // Closed while handling an earlier event of this round
+          continue;
+        }
+
+        // Keep it alive in case it is closed in one of the handlers
+        std::shared_ptr<Connection> c = it->second;
+        uint32_t e = events[i].events;
+        if (e & (EPOLLERR | EPOLLHUP)) {
+          Close(c.get());
+          continue;
+        }
+
+        if (e & EPOLLIN) {
+          OnReadable(c.get());
+        }
+
+        if ((e & EPOLLOUT) && c->fd >= 0) {
+          Flush(c.get());
+        }
+      }
+
+      auto now = Clock::now();
+      if (now - last_idle_check > std::chrono::seconds(1)) {
+        CloseIdle(now);
+        last_idle_check = now;
+      }
+    }
+  }
+
+ private:
+  bool Listen() {
+    if (!config_.unix_socket.empty()) {
+      listen_fd_ =
+          socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listen_fd_ < 0) {
+        perror("socket");
+        return false;
+      }
+
+      sockaddr_un addr = {};
+      addr.sun_family = AF_UNIX;
+      if (config_.unix_socket.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Unix socket path is too long: %s\n",
+                config_.unix_socket.c_str());
+        return false;
+      }
+      strncpy(addr.sun_path, config_.unix_socket.c_str(),
+              sizeof(addr.sun_path) - 1);
+
+      unlink(config_.unix_socket.c_str());
+      if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr),
+               sizeof(addr)) < 0) {
+        perror("bind");
+        return false;
+      }
+    } else {
+      listen_fd_ =
+          socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listen_fd_ < 0) {
+        perror("socket");
+        return false;
+      }
+
+      int32_t one = 1;
+      setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+      // So that several processes can listen on the same port. The kernel
+      // distributes new connections among them.
+      if (setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEPORT, &one,
+                     sizeof(one)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        return false;
+      }
+
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      addr.sin_port = htons(config_.port);
+      if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr),
+               sizeof(addr)) < 0) {
+        perror("bind");
+        return false;
+      }
+    }
+
+    if (listen(listen_fd_, SOMAXCONN) < 0) {
+      perror("listen");
+      return false;
+    }
+
+    return true;
+  }
+
+  void AddFd(int32_t fd, uint64_t id, uint32_t events) {
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      perror("epoll_ctl");
+      exit(-1);
+    }
+  }
+
+  void Accept() {
+    while (true) {
+      int32_t fd = accept4(listen_fd_, nullptr, nullptr,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          perror("accept4");
+        }
+        return;
+      }
+
+      if (static_cast<int32_t>(conns_.size()) >= config_.max_connections) {
+        std::string msg = "Too many connections";
+        std::string frame;
+        AppendFrame(kError, msg.data(), msg.size(), &frame);
+        // Best effort. The socket buffer of a new connection is empty
+        send(fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+        close(fd);
+        continue;
+      }
+
+      if (config_.unix_socket.empty()) {
+        int32_t one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      }
+
+      auto c = std::make_shared<Connection>();
+      c->id = next_id_++;
+      c->fd = fd;
+      c->stream = recognizer_.CreateStream();
+      c->events = EPOLLIN;
+      c->last_read = Clock::now();
+
+      AddFd(fd, c->id, c->events);
+      conns_[c->id] = std::move(c);
+    }
+  }
+
+  void OnReadable(Connection *c) {
+    char buf[64 * 1024];
+    while (WantRead(*c)) {
+      ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+      if (n > 0) {
+        c->rbuf.append(buf, n);
+        c->last_read = Clock::now();
+        if (!ParseFrames(c)) {
+          return;
+        }
+        continue;
+      }
+
+      if (n == 0) {
+        c->peer_closed = true;
+        if (!c->eos) {
+          // The client is gone without finishing the stream
+          Close(c);
+          return;
+        }
+        break;
+      }
+
+      if (errno == EINTR) continue;
+
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        Close(c);
+        return;
+      }
+      break;
+    }
+
+    FeedStream(c);
+    UpdateEvents(c);
+  }
+
+  // Return false if the connection is closed
+  bool ParseFrames(Connection *c) {
+    size_t start = 0;
+    uint8_t type;
+    uint32_t n;
+    while (ParseFrameHeader(c->rbuf.data() + start, c->rbuf.size() - start,
+                            &type, &n)) {
+      if (n > kMaxFramePayloadSize) {
+        return Fail(c, "Frame is too large");
+      }
+
+      if (c->rbuf.size() - start < kFrameHeaderSize + n) break;
+
+      const char *p = c->rbuf.data() + start + kFrameHeaderSize;
+      if (!HandleFrame(c, type, p, n)) {
+        return false;
+      }
+
+      start += kFrameHeaderSize + n;
+    }
+
+    c->rbuf.erase(0, start);
+    return true;
+  }
+
+  // Return false if the connection is closed
+  bool HandleFrame(Connection *c, uint8_t type, const char *p, uint32_t n) {
+    if (c->eos) {
+      return Fail(c, "Received data after end of stream");
+    }
+
+    switch (type) {
+      case kAudio: {
+        if (n < 4 || n % 4 != 0) {
+          return Fail(c, "Invalid audio frame");
+        }
+
+        int32_t sampling_rate;
+        memcpy(&sampling_rate, p, 4);
+        if (sampling_rate <= 0 ||
+            (c->sampling_rate != 0 && sampling_rate != c->sampling_rate)) {
+          return Fail(c, "Invalid or changed sampling rate");
+        }
+        c->sampling_rate = sampling_rate;
+
+        size_t num_samples = (n - 4) / 4;
+        size_t size = c->pending.size();
+        c->pending.resize(size + num_samples);
+        memcpy(c->pending.data() + size, p + 4, num_samples * 4);
+        return true;
+      }
+      case kEndOfStream:
+        c->eos = true;
+        return true;
+      default:
+        return Fail(c, "Unknown message type");
+    }
+  }
+
+  // Send an error to the client and close the connection. It always
+  // returns false.
+  bool Fail(Connection *c, const std::string &msg) {
+    std::string frame;
+    AppendFrame(kError, msg.data(), msg.size(), &frame);
+    send(c->fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+    Close(c);
+    return false;
+  }
+
+  // Move buffered audio into the stream and queue it for decoding if
+  // needed. No-op if a worker owns the stream.
+  void FeedStream(Connection *c) {
+    if (c->busy || c->done) return;
+
+    Stream *s = c->stream.get();
+    if (!c->pending.empty()) {
+      s->AcceptWaveform(c->sampling_rate, c->pending.data(),
+                        c->pending.size());
+      c->pending.clear();
+    }
+
+    if (c->eos && !c->input_finished) {
+      int32_t sampling_rate = c->sampling_rate;
+      if (sampling_rate == 0) {
+        sampling_rate = 16000;
+      }
+
+      std::vector<float> tail_paddings(static_cast<int>(0.3 * sampling_rate));
+      s->AcceptWaveform(sampling_rate, tail_paddings.data(),
+                        tail_paddings.size());
+      s->InputFinished();
+      c->input_finished = true;
+    }
+
+    if (c->input_finished || recognizer_.IsReady(s)) {
+      c->busy = true;
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queue_.push_back(conns_.at(c->id));
+      }
+      queue_cv_.notify_one();
+    }
+  }
+
+  bool WantRead(const Connection &c) const {
+    if (c.peer_closed || c.eos || c.done) return false;
+
+    int32_t sampling_rate = c.sampling_rate ? c.sampling_rate : 16000;
+    if (c.pending.size() > config_.max_pending_seconds * sampling_rate) {
+      return false;
+    }
+
+    return static_cast<int32_t>(c.wbuf.size()) < config_.max_write_buffer;
+  }
+
+  void UpdateEvents(Connection *c) {
+    if (c->fd < 0) return;
+
+    uint32_t events = 0;
+    if (WantRead(*c)) events |= EPOLLIN;
+    if (!c->wbuf.empty()) events |= EPOLLOUT;
+
+    if (events == c->events) return;
+
+    // The idle timeout counts only the time in which it is read from
+    if ((events & EPOLLIN) && !(c->events & EPOLLIN)) {
+      c->last_read = Clock::now();
+    }
+
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = c->id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+  }
+
+  void Flush(Connection *c) {
+    size_t start = 0;
+    while (start < c->wbuf.size()) {
+      ssize_t n = send(c->fd, c->wbuf.data() + start, c->wbuf.size() - start,
+                       MSG_NOSIGNAL);
+      if (n > 0) {
+        start += n;
+        continue;
+      }
+
+      if (n < 0 && errno == EINTR) continue;
+
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+      Close(c);
+      return;
+    }
+    c->wbuf.erase(0, start);
+
+    if (start > 0) {
+      c->last_write = Clock::now();
+    }
+
+    if (c->done && c->wbuf.empty()) {
+      Close(c);
+      return;
+    }
+
+    // Reading may be resumed now that the write buffer is drained
+    if (WantRead(*c) && !(c->events & EPOLLIN)) {
+      UpdateEvents(c);
+      OnReadable(c);
+      return;
+    }
+
+    UpdateEvents(c);
+  }
+
+  void Close(Connection *c) {
+    if (c->fd < 0) return;
+
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c->fd, nullptr);
+    close(c->fd);
+    c->fd = -1;
+
+    // If a worker owns the stream, its completion is discarded
+    conns_.erase(c->id);
+  }
+
+  void CloseIdle(Clock::time_point now) {
+    auto idle_timeout = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(config_.idle_timeout));
+
+    auto write_timeout = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(config_.write_timeout));
+
+    std::vector<Connection *> idle;
+    std::vector<Connection *> stalled;
+    for (auto &p : conns_) {
+      Connection *c = p.second.get();
+      if (!c->wbuf.empty() && now - c->last_write > write_timeout) {
+        stalled.push_back(c);
+        continue;
+      }
+
+      // Only while the server waits for audio from the client. A worker
+      // may still send results to it.
+      if (!c->busy && (c->events & EPOLLIN) &&
+          now - c->last_read > idle_timeout) {
+        idle.push_back(c);
+      }
+    }
+
+    for (auto c : idle) {
+      Fail(c, "Idle timeout");
+    }
+
+    // The client would not receive an error either
+    for (auto c : stalled) {
+      Close(c);
+    }
+  }
+
+  void HandleCompletions() {
+    uint64_t v;
+    while (read(wakeup_fd_, &v, sizeof(v)) > 0) {
+    }
+
+    std::vector<Completion> completions;
+    {
+      std::lock_guard<std::mutex> lock(completion_mutex_);
+      completions.swap(completions_);
+    }
+
+    for (auto &comp : completions) {
+      Connection *c = comp.conn.get();
+      c->busy = false;
+      if (c->fd < 0) continue;
+
+      if (c->wbuf.empty() && !comp.frames.empty()) {
+        c->last_write = Clock::now();
+      }
+
+      c->wbuf += comp.frames;
+      c->done = comp.done;
+
+      if (!c->done) {
+        FeedStream(c);
+      }
+
+      if (!c->wbuf.empty()) {
+        Flush(c);
+      } else {
+        UpdateEvents(c);
+
+        // It may have been paused by the pending audio limit
+        if (WantRead(*c)) OnReadable(c);
+      }
+    }
+  }
+
+  void WorkerLoop() {
+    while (true) {
+      std::vector<std::shared_ptr<Connection>> batch;
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+        if (stop_) return;
+
+        while (!queue_.empty() &&
+               static_cast<int32_t>(batch.size()) < config_.max_batch_size) {
+          batch.push_back(std::move(queue_.front()));
+          queue_.pop_front();
+        }
+      }
+
+      int32_t num_busy = ++num_busy_workers_;
+      if (budget_) {
+        ThreadPlan plan = budget_->Plan(num_busy);
+        SetThreadLocalPlan(&plan);
+      }
+
+      std::vector<Completion> completions(batch.size());
+      for (size_t i = 0; i != batch.size(); ++i) {
+        completions[i].conn = std::move(batch[i]);
+      }
+
+      // Decode one chunk of each stream in turn so that all streams of
+      // the batch make progress
+      bool decoded = true;
+      while (decoded) {
+        decoded = false;
+        for (auto &comp : completions) {
+          Stream *s = comp.conn->stream.get();
+          if (!recognizer_.IsReady(s)) continue;
+
+          recognizer_.DecodeStream(s);
+          decoded = true;
+
+          if (recognizer_.IsEndpoint(s)) {
+            std::string text = recognizer_.GetResult(s).text;
+            if (!text.empty()) {
+              AppendFrame(kFinal, text.data(), text.size(), &comp.frames);
+            }
+            recognizer_.Reset(s);
+            comp.conn->last_text.clear();
+          }
+        }
+      }
+
+      --num_busy_workers_;
+
+      for (auto &comp : completions) {
+        MakeResult(&comp);
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(completion_mutex_);
+        for (auto &comp : completions) {
+          completions_.push_back(std::move(comp));
+        }
+      }
+
+      uint64_t one = 1;
+      if (write(wakeup_fd_, &one, sizeof(one)) < 0) {
+        perror("write(eventfd)");
+      }
+    }
+  }
+
+  // Append the result of the current segment after decoding
+  void MakeResult(Completion *comp) const {
+    Connection *c = comp->conn.get();
+    Stream *s = c->stream.get();
+
+    std::string text = recognizer_.GetResult(s).text;
+
+    if (c->input_finished) {
+      AppendFrame(kFinal, text.data(), text.size(), &comp->frames);
+      comp->done = true;
+      return;
+    }
+
+    if (text != c->last_text) {
+      AppendFrame(kPartial, text.data(), text.size(), &comp->frames);
+      c->last_text = std::move(text);
+    }
+  }
+
+ private:
+  Recognizer recognizer_;
+  ServerConfig config_;
+
+  int32_t listen_fd_ = -1;
+  int32_t epoll_fd_ = -1;
+  int32_t wakeup_fd_ = -1;
+
+  // Owned by the event loop
+  std::unordered_map<uint64_t, std::shared_ptr<Connection>> conns_;
+  uint64_t next_id_ = kWakeupId + 1;
+
+  std::vector<std::thread> workers_;
+  std::unique_ptr<ThreadBudget> budget_;
+
+  // Number of workers decoding a batch
+  std::atomic<int32_t> num_busy_workers_{0};
+
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cv_;
+  std::deque<std::shared_ptr<Connection>> queue_;
+  bool stop_ = false;
+
+  std::mutex completion_mutex_;
+  std::vector<Completion> completions_;
+};
+
+}  // namespace sherpa_ncnn
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *usage = R"usage(
+Usage:
+  ./bin/sherpa-ncnn-server \
+    /path/to/tokens.txt \
+    /path/to/encoder.ncnn.param \
+    /path/to/encoder.ncnn.bin \
+    /path/to/decoder.ncnn.param \
+    /path/to/decoder.ncnn.bin \
+    /path/to/joiner.ncnn.param \
+    /path/to/joiner.ncnn.bin \
+    [--port=6006] \
+    [--unix-socket=/path/to/socket] \
+    [--num-workers=2] \
+    [--num-threads=1] \
+    [--pin=none] \
+    [--max-batch-size=8] \
+    [--max-connections=1024] \
+    [--idle-timeout=30] \
+    [--write-timeout=30] \
+    [--max-pending-seconds=10] \
+    [--num-processes=1] \
+    [--decoding-method=greedy_search] \
+    [--state-storage=fp32]
+
+--num-threads is the number of threads of each neural network
+computation. The server runs --num-workers of them in parallel.
+If it is 0, the threads of each network are chosen by the number of busy
+workers so that the workers together use the CPUs available to the
+process (CPU affinity and cgroup quota).
+
+--pin is used only with --num-threads=0. Valid values: none, core, numa.
+It pins each worker to its own CPUs or to a NUMA node.
+
+--idle-timeout closes a connection whose client sends no audio while the
+server waits for it. --write-timeout closes a connection whose client
+receives no results while the server has some to send.
+
+--num-processes forks processes that share the TCP port with SO_REUSEPORT.
+Each process loads its own copy of the model.
+
+With --num-processes=1, set the environment variable
+SHERPA_NCNN_TRACE=/path/to/trace.json to save the spans of each stage,
+stream and thread in the Chrome trace event format. The trace is written
+when the server is stopped by SIGINT or SIGTERM. See trace-recorder.h
+
+Use ./bin/sherpa-ncnn-server-client to send wave files to the server.
+
+Please refer to
+https://k2-fsa.github.io/sherpa/ncnn/pretrained_models/index.html
+for a list of pre-trained models to download.
+)usage";
+
+  if (argc < 8) {
+    fprintf(stderr, "%s\n", usage);
+    return 0;
+  }
+
+  sherpa_ncnn::RecognizerConfig config;
+  config.model_config.tokens = argv[1];
+  config.model_config.encoder_param = argv[2];
+  config.model_config.encoder_bin = argv[3];
+  config.model_config.decoder_param = argv[4];
+  config.model_config.decoder_bin = argv[5];
+  config.model_config.joiner_param = argv[6];
+  config.model_config.joiner_bin = argv[7];
+  config.model_config.use_buffer = false;
+
+  int32_t num_threads = 1;
+  sherpa_ncnn::ServerConfig server_config;
+
+  for (int32_t i = 8; i < argc; ++i) {
+    std::string arg = argv[i];
+    std::string value;
+    if (sherpa_ncnn::ParseFlag(arg, "port", &value)) {
+      server_config.port = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "unix-socket", &value)) {
+      server_config.unix_socket = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-workers", &value)) {
+      server_config.num_workers = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-threads", &value)) {
+      num_threads = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "pin", &value)) {
+      server_config.pin = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "max-batch-size", &value)) {
+      server_config.max_batch_size = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "max-connections", &value)) {
+      server_config.max_connections = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "idle-timeout", &value)) {
+      server_config.idle_timeout = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "write-timeout", &value)) {
+      server_config.write_timeout = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "max-pending-seconds", &value)) {
+      server_config.max_pending_seconds = atof(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "num-processes", &value)) {
+      server_config.num_processes = atoi(value.c_str());
+    } else if (sherpa_ncnn::ParseFlag(arg, "decoding-method", &value)) {
+      config.decoder_config.method = value;
+    } else if (sherpa_ncnn::ParseFlag(arg, "state-storage", &value)) {
+      config.state_storage = value;
+    } else {
+      fprintf(stderr, "Unknown option: %s\n%s\n", arg.c_str(), usage);
+      return -1;
+    }
+  }
+
+  if (server_config.num_workers < 1 || server_config.max_batch_size < 1 ||
+      num_threads < 0) {
+    fprintf(stderr, "--num-workers and --max-batch-size must be positive. "
+                    "--num-threads must not be negative\n");
+    return -1;
+  }
+
+  if (server_config.num_processes > 1 && !server_config.unix_socket.empty()) {
+    fprintf(stderr, "--num-processes > 1 works only with TCP\n");
+    return -1;
+  }
+
+  if (num_threads == 0) {
+    // Workers set the threads of each extractor. Keep the networks
+    // single-threaded for the other threads.
+    server_config.thread_budget = true;
+    num_threads = 1;
+  }
+
+  config.model_config.encoder_opt.num_threads = num_threads;
+  config.model_config.decoder_opt.num_threads = num_threads;
+  config.model_config.joiner_opt.num_threads = num_threads;
+
+  config.feat_config.sampling_rate = 16000;
+  config.feat_config.feature_dim = 80;
+  config.enable_endpoint = true;
+
+  fprintf(stderr, "%s\n%s\n", config.ToString().c_str(),
+          server_config.ToString().c_str());
+
+  // Results are sent with MSG_NOSIGNAL, but be safe
+  signal(SIGPIPE, SIG_IGN);
+
+  if (server_config.num_processes > 1) {
+    for (int32_t i = 0; i != server_config.num_processes; ++i) {
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        return -1;
+      }
+
+      if (pid == 0) {
+        sherpa_ncnn::Server server(config, server_config);
+        return server.Run() ? 0 : -1;
+      }
+    }
+
+    int32_t status = 0;
+    while (wait(&status) > 0) {
+    }
+
+    return 0;
+  }
+
+  if (sherpa_ncnn::StartTracingFromEnv()) {
+    // Return from main() so that the trace is written
+    signal(SIGINT, sherpa_ncnn::OnStopSignal);
+    signal(SIGTERM, sherpa_ncnn::OnStopSignal);
+  }
+
+  sherpa_ncnn::Server server(config, server_config);
+  return server.Run() ? 0 : -1;
+}
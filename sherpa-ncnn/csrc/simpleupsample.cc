@@ -18,11 +18,58 @@
 
 #include "sherpa-ncnn/csrc/simpleupsample.h"
 
+#include "sherpa-ncnn/csrc/custom-layer-kernels.h"
+
 namespace sherpa_ncnn {
 
 SimpleUpsample::SimpleUpsample() {
   one_blob_only = true;
   support_inplace = false;
+  support_packing = true;
+  support_fp16_storage = true;
+}
+
+static inline float Load(float v) { return v; }
+
+static inline float Load(unsigned short v) {
+  return ncnn::float16_to_float32(v);
+}
+
+static inline void Store(float v, float *p) { *p = v; }
+
+static inline void Store(float v, unsigned short *p) {
+  *p = ncnn::float32_to_float16(v);
+}
+
+// T is float for fp32 blobs and unsigned short for fp16 blobs.
+//
+// Both the input and the output are packed along frames. Output frame j
+// is input frame j / upsample plus row j % upsample of the bias.
+template <typename T>
+static void ForwardPacked(const ncnn::Mat &bottom_blob, const ncnn::Mat &bias,
+                          int32_t upsample, ncnn::Mat *top_blob,
+                          const ncnn::Option &opt) {
+  int32_t w = bottom_blob.w;
+  int32_t elempack = bottom_blob.elempack;
+  int32_t outh = top_blob->h;
+
+#pragma omp parallel for num_threads(opt.num_threads)
+  for (int32_t r = 0; r < outh; ++r) {
+    T *out_ptr = top_blob->row<T>(r);
+
+    for (int32_t i = 0; i != elempack; ++i) {
+      int32_t j = r * elempack + i;
+      int32_t q = j / upsample;
+
+      const T *a_ptr = bottom_blob.row<T>(q / elempack) + q % elempack;
+      const float *b_ptr = bias.row(j % upsample);
+
+      for (int32_t x = 0; x != w; ++x) {
+        Store(Load(a_ptr[x * elempack]) + b_ptr[x],
+              out_ptr + x * elempack + i);
+      }
+    }
+  }
 }
 
 int32_t SimpleUpsample::load_param(const ncnn::ParamDict &pd) {
@@ -50,17 +97,37 @@ int32_t SimpleUpsample::forward(const ncnn::Mat &bottom_blob,
                                 ncnn::Mat &top_blob,
                                 const ncnn::Option &opt) const {
   // bottom_blob.dims == 2
-  // bottom_blob.w == seq_len
-  // bottom_blob.h == num_channels
+  // bottom_blob.w == num_channels
+  // bottom_blob.h * bottom_blob.elempack == seq_len
+
+  size_t elemsize = bottom_blob.elemsize;
+  int32_t elempack = bottom_blob.elempack;
+  bool fp16 = elemsize / elempack == 2;
+
+  if (elempack > 1 || fp16) {
+    top_blob.create(bottom_blob.w, bottom_blob.h * upsample, elemsize,
+                    elempack, opt.blob_allocator);
+    if (top_blob.empty()) return -100;
+
+    if (fp16) {
+      ForwardPacked<unsigned short>(bottom_blob, bias, upsample, &top_blob,
+                                    opt);
+    } else {
+      ForwardPacked<float>(bottom_blob, bias, upsample, &top_blob, opt);
+    }
+
+    return 0;
+  }
 
   int32_t outw = bottom_blob.w;
   int32_t outh = upsample;
   int32_t outc = bottom_blob.h;
-  size_t elemsize = bottom_blob.elemsize;
 
   top_blob.create(outw, outh, outc, elemsize, opt.blob_allocator);
   if (top_blob.empty()) return -100;
 
+  const CustomLayerKernels &k = GetCustomLayerKernels();
+
 #pragma omp parallel for num_threads(opt.num_threads)
   for (int32_t q = 0; q < outc; ++q) {
     ncnn::Mat out_m = top_blob.channel(q);
@@ -69,9 +136,7 @@ int32_t SimpleUpsample::forward(const ncnn::Mat &bottom_blob,
     for (int32_t y = 0; y < outh; ++y) {
       float *out_ptr = out_m.row(y);
       const float *b_ptr = bias.row(y);
-      for (int32_t x = 0; x < outw; ++x) {
-        out_ptr[x] = a_ptr[x] + b_ptr[x];
-      }
+      k.add(a_ptr, b_ptr, out_ptr, outw);
     }
   }
 
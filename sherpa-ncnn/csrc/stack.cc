@@ -23,6 +23,10 @@ namespace sherpa_ncnn {
 Stack::Stack() {
   one_blob_only = false;
   support_inplace = false;
+
+  // fp16 storage is not enabled since it also stacks cached_len of the
+  // Zipformer, which is exact in fp16 only up to 2048 frames
+  support_packing = true;
 }
 
 int32_t Stack::load_param(const ncnn::ParamDict &pd) {
@@ -40,10 +44,14 @@ int32_t Stack::forward(const std::vector<ncnn::Mat> &bottom_blobs,
                        const ncnn::Option &opt) const {
   int32_t dims = bottom_blobs[0].dims;
   size_t elemsize = bottom_blobs[0].elemsize;
+  int32_t elempack = bottom_blobs[0].elempack;
 
   if (dims == 1) {
-    int32_t out_w = bottom_blobs[0].w;
+    // A 1-D blob packed along w has the same memory layout as an
+    // unpacked one, so the output is not packed
+    int32_t out_w = bottom_blobs[0].w * elempack;
     int32_t out_h = bottom_blobs.size();
+    elemsize /= elempack;
 
     ncnn::Mat &top_blob = top_blobs[0];
     top_blob.create(out_w, out_h, elemsize, opt.blob_allocator);
@@ -65,13 +73,35 @@ int32_t Stack::forward(const std::vector<ncnn::Mat> &bottom_blobs,
 
   if (dims == 2) {
     int32_t out_w = bottom_blobs[0].w;
-    int32_t out_h = bottom_blobs[0].h;
+    int32_t out_h = bottom_blobs[0].h * elempack;
     int32_t out_c = bottom_blobs.size();
 
     ncnn::Mat &top_blob = top_blobs[0];
-    top_blob.create(out_w, out_h, out_c, elemsize, opt.blob_allocator);
+    top_blob.create(out_w, out_h, out_c, elemsize / elempack,
+                    opt.blob_allocator);
     if (top_blob.empty()) return -100;
 
+    if (elempack > 1) {
+      // The inputs are packed along h, which cannot be kept when they
+      // become channels, so unpack them while copying
+      for (size_t b = 0; b < bottom_blobs.size(); ++b) {
+        ncnn::Mat out_m = top_blob.channel(b);
+        const ncnn::Mat &in_m = bottom_blobs[b];
+
+        for (int32_t r = 0; r < in_m.h; ++r) {
+          const float *in_ptr = in_m.row(r);
+          for (int32_t i = 0; i < elempack; ++i) {
+            float *out_ptr = out_m.row(r * elempack + i);
+            for (int32_t x = 0; x < out_w; ++x) {
+              out_ptr[x] = in_ptr[x * elempack + i];
+            }
+          }
+        }
+      }
+
+      return 0;
+    }
+
     size_t bytes_per_blob = out_w * out_h * elemsize;
 
     for (size_t b = 0; b < bottom_blobs.size(); ++b) {
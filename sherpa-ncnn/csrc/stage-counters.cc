@@ -0,0 +1,104 @@
+// sherpa-ncnn/csrc/stage-counters.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/stage-counters.h"
+
+#include <sstream>
+
+namespace sherpa_ncnn {
+
+static void AtomicMax(std::atomic<int64_t> *a, int64_t v) {
+  int64_t cur = a->load(std::memory_order_relaxed);
+  while (cur < v &&
+         !a->compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+  }
+}
+
+std::string DecodeCounters::ToString() const {
+  std::ostringstream os;
+
+  os << "DecodeCounters(";
+  os << "num_chunks=" << num_chunks << ", ";
+  os << "num_frames=" << num_frames;
+  for (int32_t i = 0; i != kNumStages; ++i) {
+    const StageCount &s = stages[i];
+    os << ", " << StageName(static_cast<Stage>(i)) << "=(count=" << s.count
+       << ", seconds=" << s.seconds << ", max_seconds=" << s.max_seconds
+       << ")";
+  }
+  os << ")";
+
+  return os.str();
+}
+
+void AtomicDecodeCounters::Add(const Delta &delta) {
+  if (delta.num_chunks) {
+    num_chunks_.fetch_add(delta.num_chunks, std::memory_order_relaxed);
+    num_frames_.fetch_add(delta.num_frames, std::memory_order_relaxed);
+  }
+
+  for (int32_t i = 0; i != kNumStages; ++i) {
+    if (delta.count[i] == 0) continue;
+
+    count_[i].fetch_add(delta.count[i], std::memory_order_relaxed);
+    ns_[i].fetch_add(delta.ns[i], std::memory_order_relaxed);
+    AtomicMax(&max_ns_[i], delta.max_ns[i]);
+  }
+}
+
+DecodeCounters AtomicDecodeCounters::Get() const {
+  DecodeCounters ans;
+  ans.num_chunks = num_chunks_.load(std::memory_order_relaxed);
+  ans.num_frames = num_frames_.load(std::memory_order_relaxed);
+
+  for (int32_t i = 0; i != kNumStages; ++i) {
+    ans.stages[i].count = count_[i].load(std::memory_order_relaxed);
+    ans.stages[i].seconds = ns_[i].load(std::memory_order_relaxed) * 1e-9;
+    ans.stages[i].max_seconds =
+        max_ns_[i].load(std::memory_order_relaxed) * 1e-9;
+  }
+
+  return ans;
+}
+
+void AtomicDecodeCounters::Reset() {
+  num_chunks_.store(0, std::memory_order_relaxed);
+  num_frames_.store(0, std::memory_order_relaxed);
+
+  for (int32_t i = 0; i != kNumStages; ++i) {
+    count_[i].store(0, std::memory_order_relaxed);
+    ns_[i].store(0, std::memory_order_relaxed);
+    max_ns_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+ScopedDecodeCounters::ScopedDecodeCounters(AtomicDecodeCounters *stream,
+                                           AtomicDecodeCounters *recognizer)
+    : stream_(stream),
+      recognizer_(recognizer),
+      prev_(SetThreadStageObserver(this)) {}
+
+ScopedDecodeCounters::~ScopedDecodeCounters() {
+  SetThreadStageObserver(prev_);
+
+  if (stream_) stream_->Add(delta_);
+  if (recognizer_) recognizer_->Add(delta_);
+}
+
+void ScopedDecodeCounters::OnStage(Stage stage, StageClock::time_point start,
+                                   StageClock::time_point end,
+                                   StageClock::duration self) {
+  int32_t i = static_cast<int32_t>(stage);
+  int64_t ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+
+  delta_.count[i] += 1;
+  delta_.ns[i] += ns;
+  if (ns > delta_.max_ns[i]) delta_.max_ns[i] = ns;
+
+  if (prev_) prev_->OnStage(stage, start, end, self);
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,113 @@
+// sherpa-ncnn/csrc/stage-counters.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_STAGE_COUNTERS_H_
+#define SHERPA_NCNN_CSRC_STAGE_COUNTERS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "sherpa-ncnn/csrc/stage-timer.h"
+
+namespace sherpa_ncnn {
+
+struct StageCount {
+  // Number of times the stage has run, e.g., the number of joiner runs
+  int64_t count = 0;
+
+  // Total and longest time of a run. The time of a stage includes the
+  // stages run within it, e.g., kSearch includes kDecoder and kJoiner.
+  double seconds = 0;
+  double max_seconds = 0;
+};
+
+// A snapshot of the counters of a stream or a recognizer
+struct DecodeCounters {
+  int64_t num_chunks = 0;
+
+  // Feature frames consumed by the encoder, i.e., Model::Offset() per chunk
+  int64_t num_frames = 0;
+
+  StageCount stages[kNumStages];
+
+  const StageCount &operator[](Stage stage) const {
+    return stages[static_cast<int32_t>(stage)];
+  }
+
+  std::string ToString() const;
+};
+
+/* Counters that are updated by the decoding threads and can be read by
+ * any thread at any time.
+ *
+ * They are updated once per call of the recognizer by
+ * ScopedDecodeCounters with relaxed atomics, so a snapshot may mix two
+ * calls that run at the same time.
+ */
+class AtomicDecodeCounters {
+ public:
+  // Counts of one call, accumulated without atomics
+  struct Delta {
+    int64_t num_chunks = 0;
+    int64_t num_frames = 0;
+    int64_t count[kNumStages] = {};
+    int64_t ns[kNumStages] = {};
+    int64_t max_ns[kNumStages] = {};
+  };
+
+  void Add(const Delta &delta);
+
+  DecodeCounters Get() const;
+
+  void Reset();
+
+ private:
+  std::atomic<int64_t> num_chunks_{0};
+  std::atomic<int64_t> num_frames_{0};
+  std::atomic<int64_t> count_[kNumStages] = {};
+  std::atomic<int64_t> ns_[kNumStages] = {};
+  std::atomic<int64_t> max_ns_[kNumStages] = {};
+};
+
+/* Count the stages run on the calling thread while it is alive.
+ *
+ * It replaces the stage observer of the thread and passes the stages on
+ * to the previous one, if any, so that it can be nested and used together
+ * with other observers. The counts are added to the given counters when
+ * it is destroyed.
+ */
+class ScopedDecodeCounters : public StageObserver {
+ public:
+  // Either of the counters can be nullptr
+  ScopedDecodeCounters(AtomicDecodeCounters *stream,
+                       AtomicDecodeCounters *recognizer);
+  ~ScopedDecodeCounters() override;
+
+  ScopedDecodeCounters(const ScopedDecodeCounters &) = delete;
+  ScopedDecodeCounters &operator=(const ScopedDecodeCounters &) = delete;
+
+  // Count a chunk that consumed num_frames feature frames
+  void AddChunk(int32_t num_frames) {
+    delta_.num_chunks += 1;
+    delta_.num_frames += num_frames;
+  }
+
+  void OnStageStart(Stage stage) override {
+    if (prev_) prev_->OnStageStart(stage);
+  }
+
+  void OnStage(Stage stage, StageClock::time_point start,
+               StageClock::time_point end, StageClock::duration self) override;
+
+ private:
+  AtomicDecodeCounters *stream_;
+  AtomicDecodeCounters *recognizer_;
+  StageObserver *prev_;
+  AtomicDecodeCounters::Delta delta_;
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_STAGE_COUNTERS_H_
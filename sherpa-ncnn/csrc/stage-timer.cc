@@ -0,0 +1,73 @@
+// sherpa-ncnn/csrc/stage-timer.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/stage-timer.h"
+
+#include "sherpa-ncnn/csrc/trace-recorder.h"
+
+namespace sherpa_ncnn {
+
+static thread_local StageObserver *tls_observer = nullptr;
+
+// The innermost stage being observed on this thread
+static thread_local ScopedStage *tls_current = nullptr;
+
+const char *StageName(Stage stage) {
+  switch (stage) {
+    case Stage::kFbank:
+      return "fbank";
+    case Stage::kEncoder:
+      return "encoder";
+    case Stage::kDecoder:
+      return "decoder";
+    case Stage::kJoiner:
+      return "joiner";
+    case Stage::kSearch:
+      return "search";
+    case Stage::kResult:
+      return "result";
+  }
+  return "";
+}
+
+StageObserver *SetThreadStageObserver(StageObserver *observer) {
+  StageObserver *prev = tls_observer;
+  tls_observer = observer;
+  return prev;
+}
+
+ScopedStage::ScopedStage(Stage stage)
+    : stage_(stage), observer_(tls_observer), tracing_(IsTracing()) {
+  if (!observer_ && !tracing_) return;
+
+  if (observer_) {
+    observer_->OnStageStart(stage_);
+  }
+
+  parent_ = tls_current;
+  tls_current = this;
+  start_ = StageClock::now();
+}
+
+ScopedStage::~ScopedStage() {
+  if (!observer_ && !tracing_) return;
+
+  StageClock::time_point end = StageClock::now();
+  StageClock::duration d = end - start_;
+
+  tls_current = parent_;
+  if (parent_) {
+    parent_->nested_ += d;
+  }
+
+  if (tracing_) {
+    RecordTraceSpan(StageName(stage_), start_, end);
+  }
+
+  if (observer_) {
+    observer_->OnStage(stage_, start_, end, d - nested_);
+  }
+}
+
+}  // namespace sherpa_ncnn
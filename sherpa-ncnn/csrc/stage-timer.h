@@ -0,0 +1,84 @@
+// sherpa-ncnn/csrc/stage-timer.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_STAGE_TIMER_H_
+#define SHERPA_NCNN_CSRC_STAGE_TIMER_H_
+
+#include <chrono>  // NOLINT
+#include <cstdint>
+
+namespace sherpa_ncnn {
+
+/* Stages of decoding a stream.
+ *
+ * Code running a stage creates a ScopedStage, which reports the duration
+ * of the stage to the observer of the current thread and, if tracing is
+ * on, records a span (see trace-recorder.h). Without an observer and
+ * tracing, a ScopedStage costs a thread-local load and an atomic load.
+ */
+enum class Stage : int32_t {
+  kFbank = 0,  // Feature extraction in AcceptWaveform() and InputFinished()
+  kEncoder,
+  kDecoder,
+  kJoiner,
+  kSearch,  // Decoding a chunk of encoder output. It runs kDecoder, kJoiner
+  kResult,  // Converting the decoder result in GetResult()
+};
+
+constexpr int32_t kNumStages = 6;
+
+const char *StageName(Stage stage);
+
+using StageClock = std::chrono::steady_clock;
+
+class StageObserver {
+ public:
+  virtual ~StageObserver() = default;
+
+  /// Called on the thread of the observer when a stage starts, before
+  /// its start time is taken.
+  virtual void OnStageStart(Stage /*stage*/) {}
+
+  /** Called on the thread of the observer when a stage ends.
+   *
+   * @param stage  The stage.
+   * @param start  When the stage started.
+   * @param end  When the stage ended.
+   * @param self  end - start minus the time of the stages run within it,
+   *              e.g., the time of kSearch without kDecoder and kJoiner.
+   */
+  virtual void OnStage(Stage stage, StageClock::time_point start,
+                       StageClock::time_point end,
+                       StageClock::duration self) = 0;
+};
+
+/// Set the observer of the calling thread. Use nullptr to remove it.
+/// Return the previous observer.
+StageObserver *SetThreadStageObserver(StageObserver *observer);
+
+class ScopedStage {
+ public:
+  explicit ScopedStage(Stage stage);
+  ~ScopedStage();
+
+  ScopedStage(const ScopedStage &) = delete;
+  ScopedStage &operator=(const ScopedStage &) = delete;
+
+ private:
+  Stage stage_;
+  StageObserver *observer_;
+  bool tracing_;
+
+  // The enclosing stage on this thread
+  ScopedStage *parent_ = nullptr;
+
+  StageClock::time_point start_;
+
+  // Time of the stages run within this one
+  StageClock::duration nested_{0};
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_STAGE_TIMER_H_
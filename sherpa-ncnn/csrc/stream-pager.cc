@@ -0,0 +1,435 @@
+// sherpa-ncnn/csrc/stream-pager.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/stream-pager.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>  // NOLINT
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "platform.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+std::string StreamPagerConfig::ToString() const {
+  std::ostringstream os;
+
+  os << "StreamPagerConfig(";
+  os << "idle_seconds=" << idle_seconds << ", ";
+  os << "spill_file=\"" << spill_file << "\")";
+
+  return os.str();
+}
+
+std::string StreamPagerStats::ToString() const {
+  std::ostringstream os;
+
+  os << "StreamPagerStats(";
+  os << "num_resident=" << num_resident << ", ";
+  os << "num_paged=" << num_paged << ", ";
+  os << "paged_bytes=" << paged_bytes << ", ";
+  os << "spill_bytes=" << spill_bytes << ", ";
+  os << "num_page_outs=" << num_page_outs << ", ";
+  os << "num_page_ins=" << num_page_ins << ", ";
+  os << "avg_restore_ms=" << avg_restore_ms << ", ";
+  os << "max_restore_ms=" << max_restore_ms << ")";
+
+  return os.str();
+}
+
+class StreamPager::Impl {
+ public:
+  Impl(const Recognizer *recognizer, const StreamPagerConfig &config)
+      : recognizer_(recognizer), config_(config) {
+    if (!config_.spill_file.empty()) {
+      fp_ = fopen(config_.spill_file.c_str(), "w+b");
+      if (!fp_) {
+        NCNN_LOGE("Failed to open %s", config_.spill_file.c_str());
+        exit(-1);
+      }
+    }
+  }
+
+  ~Impl() {
+    if (fp_) {
+      fclose(fp_);
+    }
+  }
+
+  int64_t CreateStream() {
+    auto e = std::make_shared<Entry>();
+    e->stream = recognizer_->CreateStream();
+    e->last_active = Clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t id = next_id_++;
+    entries_[id] = std::move(e);
+    ++num_resident_;
+
+    return id;
+  }
+
+  void DestroyStream(int64_t id) {
+    std::shared_ptr<Entry> e;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = entries_.find(id);
+      if (it == entries_.end()) return;
+
+      e = std::move(it->second);
+      entries_.erase(it);
+    }
+
+    // Wait for a running page-in or page-out of this stream
+    std::lock_guard<std::mutex> entry_lock(e->mutex);
+    e->destroyed = true;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (e->stream) {
+      e->stream.reset();
+      --num_resident_;
+    } else {
+      ReleaseColdState(e.get());
+      --num_paged_;
+    }
+  }
+
+  bool AcceptWaveform(int64_t id, int32_t sampling_rate,
+                      const float *waveform, int32_t n) {
+    // Holding a reference pins the stream so that PageOutIdle() won't
+    // free it while we are computing features
+    std::shared_ptr<Stream> s = Acquire(id, true);
+    if (!s) {
+      NCNN_LOGE("Stream %d does not exist or cannot be paged in",
+                static_cast<int32_t>(id));
+      return false;
+    }
+
+    s->AcceptWaveform(sampling_rate, waveform, n);
+    return true;
+  }
+
+  std::shared_ptr<Stream> GetStream(int64_t id) { return Acquire(id, false); }
+
+  int32_t PageOutIdle() {
+    auto now = Clock::now();
+    auto idle = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(config_.idle_seconds));
+
+    std::vector<std::shared_ptr<Entry>> entries;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries.reserve(entries_.size());
+      for (const auto &p : entries_) {
+        entries.push_back(p.second);
+      }
+    }
+
+    int32_t num_paged_out = 0;
+    for (auto &e : entries) {
+      // Skip streams that are being paged in or destroyed
+      std::unique_lock<std::mutex> entry_lock(e->mutex, std::try_to_lock);
+      if (!entry_lock.owns_lock() || e->destroyed) continue;
+
+      // References to a stream are only handed out while holding the
+      // lock of its entry, so a use count of 1 means no one else is
+      // using it
+      if (!e->stream || e->stream.use_count() > 1 ||
+          now - e->last_active < idle ||
+          recognizer_->IsReady(e->stream.get())) {
+        continue;
+      }
+
+      if (PageOut(e.get())) {
+        ++num_paged_out;
+      }
+    }
+
+    return num_paged_out;
+  }
+
+  StreamPagerStats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    StreamPagerStats ans;
+    ans.num_resident = num_resident_;
+    ans.num_paged = num_paged_;
+    ans.paged_bytes = paged_bytes_;
+    ans.spill_bytes = file_end_;
+    ans.num_page_outs = num_page_outs_;
+    ans.num_page_ins = num_page_ins_;
+    if (num_page_ins_ > 0) {
+      ans.avg_restore_ms = total_restore_ms_ / num_page_ins_;
+    }
+    ans.max_restore_ms = max_restore_ms_;
+
+    return ans;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // Locks are taken in the order Entry::mutex, then mutex_, then
+  // file_mutex_. Entry::mutex is held while a stream is paged in or out,
+  // so it only blocks other users of the same stream.
+  struct Entry {
+    std::mutex mutex;
+
+    // Set by DestroyStream(). The entry is no longer in entries_
+    bool destroyed = false;
+
+    // nullptr if the stream is paged out. Callers of GetStream() and
+    // AcceptWaveform() share it while they use it.
+    std::shared_ptr<Stream> stream;
+    Clock::time_point last_active;
+
+    // Serialized state of a paged-out stream. Used if there is no spill file
+    std::vector<uint8_t> state;
+
+    // Location of the serialized state in the spill file
+    int64_t offset = -1;
+    int64_t size = 0;
+  };
+
+  // Return the stream with the given id, paging it in if needed.
+  // If touch is true, the stream becomes active.
+  std::shared_ptr<Stream> Acquire(int64_t id, bool touch) {
+    std::shared_ptr<Entry> e;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = entries_.find(id);
+      if (it == entries_.end()) return nullptr;
+
+      e = it->second;
+    }
+
+    std::lock_guard<std::mutex> entry_lock(e->mutex);
+    if (e->destroyed) return nullptr;
+
+    if (!e->stream && !PageIn(e.get())) return nullptr;
+
+    if (touch) {
+      e->last_active = Clock::now();
+    }
+
+    return e->stream;
+  }
+
+  // Caller should hold the lock of the entry. If it returns false,
+  // the stream is still in memory.
+  bool PageOut(Entry *e) {
+    std::vector<uint8_t> state;
+    recognizer_->SaveStreamState(e->stream.get(), &state);
+    int64_t size = state.size();
+
+    if (fp_) {
+      int64_t offset;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        offset = Allocate(size);
+      }
+
+      if (!WriteSpill(offset, state)) {
+        NCNN_LOGE("Failed to write to %s. Keep the stream in memory",
+                  config_.spill_file.c_str());
+        std::lock_guard<std::mutex> lock(mutex_);
+        Free(offset, size);
+        return false;
+      }
+
+      e->offset = offset;
+    } else {
+      e->state = std::move(state);
+    }
+
+    e->size = size;
+    e->stream.reset();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    paged_bytes_ += size;
+    --num_resident_;
+    ++num_paged_;
+    ++num_page_outs_;
+
+    return true;
+  }
+
+  // Caller should hold the lock of the entry. If it returns false,
+  // the stream stays paged out.
+  bool PageIn(Entry *e) {
+    auto start = Clock::now();
+
+    std::vector<uint8_t> buf;
+    const std::vector<uint8_t> *state = &e->state;
+    if (fp_) {
+      buf.resize(e->size);
+      if (!ReadSpill(e->offset, &buf)) {
+        NCNN_LOGE("Failed to read from %s", config_.spill_file.c_str());
+        return false;
+      }
+      state = &buf;
+    }
+
+    std::shared_ptr<Stream> stream =
+        recognizer_->RestoreStreamState(state->data(), state->size());
+    if (!stream) {
+      NCNN_LOGE("Failed to restore a paged-out stream");
+      return false;
+    }
+
+    e->stream = std::move(stream);
+
+    float ms = std::chrono::duration<float, std::milli>(Clock::now() - start)
+                   .count();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReleaseColdState(e);
+
+    --num_paged_;
+    ++num_resident_;
+    ++num_page_ins_;
+    total_restore_ms_ += ms;
+    max_restore_ms_ = std::max(max_restore_ms_, ms);
+
+    return true;
+  }
+
+  bool WriteSpill(int64_t offset, const std::vector<uint8_t> &buf) {
+    if (offset > std::numeric_limits<long>::max()) {  // NOLINT
+      return false;
+    }
+
+    // fflush() reports a failed write now instead of on a later fseek()
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    return fseek(fp_, static_cast<long>(offset), SEEK_SET) == 0 &&  // NOLINT
+           fwrite(buf.data(), 1, buf.size(), fp_) == buf.size() &&
+           fflush(fp_) == 0;
+  }
+
+  bool ReadSpill(int64_t offset, std::vector<uint8_t> *buf) {
+    if (offset < 0 || offset > std::numeric_limits<long>::max()) {  // NOLINT
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    return fseek(fp_, static_cast<long>(offset), SEEK_SET) == 0 &&  // NOLINT
+           fread(buf->data(), 1, buf->size(), fp_) == buf->size();
+  }
+
+  // Caller should hold mutex_ and the lock of the entry
+  void ReleaseColdState(Entry *e) {
+    paged_bytes_ -= e->size;
+
+    if (fp_ && e->offset >= 0) {
+      Free(e->offset, e->size);
+    }
+
+    e->state = {};
+    e->offset = -1;
+    e->size = 0;
+  }
+
+  // Return the offset of a free region of n bytes in the spill file.
+  // Caller should hold mutex_.
+  int64_t Allocate(int64_t n) {
+    for (auto it = holes_.begin(); it != holes_.end(); ++it) {
+      if (it->second < n) continue;
+
+      int64_t offset = it->first;
+      int64_t left = it->second - n;
+      holes_.erase(it);
+      if (left > 0) {
+        holes_[offset + n] = left;
+      }
+      return offset;
+    }
+
+    int64_t offset = file_end_;
+    file_end_ += n;
+    return offset;
+  }
+
+  // Merge the region with its free neighbours. A free region at the end
+  // of the file is given back. Caller should hold mutex_.
+  void Free(int64_t offset, int64_t n) {
+    auto next = holes_.lower_bound(offset);
+    if (next != holes_.end() && offset + n == next->first) {
+      n += next->second;
+      next = holes_.erase(next);
+    }
+
+    if (next != holes_.begin()) {
+      auto prev = std::prev(next);
+      if (prev->first + prev->second == offset) {
+        offset = prev->first;
+        n += prev->second;
+        holes_.erase(prev);
+      }
+    }
+
+    if (offset + n == file_end_) {
+      file_end_ = offset;
+      return;
+    }
+
+    holes_[offset] = n;
+  }
+
+ private:
+  const Recognizer *recognizer_;
+  StreamPagerConfig config_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<int64_t, std::shared_ptr<Entry>> entries_;
+  int64_t next_id_ = 0;
+
+  // The spill file has a single position, so reads and writes take turns
+  std::mutex file_mutex_;
+  FILE *fp_ = nullptr;
+  std::map<int64_t, int64_t> holes_;  // offset -> size in the spill file
+  int64_t file_end_ = 0;
+
+  int32_t num_resident_ = 0;
+  int32_t num_paged_ = 0;
+  int64_t paged_bytes_ = 0;
+  int64_t num_page_outs_ = 0;
+  int64_t num_page_ins_ = 0;
+  float total_restore_ms_ = 0;
+  float max_restore_ms_ = 0;
+};
+
+StreamPager::StreamPager(const Recognizer *recognizer,
+                         const StreamPagerConfig &config)
+    : impl_(std::make_unique<Impl>(recognizer, config)) {}
+
+StreamPager::~StreamPager() = default;
+
+int64_t StreamPager::CreateStream() { return impl_->CreateStream(); }
+
+void StreamPager::DestroyStream(int64_t id) { impl_->DestroyStream(id); }
+
+bool StreamPager::AcceptWaveform(int64_t id, int32_t sampling_rate,
+                                 const float *waveform, int32_t n) {
+  return impl_->AcceptWaveform(id, sampling_rate, waveform, n);
+}
+
+std::shared_ptr<Stream> StreamPager::GetStream(int64_t id) {
+  return impl_->GetStream(id);
+}
+
+int32_t StreamPager::PageOutIdle() { return impl_->PageOutIdle(); }
+
+StreamPagerStats StreamPager::GetStats() const { return impl_->GetStats(); }
+
+}  // namespace sherpa_ncnn
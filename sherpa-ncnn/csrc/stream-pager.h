@@ -0,0 +1,116 @@
+// sherpa-ncnn/csrc/stream-pager.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_STREAM_PAGER_H_
+#define SHERPA_NCNN_CSRC_STREAM_PAGER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/stream.h"
+
+namespace sherpa_ncnn {
+
+struct StreamPagerConfig {
+  // A stream that has not received any samples for this number of seconds
+  // is paged out by StreamPager::PageOutIdle()
+  float idle_seconds = 30;
+
+  // If empty, paged-out streams are kept in memory as serialized states.
+  // Otherwise, they are written to this file, which is truncated on start.
+  std::string spill_file;
+
+  StreamPagerConfig() = default;
+
+  StreamPagerConfig(float idle_seconds, const std::string &spill_file)
+      : idle_seconds(idle_seconds), spill_file(spill_file) {}
+
+  std::string ToString() const;
+};
+
+struct StreamPagerStats {
+  // Number of streams that are in memory
+  int32_t num_resident = 0;
+
+  // Number of streams that are paged out
+  int32_t num_paged = 0;
+
+  // Number of bytes held by paged-out streams
+  int64_t paged_bytes = 0;
+
+  // Size of the used part of the spill file. Free regions at its end are
+  // given back, so it is 0 once all streams are paged in or destroyed.
+  int64_t spill_bytes = 0;
+
+  // Totals since the pager was created
+  int64_t num_page_outs = 0;
+  int64_t num_page_ins = 0;
+
+  // Latency of paging in a stream, in milliseconds
+  float avg_restore_ms = 0;
+  float max_restore_ms = 0;
+
+  std::string ToString() const;
+};
+
+/** Owns streams and pages out the ones that are idle.
+ *
+ * A stream is identified by the id returned from CreateStream(). Streams
+ * without AcceptWaveform() for config.idle_seconds are serialized with
+ * Recognizer::SaveStreamState() into a cold tier (memory or a spill file)
+ * by PageOutIdle(). They are restored transparently on the next access.
+ *
+ * All methods are thread-safe. Paging a stream in or out, including the
+ * I/O of the spill file, only blocks other accesses to the same stream.
+ * A stream returned by GetStream() is pinned: PageOutIdle() skips it as
+ * long as the caller holds the returned pointer, and DestroyStream() only
+ * drops the pager's reference to it.
+ *
+ * If a stream cannot be written to the spill file, it stays in memory.
+ * If it cannot be read back, GetStream() and AcceptWaveform() fail and the
+ * stream stays paged out.
+ */
+class StreamPager {
+ public:
+  StreamPager(const Recognizer *recognizer, const StreamPagerConfig &config);
+  ~StreamPager();
+
+  /// Create a stream and return its id.
+  int64_t CreateStream();
+
+  /// Destroy a stream, no matter whether it is paged out or not.
+  void DestroyStream(int64_t id);
+
+  /// Feed samples to a stream. It is paged in if needed.
+  ///
+  /// @return Return false if there is no such stream or it cannot be
+  ///         paged in.
+  bool AcceptWaveform(int64_t id, int32_t sampling_rate, const float *waveform,
+                      int32_t n);
+
+  /// Return the stream with the given id, paging it in if needed.
+  /// Return nullptr if there is no such stream or it cannot be paged in.
+  /// Release the returned pointer when done with it so that the stream
+  /// can be paged out.
+  std::shared_ptr<Stream> GetStream(int64_t id);
+
+  /// Page out streams that have been idle for config.idle_seconds, have
+  /// no frames ready for decoding and are not pinned by GetStream() or
+  /// a running AcceptWaveform().
+  ///
+  /// @return Return the number of streams paged out.
+  int32_t PageOutIdle();
+
+  StreamPagerStats GetStats() const;
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_STREAM_PAGER_H_
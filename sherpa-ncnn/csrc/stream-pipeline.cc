@@ -0,0 +1,317 @@
+// sherpa-ncnn/csrc/stream-pipeline.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/stream-pipeline.h"
+
+#include <algorithm>
+#include <chrono>              // NOLINT
+#include <condition_variable>  // NOLINT
+#include <deque>
+#include <mutex>  // NOLINT
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "platform.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+bool StreamPipelineConfig::Validate() const {
+  // With a queue size of 0, the encoder stage could never take a chunk
+  // and Decode() would wait forever
+  if (queue_size <= 0) {
+    NCNN_LOGE("queue_size should be positive. Given %d", queue_size);
+    return false;
+  }
+
+  return true;
+}
+
+std::string StreamPipelineConfig::ToString() const {
+  std::ostringstream os;
+
+  os << "StreamPipelineConfig(";
+  os << "queue_size=" << queue_size << ", ";
+  os << "pipelined=" << (pipelined ? "True" : "False") << ")";
+
+  return os.str();
+}
+
+std::string StreamPipelineStats::ToString() const {
+  std::ostringstream os;
+
+  os << "StreamPipelineStats(";
+  os << "num_chunks=" << num_chunks << ", ";
+  os << "avg_encoder_ms=" << avg_encoder_ms << ", ";
+  os << "avg_search_ms=" << avg_search_ms << ", ";
+  os << "avg_latency_ms=" << avg_latency_ms << ", ";
+  os << "max_latency_ms=" << max_latency_ms << ")";
+
+  return os.str();
+}
+
+class StreamPipeline::Impl {
+ public:
+  Impl(const Recognizer *recognizer, Stream *s,
+       const StreamPipelineConfig &config)
+      : recognizer_(recognizer),
+        s_(s),
+        config_(config),
+        segment_(recognizer->GetModel()->Segment()),
+        offset_(recognizer->GetModel()->Offset()) {
+    if (!config_.Validate()) {
+      NCNN_LOGE("Invalid config: %s", config_.ToString().c_str());
+      exit(-1);
+    }
+
+    if (config_.pipelined) {
+      encoder_thread_ = std::thread([this]() { EncoderLoop(); });
+    }
+  }
+
+  ~Impl() {
+    if (!config_.pipelined) return;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    encoder_thread_.join();
+
+    // The encoder states of the stream already include the queued chunks
+    while (!queue_.empty()) {
+      Chunk c = std::move(queue_.front());
+      queue_.pop_front();
+      Search(&c);
+    }
+  }
+
+  void AcceptWaveform(int32_t sampling_rate, const float *waveform,
+                      int32_t n) {
+    s_->AcceptWaveform(sampling_rate, waveform, n);
+    OnNewFrames();
+  }
+
+  void InputFinished() {
+    s_->InputFinished();
+    OnNewFrames();
+  }
+
+  void Decode() {
+    while (true) {
+      Chunk c;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!recognizer_->IsReady(s_)) break;
+
+        if (config_.pipelined) {
+          cv_.wait(lock, [this]() { return !queue_.empty(); });
+          c = std::move(queue_.front());
+          queue_.pop_front();
+        } else {
+          c.features = s_->GetFrames(s_->GetNumProcessedFrames(), segment_);
+          ahead_ += offset_;
+        }
+      }
+
+      if (config_.pipelined) {
+        // There is room in the queue now
+        cv_.notify_all();
+      } else {
+        Encode(&c);
+      }
+
+      Search(&c);
+    }
+  }
+
+  bool IsEndpoint() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return recognizer_->IsEndpoint(s_);
+  }
+
+  void Reset() {
+    // Reset() keeps the absolute index of the next frame to process, so
+    // chunks that are already encoded stay valid
+    std::lock_guard<std::mutex> lock(mutex_);
+    recognizer_->Reset(s_);
+  }
+
+  RecognitionResult GetResult() const { return recognizer_->GetResult(s_); }
+
+  StreamPipelineStats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    StreamPipelineStats ans;
+    ans.num_chunks = num_chunks_;
+    if (num_chunks_ > 0) {
+      ans.avg_encoder_ms = total_encoder_ms_ / num_chunks_;
+      ans.avg_search_ms = total_search_ms_ / num_chunks_;
+    }
+
+    if (num_latencies_ > 0) {
+      ans.avg_latency_ms = total_latency_ms_ / num_latencies_;
+    }
+    ans.max_latency_ms = max_latency_ms_;
+
+    return ans;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Chunk {
+    ncnn::Mat features;
+    ncnn::Mat encoder_out;
+    float encoder_ms = 0;
+  };
+
+  // Caller should hold the lock
+  bool CanEncode() const {
+    return ahead_ < config_.queue_size * offset_ &&
+           s_->GetNumProcessedFrames() + ahead_ + segment_ <
+               s_->NumFramesReady();
+  }
+
+  void OnNewFrames() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      // Number of frames available, counted from the first frame of the
+      // stream. It is not affected by Reset().
+      int64_t frames = num_searched_frames_ + s_->NumFramesReady() -
+                       s_->GetNumProcessedFrames();
+      if (arrivals_.empty() || arrivals_.back().first < frames) {
+        arrivals_.emplace_back(frames, Clock::now());
+      }
+    }
+    cv_.notify_all();
+  }
+
+  void EncoderLoop() {
+    while (true) {
+      Chunk c;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stop_ || CanEncode(); });
+        if (stop_) return;
+
+        c.features =
+            s_->GetFrames(s_->GetNumProcessedFrames() + ahead_, segment_);
+        ahead_ += offset_;
+      }
+
+      Encode(&c);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(c));
+      }
+      cv_.notify_all();
+    }
+  }
+
+  void Encode(Chunk *c) const {
+    auto start = Clock::now();
+    c->encoder_out = recognizer_->RunEncoder(s_, c->features);
+    c->features.release();
+    c->encoder_ms =
+        std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+  }
+
+  void Search(Chunk *c) {
+    auto start = Clock::now();
+    recognizer_->Search(s_, c->encoder_out);
+    auto end = Clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    s_->GetNumProcessedFrames() += offset_;
+    ahead_ -= offset_;
+
+    // IsReady() for this chunk became true once this many frames were
+    // available
+    int64_t needed = num_searched_frames_ + segment_ + 1;
+    num_searched_frames_ += offset_;
+
+    while (!arrivals_.empty() && arrivals_.front().first < needed) {
+      arrivals_.pop_front();
+    }
+
+    if (!arrivals_.empty()) {
+      float ms = std::chrono::duration<float, std::milli>(
+                     end - arrivals_.front().second)
+                     .count();
+      total_latency_ms_ += ms;
+      max_latency_ms_ = std::max(max_latency_ms_, ms);
+      ++num_latencies_;
+    }
+
+    ++num_chunks_;
+    total_encoder_ms_ += c->encoder_ms;
+    total_search_ms_ +=
+        std::chrono::duration<float, std::milli>(end - start).count();
+  }
+
+ private:
+  const Recognizer *recognizer_;
+  Stream *s_;  // not owned
+  StreamPipelineConfig config_;
+  int32_t segment_;
+  int32_t offset_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+
+  // Encoded chunks waiting for the search stage
+  std::deque<Chunk> queue_;
+
+  // Number of frames, after GetNumProcessedFrames(), taken by the encoder
+  // stage but not searched yet
+  int32_t ahead_ = 0;
+
+  bool stop_ = false;
+  std::thread encoder_thread_;
+
+  // For latency statistics: (number of available frames, arrival time)
+  std::deque<std::pair<int64_t, Clock::time_point>> arrivals_;
+  int64_t num_searched_frames_ = 0;
+
+  int32_t num_chunks_ = 0;
+  float total_encoder_ms_ = 0;
+  float total_search_ms_ = 0;
+  int32_t num_latencies_ = 0;
+  float total_latency_ms_ = 0;
+  float max_latency_ms_ = 0;
+};
+
+StreamPipeline::StreamPipeline(const Recognizer *recognizer, Stream *s,
+                               const StreamPipelineConfig &config)
+    : impl_(std::make_unique<Impl>(recognizer, s, config)) {}
+
+StreamPipeline::~StreamPipeline() = default;
+
+void StreamPipeline::AcceptWaveform(int32_t sampling_rate,
+                                    const float *waveform, int32_t n) {
+  impl_->AcceptWaveform(sampling_rate, waveform, n);
+}
+
+void StreamPipeline::InputFinished() { impl_->InputFinished(); }
+
+void StreamPipeline::Decode() { impl_->Decode(); }
+
+bool StreamPipeline::IsEndpoint() const { return impl_->IsEndpoint(); }
+
+void StreamPipeline::Reset() { impl_->Reset(); }
+
+RecognitionResult StreamPipeline::GetResult() const {
+  return impl_->GetResult();
+}
+
+StreamPipelineStats StreamPipeline::GetStats() const {
+  return impl_->GetStats();
+}
+
+}  // namespace sherpa_ncnn
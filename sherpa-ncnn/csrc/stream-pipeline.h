@@ -0,0 +1,99 @@
+// sherpa-ncnn/csrc/stream-pipeline.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_STREAM_PIPELINE_H_
+#define SHERPA_NCNN_CSRC_STREAM_PIPELINE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/stream.h"
+
+namespace sherpa_ncnn {
+
+struct StreamPipelineConfig {
+  // Maximum number of chunks the encoder stage may run ahead of the
+  // search stage. It must be positive.
+  int32_t queue_size = 2;
+
+  // If false, Decode() runs the encoder on the caller thread as
+  // Recognizer::DecodeStream() does. It is useful for comparing the
+  // statistics with the pipelined mode.
+  bool pipelined = true;
+
+  StreamPipelineConfig() = default;
+
+  StreamPipelineConfig(int32_t queue_size, bool pipelined)
+      : queue_size(queue_size), pipelined(pipelined) {}
+
+  bool Validate() const;
+
+  std::string ToString() const;
+};
+
+struct StreamPipelineStats {
+  int32_t num_chunks = 0;
+
+  // Average time per chunk of each stage, in milliseconds
+  float avg_encoder_ms = 0;
+  float avg_search_ms = 0;
+
+  // From the time the audio of a chunk arrives in AcceptWaveform() to the
+  // end of its search, in milliseconds
+  float avg_latency_ms = 0;
+  float max_latency_ms = 0;
+
+  std::string ToString() const;
+};
+
+/** Decode a single stream in two pipelined stages.
+ *
+ * A background thread runs the encoder on a chunk as soon as its audio is
+ * available and hands the output to the search stage over a bounded queue.
+ * Decode() runs the search on the caller thread. So the encoder of chunk
+ * N + 1 overlaps with the search of chunk N, which lowers the per-chunk
+ * latency of a single low-latency stream. Results are identical to
+ * calling Recognizer::DecodeStream().
+ *
+ * While a pipeline exists, feed audio and reset the stream only through
+ * it. AcceptWaveform() and InputFinished() can be called from any thread;
+ * the other methods must be called from a single thread.
+ */
+class StreamPipeline {
+ public:
+  // It exits if config is invalid
+  StreamPipeline(const Recognizer *recognizer, Stream *s,
+                 const StreamPipelineConfig &config = {});
+
+  // Chunks already encoded are searched before returning, so the stream
+  // can be used without the pipeline afterwards.
+  ~StreamPipeline();
+
+  void AcceptWaveform(int32_t sampling_rate, const float *waveform, int32_t n);
+
+  void InputFinished();
+
+  /// Same as
+  ///
+  ///   while (recognizer->IsReady(s)) recognizer->DecodeStream(s);
+  void Decode();
+
+  bool IsEndpoint() const;
+
+  void Reset();
+
+  RecognitionResult GetResult() const;
+
+  StreamPipelineStats GetStats() const;
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_STREAM_PIPELINE_H_
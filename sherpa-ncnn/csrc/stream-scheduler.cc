@@ -0,0 +1,290 @@
+// sherpa-ncnn/csrc/stream-scheduler.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/stream-scheduler.h"
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <deque>
+#include <mutex>  // NOLINT
+#include <queue>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sherpa_ncnn {
+
+// Frame shift of the features in seconds
+static constexpr double kFrameShift = 0.01;
+
+std::string StreamSchedulerConfig::ToString() const {
+  std::ostringstream os;
+
+  os << "StreamSchedulerConfig(";
+  os << "max_latency=" << max_latency << ", ";
+  os << "degrade_backlog=" << degrade_backlog << ", ";
+  os << "recover_backlog=" << recover_backlog << ", ";
+  os << "num_chunks_to_switch=" << num_chunks_to_switch << ", ";
+  os << "enable_degradation=" << (enable_degradation ? "True" : "False")
+     << ")";
+
+  return os.str();
+}
+
+class StreamScheduler::Impl {
+ public:
+  Impl(const Recognizer *recognizer, const StreamSchedulerConfig &config)
+      : recognizer_(recognizer),
+        config_(config),
+        chunk_seconds_(recognizer->GetModel()->Offset() * kFrameShift),
+        segment_seconds_(recognizer->GetModel()->Segment() * kFrameShift) {}
+
+  void AddStream(Stream *s) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry &e = entries_[s];
+    e.added = Clock::now();
+    Push(s, &e);
+  }
+
+  void RemoveStream(Stream *s) {
+    // Its items in the heap are dropped when they reach the top
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.erase(s);
+  }
+
+  void AcceptWaveform(Stream *s, int32_t sampling_rate, const float *waveform,
+                      int32_t n) {
+    s->AcceptWaveform(sampling_rate, waveform, n);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(s);
+    if (it == entries_.end()) return;
+
+    Entry &e = it->second;
+    e.received_seconds += static_cast<double>(n) / sampling_rate;
+    e.arrivals.emplace_back(e.received_seconds, Clock::now());
+
+    Push(s, &e);
+  }
+
+  void InputFinished(Stream *s) {
+    s->InputFinished();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(s);
+    if (it != entries_.end()) {
+      Push(s, &it->second);
+    }
+  }
+
+  Stream *DecodeNext() {
+    Stream *s = nullptr;
+    Entry *e = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while (!heap_.empty()) {
+        HeapItem item = heap_.top();
+        heap_.pop();
+
+        auto it = entries_.find(item.stream);
+        if (it == entries_.end() || it->second.seq != item.seq) {
+          // The stream was removed, or removed and added again
+          continue;
+        }
+
+        it->second.queued = false;
+
+        // It is not ready any more, e.g., after Recognizer::Reset().
+        // It is pushed again when it receives audio.
+        if (!recognizer_->IsReady(item.stream)) continue;
+
+        s = item.stream;
+        e = &it->second;
+        break;
+      }
+
+      if (!s) return nullptr;
+
+      e->busy = true;
+    }
+
+    recognizer_->DecodeStream(s);
+
+    int32_t step = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      e->decoded_seconds += chunk_seconds_;
+
+      // Drop arrivals whose audio is fully decoded
+      while (!e->arrivals.empty() &&
+             e->arrivals.front().first <= e->decoded_seconds) {
+        e->arrivals.pop_front();
+      }
+
+      step = UpdateLevel(e, s->GetDegradationLevel());
+    }
+
+    // The stream is still marked busy, so no other thread touches it
+    if (step != 0) {
+      recognizer_->SetDegradationLevel(s, s->GetDegradationLevel() + step);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      e->busy = false;
+
+      // Its next chunk may be ready already, or audio may have arrived
+      // while it was being decoded
+      Push(s, e);
+    }
+
+    return s;
+  }
+
+  float GetBacklogSeconds(Stream *s) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(s);
+    if (it == entries_.end()) return 0;
+
+    return Backlog(it->second);
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    // (received_seconds after a call to AcceptWaveform(), time of the call)
+    std::deque<std::pair<double, Clock::time_point>> arrivals;
+
+    // Time of AddStream()
+    Clock::time_point added;
+
+    // Seconds of audio received through AcceptWaveform()
+    double received_seconds = 0;
+
+    // Seconds of audio decoded so far. Not affected by Recognizer::Reset()
+    double decoded_seconds = 0;
+
+    // Number of consecutive chunks with the backlog above degrade_backlog
+    // or below recover_backlog
+    int32_t num_over = 0;
+    int32_t num_under = 0;
+
+    // true while being decoded
+    bool busy = false;
+
+    // true while the stream has an item in the heap
+    bool queued = false;
+
+    // Identifies the item of the stream in the heap
+    uint64_t seq = 0;
+  };
+
+  struct HeapItem {
+    Clock::time_point deadline;
+    Stream *stream;
+    uint64_t seq;
+
+    // std::priority_queue is a max-heap. Put the earliest deadline on top.
+    bool operator<(const HeapItem &other) const {
+      return deadline > other.deadline;
+    }
+  };
+
+  // Push a ready stream into the heap unless it is already there or
+  // being decoded. Caller should hold mutex_.
+  void Push(Stream *s, Entry *e) {
+    if (e->busy || e->queued || !recognizer_->IsReady(s)) return;
+
+    e->queued = true;
+    e->seq = next_seq_++;
+    heap_.push({Deadline(*e), s, e->seq});
+  }
+
+  float Backlog(const Entry &e) const {
+    double backlog = e.received_seconds - e.decoded_seconds - segment_seconds_;
+    return static_cast<float>(std::max(0.0, backlog));
+  }
+
+  // The next chunk needs audio up to decoded_seconds + segment_seconds_.
+  // Its deadline is max_latency after that audio arrived. It does not
+  // change while the stream waits in the heap.
+  Clock::time_point Deadline(const Entry &e) const {
+    auto max_latency = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(config_.max_latency));
+
+    double needed = e.decoded_seconds + segment_seconds_;
+    for (const auto &a : e.arrivals) {
+      if (a.first >= needed) {
+        return a.second + max_latency;
+      }
+    }
+
+    // The audio was not fed through AcceptWaveform(), e.g., tail paddings
+    return (e.arrivals.empty() ? e.added : e.arrivals.back().second) +
+           max_latency;
+  }
+
+  // Return the change of the degradation level: -1, 0 or 1
+  int32_t UpdateLevel(Entry *e, int32_t level) const {
+    if (!config_.enable_degradation) return 0;
+
+    float backlog = Backlog(*e);
+    e->num_over = backlog > config_.degrade_backlog ? e->num_over + 1 : 0;
+    e->num_under = backlog < config_.recover_backlog ? e->num_under + 1 : 0;
+
+    if (e->num_over >= config_.num_chunks_to_switch &&
+        level + 1 < recognizer_->NumDegradationLevels()) {
+      e->num_over = 0;
+      return 1;
+    }
+
+    if (e->num_under >= config_.num_chunks_to_switch && level > 0) {
+      e->num_under = 0;
+      return -1;
+    }
+
+    return 0;
+  }
+
+ private:
+  const Recognizer *recognizer_;
+  StreamSchedulerConfig config_;
+  double chunk_seconds_;
+  double segment_seconds_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<Stream *, Entry> entries_;
+
+  // Ready streams that are not being decoded
+  std::priority_queue<HeapItem> heap_;
+  uint64_t next_seq_ = 0;
+};
+
+StreamScheduler::StreamScheduler(const Recognizer *recognizer,
+                                 const StreamSchedulerConfig &config)
+    : impl_(std::make_unique<Impl>(recognizer, config)) {}
+
+StreamScheduler::~StreamScheduler() = default;
+
+void StreamScheduler::AddStream(Stream *s) { impl_->AddStream(s); }
+
+void StreamScheduler::RemoveStream(Stream *s) { impl_->RemoveStream(s); }
+
+void StreamScheduler::AcceptWaveform(Stream *s, int32_t sampling_rate,
+                                     const float *waveform, int32_t n) {
+  impl_->AcceptWaveform(s, sampling_rate, waveform, n);
+}
+
+void StreamScheduler::InputFinished(Stream *s) { impl_->InputFinished(s); }
+
+Stream *StreamScheduler::DecodeNext() { return impl_->DecodeNext(); }
+
+float StreamScheduler::GetBacklogSeconds(Stream *s) const {
+  return impl_->GetBacklogSeconds(s);
+}
+
+}  // namespace sherpa_ncnn
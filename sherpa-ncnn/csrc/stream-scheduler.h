@@ -0,0 +1,105 @@
+// sherpa-ncnn/csrc/stream-scheduler.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_STREAM_SCHEDULER_H_
+#define SHERPA_NCNN_CSRC_STREAM_SCHEDULER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/stream.h"
+
+namespace sherpa_ncnn {
+
+struct StreamSchedulerConfig {
+  // A chunk should be decoded within this number of seconds after its
+  // last sample arrives. It is used to compute deadlines.
+  float max_latency = 0.5;
+
+  // The backlog of a stream is the audio, in seconds, that could be
+  // decoded but is not decoded yet.
+  //
+  // A stream is degraded by one level after its backlog is above
+  // degrade_backlog for num_chunks_to_switch consecutive decoded chunks.
+  float degrade_backlog = 0.5;
+
+  // A stream is upgraded by one level after its backlog is below
+  // recover_backlog for num_chunks_to_switch consecutive decoded chunks.
+  float recover_backlog = 0.1;
+
+  int32_t num_chunks_to_switch = 8;
+
+  // If false, streams are only scheduled and never degraded
+  bool enable_degradation = true;
+
+  StreamSchedulerConfig() = default;
+
+  StreamSchedulerConfig(float max_latency, float degrade_backlog,
+                        float recover_backlog, int32_t num_chunks_to_switch,
+                        bool enable_degradation)
+      : max_latency(max_latency),
+        degrade_backlog(degrade_backlog),
+        recover_backlog(recover_backlog),
+        num_chunks_to_switch(num_chunks_to_switch),
+        enable_degradation(enable_degradation) {}
+
+  std::string ToString() const;
+};
+
+/** Decide which stream to decode next and at which quality.
+ *
+ * Streams are decoded in earliest-deadline-first order. The deadline of a
+ * stream is the arrival time of the audio its next chunk needs plus
+ * config.max_latency. To know arrival times and when a stream becomes
+ * ready, audio must be fed through StreamScheduler::AcceptWaveform() and
+ * the end of the input marked by StreamScheduler::InputFinished().
+ *
+ * Ready streams are kept in a heap keyed by their deadlines, so picking
+ * the next stream takes O(log n) for n ready streams.
+ *
+ * Under sustained overload, streams are moved down the quality ladder of
+ * the recognizer one level at a time (see Recognizer::SetDegradationLevel())
+ * and moved back up when their backlog is gone.
+ *
+ * All methods are thread-safe. DecodeNext() can be called from several
+ * worker threads; a stream is decoded by at most one of them at a time.
+ */
+class StreamScheduler {
+ public:
+  StreamScheduler(const Recognizer *recognizer,
+                  const StreamSchedulerConfig &config);
+  ~StreamScheduler();
+
+  /// Start scheduling a stream. It is not owned by the scheduler.
+  void AddStream(Stream *s);
+
+  /// Stop scheduling a stream. It must not be in DecodeNext() at the time.
+  void RemoveStream(Stream *s);
+
+  /// Same as s->AcceptWaveform(), but records the arrival time.
+  void AcceptWaveform(Stream *s, int32_t sampling_rate, const float *waveform,
+                      int32_t n);
+
+  /// Same as s->InputFinished(). The tail paddings may make it ready.
+  void InputFinished(Stream *s);
+
+  /** Decode one chunk of the ready stream with the earliest deadline.
+   *
+   * @return Return the decoded stream, or nullptr if no stream is ready.
+   */
+  Stream *DecodeNext();
+
+  /// Return the backlog of the given stream in seconds.
+  float GetBacklogSeconds(Stream *s) const;
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_STREAM_SCHEDULER_H_
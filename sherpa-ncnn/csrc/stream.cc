@@ -18,19 +18,217 @@
 
 #include "sherpa-ncnn/csrc/stream.h"
 
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sherpa-ncnn/csrc/trace-recorder.h"
+
 namespace sherpa_ncnn {
 
+// Layout of a blob produced by Stream::SaveState()
+//
+//  - magic "SNST", uint32 version
+//  - int32 num_processed_frames, int32 start_frame_index
+//  - feature extractor: int32 frame_offset, int32 last_frame_index,
+//    uint8 input_finished, samples
+//  - encoder states: uint8 storage, bytes
+//  - decoder result: int32 frame_offset, int32 num_trailing_blanks,
+//    tokens, timestamps, decoder_out, hyps
+//  - int32 degradation_level (version >= 2)
+//
+// A vector is saved as a uint32 count followed by its elements.
+static constexpr char kStateMagic[4] = {'S', 'N', 'S', 'T'};
+static constexpr uint32_t kStateVersion = 2;
+
+static std::atomic<int64_t> g_next_stream_id{0};
+
+class StateWriter {
+ public:
+  explicit StateWriter(std::vector<uint8_t> *buf) : buf_(buf) {}
+
+  void WriteBytes(const void *p, size_t n) {
+    const auto *q = static_cast<const uint8_t *>(p);
+    buf_->insert(buf_->end(), q, q + n);
+  }
+
+  template <typename T>
+  void Write(T v) {
+    WriteBytes(&v, sizeof(T));
+  }
+
+  template <typename T>
+  void WriteVector(const std::vector<T> &v) {
+    Write<uint32_t>(v.size());
+    WriteBytes(v.data(), v.size() * sizeof(T));
+  }
+
+  void WriteMat(const ncnn::Mat &m) {
+    Write<int32_t>(m.dims);
+    if (m.dims == 0) return;
+
+    Write<int32_t>(m.w);
+    Write<int32_t>(m.h);
+    Write<int32_t>(m.d);
+    Write<int32_t>(m.c);
+    Write<uint32_t>(m.elemsize);
+
+    size_t plane = static_cast<size_t>(m.w) * m.h * m.d * m.elemsize;
+    for (int32_t q = 0; q != m.c; ++q) {
+      const auto *p = static_cast<const uint8_t *>(m.data);
+      WriteBytes(p + q * m.cstep * m.elemsize, plane);
+    }
+  }
+
+ private:
+  std::vector<uint8_t> *buf_;
+};
+
+class StateReader {
+ public:
+  StateReader(const uint8_t *data, size_t n) : p_(data), end_(data + n) {}
+
+  // Number of bytes not read yet
+  size_t Remaining() const { return end_ - p_; }
+
+  bool ReadBytes(void *p, size_t n) {
+    if (Remaining() < n) return false;
+    std::memcpy(p, p_, n);
+    p_ += n;
+    return true;
+  }
+
+  template <typename T>
+  bool Read(T *v) {
+    return ReadBytes(v, sizeof(T));
+  }
+
+  template <typename T>
+  bool ReadVector(std::vector<T> *v) {
+    uint32_t n;
+    if (!Read(&n) || n > Remaining() / sizeof(T)) return false;
+
+    v->resize(n);
+    return ReadBytes(v->data(), n * sizeof(T));
+  }
+
+  bool ReadMat(ncnn::Mat *m) {
+    int32_t dims;
+    if (!Read(&dims)) return false;
+    if (dims == 0) {
+      m->release();
+      return true;
+    }
+
+    int32_t w, h, d, c;
+    uint32_t elemsize;
+    if (!Read(&w) || !Read(&h) || !Read(&d) || !Read(&c) || !Read(&elemsize)) {
+      return false;
+    }
+
+    if (w <= 0 || h <= 0 || d <= 0 || c <= 0) return false;
+
+    // Unused axes of a Mat are 1
+    if (dims < 1 || dims > 4 || (dims < 2 && h != 1) || (dims < 4 && d != 1) ||
+        (dims < 3 && c != 1)) {
+      return false;
+    }
+
+    // fp32, fp16, bf16 or int8
+    if (elemsize != 1 && elemsize != 2 && elemsize != 4) return false;
+
+    // Check that the data is there before allocating. Each factor is
+    // checked against the bytes left, so the products cannot overflow.
+    size_t es = elemsize;
+    size_t remaining = Remaining();
+    size_t plane = es;
+    for (int32_t k : {w, h, d}) {
+      if (static_cast<size_t>(k) > remaining / plane) return false;
+      plane *= k;
+    }
+
+    if (static_cast<size_t>(c) > remaining / plane) return false;
+
+    switch (dims) {
+      case 1:
+        m->create(w, es);
+        break;
+      case 2:
+        m->create(w, h, es);
+        break;
+      case 3:
+        m->create(w, h, c, es);
+        break;
+      case 4:
+        m->create(w, h, d, c, es);
+        break;
+      default:
+        return false;
+    }
+
+    if (m->empty()) return false;
+
+    for (int32_t q = 0; q != c; ++q) {
+      if (!ReadBytes(static_cast<uint8_t *>(m->data) + q * m->cstep * es,
+                     plane)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool Done() const { return p_ == end_; }
+
+ private:
+  const uint8_t *p_;
+  const uint8_t *end_;
+};
+
+static int64_t VectorBytes(const std::vector<int32_t> &v) {
+  return v.capacity() * sizeof(int32_t);
+}
+
+static int64_t DecoderResultBytes(const DecoderResult &r) {
+  int64_t ans = VectorBytes(r.tokens) + VectorBytes(r.timestamps);
+  ans += r.decoder_out.total() * r.decoder_out.elemsize;
+
+  for (const auto &p : r.hyps) {
+    const Hypothesis &hyp = p.second;
+    ans += sizeof(p) + p.first.capacity();
+    ans += VectorBytes(hyp.ys) + VectorBytes(hyp.timestamps);
+  }
+
+  return ans;
+}
+
 class Stream::Impl {
  public:
   explicit Impl(const FeatureExtractorConfig &config,
                 ContextGraphPtr context_graph)
-      : feat_extractor_(config), context_graph_(context_graph) {}
+      : feat_extractor_(config),
+        context_graph_(context_graph),
+        context_graph_bytes_(context_graph ? context_graph->NumBytes() : 0) {}
 
   void AcceptWaveform(int32_t sampling_rate, const float *waveform, int32_t n) {
+    ScopedTraceStream trace_stream(id_);
+    ScopedTraceSpan span("AcceptWaveform");
+    ScopedDecodeCounters counters(&counters_, recognizer_counters_.get());
     feat_extractor_.AcceptWaveform(sampling_rate, waveform, n);
   }
 
-  void InputFinished() { feat_extractor_.InputFinished(); }
+  void InputFinished() {
+    ScopedTraceStream trace_stream(id_);
+    ScopedTraceSpan span("InputFinished");
+    ScopedDecodeCounters counters(&counters_, recognizer_counters_.get());
+    feat_extractor_.InputFinished();
+  }
+
+  int64_t GetId() const { return id_; }
 
   int32_t NumFramesReady() const {
     return feat_extractor_.NumFramesReady() - start_frame_index_;
@@ -59,19 +257,220 @@ class Stream::Impl {
 
   DecoderResult &GetResult() { return result_; }
 
-  void SetStates(const std::vector<ncnn::Mat> &states) { states_ = states; }
+  void SetStates(const std::vector<ncnn::Mat> &states) {
+    if (states_.Current().size() != states.size()) {
+      states_.Init(states, states_.Storage(), states_.IntegerStates());
+    } else {
+      states_.Assign(states);
+    }
+  }
+
+  const std::vector<ncnn::Mat> &GetStates() const { return states_.Current(); }
 
-  std::vector<ncnn::Mat> &GetStates() { return states_; }
+  EncoderStateArena &GetStateArena() { return states_; }
 
   const ContextGraphPtr &GetContextGraph() const { return context_graph_; }
 
+  void SaveState(std::vector<uint8_t> *state) const {
+    state->clear();
+    StateWriter w(state);
+
+    w.WriteBytes(kStateMagic, sizeof(kStateMagic));
+    w.Write<uint32_t>(kStateVersion);
+
+    w.Write<int32_t>(num_processed_frames_);
+    w.Write<int32_t>(start_frame_index_);
+
+    FeatureExtractorSnapshot feat = feat_extractor_.GetSnapshot(
+        start_frame_index_ + num_processed_frames_);
+    w.Write<int32_t>(feat.frame_offset);
+    w.Write<int32_t>(feat.last_frame_index);
+    w.Write<uint8_t>(feat.input_finished);
+    w.WriteVector(feat.samples);
+
+    w.Write<uint8_t>(static_cast<uint8_t>(states_.Storage()));
+    w.Write<uint64_t>(states_.NumBytes());
+    w.WriteBytes(states_.Data(), states_.NumBytes());
+
+    w.Write<int32_t>(result_.frame_offset);
+    w.Write<int32_t>(result_.num_trailing_blanks);
+    w.WriteVector(result_.tokens);
+    w.WriteVector(result_.timestamps);
+    w.WriteMat(result_.decoder_out);
+
+    std::unordered_map<const ContextState *, int32_t> state_ids;
+    if (context_graph_) {
+      auto context_states = context_graph_->GetStates();
+      for (int32_t i = 0; i != context_states.size(); ++i) {
+        state_ids[context_states[i]] = i;
+      }
+    }
+
+    w.Write<uint32_t>(result_.hyps.Size());
+    for (const auto &p : result_.hyps) {
+      const Hypothesis &hyp = p.second;
+      w.WriteVector(hyp.ys);
+      w.WriteVector(hyp.timestamps);
+      w.Write<double>(hyp.log_prob);
+
+      int32_t id = -1;
+      auto it = state_ids.find(hyp.context_state);
+      if (it != state_ids.end()) id = it->second;
+      w.Write<int32_t>(id);
+
+      w.Write<int32_t>(hyp.num_trailing_blanks);
+    }
+
+    w.Write<int32_t>(degradation_level_);
+  }
+
+  bool RestoreState(const uint8_t *data, size_t n) {
+    StateReader r(data, n);
+
+    char magic[sizeof(kStateMagic)];
+    uint32_t version;
+    if (!r.ReadBytes(magic, sizeof(magic)) ||
+        std::memcmp(magic, kStateMagic, sizeof(magic)) != 0) {
+      NCNN_LOGE("Not a stream state");
+      return false;
+    }
+
+    // Version 1 has no degradation level
+    if (!r.Read(&version) || version < 1 || version > kStateVersion) {
+      NCNN_LOGE("Unsupported stream state version: %d. Expected: 1 to %d",
+                static_cast<int32_t>(version),
+                static_cast<int32_t>(kStateVersion));
+      return false;
+    }
+
+    int32_t num_processed_frames;
+    int32_t start_frame_index;
+    if (!r.Read(&num_processed_frames) || !r.Read(&start_frame_index)) {
+      return false;
+    }
+
+    FeatureExtractorSnapshot feat;
+    uint8_t input_finished;
+    if (!r.Read(&feat.frame_offset) || !r.Read(&feat.last_frame_index) ||
+        !r.Read(&input_finished) || !r.ReadVector(&feat.samples)) {
+      return false;
+    }
+    feat.input_finished = input_finished;
+
+    uint8_t storage;
+    uint64_t num_bytes;
+    if (!r.Read(&storage) || !r.Read(&num_bytes)) return false;
+
+    if (storage != static_cast<uint8_t>(states_.Storage()) ||
+        num_bytes != states_.NumBytes()) {
+      NCNN_LOGE(
+          "Encoder states mismatch. Please use the same model and "
+          "state_storage for saving and restoring.");
+      return false;
+    }
+
+    std::vector<uint8_t> encoder_states(num_bytes);
+    if (!r.ReadBytes(encoder_states.data(), num_bytes)) return false;
+
+    DecoderResult result;
+    if (!r.Read(&result.frame_offset) ||
+        !r.Read(&result.num_trailing_blanks) || !r.ReadVector(&result.tokens) ||
+        !r.ReadVector(&result.timestamps) || !r.ReadMat(&result.decoder_out)) {
+      return false;
+    }
+
+    std::vector<const ContextState *> context_states;
+    if (context_graph_) {
+      context_states = context_graph_->GetStates();
+    }
+
+    // Each hypothesis takes at least this number of bytes. It bounds the
+    // number of hypotheses before they are allocated.
+    constexpr size_t kMinHypBytes = 2 * sizeof(uint32_t) + sizeof(double) +
+                                    2 * sizeof(int32_t);
+
+    uint32_t num_hyps;
+    if (!r.Read(&num_hyps) || num_hyps > r.Remaining() / kMinHypBytes) {
+      return false;
+    }
+
+    std::vector<Hypothesis> hyps(num_hyps);
+    for (auto &hyp : hyps) {
+      int32_t id;
+      if (!r.ReadVector(&hyp.ys) || !r.ReadVector(&hyp.timestamps) ||
+          !r.Read(&hyp.log_prob) || !r.Read(&id) ||
+          !r.Read(&hyp.num_trailing_blanks)) {
+        return false;
+      }
+
+      if (id >= static_cast<int32_t>(context_states.size())) {
+        NCNN_LOGE(
+            "Invalid context state. Please use the same hotwords for saving "
+            "and restoring.");
+        return false;
+      }
+
+      hyp.context_state = id < 0 ? nullptr : context_states[id];
+    }
+    result.hyps = Hypotheses(std::move(hyps));
+
+    int32_t degradation_level = 0;
+    if (version >= 2 && !r.Read(&degradation_level)) return false;
+
+    if (!r.Done()) return false;
+
+    // Everything is parsed. Now it is safe to modify this stream.
+    num_processed_frames_ = num_processed_frames;
+    start_frame_index_ = start_frame_index;
+    feat_extractor_.RestoreSnapshot(feat);
+    states_.SetData(encoder_states.data(), encoder_states.size());
+    result_ = std::move(result);
+    degradation_level_ = degradation_level;
+
+    return true;
+  }
+
+  int32_t GetDegradationLevel() const { return degradation_level_; }
+
+  void SetDegradationLevel(int32_t level) { degradation_level_ = level; }
+
+  StreamMemoryUsage GetMemoryUsage() const {
+    StreamMemoryUsage ans;
+    ans.features = feat_extractor_.NumBytes();
+    ans.encoder_states = states_.AllocatedBytes();
+    ans.decoder_result = DecoderResultBytes(result_);
+    ans.context_graph = context_graph_bytes_;
+    return ans;
+  }
+
+  AtomicDecodeCounters &GetAtomicCounters() { return counters_; }
+
+  void SetRecognizerCounters(std::shared_ptr<AtomicDecodeCounters> counters) {
+    recognizer_counters_ = std::move(counters);
+  }
+
+  void SetAllocators(std::shared_ptr<void> allocators) {
+    allocators_ = std::move(allocators);
+  }
+
  private:
+  // Declared first so that the blobs below are freed before it
+  std::shared_ptr<void> allocators_;
+
   FeatureExtractor feat_extractor_;
   ContextGraphPtr context_graph_;
+  int64_t context_graph_bytes_;
   int32_t num_processed_frames_ = 0;  // before subsampling
   int32_t start_frame_index_ = 0;
   DecoderResult result_;
-  std::vector<ncnn::Mat> states_;
+  EncoderStateArena states_;
+  int32_t degradation_level_ = 0;
+  const int64_t id_ =
+      g_next_stream_id.fetch_add(1, std::memory_order_relaxed);
+  AtomicDecodeCounters counters_;
+
+  // Shared with the recognizer, which may be destroyed first
+  std::shared_ptr<AtomicDecodeCounters> recognizer_counters_;
 };
 
 Stream::Stream(const FeatureExtractorConfig &config,
@@ -111,9 +510,52 @@ void Stream::SetStates(const std::vector<ncnn::Mat> &states) {
   impl_->SetStates(states);
 }
 
-std::vector<ncnn::Mat> &Stream::GetStates() { return impl_->GetStates(); }
+const std::vector<ncnn::Mat> &Stream::GetStates() const {
+  return impl_->GetStates();
+}
+
+EncoderStateArena &Stream::GetStateArena() { return impl_->GetStateArena(); }
+
+void Stream::SaveState(std::vector<uint8_t> *state) const {
+  impl_->SaveState(state);
+}
+
+bool Stream::RestoreState(const uint8_t *data, size_t n) {
+  return impl_->RestoreState(data, n);
+}
+
+int32_t Stream::GetDegradationLevel() const {
+  return impl_->GetDegradationLevel();
+}
+
+void Stream::SetDegradationLevel(int32_t level) {
+  impl_->SetDegradationLevel(level);
+}
 
 const ContextGraphPtr &Stream::GetContextGraph() const {
   return impl_->GetContextGraph();
 }
+
+int64_t Stream::GetId() const { return impl_->GetId(); }
+
+DecodeCounters Stream::GetCounters() const {
+  return impl_->GetAtomicCounters().Get();
+}
+
+StreamMemoryUsage Stream::GetMemoryUsage() const {
+  return impl_->GetMemoryUsage();
+}
+
+AtomicDecodeCounters &Stream::GetAtomicCounters() {
+  return impl_->GetAtomicCounters();
+}
+
+void Stream::SetAllocators(std::shared_ptr<void> allocators) {
+  impl_->SetAllocators(std::move(allocators));
+}
+
+void Stream::SetRecognizerCounters(
+    std::shared_ptr<AtomicDecodeCounters> counters) {
+  impl_->SetRecognizerCounters(std::move(counters));
+}
 }  // namespace sherpa_ncnn
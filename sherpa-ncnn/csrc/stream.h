@@ -19,12 +19,16 @@
 #ifndef SHERPA_NCNN_CSRC_STREAM_H_
 #define SHERPA_NCNN_CSRC_STREAM_H_
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
 #include "sherpa-ncnn/csrc/context-graph.h"
 #include "sherpa-ncnn/csrc/decoder.h"
+#include "sherpa-ncnn/csrc/encoder-state-arena.h"
 #include "sherpa-ncnn/csrc/features.h"
+#include "sherpa-ncnn/csrc/memory-usage.h"
+#include "sherpa-ncnn/csrc/stage-counters.h"
 
 namespace sherpa_ncnn {
 class Stream {
@@ -80,8 +84,49 @@ class Stream {
   void SetResult(const DecoderResult &r);
   DecoderResult &GetResult();
 
+  // Copy the given states into the state arena of this stream. The arena
+  // is (re-)initialized if the number of states changes.
   void SetStates(const std::vector<ncnn::Mat> &states);
-  std::vector<ncnn::Mat> &GetStates();
+
+  // Return views of the current encoder states in the storage type of the
+  // state arena. They point into the arena and are overwritten by
+  // subsequent calls to Model::RunEncoder(features, &GetStateArena()).
+  const std::vector<ncnn::Mat> &GetStates() const;
+
+  // Return the arena holding the encoder states of this stream.
+  EncoderStateArena &GetStateArena();
+
+  /** Serialize the state of this stream into a versioned binary blob.
+   *
+   * It contains the encoder states, the decoder result, frame counters,
+   * samples for frames that are not processed yet and positions in the
+   * context graph. The blob uses the byte order of the host.
+   *
+   * @param state  On return, it contains the serialized state.
+   */
+  void SaveState(std::vector<uint8_t> *state) const;
+
+  /** Restore a state produced by SaveState().
+   *
+   * This stream must be freshly created by a recognizer with the same
+   * config (model, state storage, hotwords) as the saved stream.
+   *
+   * Decoding continues with bit-identical results. The only exception is
+   * modified_beam_search with hypotheses whose scores tie exactly, since
+   * the iteration order of restored hypotheses may differ.
+   *
+   * @return Return false if the blob is invalid or incompatible. The stream
+   *         should not be used in that case.
+   */
+  bool RestoreState(const uint8_t *data, size_t n);
+
+  // Index into the quality ladder of the recognizer. 0 is the configured
+  // decoding method. Use Recognizer::SetDegradationLevel() to change it.
+  int32_t GetDegradationLevel() const;
+
+  // Only set the index. It does not convert the decoder result.
+  void SetDegradationLevel(int32_t level);
+
   /**
    * Get the context graph corresponding to this stream.
    *
@@ -89,6 +134,34 @@ class Stream {
    */
   const ContextGraphPtr &GetContextGraph() const;
 
+  // Return an id that is unique among the streams of this process.
+  // It tags the spans of this stream in traces. See trace-recorder.h
+  int64_t GetId() const;
+
+  // Return the counters of this stream. See Recognizer::GetCounters().
+  DecodeCounters GetCounters() const;
+
+  /** Return the bytes held by this stream.
+   *
+   * The cached decoder output is allocated by the blob allocator of the
+   * recognizer, so it is also part of RecognizerMemoryUsage::blob_bytes.
+   * Like SetDegradationLevel(), it must not be called while the stream is
+   * being decoded.
+   */
+  StreamMemoryUsage GetMemoryUsage() const;
+
+  // The counters of this stream, to be updated by the recognizer
+  AtomicDecodeCounters &GetAtomicCounters();
+
+  // Feature extraction of this stream is also added to the given counters.
+  // They are shared with the recognizer, so the stream may outlive it.
+  void SetRecognizerCounters(std::shared_ptr<AtomicDecodeCounters> counters);
+
+  // Keep the allocators of the blobs held by this stream, e.g., the cached
+  // decoder output, alive until the stream is destroyed. It is set by the
+  // recognizer.
+  void SetAllocators(std::shared_ptr<void> allocators);
+
  private:
   class Impl;
   std::unique_ptr<Impl> impl_;
@@ -18,11 +18,18 @@
 
 #include "sherpa-ncnn/csrc/tensorasstrided.h"
 
+#include <string.h>
+
 namespace sherpa_ncnn {
 
 TensorAsStrided::TensorAsStrided() {
   one_blob_only = true;
   support_inplace = false;
+
+  // It only moves elements, so it works on bytes. A packed element holds
+  // the same position of elempack channels.
+  support_packing = true;
+  support_fp16_storage = true;
 }
 
 int32_t TensorAsStrided::load_param(const ncnn::ParamDict &pd) {
@@ -59,15 +66,15 @@ int32_t TensorAsStrided::forward(const ncnn::Mat &bottom_blob,
       return -100;
     }
 
-    int32_t inc = bottom_blob.c;
     int32_t inh = bottom_blob.h;
     int32_t inw = bottom_blob.w;
+    int32_t elempack = bottom_blob.elempack;
 
     int32_t outc = p_sizes[0];
     int32_t outh = p_sizes[1];
     int32_t outw = p_sizes[2];
 
-    if (bottom_blob.c != outc) {
+    if (bottom_blob.c * elempack != outc) {
       NCNN_LOGE("We only implement in_c == out_c right now");
       return -100;
     }
@@ -78,23 +85,39 @@ int32_t TensorAsStrided::forward(const ncnn::Mat &bottom_blob,
     }
 
     size_t elemsize = bottom_blob.elemsize;
-    top_blob.create(outw, outh, outc, elemsize, opt.blob_allocator);
+    top_blob.create(outw, outh, outc / elempack, elemsize, elempack,
+                    opt.blob_allocator);
+    if (top_blob.empty()) return -100;
 
     int32_t stride1 = p_strides[1];
     int32_t stride2 = p_strides[2];
 
+    // The relative positional encoding of Zipformer uses stride2 == 1,
+    // so each output row is a contiguous run of the input
 #pragma omp parallel for num_threads(opt.num_threads)
-    for (int32_t q = 0; q < outc; q++) {
+    for (int32_t q = 0; q < top_blob.c; q++) {
       ncnn::Mat out_m = top_blob.channel(q);
 
-      const float *in_m = bottom_blob.channel(q);
-      in_m += storage_offset;
+      const unsigned char *in_m = bottom_blob.channel(q);
+      in_m += storage_offset * elemsize;
+
+      if (stride2 == 1 && stride1 == outw) {
+        // The whole channel is a contiguous run
+        memcpy(out_m.row<unsigned char>(0), in_m, outw * outh * elemsize);
+        continue;
+      }
 
       for (int32_t y = 0; y < outh; ++y) {
-        float *out_ptr = out_m.row(y);
-        const float *in_ptr = in_m + y * stride1;
+        unsigned char *out_ptr = out_m.row<unsigned char>(y);
+        const unsigned char *in_ptr = in_m + y * stride1 * elemsize;
+        if (stride2 == 1) {
+          memcpy(out_ptr, in_ptr, outw * elemsize);
+          continue;
+        }
+
         for (int32_t x = 0; x < outw; ++x) {
-          out_ptr[x] = in_ptr[x * stride2];
+          memcpy(out_ptr + x * elemsize, in_ptr + x * stride2 * elemsize,
+                 elemsize);
         }
       }
     }
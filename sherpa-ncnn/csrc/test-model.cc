@@ -0,0 +1,726 @@
+// sherpa-ncnn/csrc/test-model.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/test-model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "platform.h"  // NOLINT
+#include "sherpa-ncnn/csrc/param-optimizer.h"
+
+namespace sherpa_ncnn {
+
+// The same as Model::ContextSize()
+static constexpr int32_t kContextSize = 2;
+
+// Frames after subsampling are formed by stacking this number of frames
+static constexpr int32_t kSubsamplingFactor = 4;
+
+// Zipformer, the same as the pretrained models
+static constexpr int32_t kDecodeChunkLength = 32;
+static constexpr int32_t kNumLeftChunks = 4;
+static constexpr int32_t kPadLength = 7;
+static const int32_t kZipformerDownsampling[] = {1, 2, 4, 8, 2};
+
+// ConvEmformer, the same as the pretrained models
+static constexpr int32_t kMemorySize = 32;
+static constexpr int32_t kLeftContextLength = 32;
+static constexpr int32_t kChunkLength = 32;
+static constexpr int32_t kRightContextLength = 8;
+
+// LSTM, see LstmModel::Offset()
+static constexpr int32_t kLstmOffset = 4;
+
+// Tag of fp32 weights in a .bin file
+static constexpr uint32_t kFloat32Tag = 0;
+
+static std::string Param(int32_t key, int32_t value) {
+  return std::to_string(key) + "=" + std::to_string(value);
+}
+
+// ncnn parses a value as float only if it has a decimal point
+static std::string Param(int32_t key, float value) {
+  std::ostringstream os;
+  os << key << "=" << std::showpoint << value;
+  return os.str();
+}
+
+// Array params use the key -23300 - key
+static std::string Param(int32_t key, const std::vector<int32_t> &values) {
+  std::ostringstream os;
+  os << (-23300 - key) << "=" << values.size();
+  for (auto v : values) os << "," << v;
+  return os.str();
+}
+
+// Build a network layer by layer together with its weights
+class NetWriter {
+ public:
+  explicit NetWriter(std::mt19937 *rng) : rng_(rng) {}
+
+  void Add(const std::string &type, const std::string &name,
+           std::vector<std::string> bottoms, std::vector<std::string> tops,
+           std::vector<std::string> params = {}) {
+    ParamLayer layer;
+    layer.type = type;
+    layer.name = name;
+    layer.bottoms = std::move(bottoms);
+    layer.tops = std::move(tops);
+    layer.params = std::move(params);
+    graph_.layers.push_back(std::move(layer));
+  }
+
+  // bias0 is added to the bias of the first output
+  void AddInnerProduct(const std::string &name, const std::string &bottom,
+                       const std::string &top, int32_t num_input,
+                       int32_t num_output, bool relu, float bias0 = 0) {
+    std::vector<std::string> params = {Param(0, num_output), Param(1, 1),
+                                       Param(2, num_input * num_output)};
+    if (relu) params.push_back(Param(9, 1));
+
+    Add("InnerProduct", name, {bottom}, {top}, std::move(params));
+
+    float scale = 1.0f / std::sqrt(static_cast<float>(num_input));
+    AppendWeights(num_input * num_output, scale, true);
+
+    size_t bias_offset = bin_.size();
+    AppendWeights(num_output, scale, false);
+
+    float bias = 0;
+    memcpy(&bias, &bin_[bias_offset], sizeof(float));
+    bias += bias0;
+    memcpy(&bin_[bias_offset], &bias, sizeof(float));
+  }
+
+  void AddDepthWiseConv1D(const std::string &name, const std::string &bottom,
+                          const std::string &top, int32_t channels,
+                          int32_t kernel) {
+    Add("ConvolutionDepthWise1D", name, {bottom}, {top},
+        {Param(0, channels), Param(1, kernel), Param(5, 1),
+         Param(6, channels * kernel), Param(7, channels)});
+
+    float scale = 1.0f / std::sqrt(static_cast<float>(kernel));
+    AppendWeights(channels * kernel, scale, true);
+    AppendWeights(channels, scale, false);
+  }
+
+  void AddSimpleUpsample(const std::string &name, const std::string &bottom,
+                         const std::string &top, int32_t channels,
+                         int32_t upsample) {
+    Add("SimpleUpsample", name, {bottom}, {top},
+        {Param(0, upsample), Param(1, channels),
+         Param(2, channels * upsample)});
+
+    AppendWeights(channels * upsample, 0.1f, true);
+  }
+
+  // A blob can be the input of only one layer. If it is used n times,
+  // add a Split layer. Return the names of the copies.
+  std::vector<std::string> Split(const std::string &blob, int32_t n) {
+    if (n == 1) return {blob};
+
+    std::vector<std::string> tops;
+    for (int32_t i = 0; i != n; ++i) {
+      tops.push_back(blob + "_" + std::to_string(i));
+    }
+
+    Add("Split", blob + "_split", {blob}, tops);
+    return tops;
+  }
+
+  void AddEmbedding(const std::string &name, const std::string &bottom,
+                    const std::string &top, int32_t input_dim,
+                    int32_t num_output) {
+    Add("Embedding", name, {bottom}, {top},
+        {Param(0, num_output), Param(1, input_dim), Param(2, 0),
+         Param(3, input_dim * num_output)});
+
+    AppendWeights(input_dim * num_output, 1.0f, true);
+  }
+
+  bool Write(const std::string &param_filename,
+             const std::string &bin_filename) const {
+    if (!WriteParamGraph(param_filename, graph_)) return false;
+
+    std::ofstream os(bin_filename, std::ios::binary);
+    if (!os) {
+      NCNN_LOGE("Failed to create %s", bin_filename.c_str());
+      return false;
+    }
+
+    os.write(bin_.data(), bin_.size());
+
+    return static_cast<bool>(os);
+  }
+
+ private:
+  // Weights loaded by ncnn with type 0 start with a tag, while biases are
+  // loaded with type 1 and have no tag
+  void AppendWeights(int32_t n, float scale, bool with_tag) {
+    if (with_tag) {
+      const char *p = reinterpret_cast<const char *>(&kFloat32Tag);
+      bin_.insert(bin_.end(), p, p + sizeof(kFloat32Tag));
+    }
+
+    std::uniform_real_distribution<float> dist(-scale, scale);
+    for (int32_t i = 0; i != n; ++i) {
+      float f = dist(*rng_);
+      const char *p = reinterpret_cast<const char *>(&f);
+      bin_.insert(bin_.end(), p, p + sizeof(float));
+    }
+  }
+
+  ParamGraph graph_;
+  std::vector<char> bin_;
+  std::mt19937 *rng_;
+};
+
+bool TestModelConfig::Validate() const {
+  if (model_type < 1 || model_type > 3) {
+    NCNN_LOGE("model_type should be 1, 2 or 3. Given %d", model_type);
+    return false;
+  }
+
+  if (feature_dim < 1 || num_layers < 1 || encoder_dim < 1 || ffn_dim < 1 ||
+      decoder_dim < 1 || joiner_dim < 1) {
+    NCNN_LOGE("Dims and num_layers should be positive");
+    return false;
+  }
+
+  if (attention_dim < 2 || attention_dim % 2 != 0) {
+    NCNN_LOGE("attention_dim should be a positive even number. Given %d",
+              attention_dim);
+    return false;
+  }
+
+  if (cnn_module_kernel < 2) {
+    NCNN_LOGE("cnn_module_kernel should be at least 2. Given %d",
+              cnn_module_kernel);
+    return false;
+  }
+
+  // <blk>, <sos/eos>, <unk> and at least one token
+  if (vocab_size < 4) {
+    NCNN_LOGE("vocab_size should be at least 4. Given %d", vocab_size);
+    return false;
+  }
+
+  return true;
+}
+
+std::string TestModelConfig::ToString() const {
+  std::ostringstream os;
+
+  os << "TestModelConfig(";
+  os << "model_type=" << model_type << ", ";
+  os << "feature_dim=" << feature_dim << ", ";
+  os << "num_layers=" << num_layers << ", ";
+  os << "encoder_dim=" << encoder_dim << ", ";
+  os << "ffn_dim=" << ffn_dim << ", ";
+  os << "attention_dim=" << attention_dim << ", ";
+  os << "cnn_module_kernel=" << cnn_module_kernel << ", ";
+  os << "decoder_dim=" << decoder_dim << ", ";
+  os << "joiner_dim=" << joiner_dim << ", ";
+  os << "vocab_size=" << vocab_size << ", ";
+  os << "blank_bias=" << blank_bias << ", ";
+  os << "seed=" << seed << ")";
+
+  return os.str();
+}
+
+// Number of layers of each Zipformer stack. The layers are split into
+// stacks as evenly as possible.
+static std::vector<int32_t> GetZipformerLayers(const TestModelConfig &config) {
+  int32_t num_stacks = std::min(config.num_layers, 5);
+  std::vector<int32_t> ans(num_stacks, config.num_layers / num_stacks);
+  for (int32_t i = 0; i != config.num_layers % num_stacks; ++i) {
+    ans[i] += 1;
+  }
+
+  return ans;
+}
+
+// Return the SherpaMetaData params and the number of states of the encoder
+static std::vector<std::string> GetMetaData(const TestModelConfig &config,
+                                            int32_t *num_states) {
+  const auto &c = config;
+  std::vector<std::string> params = {Param(0, c.model_type)};
+
+  if (c.model_type == 1) {
+    params.push_back(Param(1, c.num_layers));
+    params.push_back(Param(2, kMemorySize));
+    params.push_back(Param(3, c.cnn_module_kernel));
+    params.push_back(Param(4, kLeftContextLength));
+    params.push_back(Param(5, kChunkLength));
+    params.push_back(Param(6, kRightContextLength));
+    params.push_back(Param(7, c.encoder_dim));
+
+    *num_states = c.num_layers * 4;
+  } else if (c.model_type == 2) {
+    std::vector<int32_t> num_encoder_layers = GetZipformerLayers(c);
+    int32_t num_stacks = num_encoder_layers.size();
+
+    params.push_back(Param(1, kDecodeChunkLength));
+    params.push_back(Param(2, kNumLeftChunks));
+    params.push_back(Param(3, kPadLength));
+    params.push_back(Param(15, 1));  // version
+    params.push_back(Param(16, num_encoder_layers));
+    params.push_back(
+        Param(17, std::vector<int32_t>(num_stacks, c.encoder_dim)));
+    params.push_back(
+        Param(18, std::vector<int32_t>(num_stacks, c.attention_dim)));
+    params.push_back(Param(
+        19, std::vector<int32_t>(kZipformerDownsampling,
+                                 kZipformerDownsampling + num_stacks)));
+    params.push_back(
+        Param(20, std::vector<int32_t>(num_stacks, c.cnn_module_kernel)));
+
+    *num_states = num_stacks * 7;
+  } else {
+    params.push_back(Param(1, c.num_layers));
+    params.push_back(Param(2, c.encoder_dim));
+    params.push_back(Param(3, c.ffn_dim));
+
+    *num_states = 2;
+  }
+
+  return params;
+}
+
+// Number of feature frames consumed by each chunk, i.e., Model::Offset()
+static int32_t GetOffset(int32_t model_type) {
+  switch (model_type) {
+    case 1:
+      return kChunkLength;
+    case 2:
+      return kDecodeChunkLength;
+    default:
+      return kLstmOffset;
+  }
+}
+
+// The 7 states of each Zipformer stack. They are grouped by kind in the
+// encoder inputs: cached_len of all stacks, then cached_avg of all stacks,
+// and so on. See ZipformerModel::GetEncoderInitStates()
+enum ZipformerState {
+  kCachedLen = 0,
+  kCachedAvg,
+  kCachedKey,
+  kCachedVal,
+  kCachedVal2,
+  kCachedConv1,
+  kCachedConv2,
+};
+
+// Return the index of a state in the encoder inputs, where in0 is the
+// features
+static int32_t ZipformerStateIndex(int32_t state, int32_t stack,
+                                   int32_t num_stacks) {
+  return 1 + state * num_stacks + stack;
+}
+
+// Crop layer j from a state of shape (num_layers, h, w) and reshape it
+// to (h, w)
+static std::string CropLayer(const std::string &state, int32_t j, int32_t w,
+                             int32_t h, const std::string &name,
+                             NetWriter *writer) {
+  writer->Add("Crop", name + "_crop", {state}, {name + "_3d"},
+              {Param(2, j), Param(3, w), Param(4, h), Param(5, 1)});
+  writer->Add("Reshape", name + "_reshape", {name + "_3d"}, {name},
+              {Param(0, w), Param(1, h)});
+  return name;
+}
+
+// Add layer j of the first Zipformer stack on top of x, which has shape
+// (num_frames, encoder_dim), and return its output. Like the layers of the
+// exported models, it has
+//
+//  - the pooling module (PoolingModuleNoProj) with cached_len, cached_avg
+//  - attention over the cached frames and this chunk with cached_key,
+//    cached_val and relative positions shifted by TensorAsStrided
+//  - the convolution module, a depthwise convolution over cached_conv1
+//    and this chunk
+//  - a branch at half the frame rate, upsampled back by SimpleUpsample
+//
+// each with a residual connection. states[k] is layer j of state k.
+// new_states[k] receives the next value of state k of this layer.
+static std::string AddZipformerLayer(const TestModelConfig &config,
+                                     int32_t j, int32_t num_frames,
+                                     int32_t left_context,
+                                     const std::string &x,
+                                     const std::vector<std::string> &states,
+                                     std::vector<std::string> *new_states,
+                                     NetWriter *w) {
+  const auto &c = config;
+  std::string l = "zipformer" + std::to_string(j);
+  int32_t t = num_frames;
+  int32_t v_dim = c.attention_dim / 2;
+
+  // 1. Pooling module
+  auto x0 = w->Split(x, 2);
+  (*new_states)[kCachedLen] = l + "_cached_len";
+  (*new_states)[kCachedAvg] = l + "_cached_avg";
+  w->Add("PoolingModuleNoProj", l + "_pooling",
+         {x0[0], states[kCachedLen], states[kCachedAvg]},
+         {l + "_pooled", (*new_states)[kCachedLen],
+          (*new_states)[kCachedAvg]});
+  w->Add("BinaryOp", l + "_pooling_residual", {x0[1], l + "_pooled"},
+         {l + "_x1"}, {Param(0, 0)});
+
+  // 2. Attention. Keys and values of this chunk are appended to the
+  // cached ones, and the last left_context of them are cached.
+  auto x1 = w->Split(l + "_x1", 5);
+  w->AddInnerProduct(l + "_q", x1[0], l + "_query", c.encoder_dim,
+                     c.attention_dim, false);
+  w->AddInnerProduct(l + "_k", x1[1], l + "_key", c.encoder_dim,
+                     c.attention_dim, false);
+  w->AddInnerProduct(l + "_v", x1[2], l + "_value", c.encoder_dim, v_dim,
+                     false);
+
+  w->Add("Concat", l + "_key_concat", {states[kCachedKey], l + "_key"},
+         {l + "_keys"}, {Param(0, 0)});
+  auto keys = w->Split(l + "_keys", 2);
+  (*new_states)[kCachedKey] = l + "_cached_key";
+  w->Add("Crop", l + "_key_crop", {keys[1]}, {(*new_states)[kCachedKey]},
+         {Param(1, t), Param(3, c.attention_dim), Param(4, left_context)});
+
+  w->Add("Concat", l + "_value_concat", {states[kCachedVal], l + "_value"},
+         {l + "_values"}, {Param(0, 0)});
+  auto values = w->Split(l + "_values", 2);
+  (*new_states)[kCachedVal] = l + "_cached_val";
+  w->Add("Crop", l + "_value_crop", {values[1]}, {(*new_states)[kCachedVal]},
+         {Param(1, t), Param(3, v_dim), Param(4, left_context)});
+
+  // (left_context + t, t)
+  int32_t num_keys = left_context + t;
+  w->Add("MatMul", l + "_scores", {l + "_query", keys[0]}, {l + "_content"},
+         {Param(0, 1)});
+
+  // Scores of the 2 * t - 1 + left_context relative positions. Row i is
+  // shifted by t - 1 - i as in the exported models.
+  int32_t num_pos = num_keys + t - 1;
+  w->AddInnerProduct(l + "_pos", x1[3], l + "_pos_all", c.encoder_dim,
+                     num_pos, false);
+  w->Add("Reshape", l + "_pos_3d", {l + "_pos_all"}, {l + "_pos_3d"},
+         {Param(0, num_pos), Param(1, t), Param(2, 1)});
+  w->Add("TensorAsStrided", l + "_rel_shift", {l + "_pos_3d"},
+         {l + "_pos_shifted"},
+         {Param(0, std::vector<int32_t>{1, t, num_keys}),
+          Param(1, std::vector<int32_t>{t * num_pos, num_pos - 1, 1}),
+          Param(2, t - 1)});
+  w->Add("Reshape", l + "_pos_2d", {l + "_pos_shifted"}, {l + "_position"},
+         {Param(0, num_keys), Param(1, t)});
+
+  w->Add("BinaryOp", l + "_logits", {l + "_content", l + "_position"},
+         {l + "_logits"}, {Param(0, 0)});
+  w->Add("Softmax", l + "_softmax", {l + "_logits"}, {l + "_weights"},
+         {Param(0, 1), Param(1, 1)});
+  w->Add("MatMul", l + "_attention", {l + "_weights", values[0]},
+         {l + "_attended"});
+  w->AddInnerProduct(l + "_out_proj", l + "_attended", l + "_attention_out",
+                     v_dim, c.encoder_dim, false);
+  w->Add("BinaryOp", l + "_attention_residual",
+         {x1[4], l + "_attention_out"}, {l + "_x2"}, {Param(0, 0)});
+
+  // 3. Convolution module over time, i.e., on the transposed input.
+  // The last cnn_module_kernel - 1 frames are cached.
+  int32_t k = c.cnn_module_kernel;
+  auto x2 = w->Split(l + "_x2", 2);
+  w->Add("Permute", l + "_conv_in", {x2[0]}, {l + "_xt"}, {Param(0, 1)});
+  w->Add("Concat", l + "_conv_concat", {states[kCachedConv1], l + "_xt"},
+         {l + "_padded"}, {Param(0, 1)});
+  auto padded = w->Split(l + "_padded", 2);
+  (*new_states)[kCachedConv1] = l + "_cached_conv1";
+  w->Add("Crop", l + "_conv_crop", {padded[1]},
+         {(*new_states)[kCachedConv1]},
+         {Param(0, t), Param(3, k - 1), Param(4, c.encoder_dim)});
+  w->AddDepthWiseConv1D(l + "_depthwise", padded[0], l + "_conv",
+                        c.encoder_dim, k);
+  w->Add("Permute", l + "_conv_out", {l + "_conv"}, {l + "_convt"},
+         {Param(0, 1)});
+  w->Add("BinaryOp", l + "_conv_residual", {x2[1], l + "_convt"},
+         {l + "_x3"}, {Param(0, 0)});
+
+  // 4. Downsample by 2 and upsample back
+  auto x3 = w->Split(l + "_x3", 2);
+  w->Add("Reshape", l + "_downsample", {x3[0]}, {l + "_pairs"},
+         {Param(0, 2 * c.encoder_dim), Param(1, t / 2)});
+  w->AddInnerProduct(l + "_downsample_proj", l + "_pairs", l + "_down",
+                     2 * c.encoder_dim, c.encoder_dim, false);
+  w->AddSimpleUpsample(l + "_upsample", l + "_down", l + "_up_3d",
+                       c.encoder_dim, 2);
+  w->Add("Reshape", l + "_upsample_reshape", {l + "_up_3d"}, {l + "_up"},
+         {Param(0, c.encoder_dim), Param(1, t)});
+
+  std::string y = l + "_out";
+  w->Add("BinaryOp", l + "_upsample_residual", {x3[1], l + "_up"}, {y},
+         {Param(0, 0)});
+
+  return y;
+}
+
+// Add the layers of the first Zipformer stack on top of x and return
+// their output. They update the states of the stack except cached_val2
+// and cached_conv2, whose next values are added by the caller.
+static std::string AddZipformerStack(const TestModelConfig &config,
+                                     int32_t num_frames, const std::string &x,
+                                     NetWriter *w) {
+  const auto &c = config;
+  std::vector<int32_t> num_encoder_layers = GetZipformerLayers(c);
+  int32_t num_stacks = num_encoder_layers.size();
+  int32_t num_layers = num_encoder_layers[0];
+
+  // The first stack is not downsampled
+  int32_t left_context = kDecodeChunkLength / 2 * kNumLeftChunks;
+  int32_t v_dim = c.attention_dim / 2;
+  int32_t k = c.cnn_module_kernel;
+
+  auto Input = [&](int32_t state) {
+    return w->Split("in" + std::to_string(ZipformerStateIndex(state, 0,
+                                                              num_stacks)),
+                    num_layers);
+  };
+
+  auto len = Input(kCachedLen);
+  auto avg = Input(kCachedAvg);
+  auto key = Input(kCachedKey);
+  auto val = Input(kCachedVal);
+  auto conv = Input(kCachedConv1);
+
+  std::vector<std::vector<std::string>> new_states(7);
+  std::string y = x;
+  for (int32_t j = 0; j != num_layers; ++j) {
+    std::string l = "zipformer" + std::to_string(j);
+
+    std::vector<std::string> states(7);
+    states[kCachedLen] = l + "_len_in";
+    w->Add("Crop", l + "_len_crop", {len[j]}, {states[kCachedLen]},
+           {Param(0, j), Param(3, 1)});
+    states[kCachedAvg] = l + "_avg_in";
+    w->Add("Crop", l + "_avg_crop", {avg[j]}, {states[kCachedAvg]},
+           {Param(1, j), Param(3, c.encoder_dim), Param(4, 1)});
+    states[kCachedKey] = CropLayer(key[j], j, c.attention_dim, left_context,
+                                   l + "_key_in", w);
+    states[kCachedVal] =
+        CropLayer(val[j], j, v_dim, left_context, l + "_val_in", w);
+    states[kCachedConv1] =
+        CropLayer(conv[j], j, k - 1, c.encoder_dim, l + "_conv_in", w);
+
+    std::vector<std::string> next(7);
+    y = AddZipformerLayer(c, j, num_frames, left_context, y, states, &next,
+                          w);
+
+    for (int32_t s : {kCachedLen, kCachedAvg, kCachedKey, kCachedVal,
+                      kCachedConv1}) {
+      new_states[s].push_back(next[s]);
+    }
+  }
+
+  // The next states of the layers are stacked into (num_layers, ...) as
+  // in the exported models
+  for (int32_t s : {kCachedLen, kCachedAvg, kCachedKey, kCachedVal,
+                    kCachedConv1}) {
+    std::string out =
+        "out" + std::to_string(ZipformerStateIndex(s, 0, num_stacks));
+    w->Add("Stack", "zipformer_stack" + std::to_string(s), new_states[s],
+           {out}, {Param(0, 0)});
+  }
+
+  return y;
+}
+
+static bool WriteEncoder(const TestModelConfig &config, const std::string &dir,
+                         std::mt19937 *rng) {
+  const auto &c = config;
+  NetWriter w(rng);
+
+  int32_t num_states = 0;
+  w.Add("SherpaMetaData", "sherpa_meta_data1", {}, {},
+        GetMetaData(c, &num_states));
+
+  w.Add("Input", "in0", {}, {"in0"});
+
+  // LSTM has the input feature_length and the output encoder_out_lens
+  // before the states
+  int32_t first_state = 1;
+  if (c.model_type == 3) {
+    w.Add("Input", "in1", {}, {"in1"});
+    w.Add("BinaryOp", "encoder_out_lens", {"in1"}, {"out1"},
+          {Param(0, 3), Param(1, 1), Param(2, 1.0f * kSubsamplingFactor)});
+    first_state = 2;
+  }
+
+  for (int32_t i = first_state; i != first_state + num_states; ++i) {
+    std::string in = "in" + std::to_string(i);
+    w.Add("Input", in, {}, {in});
+  }
+
+  // The layers of the first Zipformer stack update its states except
+  // cached_val2 and cached_conv2
+  int32_t num_stacks = c.model_type == 2 ? num_states / 7 : 0;
+  auto UpdatedByLayers = [&](int32_t i) {
+    int32_t stack = (i - 1) % std::max(num_stacks, 1);
+    int32_t state = (i - 1) / std::max(num_stacks, 1);
+    return num_stacks > 0 && stack == 0 && state != kCachedVal2 &&
+           state != kCachedConv2;
+  };
+
+  // The real models update each state in the encoder layers. Here the
+  // other states are only scaled, which reads and writes them once.
+  for (int32_t i = first_state; i != first_state + num_states; ++i) {
+    if (UpdatedByLayers(i)) continue;
+
+    std::string in = "in" + std::to_string(i);
+    std::string out = "out" + std::to_string(i);
+
+    // cached_len and cached_avg of Zipformer have shapes (num_layers, 1)
+    // and (num_layers, 1, encoder_dim) in the outputs
+    int32_t state = num_stacks > 0 ? (i - 1) / num_stacks : -1;
+    if (state == kCachedLen || state == kCachedAvg) {
+      int32_t n = GetZipformerLayers(c)[(i - 1) % num_stacks];
+      std::string scaled = "scaled" + std::to_string(i);
+      w.Add("BinaryOp", "state" + std::to_string(i), {in}, {scaled},
+            {Param(0, 2), Param(1, 1), Param(2, 0.5f)});
+      w.Add("Reshape", "state_reshape" + std::to_string(i), {scaled}, {out},
+            state == kCachedLen
+                ? std::vector<std::string>{Param(0, 1), Param(1, n)}
+                : std::vector<std::string>{Param(0, c.encoder_dim),
+                                           Param(1, 1), Param(2, n)});
+      continue;
+    }
+
+    w.Add("BinaryOp", "state" + std::to_string(i), {in}, {out},
+          {Param(0, 2), Param(1, 1), Param(2, 0.5f)});
+  }
+
+  // Frames after Offset() are the right context of the chunk. Drop them
+  // and stack every kSubsamplingFactor frames.
+  int32_t offset = GetOffset(c.model_type);
+  w.Add("Crop", "crop", {"in0"}, {"chunk"},
+        {Param(0, 0), Param(1, 0), Param(3, c.feature_dim), Param(4, offset)});
+  w.Add("Reshape", "subsampling", {"chunk"}, {"stacked"},
+        {Param(0, c.feature_dim * kSubsamplingFactor),
+         Param(1, offset / kSubsamplingFactor)});
+
+  w.AddInnerProduct("embed", "stacked", "embedded",
+                    c.feature_dim * kSubsamplingFactor, c.encoder_dim, true);
+
+  std::string x0 = "embedded";
+  if (c.model_type == 2) {
+    x0 = AddZipformerStack(c, offset / kSubsamplingFactor, x0, &w);
+  }
+
+  for (int32_t i = 0; i != c.num_layers; ++i) {
+    std::string l = "layer" + std::to_string(i);
+    std::string x = i == 0 ? x0 : "x" + std::to_string(i);
+    std::string next =
+        i + 1 == c.num_layers ? "out0" : "x" + std::to_string(i + 1);
+
+    w.Add("Split", l + "_split", {x}, {l + "_a", l + "_b"});
+    w.AddInnerProduct(l + "_ffn1", l + "_a", l + "_hidden", c.encoder_dim,
+                      c.ffn_dim, true);
+    w.AddInnerProduct(l + "_ffn2", l + "_hidden", l + "_ffn", c.ffn_dim,
+                      c.encoder_dim, false);
+    w.Add("BinaryOp", l + "_residual", {l + "_b", l + "_ffn"}, {next},
+          {Param(0, 0)});
+  }
+
+  return w.Write(dir + "/encoder.ncnn.param", dir + "/encoder.ncnn.bin");
+}
+
+static bool WriteDecoder(const TestModelConfig &config, const std::string &dir,
+                         std::mt19937 *rng) {
+  const auto &c = config;
+  NetWriter w(rng);
+
+  w.Add("Input", "in0", {}, {"in0"});
+  w.AddEmbedding("embedding", "in0", "embedding_out", c.vocab_size,
+                 c.decoder_dim);
+  w.Add("Flatten", "flatten", {"embedding_out"}, {"context"});
+  w.AddInnerProduct("conv", "context", "out0", kContextSize * c.decoder_dim,
+                    c.decoder_dim, true);
+
+  return w.Write(dir + "/decoder.ncnn.param", dir + "/decoder.ncnn.bin");
+}
+
+static bool WriteJoiner(const TestModelConfig &config, const std::string &dir,
+                        std::mt19937 *rng) {
+  const auto &c = config;
+  NetWriter w(rng);
+
+  w.Add("Input", "in0", {}, {"in0"});
+  w.Add("Input", "in1", {}, {"in1"});
+  w.AddInnerProduct("encoder_proj", "in0", "encoder_proj_out", c.encoder_dim,
+                    c.joiner_dim, false);
+  w.AddInnerProduct("decoder_proj", "in1", "decoder_proj_out", c.decoder_dim,
+                    c.joiner_dim, false);
+  w.Add("BinaryOp", "add", {"encoder_proj_out", "decoder_proj_out"}, {"sum"},
+        {Param(0, 0)});
+  w.Add("TanH", "tanh", {"sum"}, {"activation"});
+  w.AddInnerProduct("output_linear", "activation", "out0", c.joiner_dim,
+                    c.vocab_size, false, c.blank_bias);
+
+  return w.Write(dir + "/joiner.ncnn.param", dir + "/joiner.ncnn.bin");
+}
+
+// <blk>, <sos/eos>, <unk>, and then letter sequences. Every other one
+// starts with ▁ as the BPE tokens starting a word.
+static bool WriteTokens(const TestModelConfig &config,
+                        const std::string &dir) {
+  std::string filename = dir + "/tokens.txt";
+  std::ofstream os(filename);
+  if (!os) {
+    NCNN_LOGE("Failed to create %s", filename.c_str());
+    return false;
+  }
+
+  os << "<blk> 0\n<sos/eos> 1\n<unk> 2\n";
+
+  for (int32_t i = 3; i != config.vocab_size; ++i) {
+    std::string sym;
+    for (int32_t k = i - 3; k >= 0; k = k / 26 - 1) {
+      sym.insert(sym.begin(), static_cast<char>('a' + k % 26));
+    }
+
+    if (i % 2 == 1) sym = "\xe2\x96\x81" + sym;
+
+    os << sym << " " << i << "\n";
+  }
+
+  return static_cast<bool>(os);
+}
+
+bool GenerateTestModel(const TestModelConfig &config, const std::string &dir) {
+  if (!config.Validate()) return false;
+
+  std::mt19937 rng(config.seed);
+
+  return WriteEncoder(config, dir, &rng) && WriteDecoder(config, dir, &rng) &&
+         WriteJoiner(config, dir, &rng) && WriteTokens(config, dir);
+}
+
+ModelConfig GetTestModelConfig(const std::string &dir) {
+  ModelConfig config;
+  config.encoder_param = dir + "/encoder.ncnn.param";
+  config.encoder_bin = dir + "/encoder.ncnn.bin";
+  config.decoder_param = dir + "/decoder.ncnn.param";
+  config.decoder_bin = dir + "/decoder.ncnn.bin";
+  config.joiner_param = dir + "/joiner.ncnn.param";
+  config.joiner_bin = dir + "/joiner.ncnn.bin";
+  config.tokens = dir + "/tokens.txt";
+  config.use_buffer = false;
+  config.use_vulkan_compute = false;
+
+  return config;
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,95 @@
+// sherpa-ncnn/csrc/test-model.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_TEST_MODEL_H_
+#define SHERPA_NCNN_CSRC_TEST_MODEL_H_
+
+#include <cstdint>
+#include <string>
+
+#include "sherpa-ncnn/csrc/model.h"
+
+namespace sherpa_ncnn {
+
+/* Synthetic transducer models with random weights.
+ *
+ * The generated encoder, decoder and joiner have the same inputs, outputs,
+ * states and SherpaMetaData as the models exported from icefall, so they
+ * can be loaded by Model::Create() and decoded by Recognizer. The body of
+ * the encoder is a stack of feed-forward layers with residual connections:
+ *
+ *   in0 -> Crop (Offset() frames) -> Reshape (stack 4 frames)
+ *       -> InnerProduct -> num_layers x (InnerProduct, ReLU, InnerProduct,
+ *          BinaryOp add) -> out0
+ *
+ * For Zipformer, the layers of the first stack also have the blocks of the
+ * exported models before their feed-forward part: PoolingModuleNoProj,
+ * attention over the cached keys and values with relative positions
+ * shifted by TensorAsStrided, a depthwise convolution over the cached
+ * frames and a downsampled branch restored by SimpleUpsample. They update
+ * the states of the stack, which are gathered by Stack. The other states
+ * are scaled by a BinaryOp from in<i> to out<i>.
+ *
+ * The decoder is Embedding -> Flatten -> InnerProduct and the joiner is the
+ * same as in icefall, i.e., two projections, add, tanh and the output
+ * projection.
+ *
+ * They are meant for benchmarks and tests without downloading a model.
+ * The recognition results are meaningless.
+ */
+struct TestModelConfig {
+  // 1 - ConvEmformer, 2 - Zipformer, 3 - LSTM, the same as arg0 of
+  // SherpaMetaData
+  int32_t model_type = 2;
+
+  int32_t feature_dim = 80;
+
+  // Number of encoder layers. For Zipformer, they are split into at most
+  // 5 stacks with downsampling factors 1, 2, 4, 8, 2.
+  int32_t num_layers = 12;
+
+  int32_t encoder_dim = 384;
+
+  // Hidden dim of the feed-forward layers. It is also the hidden size
+  // of the LSTM states.
+  int32_t ffn_dim = 1536;
+
+  // Used only by the states of Zipformer
+  int32_t attention_dim = 192;
+
+  // Used only by the states of Zipformer and ConvEmformer
+  int32_t cnn_module_kernel = 31;
+
+  int32_t decoder_dim = 512;
+  int32_t joiner_dim = 512;
+
+  // Including <blk>, which is 0
+  int32_t vocab_size = 500;
+
+  // Added to the blank logit so that most frames emit blank as in
+  // a trained model
+  float blank_bias = 3.0f;
+
+  uint32_t seed = 0;
+
+  bool Validate() const;
+
+  std::string ToString() const;
+};
+
+/** Write encoder.ncnn.{param,bin}, decoder.ncnn.{param,bin},
+ * joiner.ncnn.{param,bin} and tokens.txt into an existing directory.
+ *
+ * @return Return false on error.
+ */
+bool GenerateTestModel(const TestModelConfig &config, const std::string &dir);
+
+/** Return a ModelConfig that loads the files written by GenerateTestModel()
+ * into dir. Vulkan is disabled.
+ */
+ModelConfig GetTestModelConfig(const std::string &dir);
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_TEST_MODEL_H_
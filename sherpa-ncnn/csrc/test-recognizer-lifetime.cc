@@ -0,0 +1,126 @@
+// sherpa-ncnn/csrc/test-recognizer-lifetime.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Check that a stream can be used and destroyed after the recognizer that
+// created it, e.g., by the C API or Python, which destroy them in any
+// order.
+//
+// The stream holds the decoder output, which is allocated by the
+// recognizer. It decodes with a small synthetic model (see test-model.h),
+// so no pretrained model is needed. Build with
+//
+//   cmake -DSHERPA_NCNN_ENABLE_TEST=ON -DCMAKE_CXX_FLAGS=-fsanitize=address ..
+//
+// to catch a use after free.
+
+#include <stdio.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/test-model.h"
+
+static constexpr int32_t kSampleRate = 16000;
+
+static std::vector<float> GenerateSamples(int32_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+  std::vector<float> ans(n);
+  for (auto &x : ans) {
+    x = dist(rng);
+  }
+  return ans;
+}
+
+static void TestStreamOutlivesRecognizer(const std::string &dir,
+                                         bool use_thread_allocators) {
+  sherpa_ncnn::RecognizerConfig config;
+  config.model_config = sherpa_ncnn::GetTestModelConfig(dir);
+  config.model_config.encoder_opt.num_threads = 1;
+  config.model_config.decoder_opt.num_threads = 1;
+  config.model_config.joiner_opt.num_threads = 1;
+  config.model_config.use_thread_allocators = use_thread_allocators;
+
+  auto recognizer = std::make_unique<sherpa_ncnn::Recognizer>(config);
+  auto s = recognizer->CreateStream();
+
+  // 1 second
+  std::vector<float> samples = GenerateSamples(kSampleRate, 0);
+  s->AcceptWaveform(kSampleRate, samples.data(), samples.size());
+  while (recognizer->IsReady(s.get())) {
+    recognizer->DecodeStream(s.get());
+  }
+
+  ncnn::Mat expected = s->GetResult().decoder_out.clone();
+
+  recognizer.reset();
+
+  // The stream still updates the counters of the recognizer
+  s->AcceptWaveform(kSampleRate, samples.data(), samples.size());
+  s->InputFinished();
+
+  const ncnn::Mat &decoder_out = s->GetResult().decoder_out;
+  if (decoder_out.empty() || decoder_out.total() != expected.total()) {
+    fprintf(stderr, "The decoder output is lost\n");
+    exit(-1);
+  }
+
+  const float *p = decoder_out;
+  const float *q = expected;
+  for (size_t i = 0; i != expected.total(); ++i) {
+    if (p[i] != q[i]) {
+      fprintf(stderr, "The decoder output changed\n");
+      exit(-1);
+    }
+  }
+
+  fprintf(stderr, "use_thread_allocators=%d: %s\n", use_thread_allocators,
+          s->GetMemoryUsage().ToString().c_str());
+
+  // It frees the decoder output with the allocator of the recognizer
+  s.reset();
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *kUsage = R"(
+Usage:
+
+  ./bin/test-recognizer-lifetime /path/to/dir
+
+The directory must exist. A small synthetic model is written into it.
+)";
+
+  if (argc != 2) {
+    fprintf(stderr, "%s", kUsage);
+    exit(-1);
+  }
+
+  std::string dir = argv[1];
+
+  sherpa_ncnn::TestModelConfig model_config;
+  model_config.num_layers = 2;
+  model_config.encoder_dim = 64;
+  model_config.ffn_dim = 128;
+  model_config.attention_dim = 32;
+  model_config.cnn_module_kernel = 3;
+  model_config.decoder_dim = 32;
+  model_config.joiner_dim = 32;
+  model_config.vocab_size = 50;
+
+  if (!sherpa_ncnn::GenerateTestModel(model_config, dir)) {
+    fprintf(stderr, "Failed to generate a model in %s\n", dir.c_str());
+    exit(-1);
+  }
+
+  TestStreamOutlivesRecognizer(dir, true);
+  TestStreamOutlivesRecognizer(dir, false);
+
+  fprintf(stderr, "Passed\n");
+
+  return 0;
+}
@@ -0,0 +1,286 @@
+// sherpa-ncnn/csrc/test-server.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Check the timeouts of sherpa-ncnn-server over a Unix domain socket on
+// localhost: a client that sends nothing is closed, while a client that
+// keeps sending audio for longer than the idle timeout gets its final
+// result.
+//
+// It starts the given server binary with a small synthetic model (see
+// test-model.h), so no pretrained model is needed.
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>  // NOLINT
+#include <random>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "sherpa-ncnn/csrc/server-protocol.h"
+#include "sherpa-ncnn/csrc/test-model.h"
+
+static constexpr int32_t kSampleRate = 16000;
+
+// Seconds
+static constexpr int32_t kIdleTimeout = 1;
+
+static pid_t server_pid = -1;
+
+static void StopServer() {
+  if (server_pid > 0) {
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, nullptr, 0);
+    server_pid = -1;
+  }
+}
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "Failed: %s\n", what);
+    StopServer();
+    exit(-1);
+  }
+}
+
+static std::vector<float> GenerateSamples(int32_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+  std::vector<float> ans(n);
+  for (auto &x : ans) {
+    x = dist(rng);
+  }
+  return ans;
+}
+
+static void StartServer(const std::string &server, const std::string &dir,
+                        const std::string &socket_path) {
+  sherpa_ncnn::ModelConfig c = sherpa_ncnn::GetTestModelConfig(dir);
+
+  std::vector<std::string> args = {
+      server,
+      c.tokens,
+      c.encoder_param,
+      c.encoder_bin,
+      c.decoder_param,
+      c.decoder_bin,
+      c.joiner_param,
+      c.joiner_bin,
+      "--unix-socket=" + socket_path,
+      "--num-workers=1",
+      "--idle-timeout=" + std::to_string(kIdleTimeout),
+  };
+
+  server_pid = fork();
+  Check(server_pid >= 0, "fork the server");
+
+  if (server_pid == 0) {
+    std::vector<char *> argv;
+    for (auto &a : args) {
+      argv.push_back(&a[0]);
+    }
+    argv.push_back(nullptr);
+
+    execv(argv[0], argv.data());
+    perror("execv");
+    _exit(-1);
+  }
+}
+
+// Return -1 if the server is not listening
+static int32_t Connect(const std::string &socket_path) {
+  int32_t fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  // Fail instead of waiting forever for a server that sends nothing
+  timeval tv = {};
+  tv.tv_sec = 10 * kIdleTimeout;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  return fd;
+}
+
+// The model is loaded before the server listens
+static int32_t WaitForServer(const std::string &socket_path) {
+  for (int32_t i = 0; i != 300; ++i) {
+    int32_t fd = Connect(socket_path);
+    if (fd >= 0) return fd;
+
+    Check(waitpid(server_pid, nullptr, WNOHANG) == 0, "the server is running");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  Check(false, "the server listens");
+  return -1;
+}
+
+static bool SendAll(int32_t fd, const std::string &buf) {
+  size_t start = 0;
+  while (start < buf.size()) {
+    ssize_t n = send(fd, buf.data() + start, buf.size() - start, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    start += n;
+  }
+  return true;
+}
+
+static bool SendAudio(int32_t fd, const float *samples, int32_t n) {
+  std::string payload(4 + n * 4, '\0');
+  memcpy(&payload[0], &kSampleRate, 4);
+  memcpy(&payload[4], samples, n * 4);
+
+  std::string frame;
+  sherpa_ncnn::AppendFrame(sherpa_ncnn::kAudio, payload.data(),
+                           payload.size(), &frame);
+  return SendAll(fd, frame);
+}
+
+static bool SendEndOfStream(int32_t fd) {
+  std::string frame;
+  sherpa_ncnn::AppendFrame(sherpa_ncnn::kEndOfStream, nullptr, 0, &frame);
+  return SendAll(fd, frame);
+}
+
+// Return false on end of file or if nothing is received within the
+// timeout of the socket
+static bool ReadFrame(int32_t fd, uint8_t *type, std::string *payload) {
+  char header[sherpa_ncnn::kFrameHeaderSize];
+  uint32_t n = 0;
+
+  size_t got = 0;
+  while (got < sizeof(header)) {
+    ssize_t k = recv(fd, header + got, sizeof(header) - got, 0);
+    if (k <= 0) return false;
+    got += k;
+  }
+  sherpa_ncnn::ParseFrameHeader(header, sizeof(header), type, &n);
+
+  payload->resize(n);
+  got = 0;
+  while (got < n) {
+    ssize_t k = recv(fd, &(*payload)[got], n - got, 0);
+    if (k <= 0) return false;
+    got += k;
+  }
+
+  return true;
+}
+
+static void TestIdleClient(const std::string &socket_path) {
+  int32_t fd = Connect(socket_path);
+  Check(fd >= 0, "connect");
+
+  auto start = std::chrono::steady_clock::now();
+
+  uint8_t type = 0;
+  std::string payload;
+  Check(ReadFrame(fd, &type, &payload), "an error for an idle client");
+  Check(type == sherpa_ncnn::kError && payload == "Idle timeout",
+        "an error for an idle client");
+
+  float elapsed = std::chrono::duration<float>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  // The server may accept the connection a little before connect()
+  // returns
+  Check(elapsed > kIdleTimeout - 0.1f, "not closed before the idle timeout");
+
+  Check(!ReadFrame(fd, &type, &payload), "an idle client is closed");
+  close(fd);
+}
+
+static void TestActiveClient(const std::string &socket_path) {
+  int32_t fd = Connect(socket_path);
+  Check(fd >= 0, "connect");
+
+  // 100 ms of audio every 300 ms, for 3 times the idle timeout. A worker
+  // decodes the audio meanwhile and the client reads no results until
+  // the end.
+  int32_t chunk = kSampleRate / 10;
+  std::vector<float> samples = GenerateSamples(chunk, 0);
+
+  int32_t num_chunks = 3 * kIdleTimeout * 1000 / 300;
+  for (int32_t i = 0; i != num_chunks; ++i) {
+    Check(SendAudio(fd, samples.data(), chunk), "send audio");
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  }
+
+  Check(SendEndOfStream(fd), "send the end of stream");
+
+  // Partial and final results until the final result of the stream,
+  // after which the server closes the connection
+  int32_t num_finals = 0;
+  uint8_t type = 0;
+  std::string payload;
+  while (ReadFrame(fd, &type, &payload)) {
+    Check(type != sherpa_ncnn::kError, "no error for an active client");
+    num_finals += type == sherpa_ncnn::kFinal;
+  }
+
+  Check(num_finals >= 1, "a final result for an active client");
+  close(fd);
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *kUsage = R"(
+Usage:
+
+  ./bin/test-server ./bin/sherpa-ncnn-server /path/to/dir
+
+The directory must exist. A small synthetic model and the socket of the
+server are created in it.
+)";
+
+  if (argc != 3) {
+    fprintf(stderr, "%s", kUsage);
+    exit(-1);
+  }
+
+  std::string server = argv[1];
+  std::string dir = argv[2];
+
+  sherpa_ncnn::TestModelConfig model_config;
+  model_config.num_layers = 2;
+  model_config.encoder_dim = 64;
+  model_config.ffn_dim = 128;
+  model_config.attention_dim = 32;
+  model_config.cnn_module_kernel = 3;
+  model_config.decoder_dim = 32;
+  model_config.joiner_dim = 32;
+  model_config.vocab_size = 50;
+
+  if (!sherpa_ncnn::GenerateTestModel(model_config, dir)) {
+    fprintf(stderr, "Failed to generate a model in %s\n", dir.c_str());
+    exit(-1);
+  }
+
+  std::string socket_path = dir + "/server.sock";
+  StartServer(server, dir, socket_path);
+  close(WaitForServer(socket_path));
+
+  TestIdleClient(socket_path);
+  TestActiveClient(socket_path);
+
+  StopServer();
+
+  fprintf(stderr, "Passed\n");
+
+  return 0;
+}
@@ -0,0 +1,204 @@
+// sherpa-ncnn/csrc/test-stream-pager.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Check that streams paged out by StreamPager and paged in again decode
+// with the same results as streams that are never paged out, with the
+// states kept in memory or in a spill file.
+//
+// It decodes with a small synthetic model (see test-model.h), so no
+// pretrained model is needed.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/stream-pager.h"
+#include "sherpa-ncnn/csrc/test-model.h"
+
+static constexpr int32_t kSampleRate = 16000;
+
+// Feed samples in chunks of 100 ms
+static constexpr int32_t kChunkSize = kSampleRate / 10;
+
+static constexpr int32_t kNumStreams = 3;
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "Failed: %s\n", what);
+    exit(-1);
+  }
+}
+
+static std::vector<float> GenerateSamples(int32_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+  std::vector<float> ans(n);
+  for (auto &x : ans) {
+    x = dist(rng);
+  }
+  return ans;
+}
+
+static void Decode(const sherpa_ncnn::Recognizer &recognizer,
+                   sherpa_ncnn::Stream *s) {
+  while (recognizer.IsReady(s)) {
+    recognizer.DecodeStream(s);
+  }
+}
+
+static bool SameDecoderOut(const ncnn::Mat &a, const ncnn::Mat &b) {
+  if (a.total() != b.total()) return false;
+
+  const float *p = a;
+  const float *q = b;
+  return std::equal(p, p + a.total(), q);
+}
+
+static void TestPager(const sherpa_ncnn::Recognizer &recognizer,
+                      const std::string &spill_file) {
+  std::vector<std::vector<float>> samples;
+  std::vector<std::unique_ptr<sherpa_ncnn::Stream>> expected;
+  for (int32_t i = 0; i != kNumStreams; ++i) {
+    samples.push_back(GenerateSamples(2 * kSampleRate, i));
+
+    auto s = recognizer.CreateStream();
+    for (size_t k = 0; k < samples[i].size(); k += kChunkSize) {
+      int32_t n = std::min<int32_t>(kChunkSize, samples[i].size() - k);
+      s->AcceptWaveform(kSampleRate, samples[i].data() + k, n);
+      Decode(recognizer, s.get());
+    }
+    s->InputFinished();
+    Decode(recognizer, s.get());
+    expected.push_back(std::move(s));
+  }
+
+  // Every stream that is not in use is idle
+  sherpa_ncnn::StreamPagerConfig config(0, spill_file);
+  sherpa_ncnn::StreamPager pager(&recognizer, config);
+
+  std::vector<int64_t> ids;
+  for (int32_t i = 0; i != kNumStreams; ++i) {
+    ids.push_back(pager.CreateStream());
+  }
+
+  int32_t num_samples = samples[0].size();
+  for (int32_t k = 0; k < num_samples; k += kChunkSize) {
+    int32_t n = std::min(kChunkSize, num_samples - k);
+    for (int32_t i = 0; i != kNumStreams; ++i) {
+      Check(pager.AcceptWaveform(ids[i], kSampleRate, samples[i].data() + k,
+                                 n),
+            "page in to accept samples");
+
+      auto s = pager.GetStream(ids[i]);
+      Check(s != nullptr, "page in to decode");
+      Decode(recognizer, s.get());
+    }
+
+    // A pinned stream stays in memory
+    auto pinned = pager.GetStream(ids[0]);
+    Check(pager.PageOutIdle() == kNumStreams - 1, "page out idle streams");
+    pinned.reset();
+    Check(pager.PageOutIdle() == 1, "page out an unpinned stream");
+
+    sherpa_ncnn::StreamPagerStats stats = pager.GetStats();
+    Check(stats.num_resident == 0 && stats.num_paged == kNumStreams,
+          "all streams are paged out");
+    Check(stats.paged_bytes > 0, "bytes of paged-out streams");
+    Check(spill_file.empty() || stats.spill_bytes == stats.paged_bytes,
+          "the spill file has no holes");
+  }
+
+  // Page in the streams in an order that leaves holes in the spill file
+  for (int32_t i : {1, 0, 2}) {
+    auto s = pager.GetStream(ids[i]);
+    s->InputFinished();
+    Decode(recognizer, s.get());
+
+    const auto &r = s->GetResult();
+    const auto &e = expected[i]->GetResult();
+    Check(r.tokens == e.tokens && r.timestamps == e.timestamps,
+          "same tokens after paging");
+    Check(SameDecoderOut(r.decoder_out, e.decoder_out),
+          "same decoder output after paging");
+  }
+
+  sherpa_ncnn::StreamPagerStats stats = pager.GetStats();
+  fprintf(stderr, "spill_file=\"%s\": %s\n", spill_file.c_str(),
+          stats.ToString().c_str());
+
+  Check(stats.num_resident == kNumStreams && stats.num_paged == 0,
+        "all streams are paged in");
+  Check(stats.paged_bytes == 0, "no bytes are kept for paged-in streams");
+  Check(stats.spill_bytes == 0, "free regions of the spill file are merged");
+
+  // A paged-out stream can be destroyed
+  pager.PageOutIdle();
+  for (int64_t id : ids) {
+    pager.DestroyStream(id);
+  }
+
+  stats = pager.GetStats();
+  Check(stats.num_resident == 0 && stats.num_paged == 0,
+        "all streams are destroyed");
+  Check(stats.paged_bytes == 0 && stats.spill_bytes == 0,
+        "destroyed streams keep no bytes");
+
+  Check(pager.GetStream(ids[0]) == nullptr, "no destroyed stream");
+  Check(!pager.AcceptWaveform(ids[0], kSampleRate, samples[0].data(), 1),
+        "cannot feed a destroyed stream");
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *kUsage = R"(
+Usage:
+
+  ./bin/test-stream-pager /path/to/dir
+
+The directory must exist. A small synthetic model and a spill file are
+written into it.
+)";
+
+  if (argc != 2) {
+    fprintf(stderr, "%s", kUsage);
+    exit(-1);
+  }
+
+  std::string dir = argv[1];
+
+  sherpa_ncnn::TestModelConfig model_config;
+  model_config.num_layers = 2;
+  model_config.encoder_dim = 64;
+  model_config.ffn_dim = 128;
+  model_config.attention_dim = 32;
+  model_config.cnn_module_kernel = 3;
+  model_config.decoder_dim = 32;
+  model_config.joiner_dim = 32;
+  model_config.vocab_size = 50;
+
+  if (!sherpa_ncnn::GenerateTestModel(model_config, dir)) {
+    fprintf(stderr, "Failed to generate a model in %s\n", dir.c_str());
+    exit(-1);
+  }
+
+  sherpa_ncnn::RecognizerConfig config;
+  config.model_config = sherpa_ncnn::GetTestModelConfig(dir);
+  config.model_config.encoder_opt.num_threads = 1;
+  config.model_config.decoder_opt.num_threads = 1;
+  config.model_config.joiner_opt.num_threads = 1;
+
+  sherpa_ncnn::Recognizer recognizer(config);
+
+  TestPager(recognizer, "");
+  TestPager(recognizer, dir + "/spill.bin");
+
+  fprintf(stderr, "Passed\n");
+
+  return 0;
+}
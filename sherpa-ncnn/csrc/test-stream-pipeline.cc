@@ -0,0 +1,189 @@
+// sherpa-ncnn/csrc/test-stream-pipeline.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Check that StreamPipeline gives the same results as
+// Recognizer::DecodeStream() while audio arrives from another thread.
+//
+// It decodes with a small synthetic model (see test-model.h), so no
+// pretrained model is needed. Build with
+//
+//   cmake -DSHERPA_NCNN_ENABLE_TEST=ON -DCMAKE_CXX_FLAGS=-fsanitize=thread ..
+//
+// to check the pipeline with ThreadSanitizer.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/stream-pipeline.h"
+#include "sherpa-ncnn/csrc/test-model.h"
+
+static constexpr int32_t kSampleRate = 16000;
+
+// Feed samples in chunks of 100 ms
+static constexpr int32_t kChunkSize = kSampleRate / 10;
+
+static std::vector<float> GenerateSamples(int32_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+  std::vector<float> ans(n);
+  for (auto &x : ans) {
+    x = dist(rng);
+  }
+  return ans;
+}
+
+static std::vector<int32_t> DecodeReference(
+    const sherpa_ncnn::Recognizer &recognizer,
+    const std::vector<float> &samples) {
+  auto s = recognizer.CreateStream();
+
+  for (size_t i = 0; i < samples.size(); i += kChunkSize) {
+    int32_t n = std::min<int32_t>(kChunkSize, samples.size() - i);
+    s->AcceptWaveform(kSampleRate, samples.data() + i, n);
+    while (recognizer.IsReady(s.get())) {
+      recognizer.DecodeStream(s.get());
+    }
+  }
+
+  s->InputFinished();
+  while (recognizer.IsReady(s.get())) {
+    recognizer.DecodeStream(s.get());
+  }
+
+  return recognizer.GetResult(s.get()).tokens;
+}
+
+// Audio is fed by a separate thread while this thread decodes, so the
+// encoder thread of the pipeline, the feeding thread and the search on
+// this thread all run concurrently.
+static std::vector<int32_t> DecodePipelined(
+    const sherpa_ncnn::Recognizer &recognizer,
+    const std::vector<float> &samples, int32_t queue_size) {
+  auto s = recognizer.CreateStream();
+
+  std::vector<int32_t> tokens;
+  {
+    sherpa_ncnn::StreamPipelineConfig config(queue_size, true);
+    sherpa_ncnn::StreamPipeline pipeline(&recognizer, s.get(), config);
+
+    std::atomic<bool> done(false);
+    std::thread feeder([&]() {
+      for (size_t i = 0; i < samples.size(); i += kChunkSize) {
+        int32_t n = std::min<int32_t>(kChunkSize, samples.size() - i);
+        pipeline.AcceptWaveform(kSampleRate, samples.data() + i, n);
+        std::this_thread::yield();
+      }
+      pipeline.InputFinished();
+      done = true;
+    });
+
+    while (!done) {
+      pipeline.Decode();
+      std::this_thread::yield();
+    }
+    feeder.join();
+
+    // Frames that arrived after the last call
+    pipeline.Decode();
+
+    tokens = pipeline.GetResult().tokens;
+  }
+
+  // Destroying the pipeline must not change the result
+  if (recognizer.GetResult(s.get()).tokens != tokens) {
+    fprintf(stderr, "Result changed after destroying the pipeline\n");
+    exit(-1);
+  }
+
+  return tokens;
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *kUsage = R"(
+Usage:
+
+  ./bin/test-stream-pipeline /path/to/dir
+
+The directory must exist. A small synthetic model is written into it.
+)";
+
+  if (argc != 2) {
+    fprintf(stderr, "%s", kUsage);
+    exit(-1);
+  }
+
+  std::string dir = argv[1];
+
+  if (sherpa_ncnn::StreamPipelineConfig(0, true).Validate()) {
+    fprintf(stderr, "queue_size 0 should be rejected\n");
+    exit(-1);
+  }
+
+  sherpa_ncnn::TestModelConfig model_config;
+  model_config.num_layers = 2;
+  model_config.encoder_dim = 64;
+  model_config.ffn_dim = 128;
+  model_config.attention_dim = 32;
+  model_config.cnn_module_kernel = 3;
+  model_config.decoder_dim = 32;
+  model_config.joiner_dim = 32;
+  model_config.vocab_size = 50;
+
+  // Emit a token from time to time so that the results are not empty
+  model_config.blank_bias = 0;
+
+  if (!sherpa_ncnn::GenerateTestModel(model_config, dir)) {
+    fprintf(stderr, "Failed to generate a model in %s\n", dir.c_str());
+    exit(-1);
+  }
+
+  sherpa_ncnn::RecognizerConfig config;
+  config.model_config = sherpa_ncnn::GetTestModelConfig(dir);
+  config.model_config.encoder_opt.num_threads = 1;
+  config.model_config.decoder_opt.num_threads = 1;
+  config.model_config.joiner_opt.num_threads = 1;
+
+  sherpa_ncnn::Recognizer recognizer(config);
+
+  // 3 seconds
+  std::vector<float> samples = GenerateSamples(3 * kSampleRate, 0);
+
+  std::vector<int32_t> expected = DecodeReference(recognizer, samples);
+  fprintf(stderr, "Number of tokens: %d\n",
+          static_cast<int32_t>(expected.size()));
+
+  for (int32_t queue_size : {1, 2, 4}) {
+    // Several pipelines share the recognizer at the same time
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int32_t>> results(3);
+    for (size_t i = 0; i != results.size(); ++i) {
+      threads.emplace_back([&, i]() {
+        results[i] = DecodePipelined(recognizer, samples, queue_size);
+      });
+    }
+
+    for (auto &t : threads) {
+      t.join();
+    }
+
+    for (const auto &r : results) {
+      if (r != expected) {
+        fprintf(stderr, "Results differ with queue_size %d\n", queue_size);
+        exit(-1);
+      }
+    }
+  }
+
+  fprintf(stderr, "Passed\n");
+
+  return 0;
+}
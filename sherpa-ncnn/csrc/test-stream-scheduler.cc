@@ -0,0 +1,198 @@
+// sherpa-ncnn/csrc/test-stream-scheduler.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Check that StreamScheduler decodes ready streams in the order of their
+// deadlines, and moves a stream down the quality ladder under a backlog
+// and back up when the backlog is gone.
+//
+// It decodes with a small synthetic model (see test-model.h), so no
+// pretrained model is needed.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/stream-scheduler.h"
+#include "sherpa-ncnn/csrc/test-model.h"
+
+static constexpr int32_t kSampleRate = 16000;
+
+// Samples per feature frame
+static constexpr int32_t kFrameShift = kSampleRate / 100;
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "Failed: %s\n", what);
+    exit(-1);
+  }
+}
+
+static std::vector<float> GenerateSamples(int32_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+  std::vector<float> ans(n);
+  for (auto &x : ans) {
+    x = dist(rng);
+  }
+  return ans;
+}
+
+static void TestDeadlineOrder(const sherpa_ncnn::Recognizer &recognizer) {
+  const sherpa_ncnn::Model *model = recognizer.GetModel();
+
+  // Enough for one chunk but not for two
+  int32_t n = (model->Segment() + model->Offset() / 2) * kFrameShift;
+  std::vector<float> samples = GenerateSamples(n, 0);
+
+  sherpa_ncnn::StreamSchedulerConfig config;
+  config.enable_degradation = false;
+  sherpa_ncnn::StreamScheduler scheduler(&recognizer, config);
+
+  std::vector<std::unique_ptr<sherpa_ncnn::Stream>> streams;
+  for (int32_t i = 0; i != 4; ++i) {
+    streams.push_back(recognizer.CreateStream());
+    scheduler.AddStream(streams.back().get());
+  }
+
+  Check(scheduler.DecodeNext() == nullptr, "no stream is ready");
+
+  // Audio arrives in this order, so the deadlines are in this order
+  std::vector<int32_t> order = {2, 0, 3, 1};
+  for (int32_t i : order) {
+    scheduler.AcceptWaveform(streams[i].get(), kSampleRate, samples.data(),
+                             samples.size());
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+
+  for (int32_t i : order) {
+    Check(scheduler.DecodeNext() == streams[i].get(),
+          "the earliest deadline is decoded first");
+  }
+
+  Check(scheduler.DecodeNext() == nullptr, "every chunk is decoded");
+
+  // A removed stream is not decoded although it has a chunk in the heap
+  scheduler.AcceptWaveform(streams[1].get(), kSampleRate, samples.data(),
+                           model->Offset() * kFrameShift);
+  scheduler.AcceptWaveform(streams[3].get(), kSampleRate, samples.data(),
+                           model->Offset() * kFrameShift);
+  scheduler.RemoveStream(streams[1].get());
+  Check(scheduler.DecodeNext() == streams[3].get(), "a removed stream");
+  Check(scheduler.DecodeNext() == nullptr, "a removed stream");
+
+  // The tail paddings make a stream ready
+  scheduler.InputFinished(streams[0].get());
+  while (recognizer.IsReady(streams[0].get())) {
+    Check(scheduler.DecodeNext() == streams[0].get(), "tail paddings");
+  }
+  Check(scheduler.DecodeNext() == nullptr, "tail paddings are decoded");
+}
+
+static void TestQualityLadder(const sherpa_ncnn::Recognizer &recognizer) {
+  int32_t num_levels = recognizer.NumDegradationLevels();
+  Check(num_levels == 3, "levels of modified_beam_search with 4 paths");
+
+  const sherpa_ncnn::Model *model = recognizer.GetModel();
+  int32_t chunk = model->Offset() * kFrameShift;
+
+  sherpa_ncnn::StreamSchedulerConfig config;
+  config.degrade_backlog = 0.5;
+  config.recover_backlog = 0.1;
+  config.num_chunks_to_switch = 2;
+  sherpa_ncnn::StreamScheduler scheduler(&recognizer, config);
+
+  auto s = recognizer.CreateStream();
+  scheduler.AddStream(s.get());
+
+  // 8 seconds arrive at once, e.g., after a stall of the client
+  std::vector<float> samples = GenerateSamples(8 * kSampleRate, 1);
+  scheduler.AcceptWaveform(s.get(), kSampleRate, samples.data(),
+                           samples.size());
+
+  // One level down for every 2 chunks with a backlog, until the last level
+  for (int32_t i = 1; i <= 6; ++i) {
+    Check(scheduler.DecodeNext() == s.get(), "decode the backlog");
+    Check(scheduler.GetBacklogSeconds(s.get()) > config.degrade_backlog,
+          "backlog");
+
+    int32_t expected = std::min(i / 2, num_levels - 1);
+    Check(s->GetDegradationLevel() == expected, "degrade under a backlog");
+  }
+
+  while (scheduler.DecodeNext() != nullptr) {
+  }
+
+  // Audio now arrives in real time. One level up for every 2 chunks
+  // without a backlog.
+  int32_t level = s->GetDegradationLevel();
+  for (int32_t i = 0; i != 20 && level > 0; ++i) {
+    scheduler.AcceptWaveform(s.get(), kSampleRate, samples.data(), chunk);
+    while (scheduler.DecodeNext() != nullptr) {
+    }
+
+    Check(s->GetDegradationLevel() <= level, "recover step by step");
+    level = s->GetDegradationLevel();
+  }
+
+  Check(level == 0, "recover without a backlog");
+  Check(recognizer.GetResult(s.get()).degradation_level == 0,
+        "level in the result");
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *kUsage = R"(
+Usage:
+
+  ./bin/test-stream-scheduler /path/to/dir
+
+The directory must exist. A small synthetic model is written into it.
+)";
+
+  if (argc != 2) {
+    fprintf(stderr, "%s", kUsage);
+    exit(-1);
+  }
+
+  std::string dir = argv[1];
+
+  sherpa_ncnn::TestModelConfig model_config;
+  model_config.num_layers = 2;
+  model_config.encoder_dim = 64;
+  model_config.ffn_dim = 128;
+  model_config.attention_dim = 32;
+  model_config.cnn_module_kernel = 3;
+  model_config.decoder_dim = 32;
+  model_config.joiner_dim = 32;
+  model_config.vocab_size = 50;
+
+  if (!sherpa_ncnn::GenerateTestModel(model_config, dir)) {
+    fprintf(stderr, "Failed to generate a model in %s\n", dir.c_str());
+    exit(-1);
+  }
+
+  sherpa_ncnn::RecognizerConfig config;
+  config.model_config = sherpa_ncnn::GetTestModelConfig(dir);
+  config.model_config.encoder_opt.num_threads = 1;
+  config.model_config.decoder_opt.num_threads = 1;
+  config.model_config.joiner_opt.num_threads = 1;
+  config.decoder_config.method = "modified_beam_search";
+  config.decoder_config.num_active_paths = 4;
+
+  sherpa_ncnn::Recognizer recognizer(config);
+
+  TestDeadlineOrder(recognizer);
+  TestQualityLadder(recognizer);
+
+  fprintf(stderr, "Passed\n");
+
+  return 0;
+}
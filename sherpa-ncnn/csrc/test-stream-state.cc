@@ -0,0 +1,245 @@
+// sherpa-ncnn/csrc/test-stream-state.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Check that a stream restored from Recognizer::SaveStreamState() decodes
+// bit-identically to the stream it was saved from, and that truncated or
+// corrupted states are rejected without allocating what they claim.
+//
+// It decodes with a small synthetic model (see test-model.h), so no
+// pretrained model is needed. Build with
+//
+//   cmake -DSHERPA_NCNN_ENABLE_TEST=ON -DCMAKE_CXX_FLAGS=-fsanitize=address ..
+//
+// to check that no invalid state is read out of bounds.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/test-model.h"
+
+static constexpr int32_t kSampleRate = 16000;
+
+// Feed samples in chunks of 100 ms
+static constexpr int32_t kChunkSize = kSampleRate / 10;
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "Failed: %s\n", what);
+    exit(-1);
+  }
+}
+
+static std::vector<float> GenerateSamples(int32_t n, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+  std::vector<float> ans(n);
+  for (auto &x : ans) {
+    x = dist(rng);
+  }
+  return ans;
+}
+
+static void Feed(const sherpa_ncnn::Recognizer &recognizer,
+                 sherpa_ncnn::Stream *s, const float *samples, int32_t n) {
+  for (int32_t i = 0; i < n; i += kChunkSize) {
+    s->AcceptWaveform(kSampleRate, samples + i, std::min(kChunkSize, n - i));
+    while (recognizer.IsReady(s)) {
+      recognizer.DecodeStream(s);
+    }
+  }
+}
+
+static void Finish(const sherpa_ncnn::Recognizer &recognizer,
+                   sherpa_ncnn::Stream *s) {
+  s->InputFinished();
+  while (recognizer.IsReady(s)) {
+    recognizer.DecodeStream(s);
+  }
+}
+
+static bool SameDecoderOut(const ncnn::Mat &a, const ncnn::Mat &b) {
+  if (a.total() != b.total()) return false;
+
+  const float *p = a;
+  const float *q = b;
+  return std::equal(p, p + a.total(), q);
+}
+
+static void Put(std::vector<uint8_t> *state, size_t offset, int32_t v) {
+  memcpy(state->data() + offset, &v, sizeof(v));
+}
+
+static bool Restores(const sherpa_ncnn::Recognizer &recognizer,
+                     const std::vector<uint8_t> &state, size_t n) {
+  return recognizer.RestoreStreamState(state.data(), n) != nullptr;
+}
+
+static void TestRoundTrip(const sherpa_ncnn::Recognizer &recognizer) {
+  std::vector<float> samples = GenerateSamples(3 * kSampleRate, 0);
+
+  // Save in the middle of the audio
+  int32_t half = samples.size() / 2 + kChunkSize / 3;
+
+  auto s = recognizer.CreateStream();
+  Feed(recognizer, s.get(), samples.data(), half);
+
+  std::vector<uint8_t> state;
+  recognizer.SaveStreamState(s.get(), &state);
+
+  auto restored = recognizer.RestoreStreamState(state.data(), state.size());
+  Check(restored != nullptr, "restore a saved state");
+
+  // A restored stream saves the same state
+  std::vector<uint8_t> state2;
+  recognizer.SaveStreamState(restored.get(), &state2);
+  Check(state == state2, "same state after restoring");
+
+  for (auto *p : {s.get(), restored.get()}) {
+    Feed(recognizer, p, samples.data() + half, samples.size() - half);
+    Finish(recognizer, p);
+  }
+
+  const auto &r = restored->GetResult();
+  const auto &e = s->GetResult();
+  Check(r.tokens == e.tokens && r.timestamps == e.timestamps,
+        "same tokens after restoring");
+  Check(SameDecoderOut(r.decoder_out, e.decoder_out),
+        "same decoder output after restoring");
+}
+
+static void TestInvalidStates(const sherpa_ncnn::Recognizer &recognizer) {
+  std::vector<float> samples = GenerateSamples(kSampleRate, 1);
+
+  auto s = recognizer.CreateStream();
+  Feed(recognizer, s.get(), samples.data(), samples.size());
+
+  std::vector<uint8_t> state;
+  recognizer.SaveStreamState(s.get(), &state);
+  Check(Restores(recognizer, state, state.size()), "a valid state");
+
+  // Every prefix is rejected. Check all of the header and some of the rest.
+  size_t step = std::max<size_t>(1, state.size() / 500);
+  for (size_t n = 0; n < state.size(); n += n < 256 ? 1 : step) {
+    Check(!Restores(recognizer, state, n), "a truncated state");
+  }
+  Check(!Restores(recognizer, state, state.size() - 1), "a truncated state");
+
+  // A trailing byte is rejected
+  std::vector<uint8_t> longer = state;
+  longer.push_back(0);
+  Check(!Restores(recognizer, longer, longer.size()), "trailing bytes");
+
+  // Counts much larger than the state. They are rejected before anything
+  // is allocated for them.
+  //
+  // After the magic, the version, 2 frame counters and the feature
+  // extractor's frame offset, last frame index and input_finished flag
+  constexpr size_t kSamplesOffset = 4 + 4 + 8 + 8 + 1;
+  std::vector<uint8_t> bad = state;
+  Put(&bad, kSamplesOffset, -1);
+  Check(!Restores(recognizer, bad, bad.size()), "a huge number of samples");
+
+  // The state ends with the decoder output, the number of hypotheses
+  // (0 for greedy search) and the degradation level
+  const ncnn::Mat &decoder_out = s->GetResult().decoder_out;
+  size_t num_hyps_offset = state.size() - 2 * sizeof(int32_t);
+  int32_t num_hyps;
+  memcpy(&num_hyps, state.data() + num_hyps_offset, sizeof(num_hyps));
+  Check(num_hyps == 0, "no hypotheses for greedy search");
+
+  bad = state;
+  Put(&bad, num_hyps_offset, -1);
+  Check(!Restores(recognizer, bad, bad.size()), "a huge number of hyps");
+
+  // dims, w, h, d, c, elemsize and the data of the decoder output
+  size_t mat_offset = num_hyps_offset - 6 * sizeof(int32_t) -
+                      decoder_out.total() * decoder_out.elemsize;
+  int32_t dims;
+  memcpy(&dims, state.data() + mat_offset, sizeof(dims));
+  Check(dims == decoder_out.dims, "offset of the decoder output");
+
+  // Each case sets dims, w, h, d, c and elemsize. 0 keeps a field.
+  struct {
+    int32_t fields[6];
+    const char *what;
+  } mat_cases[] = {
+      {{0, 0x7fffffff, 0, 0, 0, 0}, "a huge width"},
+      {{0, -1, 0, 0, 0, 0}, "a negative width"},
+      {{0, 0, 2, 0, 0, 0}, "a height for the dims"},
+      {{0, 0, 0, 0, 0, 3}, "an invalid element size"},
+      {{0, 0, 0, 0, 0, 0x10000}, "an invalid element size"},
+      {{5, 0, 0, 0, 0, 0}, "invalid dims"},
+      {{4, 0x10000, 0x10000, 0x10000, 0x10000, 4}, "an overflowing size"},
+  };
+
+  for (const auto &c : mat_cases) {
+    bad = state;
+    for (int32_t i = 0; i != 6; ++i) {
+      if (c.fields[i] != 0) {
+        Put(&bad, mat_offset + i * sizeof(int32_t), c.fields[i]);
+      }
+    }
+    Check(!Restores(recognizer, bad, bad.size()), c.what);
+  }
+}
+
+int32_t main(int32_t argc, char *argv[]) {
+  const char *kUsage = R"(
+Usage:
+
+  ./bin/test-stream-state /path/to/dir
+
+The directory must exist. A small synthetic model is written into it.
+)";
+
+  if (argc != 2) {
+    fprintf(stderr, "%s", kUsage);
+    exit(-1);
+  }
+
+  std::string dir = argv[1];
+
+  sherpa_ncnn::TestModelConfig model_config;
+  model_config.num_layers = 2;
+  model_config.encoder_dim = 64;
+  model_config.ffn_dim = 128;
+  model_config.attention_dim = 32;
+  model_config.cnn_module_kernel = 3;
+  model_config.decoder_dim = 32;
+  model_config.joiner_dim = 32;
+  model_config.vocab_size = 50;
+
+  if (!sherpa_ncnn::GenerateTestModel(model_config, dir)) {
+    fprintf(stderr, "Failed to generate a model in %s\n", dir.c_str());
+    exit(-1);
+  }
+
+  for (const char *storage : {"fp32", "fp16", "bf16"}) {
+    sherpa_ncnn::RecognizerConfig config;
+    config.model_config = sherpa_ncnn::GetTestModelConfig(dir);
+    config.model_config.encoder_opt.num_threads = 1;
+    config.model_config.decoder_opt.num_threads = 1;
+    config.model_config.joiner_opt.num_threads = 1;
+    config.state_storage = storage;
+
+    sherpa_ncnn::Recognizer recognizer(config);
+
+    TestRoundTrip(recognizer);
+    TestInvalidStates(recognizer);
+
+    fprintf(stderr, "state_storage=%s: passed\n", storage);
+  }
+
+  fprintf(stderr, "Passed\n");
+
+  return 0;
+}
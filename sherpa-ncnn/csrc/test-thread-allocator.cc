@@ -0,0 +1,163 @@
+// sherpa-ncnn/csrc/test-thread-allocator.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+// Check BufferPool and the allocators of each thread, including buffers
+// freed on other threads after the thread that allocated them has exited.
+// Build with
+//
+//   cmake -DSHERPA_NCNN_ENABLE_TEST=ON -DCMAKE_CXX_FLAGS=-fsanitize=thread ..
+//
+// or with -fsanitize=address to check the locking and the lifetime of the
+// buffers.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>  // NOLINT
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "sherpa-ncnn/csrc/thread-allocator.h"
+
+static void Check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "Failed: %s\n", what);
+    exit(-1);
+  }
+}
+
+static bool IsAligned(const void *p) {
+  return reinterpret_cast<uintptr_t>(p) % NCNN_MALLOC_ALIGN == 0;
+}
+
+static void TestBufferPool() {
+  sherpa_ncnn::BufferPool pool;
+
+  void *a = pool.fastMalloc(100);
+  Check(a && IsAligned(a), "aligned buffer");
+  memset(a, 1, 100);
+  Check(sherpa_ncnn::BufferPool::Owner(a) == &pool, "owner of a buffer");
+
+  pool.fastFree(a);
+  Check(pool.PooledBytes() == 100, "freed buffer is kept");
+
+  // A smaller request reuses the buffer
+  void *b = pool.fastMalloc(80);
+  Check(b == a, "buffer is reused");
+  Check(pool.PooledBytes() == 0, "reused buffer is not kept");
+
+  // A larger one does not
+  void *c = pool.fastMalloc(200);
+  Check(c != b, "larger request gets a new buffer");
+
+  Check(pool.NumAllocs() == 3, "number of allocations");
+  Check(pool.NumMallocs() == 2, "number of allocations from the heap");
+
+  pool.fastFree(b);
+  pool.fastFree(c);
+  Check(pool.PooledBytes() == 300, "bytes of the free buffers");
+
+  // Nor does one that is less than 3/4 of the free buffers
+  void *e = pool.fastMalloc(50);
+  Check(e != b && e != c, "much smaller request gets a new buffer");
+  Check(pool.NumMallocs() == 3, "buffers are not wasted on small requests");
+  pool.fastFree(e);
+
+  // The smallest buffer that fits is used
+  void *d = pool.fastMalloc(80);
+  Check(d == b, "best fit");
+  pool.fastFree(d);
+
+  Check(pool.Trim() == 350, "bytes released by Trim()");
+  Check(pool.PooledBytes() == 0, "no buffer is kept after Trim()");
+}
+
+static void TestThreadAllocators() {
+  constexpr int32_t kNumRounds = 3;
+  constexpr int32_t kNumThreads = 4;
+  constexpr int32_t kNumIterations = 1000;
+
+  ncnn::Allocator *blob_allocator = sherpa_ncnn::GetThreadBlobAllocator();
+  ncnn::Allocator *workspace_allocator =
+      sherpa_ncnn::GetThreadWorkspaceAllocator();
+
+  sherpa_ncnn::ThreadAllocatorStats before =
+      sherpa_ncnn::GetThreadAllocatorStats();
+
+  // Blobs that outlive the thread that allocated them
+  std::vector<uint8_t *> escaped;
+  std::mutex mutex;
+
+  for (int32_t round = 0; round != kNumRounds; ++round) {
+    std::vector<std::thread> threads;
+    for (int32_t t = 0; t != kNumThreads; ++t) {
+      threads.emplace_back([&, t]() {
+        for (int32_t i = 0; i != kNumIterations; ++i) {
+          size_t n = 100 + i % 7;
+          auto w = static_cast<uint8_t *>(workspace_allocator->fastMalloc(n));
+          auto b = static_cast<uint8_t *>(blob_allocator->fastMalloc(200));
+          Check(IsAligned(w) && IsAligned(b), "aligned buffers");
+
+          memset(w, t, n);
+          memset(b, t, 200);
+          Check(w[n - 1] == t && b[0] == t, "buffers do not overlap");
+
+          workspace_allocator->fastFree(w);
+
+          if (i % 100 == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            escaped.push_back(b);
+          } else {
+            blob_allocator->fastFree(b);
+          }
+        }
+      });
+    }
+
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  // The threads have exited and their free buffers are released
+  Check(sherpa_ncnn::GetThreadAllocatorStats().pooled_bytes ==
+            before.pooled_bytes,
+        "free buffers of exited threads are released");
+
+  for (auto *b : escaped) {
+    blob_allocator->fastFree(b);
+  }
+
+  sherpa_ncnn::ThreadAllocatorStats stats =
+      sherpa_ncnn::GetThreadAllocatorStats();
+  fprintf(stderr, "%s\n", stats.ToString().c_str());
+
+  int64_t num_allocs = stats.num_allocs - before.num_allocs;
+  Check(num_allocs == 2 * kNumRounds * kNumThreads * kNumIterations,
+        "number of allocations");
+  Check(stats.num_mallocs - before.num_mallocs < num_allocs / 10,
+        "buffers are reused");
+  Check(stats.num_pools <= before.num_pools + kNumThreads,
+        "pools of exited threads are reused");
+
+  int64_t pooled_bytes = stats.pooled_bytes;
+  Check(pooled_bytes >= static_cast<int64_t>(escaped.size()) * 200,
+        "freed blobs go back to their pools");
+
+  Check(sherpa_ncnn::TrimThreadAllocators() == pooled_bytes,
+        "bytes released by TrimThreadAllocators()");
+  Check(sherpa_ncnn::GetThreadAllocatorStats().pooled_bytes == 0,
+        "no buffer is kept after TrimThreadAllocators()");
+}
+
+int32_t main() {
+  TestBufferPool();
+  TestThreadAllocators();
+
+  fprintf(stderr, "Passed\n");
+
+  return 0;
+}
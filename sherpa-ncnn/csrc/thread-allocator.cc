@@ -0,0 +1,252 @@
+// sherpa-ncnn/csrc/thread-allocator.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/thread-allocator.h"
+
+#include <memory>
+#include <mutex>  // NOLINT
+#include <sstream>
+#include <vector>
+
+namespace sherpa_ncnn {
+
+// The pool and the size of a buffer are kept in front of it. Use the
+// alignment of ncnn so that the returned pointer is aligned as well.
+struct BufferHeader {
+  BufferPool *pool;
+  size_t size;
+};
+
+static constexpr size_t kHeaderSize =
+    (sizeof(BufferHeader) + NCNN_MALLOC_ALIGN - 1) / NCNN_MALLOC_ALIGN *
+    NCNN_MALLOC_ALIGN;
+
+// When no free buffer fits and at least this many are kept, the smallest
+// is released. It is the default of ncnn::PoolAllocator.
+static constexpr size_t kDropThreshold = 10;
+
+// A free buffer is reused only if the request is at least this ratio of
+// its size. It is the default size compare ratio of ncnn::PoolAllocator.
+static constexpr float kSizeCompareRatio = 0.75f;
+
+static BufferHeader *GetHeader(void *ptr) {
+  return reinterpret_cast<BufferHeader *>(static_cast<uint8_t *>(ptr) -
+                                          kHeaderSize);
+}
+
+BufferPool::~BufferPool() { Trim(); }
+
+void *BufferPool::fastMalloc(size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_allocs_ += 1;
+
+    // The smallest buffer that is large enough. If it is too large, so are
+    // all others.
+    auto it = free_.lower_bound(size);
+    if (it != free_.end() && it->first * kSizeCompareRatio <= size) {
+      void *ptr = it->second;
+      pooled_bytes_ -= it->first;
+      free_.erase(it);
+      return ptr;
+    }
+
+    num_mallocs_ += 1;
+
+    if (free_.size() >= kDropThreshold) {
+      it = free_.begin();
+      pooled_bytes_ -= it->first;
+      ncnn::fastFree(static_cast<uint8_t *>(it->second) - kHeaderSize);
+      free_.erase(it);
+    }
+  }
+
+  void *p = ncnn::fastMalloc(size + kHeaderSize);
+  if (!p) return nullptr;
+
+  BufferHeader *header = static_cast<BufferHeader *>(p);
+  header->pool = this;
+  header->size = size;
+
+  return static_cast<uint8_t *>(p) + kHeaderSize;
+}
+
+void BufferPool::fastFree(void *ptr) {
+  if (!ptr) return;
+
+  size_t size = GetHeader(ptr)->size;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_.emplace(size, ptr);
+  pooled_bytes_ += size;
+}
+
+int64_t BufferPool::Trim() {
+  std::multimap<size_t, void *> buffers;
+  int64_t ans = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers.swap(free_);
+    ans = pooled_bytes_;
+    pooled_bytes_ = 0;
+  }
+
+  for (const auto &b : buffers) {
+    ncnn::fastFree(GetHeader(b.second));
+  }
+
+  return ans;
+}
+
+int64_t BufferPool::PooledBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pooled_bytes_;
+}
+
+int64_t BufferPool::NumAllocs() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_allocs_;
+}
+
+int64_t BufferPool::NumMallocs() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_mallocs_;
+}
+
+BufferPool *BufferPool::Owner(void *ptr) { return GetHeader(ptr)->pool; }
+
+namespace {
+
+struct ThreadPools {
+  // Locked, since buffers may be freed on other threads
+  BufferPool blob;
+  BufferPool workspace;
+};
+
+class PoolRegistry {
+ public:
+  // It is never destroyed, since blobs allocated from the pools may be
+  // freed by static objects at exit
+  static PoolRegistry &Get() {
+    static PoolRegistry *registry = new PoolRegistry;
+    return *registry;
+  }
+
+  ThreadPools *Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_.empty()) {
+      ThreadPools *p = free_.back();
+      free_.pop_back();
+      return p;
+    }
+
+    pools_.push_back(std::make_unique<ThreadPools>());
+    return pools_.back().get();
+  }
+
+  void Release(ThreadPools *p) {
+    // Blobs still in use are returned to the pools when they are freed
+    // and reused by the next thread
+    p->blob.Trim();
+    p->workspace.Trim();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(p);
+  }
+
+  ThreadAllocatorStats GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ThreadAllocatorStats ans;
+    for (const auto &p : pools_) {
+      ans.num_allocs += p->blob.NumAllocs() + p->workspace.NumAllocs();
+      ans.num_mallocs += p->blob.NumMallocs() + p->workspace.NumMallocs();
+      ans.pooled_bytes += p->blob.PooledBytes() + p->workspace.PooledBytes();
+    }
+    ans.num_pools = static_cast<int32_t>(pools_.size());
+
+    return ans;
+  }
+
+  int64_t Trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t ans = 0;
+    for (const auto &p : pools_) {
+      ans += p->blob.Trim() + p->workspace.Trim();
+    }
+
+    return ans;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadPools>> pools_;
+
+  // Pools of the threads that have exited
+  std::vector<ThreadPools *> free_;
+};
+
+// Return the pools to the registry when the thread exits
+struct ThreadSlot {
+  ThreadPools *pools = nullptr;
+
+  ~ThreadSlot() {
+    if (pools) PoolRegistry::Get().Release(pools);
+  }
+};
+
+}  // namespace
+
+static thread_local ThreadSlot tls_slot;
+
+static ThreadPools *GetThreadPools() {
+  if (!tls_slot.pools) {
+    tls_slot.pools = PoolRegistry::Get().Acquire();
+  }
+  return tls_slot.pools;
+}
+
+template <bool kWorkspace>
+class ThreadAllocator : public ncnn::Allocator {
+ public:
+  void *fastMalloc(size_t size) override {
+    ThreadPools *pools = GetThreadPools();
+    return kWorkspace ? pools->workspace.fastMalloc(size)
+                      : pools->blob.fastMalloc(size);
+  }
+
+  // The buffer goes back to the pool of the thread that allocated it
+  void fastFree(void *ptr) override {
+    if (ptr) BufferPool::Owner(ptr)->fastFree(ptr);
+  }
+};
+
+std::string ThreadAllocatorStats::ToString() const {
+  std::ostringstream os;
+
+  os << "ThreadAllocatorStats(";
+  os << "num_allocs=" << num_allocs << ", ";
+  os << "num_mallocs=" << num_mallocs << ", ";
+  os << "pooled_bytes=" << pooled_bytes << ", ";
+  os << "num_pools=" << num_pools << ")";
+
+  return os.str();
+}
+
+ncnn::Allocator *GetThreadBlobAllocator() {
+  static ThreadAllocator<false> *allocator = new ThreadAllocator<false>;
+  return allocator;
+}
+
+ncnn::Allocator *GetThreadWorkspaceAllocator() {
+  static ThreadAllocator<true> *allocator = new ThreadAllocator<true>;
+  return allocator;
+}
+
+ThreadAllocatorStats GetThreadAllocatorStats() {
+  return PoolRegistry::Get().GetStats();
+}
+
+int64_t TrimThreadAllocators() { return PoolRegistry::Get().Trim(); }
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,126 @@
+// sherpa-ncnn/csrc/thread-allocator.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_THREAD_ALLOCATOR_H_
+#define SHERPA_NCNN_CSRC_THREAD_ALLOCATOR_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>  // NOLINT
+#include <string>
+
+#include "allocator.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+struct ThreadAllocatorStats {
+  // Number of calls of fastMalloc() on the allocators of all threads
+  int64_t num_allocs = 0;
+
+  // Number of them that could not reuse a buffer of the pools and got
+  // new memory from the heap
+  int64_t num_mallocs = 0;
+
+  // Bytes of the free buffers kept by the pools for reuse
+  int64_t pooled_bytes = 0;
+
+  // Number of pools created so far, i.e., the largest number of threads
+  // that have used the allocators at the same time
+  int32_t num_pools = 0;
+
+  std::string ToString() const;
+};
+
+/* A pool of buffers that can be allocated and freed on any thread.
+ *
+ * Like ncnn::PoolAllocator with its default size compare ratio of 0.75, a
+ * freed buffer is kept and reused for a later request that it is large
+ * enough for, but not more than 4/3 of. The smallest such buffer is used,
+ * so a small request does not take a large buffer that a later large
+ * request would need. When none fits and many are kept, the smallest one
+ * is released. Unlike ncnn::PoolAllocator, it reports the
+ * bytes it keeps and they can be released with Trim().
+ *
+ * Buffers must be freed before the pool is destroyed.
+ */
+class BufferPool : public ncnn::Allocator {
+ public:
+  BufferPool() = default;
+  ~BufferPool() override;
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  void *fastMalloc(size_t size) override;
+  void fastFree(void *ptr) override;
+
+  // Release the free buffers and return their bytes. Buffers in use are
+  // not affected.
+  int64_t Trim();
+
+  // Bytes of the free buffers kept for reuse
+  int64_t PooledBytes() const;
+
+  // Number of calls of fastMalloc() so far and the number of them that
+  // got new memory from the heap
+  int64_t NumAllocs() const;
+  int64_t NumMallocs() const;
+
+  // Return the pool that allocated ptr, which is a pointer returned by
+  // fastMalloc() of any pool
+  static BufferPool *Owner(void *ptr);
+
+ private:
+  mutable std::mutex mutex_;
+
+  // Free buffers by their size, excluding the header
+  std::multimap<size_t, void *> free_;
+
+  int64_t pooled_bytes_ = 0;
+  int64_t num_allocs_ = 0;
+  int64_t num_mallocs_ = 0;
+};
+
+/* Return the blob allocator that serves each thread from its own pool.
+ *
+ * ncnn allocates every blob of an extractor, including those of the
+ * custom layers, with Option::blob_allocator. Without one, all threads
+ * share a locked pool of the network, or call malloc() for each blob if
+ * Option::use_local_pool_allocator is false.
+ *
+ * The pool of a thread is created on first use. When the thread exits, its
+ * free buffers are released and it is kept for the next new thread, so
+ * blobs may outlive the thread that allocated them. They may also be freed
+ * on other threads, e.g., the encoder output passed to the search thread
+ * by StreamPipeline, so the pools are locked. The lock is rarely
+ * contended, unlike the lock of a pool shared by all threads.
+ *
+ * The returned allocator is never destroyed. It is used by a model if
+ * ModelConfig::use_thread_allocators is true.
+ */
+ncnn::Allocator *GetThreadBlobAllocator();
+
+/* Return the workspace allocator that serves each thread from its own
+ * pool.
+ *
+ * Layers of ncnn may allocate workspace within their OpenMP loops, so each
+ * OpenMP thread uses its own pool, too.
+ */
+ncnn::Allocator *GetThreadWorkspaceAllocator();
+
+/// Return the counts of the allocators of all threads so far.
+ThreadAllocatorStats GetThreadAllocatorStats();
+
+/* Release the free buffers kept by the pools of all threads and return
+ * their bytes.
+ *
+ * The pools of a thread are also trimmed when it exits. Call it, e.g.,
+ * after a burst of streams to return the memory to the system. Decoding
+ * right after it allocates from the heap again.
+ */
+int64_t TrimThreadAllocators();
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_THREAD_ALLOCATOR_H_
@@ -0,0 +1,328 @@
+// sherpa-ncnn/csrc/thread-budget.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/thread-budget.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "platform.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+std::string ThreadBudgetConfig::ToString() const {
+  std::ostringstream os;
+
+  os << "ThreadBudgetConfig(";
+  os << "num_cpus=" << num_cpus << ", ";
+  os << "max_workers=" << max_workers << ", ";
+  os << "pin=\"" << pin << "\")";
+
+  return os.str();
+}
+
+std::string ThreadPlan::ToString() const {
+  std::ostringstream os;
+
+  os << "ThreadPlan(";
+  os << "num_workers=" << num_workers << ", ";
+  os << "encoder_threads=" << encoder_threads << ", ";
+  os << "decoder_threads=" << decoder_threads << ", ";
+  os << "joiner_threads=" << joiner_threads << ")";
+
+  return os.str();
+}
+
+#if defined(__linux__)
+// Parse a CPU list such as "0-3,8,10-11"
+static std::vector<int32_t> ParseCpuList(const std::string &s) {
+  std::vector<int32_t> ans;
+
+  std::istringstream is(s);
+  std::string range;
+  while (std::getline(is, range, ',')) {
+    if (range.empty()) continue;
+
+    int32_t first = 0;
+    int32_t last = 0;
+    auto pos = range.find('-');
+    if (pos == std::string::npos) {
+      first = last = atoi(range.c_str());
+    } else {
+      first = atoi(range.substr(0, pos).c_str());
+      last = atoi(range.substr(pos + 1).c_str());
+    }
+
+    for (int32_t i = first; i <= last; ++i) {
+      ans.push_back(i);
+    }
+  }
+
+  return ans;
+}
+
+// Return the path of the cgroup v2 of this process, e.g., /system.slice/x
+static std::string GetCgroupV2Path() {
+  std::ifstream is("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(is, line)) {
+    // The line for cgroup v2 looks like "0::/path"
+    if (line.compare(0, 3, "0::") == 0) {
+      return line.substr(3);
+    }
+  }
+
+  return {};
+}
+
+// Return the CPU quota of the cgroup in number of CPUs, or 0 if there
+// is no quota
+static double GetCgroupCpuQuota() {
+  // cgroup v2: "max 100000" or "200000 100000"
+  std::vector<std::string> files;
+  std::string path = GetCgroupV2Path();
+  if (!path.empty() && path != "/") {
+    files.push_back("/sys/fs/cgroup" + path + "/cpu.max");
+  }
+  files.push_back("/sys/fs/cgroup/cpu.max");
+
+  for (const auto &f : files) {
+    std::ifstream is(f);
+    std::string quota;
+    double period = 0;
+    if (is >> quota >> period) {
+      if (quota == "max" || period <= 0) return 0;
+      return atof(quota.c_str()) / period;
+    }
+  }
+
+  // cgroup v1. The quota is -1 if there is none.
+  for (const char *dir :
+       {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"}) {
+    std::ifstream quota_is(std::string(dir) + "/cpu.cfs_quota_us");
+    std::ifstream period_is(std::string(dir) + "/cpu.cfs_period_us");
+    double quota = 0;
+    double period = 0;
+    if ((quota_is >> quota) && (period_is >> period)) {
+      if (quota <= 0 || period <= 0) return 0;
+      return quota / period;
+    }
+  }
+
+  return 0;
+}
+
+// Return the CPUs of each NUMA node that are also in allowed
+static std::vector<std::vector<int32_t>> GetNumaNodeCpus(
+    const std::vector<int32_t> &allowed) {
+  std::vector<std::vector<int32_t>> ans;
+
+  for (int32_t node = 0;; ++node) {
+    std::ifstream is("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+    std::string line;
+    if (!std::getline(is, line)) break;
+
+    std::vector<int32_t> cpus;
+    for (int32_t c : ParseCpuList(line)) {
+      if (std::find(allowed.begin(), allowed.end(), c) != allowed.end()) {
+        cpus.push_back(c);
+      }
+    }
+
+    if (!cpus.empty()) {
+      ans.push_back(std::move(cpus));
+    }
+  }
+
+  return ans;
+}
+#endif
+
+std::vector<int32_t> GetAllowedCpus() {
+  std::vector<int32_t> ans;
+
+#if defined(__linux__)
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+    for (int32_t i = 0; i != CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &mask)) ans.push_back(i);
+    }
+  }
+#endif
+
+  if (ans.empty()) {
+    int32_t n = std::max<int32_t>(1, std::thread::hardware_concurrency());
+    for (int32_t i = 0; i != n; ++i) {
+      ans.push_back(i);
+    }
+  }
+
+  return ans;
+}
+
+int32_t GetAvailableCpus() {
+  int32_t n = static_cast<int32_t>(GetAllowedCpus().size());
+
+#if defined(__linux__)
+  double quota = GetCgroupCpuQuota();
+  if (quota > 0) {
+    n = std::min(n, std::max(1, static_cast<int32_t>(quota)));
+  }
+#endif
+
+  return n;
+}
+
+ThreadBudget::ThreadBudget(const ThreadBudgetConfig &config)
+    : config_(config), allowed_cpus_(GetAllowedCpus()) {
+  num_cpus_ = config_.num_cpus > 0 ? config_.num_cpus : GetAvailableCpus();
+  max_workers_ = config_.max_workers > 0 ? config_.max_workers : num_cpus_;
+
+  if (config_.pin != "none" && config_.pin != "core" &&
+      config_.pin != "numa") {
+    NCNN_LOGE("Unsupported pin: %s. Use none instead", config_.pin.c_str());
+    config_.pin = "none";
+  }
+
+  cpu_sets_ = GetCpuSets();
+}
+
+std::vector<std::vector<int32_t>> ThreadBudget::GetCpuSets() const {
+  std::vector<std::vector<int32_t>> ans;
+
+  if (config_.pin == "core") {
+    // Use only as many CPUs as the quota allows
+    int32_t n = std::min<int32_t>(num_cpus_, allowed_cpus_.size());
+    int32_t size = std::max(1, n / max_workers_);
+    for (int32_t i = 0; i != max_workers_; ++i) {
+      std::vector<int32_t> cpus;
+      for (int32_t k = 0; k != size; ++k) {
+        cpus.push_back(allowed_cpus_[(i * size + k) % n]);
+      }
+      ans.push_back(std::move(cpus));
+    }
+  }
+
+#if defined(__linux__)
+  if (config_.pin == "numa") {
+    ans = GetNumaNodeCpus(allowed_cpus_);
+  }
+#endif
+
+  if (config_.pin == "numa" && ans.empty()) {
+    ans.push_back(allowed_cpus_);
+  }
+
+  return ans;
+}
+
+ThreadPlan ThreadBudget::Plan(int32_t num_active) const {
+  int32_t n = std::min(std::max(num_active, 1), max_workers_);
+
+  int32_t threads = std::max(1, num_cpus_ / n);
+
+  // A pinned worker cannot use more CPUs than its set, which it may share
+  // with other workers for NUMA pinning
+  if (!cpu_sets_.empty()) {
+    int32_t num_sets = static_cast<int32_t>(cpu_sets_.size());
+    for (int32_t i = 0; i != num_sets; ++i) {
+      int32_t workers_in_set =
+          max_workers_ / num_sets + (i < max_workers_ % num_sets ? 1 : 0);
+      if (workers_in_set == 0) continue;
+
+      int32_t size = static_cast<int32_t>(cpu_sets_[i].size());
+      threads = std::min(threads, std::max(1, size / workers_in_set));
+    }
+  }
+
+  ThreadPlan plan;
+  plan.num_workers = n;
+  plan.encoder_threads = threads;
+
+  // The decoder is an embedding plus a tiny conv and the joiner a linear
+  // layer on a few frames; the OpenMP overhead outweighs the gain from
+  // many threads
+  plan.decoder_threads = 1;
+  plan.joiner_threads = std::max(1, threads / 2);
+
+  return plan;
+}
+
+void ThreadBudget::Apply(const ThreadPlan &plan, ModelConfig *config) const {
+  config->encoder_opt.num_threads = plan.encoder_threads;
+  config->decoder_opt.num_threads = plan.decoder_threads;
+  config->joiner_opt.num_threads = plan.joiner_threads;
+}
+
+bool ThreadBudget::PinWorker(int32_t worker_index) const {
+  if (cpu_sets_.empty()) return false;
+
+#if defined(__linux__)
+  const auto &cpus = cpu_sets_[worker_index % cpu_sets_.size()];
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (int32_t c : cpus) {
+    CPU_SET(c, &mask);
+  }
+
+  if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+    NCNN_LOGE("Failed to pin worker %d", worker_index);
+    return false;
+  }
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::string ThreadBudget::ToString() const {
+  std::ostringstream os;
+
+  os << "ThreadBudget(";
+  os << "config=" << config_.ToString() << ", ";
+  os << "num_cpus=" << num_cpus_ << ", ";
+  os << "max_workers=" << max_workers_ << ", ";
+  os << "num_cpu_sets=" << cpu_sets_.size() << ")";
+
+  return os.str();
+}
+
+static thread_local bool tls_has_plan = false;
+static thread_local ThreadPlan tls_plan;
+
+void SetThreadLocalPlan(const ThreadPlan *plan) {
+  tls_has_plan = plan != nullptr;
+  if (plan) tls_plan = *plan;
+}
+
+void ApplyThreadLocalPlan(NetworkType type, ncnn::Extractor *ex) {
+  if (!tls_has_plan) return;
+
+  switch (type) {
+    case NetworkType::kEncoder:
+      ex->set_num_threads(tls_plan.encoder_threads);
+      break;
+    case NetworkType::kDecoder:
+      ex->set_num_threads(tls_plan.decoder_threads);
+      break;
+    case NetworkType::kJoiner:
+      ex->set_num_threads(tls_plan.joiner_threads);
+      break;
+  }
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,135 @@
+// sherpa-ncnn/csrc/thread-budget.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_THREAD_BUDGET_H_
+#define SHERPA_NCNN_CSRC_THREAD_BUDGET_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "net.h"  // NOLINT
+#include "sherpa-ncnn/csrc/model.h"
+
+namespace sherpa_ncnn {
+
+struct ThreadBudgetConfig {
+  // Number of CPUs to share among all threads. If it is 0, it is the number
+  // of CPUs in the affinity mask of the process, limited by the CPU quota
+  // of its cgroup.
+  int32_t num_cpus = 0;
+
+  // Maximum number of worker threads decoding streams in parallel.
+  // If it is 0, it is the number of CPUs.
+  int32_t max_workers = 0;
+
+  // Valid values: none, core, numa.
+  //  - core: worker i is pinned to its own slice of the CPUs
+  //  - numa: worker i is pinned to the CPUs of NUMA node i % num_nodes
+  std::string pin = "none";
+
+  ThreadBudgetConfig() = default;
+
+  ThreadBudgetConfig(int32_t num_cpus, int32_t max_workers,
+                     const std::string &pin)
+      : num_cpus(num_cpus), max_workers(max_workers), pin(pin) {}
+
+  std::string ToString() const;
+};
+
+// Number of intra-op threads of each network
+struct ThreadPlan {
+  // Number of workers the plan is made for
+  int32_t num_workers = 1;
+
+  int32_t encoder_threads = 1;
+  int32_t decoder_threads = 1;
+  int32_t joiner_threads = 1;
+
+  std::string ToString() const;
+};
+
+/** Return the CPUs the calling process may run on.
+ *
+ * On Linux, it is the affinity mask from sched_getaffinity(). On other
+ * platforms, it is 0, 1, ..., std::thread::hardware_concurrency() - 1.
+ */
+std::vector<int32_t> GetAllowedCpus();
+
+/** Return the number of CPUs the process can use in parallel.
+ *
+ * It is the number of allowed CPUs, limited by the CPU quota of the cgroup
+ * (cpu.max of cgroup v2, cpu.cfs_quota_us of cgroup v1) if there is one.
+ * The quota is rounded down so that the process is not throttled.
+ */
+int32_t GetAvailableCpus();
+
+/** Share the CPUs between the worker threads that decode different streams
+ * and the ncnn (OpenMP) threads inside each network.
+ *
+ * ncnn does not know how many streams are decoded in parallel. With 16
+ * workers and num_threads = 4, it runs 64 threads on 16 CPUs. ThreadBudget
+ * gives each active worker num_cpus / num_active CPUs instead. Most of them
+ * go to the encoder; the decoder and the joiner are small and gain little
+ * from more threads.
+ *
+ * Usage in a worker thread:
+ *
+ *   budget.PinWorker(worker_index);  // optional
+ *   ...
+ *   ThreadPlan plan = budget.Plan(num_active_workers);
+ *   SetThreadLocalPlan(&plan);
+ *   recognizer.DecodeStream(s);
+ */
+class ThreadBudget {
+ public:
+  explicit ThreadBudget(const ThreadBudgetConfig &config);
+
+  int32_t NumCpus() const { return num_cpus_; }
+
+  int32_t MaxWorkers() const { return max_workers_; }
+
+  /// Return the plan when num_active workers decode at the same time.
+  ThreadPlan Plan(int32_t num_active) const;
+
+  /// Set the num_threads of the three networks in the given config from
+  /// the plan. Used for the threads without a thread-local plan.
+  void Apply(const ThreadPlan &plan, ModelConfig *config) const;
+
+  /** Pin the calling thread to the CPUs of worker worker_index.
+   *
+   * Threads created afterwards by the calling thread, e.g., the OpenMP
+   * threads of ncnn, inherit the affinity.
+   *
+   * @return Return false if config.pin is none or on failure.
+   */
+  bool PinWorker(int32_t worker_index) const;
+
+  std::string ToString() const;
+
+ private:
+  // CPUs of worker i are cpu_sets_[i % cpu_sets_.size()]
+  std::vector<std::vector<int32_t>> GetCpuSets() const;
+
+ private:
+  ThreadBudgetConfig config_;
+  int32_t num_cpus_;
+  int32_t max_workers_;
+  std::vector<int32_t> allowed_cpus_;
+  std::vector<std::vector<int32_t>> cpu_sets_;
+};
+
+/// Use the given plan for extractors created by the calling thread.
+/// Pass nullptr to use the num_threads from ModelConfig again.
+void SetThreadLocalPlan(const ThreadPlan *plan);
+
+enum class NetworkType { kEncoder, kDecoder, kJoiner };
+
+/// Called by the models after creating an extractor. It is a no-op if the
+/// calling thread has no plan.
+void ApplyThreadLocalPlan(NetworkType type, ncnn::Extractor *ex);
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_THREAD_BUDGET_H_
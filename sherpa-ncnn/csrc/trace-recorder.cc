@@ -0,0 +1,244 @@
+// sherpa-ncnn/csrc/trace-recorder.cc
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#include "sherpa-ncnn/csrc/trace-recorder.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>  // NOLINT
+#include <string>
+#include <vector>
+
+#include "platform.h"  // NOLINT
+
+namespace sherpa_ncnn {
+
+namespace {
+
+struct TraceEvent {
+  const char *name;
+  int64_t stream_id;
+  int64_t start_ns;
+  int64_t end_ns;
+};
+
+// Spans of one thread. Only the owning thread writes it.
+struct ThreadTrace {
+  int32_t tid = 0;
+
+  // Spans are recorded only for the generation of StartTracing()
+  std::atomic<uint32_t> generation{0};
+
+  std::vector<TraceEvent> events;
+
+  // Number of spans recorded so far. Span i is events[i % events.size()].
+  std::atomic<uint64_t> head{0};
+};
+
+class TraceRegistry {
+ public:
+  static TraceRegistry &Get() {
+    static TraceRegistry registry;
+    return registry;
+  }
+
+  std::shared_ptr<ThreadTrace> Register() {
+    auto t = std::make_shared<ThreadTrace>();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    t->tid = static_cast<int32_t>(threads_.size());
+    threads_.push_back(t);
+
+    return t;
+  }
+
+  std::vector<std::shared_ptr<ThreadTrace>> GetThreads() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return threads_;
+  }
+
+ private:
+  std::mutex mutex_;
+
+  // Kept after the threads exit so that their spans can be written
+  std::vector<std::shared_ptr<ThreadTrace>> threads_;
+};
+
+}  // namespace
+
+static std::atomic<bool> g_tracing{false};
+static std::atomic<uint32_t> g_generation{0};
+static std::atomic<int32_t> g_buffer_size{65536};
+static std::atomic<int64_t> g_start_ns{0};
+
+static thread_local std::shared_ptr<ThreadTrace> tls_trace;
+static thread_local int64_t tls_stream_id = -1;
+
+static int64_t ToNs(StageClock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+// Return the buffer of the calling thread for the current generation
+static ThreadTrace *GetThreadTrace() {
+  if (!tls_trace) {
+    tls_trace = TraceRegistry::Get().Register();
+  }
+
+  ThreadTrace *t = tls_trace.get();
+  uint32_t generation = g_generation.load(std::memory_order_acquire);
+  if (t->generation.load(std::memory_order_relaxed) != generation) {
+    t->head.store(0, std::memory_order_relaxed);
+    t->events.resize(g_buffer_size.load(std::memory_order_relaxed));
+    t->generation.store(generation, std::memory_order_release);
+  }
+
+  return t;
+}
+
+void StartTracing(int32_t buffer_size /*= 65536*/) {
+  g_buffer_size.store(std::max(buffer_size, 1), std::memory_order_relaxed);
+  g_start_ns.store(ToNs(StageClock::now()), std::memory_order_relaxed);
+  g_generation.fetch_add(1, std::memory_order_release);
+  g_tracing.store(true, std::memory_order_release);
+}
+
+void StopTracing() { g_tracing.store(false, std::memory_order_release); }
+
+bool IsTracing() { return g_tracing.load(std::memory_order_relaxed); }
+
+void RecordTraceSpan(const char *name, StageClock::time_point start,
+                     StageClock::time_point end) {
+  ThreadTrace *t = GetThreadTrace();
+
+  uint64_t head = t->head.load(std::memory_order_relaxed);
+  TraceEvent &e = t->events[head % t->events.size()];
+  e.name = name;
+  e.stream_id = tls_stream_id;
+  e.start_ns = ToNs(start);
+  e.end_ns = ToNs(end);
+
+  t->head.store(head + 1, std::memory_order_release);
+}
+
+bool WriteTrace(const std::string &filename) {
+  FILE *fp = fopen(filename.c_str(), "w");
+  if (!fp) {
+    NCNN_LOGE("Failed to open %s", filename.c_str());
+    return false;
+  }
+
+  uint32_t generation = g_generation.load(std::memory_order_acquire);
+  double start_ns = g_start_ns.load(std::memory_order_relaxed);
+
+  fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+  const char *sep = "";
+  std::vector<TraceEvent> events;
+  for (const auto &t : TraceRegistry::Get().GetThreads()) {
+    if (t->generation.load(std::memory_order_acquire) != generation) {
+      continue;
+    }
+
+    uint64_t size = t->events.size();
+    uint64_t head = t->head.load(std::memory_order_acquire);
+    uint64_t first = head > size ? head - size : 0;
+
+    events.clear();
+    for (uint64_t i = first; i != head; ++i) {
+      events.push_back(t->events[i % size]);
+    }
+
+    // Skip the spans that the thread may have overwritten while copying
+    uint64_t now = t->head.load(std::memory_order_acquire);
+    uint64_t valid = now >= size ? now - size + 1 : 0;
+    uint64_t skip = valid > first ? std::min(valid - first, head - first) : 0;
+
+    fprintf(fp,
+            "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+            "\"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+            sep, t->tid, t->tid);
+    sep = ",\n";
+
+    for (size_t i = skip; i < events.size(); ++i) {
+      const TraceEvent &e = events[i];
+      fprintf(fp,
+              "%s{\"name\": \"%s\", \"cat\": \"sherpa-ncnn\", \"ph\": \"X\", "
+              "\"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+              sep, e.name, t->tid, (e.start_ns - start_ns) / 1000,
+              (e.end_ns - e.start_ns) / 1000.0);
+      if (e.stream_id >= 0) {
+        fprintf(fp, ", \"args\": {\"stream\": %lld}",
+                static_cast<long long>(e.stream_id));  // NOLINT
+      }
+      fprintf(fp, "}");
+    }
+  }
+
+  fprintf(fp, "\n]}\n");
+
+  bool ok = !ferror(fp);
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok) {
+    NCNN_LOGE("Failed to write %s", filename.c_str());
+  }
+
+  return ok;
+}
+
+ScopedTraceSpan::ScopedTraceSpan(const char *name)
+    : name_(name), tracing_(IsTracing()) {
+  if (tracing_) start_ = StageClock::now();
+}
+
+ScopedTraceSpan::~ScopedTraceSpan() {
+  if (tracing_) RecordTraceSpan(name_, start_, StageClock::now());
+}
+
+ScopedTraceStream::ScopedTraceStream(int64_t stream_id)
+    : prev_(tls_stream_id) {
+  tls_stream_id = stream_id;
+}
+
+ScopedTraceStream::~ScopedTraceStream() { tls_stream_id = prev_; }
+
+namespace {
+
+// Write the trace to the file given by SHERPA_NCNN_TRACE at exit
+class TraceAtExit {
+ public:
+  explicit TraceAtExit(const std::string &filename) : filename_(filename) {
+    // The registry must be destroyed after this object
+    TraceRegistry::Get();
+
+    StartTracing();
+  }
+
+  ~TraceAtExit() {
+    StopTracing();
+    if (WriteTrace(filename_)) {
+      fprintf(stderr, "Trace saved to %s\n", filename_.c_str());
+    }
+  }
+
+ private:
+  std::string filename_;
+};
+
+}  // namespace
+
+bool StartTracingFromEnv() {
+  const char *p = std::getenv("SHERPA_NCNN_TRACE");
+  if (!p || !*p) return false;
+
+  static TraceAtExit trace_at_exit(p);
+  return true;
+}
+
+}  // namespace sherpa_ncnn
@@ -0,0 +1,89 @@
+// sherpa-ncnn/csrc/trace-recorder.h
+//
+// Copyright (c)  2023  Xiaomi Corporation
+
+#ifndef SHERPA_NCNN_CSRC_TRACE_RECORDER_H_
+#define SHERPA_NCNN_CSRC_TRACE_RECORDER_H_
+
+#include <cstdint>
+#include <string>
+
+#include "sherpa-ncnn/csrc/stage-timer.h"
+
+namespace sherpa_ncnn {
+
+/* An opt-in recorder of the decoding activity of all threads.
+ *
+ * When tracing, every ScopedStage and ScopedTraceSpan records a span with
+ * the id of the stream being decoded and the thread. Each thread writes
+ * into its own ring buffer without locks; when it is full, the oldest
+ * spans of the thread are overwritten.
+ *
+ * WriteTrace() saves the spans in the Chrome trace event format, which
+ * can be opened in chrome://tracing or https://ui.perfetto.dev
+ *
+ * Tools can call StartTracingFromEnv() so that tracing is enabled by the
+ * environment variable SHERPA_NCNN_TRACE.
+ */
+
+/// Start tracing and drop the spans recorded so far.
+///
+/// @param buffer_size  Number of spans kept per thread.
+void StartTracing(int32_t buffer_size = 65536);
+
+void StopTracing();
+
+/// If the environment variable SHERPA_NCNN_TRACE is set to a filename,
+/// start tracing and write the trace to that file when the process exits
+/// normally, i.e., returns from main() or calls exit(). The library never
+/// reads the variable on its own; tools call this at the start of main().
+///
+/// @return Return true if tracing is started.
+bool StartTracingFromEnv();
+
+bool IsTracing();
+
+/// Write the recorded spans to a JSON file. Call it after StopTracing()
+/// or while no stream is decoded; otherwise spans that are overwritten
+/// while writing may be garbled.
+///
+/// @return Return false if the file cannot be written.
+bool WriteTrace(const std::string &filename);
+
+/// Record a span on the calling thread. name must be a string literal.
+void RecordTraceSpan(const char *name, StageClock::time_point start,
+                     StageClock::time_point end);
+
+// Record a span for the lifetime of this object
+class ScopedTraceSpan {
+ public:
+  // name must be a string literal
+  explicit ScopedTraceSpan(const char *name);
+  ~ScopedTraceSpan();
+
+  ScopedTraceSpan(const ScopedTraceSpan &) = delete;
+  ScopedTraceSpan &operator=(const ScopedTraceSpan &) = delete;
+
+ private:
+  const char *name_;
+  bool tracing_;
+  StageClock::time_point start_;
+};
+
+// Tag the spans of the calling thread with the given stream id for the
+// lifetime of this object. See Stream::GetId().
+class ScopedTraceStream {
+ public:
+  explicit ScopedTraceStream(int64_t stream_id);
+  ~ScopedTraceStream();
+
+  ScopedTraceStream(const ScopedTraceStream &) = delete;
+  ScopedTraceStream &operator=(const ScopedTraceStream &) = delete;
+
+ private:
+  int64_t prev_;
+};
+
+}  // namespace sherpa_ncnn
+
+#endif  // SHERPA_NCNN_CSRC_TRACE_RECORDER_H_
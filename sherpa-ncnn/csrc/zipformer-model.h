@@ -27,6 +27,8 @@ class ZipformerModel : public Model {
 
   std::vector<ncnn::Mat> GetEncoderInitStates() const override;
 
+  std::vector<bool> GetEncoderIntegerStates() const override;
+
   std::pair<ncnn::Mat, std::vector<ncnn::Mat>> RunEncoder(
       ncnn::Mat &features, const std::vector<ncnn::Mat> &states) override;
 
@@ -34,6 +36,12 @@ class ZipformerModel : public Model {
       ncnn::Mat &features, const std::vector<ncnn::Mat> &states,
       ncnn::Extractor *extractor) override;
 
+  ncnn::Mat RunEncoder(ncnn::Mat &features,
+                       EncoderStateArena *states) override;
+
+  ncnn::Mat RunEncoder(ncnn::Mat &features, EncoderStateArena *states,
+                       ncnn::Extractor *extractor) override;
+
   ncnn::Mat RunDecoder(ncnn::Mat &decoder_input) override;
 
   ncnn::Mat RunDecoder(ncnn::Mat &decoder_input,
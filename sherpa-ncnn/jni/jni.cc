@@ -274,6 +274,12 @@ static RecognizerConfig ParseConfig(JNIEnv *env, jobject _config) {
   fid = env->GetFieldID(cls, "hotwordsScore", "F");
   config.hotwords_score = env->GetFloatField(_config, fid);
 
+  fid = env->GetFieldID(cls, "stateStorage", "Ljava/lang/String;");
+  s = (jstring)env->GetObjectField(_config, fid);
+  p = env->GetStringUTFChars(s, nullptr);
+  config.state_storage = p;
+  env->ReleaseStringUTFChars(s, p);
+
   NCNN_LOGE("------config------\n%s\n", config.ToString().c_str());
 
   return config;
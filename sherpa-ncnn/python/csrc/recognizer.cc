@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "sherpa-ncnn/csrc/recognizer.h"
+#include "sherpa-ncnn/csrc/thread-allocator.h"
 
 namespace sherpa_ncnn {
 
@@ -40,6 +41,13 @@ Args:
     Config for endpointing
   enable_endpoint:
     True to enable endpoint detection. False to disable endpoint detection.
+  hotwords_file:
+    Optional. Path to the hotwords file.
+  hotwords_score:
+    The scale applied to hotwords score.
+  state_storage:
+    Element type for keeping encoder states of a stream between chunks.
+    Valid values are: fp32, fp16, bf16.
 )doc";
 
 static void PybindRecognitionResult(py::module *m) {
@@ -56,7 +64,44 @@ static void PybindRecognitionResult(py::module *m) {
                              })
       .def_property_readonly(
           "timestamps",
-          [](PyClass &self) -> std::vector<float> { return self.timestamps; });
+          [](PyClass &self) -> std::vector<float> { return self.timestamps; })
+      .def_property_readonly("degradation_level", [](PyClass &self) {
+        return self.degradation_level;
+      });
+}
+
+static void PybindDecodeCounters(py::module *m) {
+  py::class_<StageCount>(*m, "StageCount")
+      .def_readonly("count", &StageCount::count)
+      .def_readonly("seconds", &StageCount::seconds)
+      .def_readonly("max_seconds", &StageCount::max_seconds);
+
+  using PyClass = DecodeCounters;
+  py::class_<PyClass> c(*m, "DecodeCounters");
+  c.def("__str__", &PyClass::ToString)
+      .def_readonly("num_chunks", &PyClass::num_chunks)
+      .def_readonly("num_frames", &PyClass::num_frames);
+
+  for (int32_t i = 0; i != kNumStages; ++i) {
+    Stage stage = static_cast<Stage>(i);
+    c.def_property_readonly(StageName(stage), [stage](PyClass &self) {
+      return self[stage];
+    });
+  }
+}
+
+static void PybindRecognizerMemoryUsage(py::module *m) {
+  using PyClass = RecognizerMemoryUsage;
+  py::class_<PyClass>(*m, "RecognizerMemoryUsage")
+      .def("__str__", &PyClass::ToString)
+      .def_readonly("model_weights", &PyClass::model_weights)
+      .def_readonly("blob_bytes", &PyClass::blob_bytes)
+      .def_readonly("blob_peak_bytes", &PyClass::blob_peak_bytes)
+      .def_readonly("workspace_bytes", &PyClass::workspace_bytes)
+      .def_readonly("workspace_peak_bytes", &PyClass::workspace_peak_bytes)
+      .def_readonly("num_allocs", &PyClass::num_allocs)
+      .def_readonly("pooled_bytes", &PyClass::pooled_bytes)
+      .def_readonly("new_stream_bytes", &PyClass::new_stream_bytes);
 }
 
 static void PybindRecognizerConfig(py::module *m) {
@@ -64,11 +109,12 @@ static void PybindRecognizerConfig(py::module *m) {
   py::class_<PyClass>(*m, "RecognizerConfig")
       .def(py::init<const FeatureExtractorConfig &, const ModelConfig &,
                     const DecoderConfig &, const EndpointConfig &, bool,
-                    const std::string &, float>(),
+                    const std::string &, float, const std::string &>(),
            py::arg("feat_config"), py::arg("model_config"),
            py::arg("decoder_config"), py::arg("endpoint_config"),
            py::arg("enable_endpoint"), py::arg("hotwords_file") = "",
-           py::arg("hotwords_score") = 1.5, kRecognizerConfigInitDoc)
+           py::arg("hotwords_score") = 1.5, py::arg("state_storage") = "fp32",
+           kRecognizerConfigInitDoc)
       .def("__str__", &PyClass::ToString)
       .def_readwrite("feat_config", &PyClass::feat_config)
       .def_readwrite("model_config", &PyClass::model_config)
@@ -76,11 +122,14 @@ static void PybindRecognizerConfig(py::module *m) {
       .def_readwrite("endpoint_config", &PyClass::endpoint_config)
       .def_readwrite("enable_endpoint", &PyClass::enable_endpoint)
       .def_readwrite("hotwords_file", &PyClass::hotwords_file)
-      .def_readwrite("hotwords_score", &PyClass::hotwords_score);
+      .def_readwrite("hotwords_score", &PyClass::hotwords_score)
+      .def_readwrite("state_storage", &PyClass::state_storage);
 }
 
 void PybindRecognizer(py::module *m) {
   PybindRecognitionResult(m);
+  PybindDecodeCounters(m);
+  PybindRecognizerMemoryUsage(m);
   PybindRecognizerConfig(m);
 
   using PyClass = Recognizer;
@@ -91,7 +140,12 @@ void PybindRecognizer(py::module *m) {
       .def("is_ready", &PyClass::IsReady, py::arg("s"))
       .def("reset", &PyClass::Reset, py::arg("s"))
       .def("is_endpoint", &PyClass::IsEndpoint, py::arg("s"))
-      .def("get_result", &PyClass::GetResult, py::arg("s"));
+      .def("get_result", &PyClass::GetResult, py::arg("s"))
+      .def("get_counters", &PyClass::GetCounters)
+      .def("reset_counters", &PyClass::ResetCounters)
+      .def("get_memory_usage", &PyClass::GetMemoryUsage);
+
+  m->def("trim_thread_allocators", &TrimThreadAllocators);
 }
 
 }  // namespace sherpa_ncnn
@@ -22,14 +22,29 @@
 
 namespace sherpa_ncnn {
 
+static void PybindStreamMemoryUsage(py::module *m) {
+  using PyClass = StreamMemoryUsage;
+  py::class_<PyClass>(*m, "StreamMemoryUsage")
+      .def("__str__", &PyClass::ToString)
+      .def_readonly("features", &PyClass::features)
+      .def_readonly("encoder_states", &PyClass::encoder_states)
+      .def_readonly("decoder_result", &PyClass::decoder_result)
+      .def_readonly("context_graph", &PyClass::context_graph)
+      .def_property_readonly("total", &PyClass::Total);
+}
+
 void PybindStream(py::module *m) {
+  PybindStreamMemoryUsage(m);
+
   using PyClass = Stream;
   py::class_<PyClass>(*m, "Stream")
       .def("accept_waveform",
            [](PyClass &self, float sample_rate, py::array_t<float> waveform) {
              self.AcceptWaveform(sample_rate, waveform.data(), waveform.size());
            })
-      .def("input_finished", &PyClass::InputFinished);
+      .def("input_finished", &PyClass::InputFinished)
+      .def("get_counters", &PyClass::GetCounters)
+      .def("get_memory_usage", &PyClass::GetMemoryUsage);
 }
 
 }  // namespace sherpa_ncnn
@@ -1,2 +1,2 @@
 from .recognizer import Recognizer
-from _sherpa_ncnn import Display
+from _sherpa_ncnn import Display, trim_thread_allocators
@@ -93,6 +93,7 @@ class Recognizer(object):
         model_sample_rate: int = 16000,
         hotwords_file: str = "",
         hotwords_score: float = 1.5,
+        state_storage: str = "fp32",
     ):
         """
         Please refer to
@@ -153,6 +154,10 @@ class Recognizer(object):
           hotwords_score:
             The scale applied to hotwords score. Used only
             when hotwords_file is not empty.
+          state_storage:
+            Element type for keeping encoder states between chunks.
+            Valid values are: fp32, fp16, bf16. fp16 and bf16 use about
+            1/4 of the state memory of fp32.
         """
         _assert_file_exists(tokens)
         _assert_file_exists(encoder_param)
@@ -167,6 +172,7 @@ class Recognizer(object):
             "greedy_search",
             "modified_beam_search",
         ), decoding_method
+        assert state_storage in ("fp32", "fp16", "bf16"), state_storage
         feat_config = FeatureExtractorConfig(
             sampling_rate=model_sample_rate,
             feature_dim=80,
@@ -202,6 +208,7 @@ class Recognizer(object):
             enable_endpoint=enable_endpoint_detection,
             hotwords_file=hotwords_file,
             hotwords_score=hotwords_score,
+            state_storage=state_storage,
         )
 
         self.sample_rate = self.config.feat_config.sampling_rate
@@ -249,6 +256,25 @@ class Recognizer(object):
     def timestamps(self):
         return self.recognizer.get_result(self.stream).timestamps
 
+    @property
+    def counters(self):
+        """Counters of chunks, frames and the time of each decoding stage
+        of the stream, e.g., ``counters.encoder.seconds``."""
+        return self.stream.get_counters()
+
+    @property
+    def memory_usage(self):
+        """Bytes held by the stream, e.g., ``memory_usage.total``."""
+        return self.stream.get_memory_usage()
+
+    @property
+    def recognizer_memory_usage(self):
+        """Bytes of the model weights, the peaks of the ncnn blob and
+        workspace allocators of the recognizer and the free buffers kept by
+        the pools, ``pooled_bytes``. See
+        ``sherpa_ncnn.trim_thread_allocators()``."""
+        return self.recognizer.get_memory_usage()
+
     @property
     def is_endpoint(self):
         return self.recognizer.is_endpoint(self.stream)
@@ -120,7 +120,8 @@ func sherpaNcnnRecognizerConfig(
     rule2MinTrailingSilence: Float = 1.2,
     rule3MinUtteranceLength: Float = 30,
     hotwordsFile: String = "",
-    hotwordsScore: Float = 1.5
+    hotwordsScore: Float = 1.5,
+    stateStorage: String = "fp32"
 ) -> SherpaNcnnRecognizerConfig {
     return SherpaNcnnRecognizerConfig(
         feat_config: featConfig,
@@ -131,7 +132,8 @@ func sherpaNcnnRecognizerConfig(
         rule2_min_trailing_silence: rule2MinTrailingSilence,
         rule3_min_utterance_length: rule3MinUtteranceLength,
         hotwords_file: toCPointer(hotwordsFile),
-        hotwords_score: hotwordsScore)
+        hotwords_score: hotwordsScore,
+        state_storage: toCPointer(stateStorage))
 }
 
 /// Wrapper for recognition result.